@@ -1,6 +1,7 @@
 #ifndef AST_H
 #define AST_H
 
+#include "Atom.h"
 #include "CMMLexer.h"
 #include <string>
 #include <map>
@@ -9,44 +10,90 @@
 #include <list>
 #include <vector>
 #include <cstdlib>
+#include <cstring>
+#include <cstdint>
 
 ///code.h
 namespace cvm {
 enum BasicType { BoolType, IntType, DoubleType, StringType, VoidType };
 std::string TypeToStr(BasicType Type);
 
+class StringObject;
+class ArrayObject;
+class ArrayStorage;
+
+/// \brief A value in CMM, 16 bytes in size.
+///
+/// Scalars are stored in place, strings and arrays live on the heap and are
+/// shared by reference counting, so copying a value never allocates. The type
+/// of an array is the type of its elements.
 class BasicValue {
 public:
   /// Public member variables
   BasicType Type;
 
-  std::string StrVal;
+private:
+  bool IsArray;
+
+public:
   union {
     int IntVal;
     double DoubleVal;
     bool BoolVal;
+    /// Use getString() and getArray() instead of these.
+    StringObject *StrObj; // nullptr for the empty string.
+    ArrayObject *ArrObj;
+    /// Cleared along with setting a narrower member, so that the payload is
+    /// written as a whole and can be copied without a partial store stall.
+    uint64_t Payload;
   };
 
-  std::shared_ptr<std::vector<BasicValue>> ArrayPtr;
-
 public:
   /// Public constructors
-  BasicValue() : Type(VoidType) {}
-  BasicValue(const std::string &S) : Type(StringType), StrVal(S) {}
-  BasicValue(int I) : Type(IntType), IntVal(I) {}
-  BasicValue(double D) : Type(DoubleType), DoubleVal(D) {}
-  BasicValue(bool B) : Type(BoolType), BoolVal(B) {}
+  BasicValue() : Type(VoidType), IsArray(false), Payload(0) {}
+  BasicValue(const std::string &S);
+  BasicValue(std::string &&S);
+  BasicValue(int I) : Type(IntType), IsArray(false), Payload(0) {
+    IntVal = I;
+  }
+  BasicValue(double D) : Type(DoubleType), IsArray(false), DoubleVal(D) {}
+  BasicValue(bool B) : Type(BoolType), IsArray(false), Payload(0) {
+    BoolVal = B;
+  }
 
   BasicValue(BasicType T);
   BasicValue(BasicType T, const std::list<int> &DimensionList);
-  BasicValue(BasicType T, std::shared_ptr<std::vector<BasicValue>> P);
+  BasicValue(BasicType T, ArrayObject *Array);
   // This should not used by user directly!
   BasicValue(BasicType Type,
              std::list<int>::const_iterator It,
              std::list<int>::const_iterator End);
 
+  BasicValue(const BasicValue &V) : Type(V.Type), IsArray(V.IsArray) {
+    copyPayload(V);
+    retain();
+  }
+  BasicValue(BasicValue &&V) noexcept : Type(V.Type), IsArray(V.IsArray) {
+    copyPayload(V);
+    V.Type = VoidType;
+    V.IsArray = false;
+  }
+  ~BasicValue() { release(); }
+
+  // The old value is released last, it may own the new one.
+  BasicValue &operator=(const BasicValue &V) {
+    BasicValue Tmp(V);
+    swap(Tmp);
+    return *this;
+  }
+  BasicValue &operator=(BasicValue &&V) noexcept {
+    BasicValue Tmp(std::move(V));
+    swap(Tmp);
+    return *this;
+  }
+
 public:
-  bool isArray() const { return ArrayPtr != nullptr; }
+  bool isArray() const { return IsArray; }
   bool isInt() const { return Type == IntType; }
   bool isDouble() const { return Type == DoubleType; }
   bool isBool() const { return Type == BoolType; }
@@ -54,10 +101,22 @@ public:
   bool isVoid() const { return Type == VoidType; }
   bool isNumeric() const { return isInt() || isDouble(); }
 
+  const std::string &getString() const;
+  ArrayObject &getArray() const;
+  ArrayObject *getArrayObject() const { return IsArray ? ArrObj : nullptr; }
+
+  /// \brief Convert an int to double in place. An int array is viewed as a
+  /// double array, as it has always been.
+  void promoteToDouble() {
+    if (!IsArray)
+      DoubleVal = static_cast<double>(IntVal);
+    Type = DoubleType;
+  }
+
   int toInt() const;
   double toDouble() const;
   bool toBool() const ;
-  std::string toString(decltype(ArrayPtr) P = nullptr) const;
+  std::string toString(const ArrayObject *P = nullptr) const;
 
   bool operator<(const BasicValue &RHS) const;
   bool operator<=(const BasicValue &RHS) const;
@@ -65,7 +124,280 @@ public:
   bool operator!=(const BasicValue &RHS) const;
   bool operator>(const BasicValue &RHS) const;
   bool operator>=(const BasicValue &RHS) const;
+
+  void swap(BasicValue &V) noexcept {
+    char Payload[sizeof(DoubleVal)];
+    std::memcpy(Payload, &DoubleVal, sizeof(Payload));
+    std::memcpy(&DoubleVal, &V.DoubleVal, sizeof(Payload));
+    std::memcpy(&V.DoubleVal, Payload, sizeof(Payload));
+    std::swap(Type, V.Type);
+    std::swap(IsArray, V.IsArray);
+  }
+
+private:
+  void copyPayload(const BasicValue &V) {
+    std::memcpy(&DoubleVal, &V.DoubleVal, sizeof(DoubleVal));
+  }
+  inline void retain() const;
+  inline void release();
+};
+
+/// \brief Immutable string shared by values.
+class StringObject {
+public:
+  size_t RefCount = 0;
+  const std::string Str;
+
+  explicit StringObject(std::string S) : Str(std::move(S)) {}
+};
+
+/// \brief Elements of an array and all its sub-arrays, stored contiguously in
+/// row-major order.
+///
+/// Arrays of int, double and bool keep their elements unboxed. Only a boxed
+/// element can be made an alias of an array, so the storage is boxed the
+/// first time that happens.
+class ArrayStorage {
+public:
+  enum StorageKind { IntStorage, DoubleStorage, BoolStorage, BoxedStorage };
+
+  size_t RefCount = 0;
+  BasicType ElementType;
+  StorageKind Kind;
+  std::vector<size_t> Dims;
+  /// Distance between consecutive elements of each dimension.
+  std::vector<size_t> Strides;
+
+  std::vector<int> Ints;
+  std::vector<double> Doubles;
+  std::vector<char> Bools;
+  std::vector<BasicValue> Values;
+
+  /// Used by GarbageCollector only.
+  bool GCVisited = false;
+
+public:
+  ArrayStorage(BasicType T, std::vector<size_t> Dims);
+
+  unsigned getRank() const { return static_cast<unsigned>(Dims.size()); }
+  BasicValue getElement(size_t Offset) const;
+  void setElement(size_t Offset, const BasicValue &V);
+  void box();
+};
+
+/// \brief An array value, a view of its storage starting from Offset, with
+/// the first Level dimensions indexed away. A sub-array shares the storage of
+/// its array. All arrays are tracked by GarbageCollector to reclaim reference
+/// cycles.
+class ArrayObject {
+public:
+  size_t RefCount = 0;
+  ArrayStorage *Storage = nullptr;
+  size_t Offset = 0;
+  unsigned Level = 0;
+
+  /// Used by GarbageCollector only.
+  ArrayObject *Prev = nullptr;
+  ArrayObject *Next = nullptr;
+  long GCRefs = 0;
+
+public:
+  ArrayObject() = default;
+  ArrayObject(ArrayStorage *S, size_t Offset, unsigned Level)
+      : Storage(S), Offset(Offset), Level(Level) {
+    ++Storage->RefCount;
+  }
+  ~ArrayObject() {
+    if (Storage && --Storage->RefCount == 0)
+      delete Storage;
+  }
+  ArrayObject(const ArrayObject &) = delete;
+  ArrayObject &operator=(const ArrayObject &) = delete;
+
+  size_t size() const { return Storage->Dims[Level]; }
+  BasicValue get(size_t Index) const;
 };
+
+/// \brief Reference to a variable, or an element or a sub-array of an array,
+/// as the result of evaluating an lvalue expression. Indexing a reference to
+/// a multi-dimensional array computes offsets only, so `A[i][j]' needs no
+/// intermediate sub-array.
+///
+/// It's kept two words in size so that it's passed around in registers.
+class ValueRef {
+private:  /*  private member variables  */
+  /// Null for a variable.
+  ArrayStorage *Storage = nullptr;
+  /// The variable, or the offset and level in the storage.
+  uintptr_t Bits = 0;
+
+public:   /* public member functions */
+  ValueRef() = default;
+  ValueRef(BasicValue &V) : Bits(reinterpret_cast<uintptr_t>(&V)) {}
+  ValueRef(ArrayStorage *S, size_t Offset, unsigned Level)
+      : Storage(S), Bits(Offset << 16 | Level) {}
+
+  bool isArray() const;
+  BasicType getType() const;
+
+  /// \brief Return the array referenced as a view of its storage, which is
+  /// invalid if it's not an array.
+  ValueRef getArrayView() const;
+  bool isValid() const { return Storage || Bits; }
+  /// Only valid for array views.
+  size_t getArraySize() const { return Storage->Dims[getLevel()]; }
+  ValueRef getElement(size_t Index) const {
+    return ValueRef(Storage,
+                    getOffset() + Index * Storage->Strides[getLevel()],
+                    getLevel() + 1);
+  }
+
+  BasicValue get() const;
+  void set(const BasicValue &V) const;
+
+private:  /* private member functions */
+  BasicValue *getVariable() const {
+    return Storage ? nullptr : reinterpret_cast<BasicValue *>(Bits);
+  }
+  size_t getOffset() const { return Bits >> 16; }
+  unsigned getLevel() const { return Bits & 0xFFFF; }
+  bool isSubArray() const {
+    return Storage && getLevel() < Storage->getRank();
+  }
+  const BasicValue *getBoxed() const;
+  BasicValue getSubArray() const;
+};
+
+/// \brief Untrack and delete an array no longer referenced.
+void freeArray(ArrayObject *Array);
+
+/// \brief Arguments of a native function, a view of the values on the stack
+/// of the engine calling it.
+class ValueSpan {
+private:  /*  private member variables  */
+  const BasicValue *Data;
+  size_t Size;
+
+public:   /* public member functions */
+  ValueSpan(const BasicValue *Data, size_t Size) : Data(Data), Size(Size) {}
+
+  size_t size() const { return Size; }
+  bool empty() const { return Size == 0; }
+  const BasicValue &operator[](size_t I) const { return Data[I]; }
+  const BasicValue &front() const { return Data[0]; }
+  const BasicValue &back() const { return Data[Size - 1]; }
+  const BasicValue *begin() const { return Data; }
+  const BasicValue *end() const { return Data + Size; }
+};
+
+typedef BasicValue (*NativeFunction)(ValueSpan Args);
+
+inline const std::string &BasicValue::getString() const {
+  static const std::string Empty;
+  return Type == StringType && !IsArray && StrObj ? StrObj->Str : Empty;
+}
+
+inline ArrayObject &BasicValue::getArray() const {
+  return *ArrObj;
+}
+
+inline void BasicValue::retain() const {
+  if (IsArray)
+    ++ArrObj->RefCount;
+  else if (Type == StringType && StrObj)
+    ++StrObj->RefCount;
+}
+
+inline void BasicValue::release() {
+  if (IsArray) {
+    if (--ArrObj->RefCount == 0)
+      freeArray(ArrObj);
+  } else if (Type == StringType && StrObj) {
+    if (--StrObj->RefCount == 0)
+      delete StrObj;
+  }
+}
+
+inline BasicValue ArrayStorage::getElement(size_t Offset) const {
+  switch (Kind) {
+  default:            return Values[Offset];
+  case IntStorage:    return Ints[Offset];
+  case DoubleStorage: return Doubles[Offset];
+  case BoolStorage:   return static_cast<bool>(Bools[Offset]);
+  }
+}
+
+inline void ArrayStorage::setElement(size_t Offset, const BasicValue &V) {
+  if (V.isArray())
+    box();
+
+  switch (Kind) {
+  default:            Values[Offset] = V;               break;
+  case IntStorage:    Ints[Offset] = V.IntVal;          break;
+  case DoubleStorage: Doubles[Offset] = V.DoubleVal;    break;
+  case BoolStorage:   Bools[Offset] = V.BoolVal;        break;
+  }
+}
+
+inline BasicValue ArrayObject::get(size_t Index) const {
+  return ValueRef(Storage, Offset, Level).getElement(Index).get();
+}
+
+inline const BasicValue *ValueRef::getBoxed() const {
+  if (!Storage)
+    return getVariable();
+  if (getLevel() == Storage->getRank() &&
+      Storage->Kind == ArrayStorage::BoxedStorage)
+    return &Storage->Values[getOffset()];
+  return nullptr;
+}
+
+inline bool ValueRef::isArray() const {
+  if (const BasicValue *V = getBoxed())
+    return V->isArray();
+  return isSubArray();
+}
+
+inline BasicType ValueRef::getType() const {
+  if (const BasicValue *V = getBoxed())
+    return V->Type;
+  if (isSubArray())
+    return Storage->ElementType;
+
+  switch (Storage->Kind) {
+  default:                          return VoidType;
+  case ArrayStorage::IntStorage:    return IntType;
+  case ArrayStorage::DoubleStorage: return DoubleType;
+  case ArrayStorage::BoolStorage:   return BoolType;
+  }
+}
+
+inline ValueRef ValueRef::getArrayView() const {
+  if (const BasicValue *V = getBoxed()) {
+    if (!V->isArray())
+      return ValueRef();
+    const ArrayObject &Array = V->getArray();
+    return ValueRef(Array.Storage, Array.Offset, Array.Level);
+  }
+  return isSubArray() ? *this : ValueRef();
+}
+
+inline BasicValue ValueRef::get() const {
+  if (const BasicValue *V = getBoxed())
+    return *V;
+  if (isSubArray())
+    return getSubArray();
+  return Storage->getElement(getOffset());
+}
+
+inline void ValueRef::set(const BasicValue &V) const {
+  if (!Storage)
+    *getVariable() = V;
+  else
+    Storage->setElement(getOffset(), V);
+}
+
+static_assert(sizeof(BasicValue) == 16, "BasicValue should be 16 bytes");
 }
 /// !code.h
 
@@ -110,7 +442,7 @@ public:
  */
 
 class Parameter {
-  std::string Name;
+  Atom Name;
   // std::unique_ptr<TypeSpecifier> Type;
   cvm::BasicType Type;
   CMMLexer::LocTy Loc;
@@ -119,17 +451,17 @@ public:
   Parameter(const std::string &Name, cvm::BasicType Type, CMMLexer::LocTy Loc)
     : Name(Name), Type(new TypeSpecifier(Type)), Loc(Loc) {}
    */
-  Parameter(const std::string &Name, cvm::BasicType Type, CMMLexer::LocTy Loc)
+  Parameter(Atom Name, cvm::BasicType Type, CMMLexer::LocTy Loc)
       : Name(Name), Type(Type), Loc(Loc) {}
 
   std::string toString() const {
-    return  cvm::TypeToStr(Type) + " " + Name;
+    return  cvm::TypeToStr(Type) + " " + Name.str();
   }
 
   /** a hack... **/
   // cvm::BasicType getType() const { return Type->getBasicType(); }
   cvm::BasicType getType() const { return Type; }
-  const std::string &getName() const { return Name; }
+  Atom getName() const { return Name; }
 };
 
 /*
@@ -141,6 +473,46 @@ class FunctionType : public DerivedType {
 
 
 
+/// \brief Names of the variables in a scope, indexed by their slots.
+/// Computed by CMMResolver.
+typedef std::vector<Atom> SlotNameList;
+
+/// \brief Where the variable referred to by an identifier lives at runtime.
+/// Computed by CMMResolver.
+struct VariableBinding {
+  enum BindingKind {
+    DynamicBinding, // Search the scope chain by name.
+    LocalBinding,   // Slot of the scope Depth levels out.
+    GlobalBinding   // Top level slot, Depth levels out if not dynamic bound.
+  };
+
+  BindingKind Kind;
+  unsigned Depth;
+  unsigned Slot;
+
+  VariableBinding(BindingKind Kind = DynamicBinding,
+                  unsigned Depth = 0, unsigned Slot = 0)
+      : Kind(Kind), Depth(Depth), Slot(Slot) {}
+};
+
+
+/// \brief Type of an expression proven by CMMTypeChecker.
+struct StaticType {
+  /// False if the type can't be proven, the rest is meaningless then.
+  bool Known;
+  cvm::BasicType Type;
+  /// Number of dimensions of an array, 0 for a scalar, -1 if unknown.
+  int Dimensions;
+
+  StaticType() : Known(false), Type(cvm::VoidType), Dimensions(-1) {}
+  StaticType(cvm::BasicType Type, int Dimensions = 0)
+      : Known(true), Type(Type), Dimensions(Dimensions) {}
+
+  bool is(cvm::BasicType T) const { return Known && Type == T; }
+  bool isScalar() const { return Known && Dimensions == 0; }
+};
+
+
 class AST {
 public:
   virtual ~AST() {};
@@ -162,9 +534,15 @@ public:
   };
 private:
   ExpressionKind Kind;
+  CMMLexer::LocTy Loc;
+  mutable StaticType Type;
+  /// Set by CMMTypeChecker if the node is proven to pass the type checks the
+  /// interpreter does on it, which are skipped then.
+  mutable bool TypeChecked = false;
 public:
   // Constructor
-  ExpressionAST(ExpressionKind Kind) : Kind(Kind) {}
+  ExpressionAST(ExpressionKind Kind, CMMLexer::LocTy Loc = CMMLexer::LocTy())
+    : Kind(Kind), Loc(Loc) {}
 
   // Other public member functions
   template <typename T>
@@ -172,7 +550,18 @@ public:
 
   ExpressionKind getKind() const { return Kind; }
 
+  CMMLexer::LocTy getLoc() const { return Loc; }
+  void setLoc(CMMLexer::LocTy L) { Loc = L; }
+
+  const StaticType &getStaticType() const { return Type; }
+  void setStaticType(const StaticType &T) const { Type = T; }
+  bool isTypeChecked() const { return TypeChecked; }
+  void setTypeChecked() const { TypeChecked = true; }
+
   bool isIdentifierExpr() const { return getKind() == IdentifierExpression; }
+  bool isFunctionCallExpr() const {
+    return getKind() == FunctionCallExpression;
+  }
   bool isBinaryOperatorExpression() const {
     return getKind() == BinaryOperatorExpression;
   }
@@ -252,61 +641,96 @@ public:
 
 
 class StringAST : public ExpressionAST {
-  std::string Value;
+  /// Equal literals share the same string object.
+  cvm::BasicValue Value;
 public:
-  StringAST(const std::string &Value)
+  StringAST(const cvm::BasicValue &Value)
     : ExpressionAST(StringExpression), Value(Value) {}
 
-  const std::string &getValue() const { return Value; }
+  const std::string &getValue() const { return Value.getString(); }
+  const cvm::BasicValue &getBasicValue() const { return Value; }
   void dump(const std::string &prefix = "") const override;
 };
 
 class IdentifierAST : public ExpressionAST {
-  std::string Name;
+  Atom Name;
+  mutable VariableBinding Binding;
 public:
-  IdentifierAST(const std::string &Name)
+  IdentifierAST(Atom Name)
     : ExpressionAST(IdentifierExpression), Name(Name) {}
 
-  const std::string &getName() const { return Name; }
+  Atom getName() const { return Name; }
+  const VariableBinding &getBinding() const { return Binding; }
+  void setBinding(const VariableBinding &B) const { Binding = B; }
   void dump(const std::string &prefix = "") const override;
 };
 
+class FunctionDefinitionAST;
+class InfixOpDefinitionAST;
+struct JitFunction;
+struct JitTrace;
+
 class InfixOpExprAST : public ExpressionAST {
 private:
-  std::string Symbol;
+  Atom Symbol;
   std::unique_ptr<ExpressionAST> LHS, RHS;
+  /// Linked by CMMResolver, null if it's undefined.
+  mutable const InfixOpDefinitionAST *InfixOp = nullptr;
 
 public:
-  InfixOpExprAST(const std::string &Symbol,
+  InfixOpExprAST(Atom Symbol,
                  std::unique_ptr<ExpressionAST> LHS,
                  std::unique_ptr<ExpressionAST> RHS)
       : ExpressionAST(InfixOpExpression)
       , Symbol(Symbol), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
 
-  const std::string &getSymbol() const { return Symbol; }
+  Atom getSymbol() const { return Symbol; }
   const ExpressionAST *getLHS() const { return LHS.get(); }
   const ExpressionAST *getRHS() const { return RHS.get(); }
+  std::unique_ptr<ExpressionAST> &getLHS() { return LHS; }
+  std::unique_ptr<ExpressionAST> &getRHS() { return RHS; }
+
+  const InfixOpDefinitionAST *getInfixOp() const { return InfixOp; }
+  void link(const InfixOpDefinitionAST *I) const { InfixOp = I; }
 
   void dump(const std::string &prefix = "") const override;
 };
 
 
 class FunctionCallAST : public ExpressionAST {
-  std::string Callee;
+  Atom Callee;
   std::list<std::unique_ptr<ExpressionAST>> Arguments;
   bool DynamicBound : 1;
+  /// The function called, linked by CMMResolver. Both are null if it's
+  /// undefined.
+  mutable const FunctionDefinitionAST *UserFunction = nullptr;
+  mutable cvm::NativeFunction Native = nullptr;
+  /// Set by CMMResolver if it calls the function it's in from tail position,
+  /// so that the frame of the caller can be reused.
+  mutable bool TailCall = false;
 public:
-  FunctionCallAST(const std::string &Callee,
+  FunctionCallAST(Atom Callee,
                   std::list<std::unique_ptr<ExpressionAST>> Arguments,
-                  bool DynamicBound = false)
-    : ExpressionAST(FunctionCallExpression), Callee(Callee)
+                  bool DynamicBound = false,
+                  CMMLexer::LocTy Loc = CMMLexer::LocTy())
+    : ExpressionAST(FunctionCallExpression, Loc), Callee(Callee)
     , Arguments(std::move(Arguments))
     , DynamicBound(DynamicBound) {}
 
-  const std::string &getCallee() const  { return Callee; }
+  Atom getCallee() const  { return Callee; }
   const decltype(Arguments) &getArguments() const { return Arguments; }
+  decltype(Arguments) &getArguments() { return Arguments; }
   bool isDynamicBound() const { return DynamicBound; }
 
+  const FunctionDefinitionAST *getUserFunction() const { return UserFunction; }
+  cvm::NativeFunction getNativeFunction() const { return Native; }
+  void link(const FunctionDefinitionAST *F, cvm::NativeFunction N) const {
+    UserFunction = F;
+    Native = N;
+  }
+  bool isTailCall() const { return TailCall; }
+  void setTailCall() const { TailCall = true; }
+
   void dump(const std::string &prefix = "") const override;
 };
 
@@ -321,9 +745,16 @@ public:
     Assign /**, Comma**/, Index
   };
 
+  /// Fast paths the interpreter specializes a node to, after the operands it
+  /// first sees. A node is deoptimized for good once its guard fails.
+  enum QuickeningKind {
+    NotQuickened, QuickenedInt, QuickenedDouble, Deoptimized
+  };
+
 private:
   OperatorKind OpKind;
   std::unique_ptr<ExpressionAST> LHS, RHS;
+  mutable QuickeningKind Quickening = NotQuickened;
 
 public:
   BinaryOperatorAST(OperatorKind OpKind,
@@ -336,6 +767,11 @@ public:
   OperatorKind getOpKind() const { return OpKind; }
   ExpressionAST *getLHS() const { return LHS.get(); }
   ExpressionAST *getRHS() const { return RHS.get(); }
+  std::unique_ptr<ExpressionAST> &getLHS() { return LHS; }
+  std::unique_ptr<ExpressionAST> &getRHS() { return RHS; }
+
+  QuickeningKind getQuickening() const { return Quickening; }
+  void quicken(QuickeningKind Q) const { Quickening = Q; }
 
   void dump(const std::string &prefix = "") const override;
 
@@ -386,6 +822,7 @@ public:
 
   OperatorKind getOpKind() const { return OpKind; }
   const ExpressionAST *getOperand() const { return Operand.get(); }
+  std::unique_ptr<ExpressionAST> &getOperand() { return Operand; }
 
   void dump(const std::string &prefix = "") const override;
 
@@ -396,30 +833,46 @@ public:
 
 
 class DeclarationAST : public StatementAST {
-  std::string Name;
+  Atom Name;
   // std::unique_ptr<TypeSpecifier> Type;
   cvm::BasicType Type;
   std::unique_ptr<ExpressionAST> Initializer;
   std::list<std::unique_ptr<ExpressionAST>> ElementCountList;
+  CMMLexer::LocTy Loc;
+  mutable unsigned Slot = 0;
+  /// Set by CMMTypeChecker if the initializer is proven to be of the type.
+  mutable bool TypeChecked = false;
 public:
-  DeclarationAST(const std::string &Name, cvm::BasicType Type,
+  DeclarationAST(Atom Name, cvm::BasicType Type,
                  std::unique_ptr<ExpressionAST> Initializer,
-                 std::list<std::unique_ptr<ExpressionAST>> ElementCountList)
+                 std::list<std::unique_ptr<ExpressionAST>> ElementCountList,
+                 CMMLexer::LocTy Loc = CMMLexer::LocTy())
     : StatementAST(DeclarationStatement), Name(Name), Type(Type)
     , Initializer(std::move(Initializer))
-    , ElementCountList(std::move(ElementCountList)) {}
+    , ElementCountList(std::move(ElementCountList)), Loc(Loc) {}
 
   bool isArray() const { return !ElementCountList.empty(); }
 
-  const std::string &getName() const { return Name; }
+  Atom getName() const { return Name; }
+  CMMLexer::LocTy getLoc() const { return Loc; }
+
+  bool isTypeChecked() const { return TypeChecked; }
+  void setTypeChecked() const { TypeChecked = true; }
 
   cvm::BasicType getType() const { return Type; }
 
+  unsigned getSlot() const { return Slot; }
+  void setSlot(unsigned S) const { Slot = S; }
+
   const ExpressionAST *getInitializer() const { return Initializer.get(); }
+  std::unique_ptr<ExpressionAST> &getInitializer() { return Initializer; }
 
   const decltype(ElementCountList) &getElementCountList() const {
       return ElementCountList;
   }
+  decltype(ElementCountList) &getElementCountList() {
+      return ElementCountList;
+  }
 
 
   void dump(const std::string &prefix = "") const override;
@@ -434,16 +887,20 @@ public:
   DeclarationListAST(cvm::BasicType Type)
     : StatementAST(DeclarationListStatement), Type(Type) {}
 
-  void addDeclaration(const std::string &Name,
+  void addDeclaration(Atom Name,
                       std::unique_ptr<ExpressionAST> I,
-                      std::list<std::unique_ptr<ExpressionAST>> C) {
+                      std::list<std::unique_ptr<ExpressionAST>> C,
+                      CMMLexer::LocTy Loc) {
     DeclarationList.emplace_back(new DeclarationAST(Name, Type, std::move(I),
-                                                                std::move(C)));
+                                                    std::move(C), Loc));
   }
 
   const std::list<std::unique_ptr<DeclarationAST>> &getDeclarationList() const {
     return DeclarationList;
   }
+  std::list<std::unique_ptr<DeclarationAST>> &getDeclarationList() {
+    return DeclarationList;
+  }
 
   void dump(const std::string &prefix = "") const override;
 };
@@ -456,6 +913,12 @@ public:
 private:
   BlockAST *OuterBlock;
   std::list<std::unique_ptr<StatementAST>> StatementList;
+  mutable SlotNameList Slots;
+  /// Set by CMMResolver if the block has no scope of its own, its variables
+  /// are in slots [HoistedBegin, HoistedEnd) of the enclosing scope instead.
+  mutable bool Hoisted = false;
+  mutable unsigned HoistedBegin = 0;
+  mutable unsigned HoistedEnd = 0;
   //std::list<std::unique_ptr<DeclarationAST>> DeclarationList;
 
 public:
@@ -480,6 +943,16 @@ public:
   //}
 
   BlockAST *getOuterBlock() const { return OuterBlock; }
+  SlotNameList &getSlots() const { return Slots; }
+
+  bool isHoisted() const { return Hoisted; }
+  unsigned getHoistedBegin() const { return HoistedBegin; }
+  unsigned getHoistedEnd() const { return HoistedEnd; }
+  void hoist(unsigned Begin, unsigned End) const {
+    Hoisted = true;
+    HoistedBegin = Begin;
+    HoistedEnd = End;
+  }
   std::list<std::unique_ptr<StatementAST>> &getStatementList() {
     return StatementList;
   }
@@ -495,6 +968,7 @@ public:
     : StatementAST(ExprStatement), Expression(std::move(Expression)) {}
 
   const ExpressionAST *getExpression() const { return Expression.get(); }
+  std::unique_ptr<ExpressionAST> &getExpression() { return Expression; }
 
   void dump(const std::string &prefix) const override;
 };
@@ -511,21 +985,23 @@ public:
   static const int8_t DefaultPrecedence = 12;
 
 private:
-  std::string Symbol;
-  std::string LHSName, RHSName;
+  Atom Symbol;
+  Atom LHSName, RHSName;
   std::unique_ptr<StatementAST> Statement;
+  mutable SlotNameList Slots;
 
 public:
-  InfixOpDefinitionAST(const std::string &Sym,
-                       const std::string &LHS,
-                       const std::string &RHS,
+  InfixOpDefinitionAST(Atom Sym, Atom LHS, Atom RHS,
                        std::unique_ptr<StatementAST> Stmt)
   : Symbol(Sym), LHSName(LHS), RHSName(RHS), Statement(std::move(Stmt)) {}
 
-  const std::string &getSymbol() const { return Symbol; }
-  const std::string &getLHSName() const { return LHSName; }
-  const std::string &getRHSName() const { return RHSName; }
+  Atom getSymbol() const { return Symbol; }
+  Atom getLHSName() const { return LHSName; }
+  Atom getRHSName() const { return RHSName; }
   const StatementAST *getStatement() const { return Statement.get(); }
+  std::unique_ptr<StatementAST> &getStatement() { return Statement; }
+  /// Operands take the first two slots.
+  SlotNameList &getSlots() const { return Slots; }
 
   void dump() const;
 };
@@ -533,15 +1009,20 @@ public:
 
 
 class FunctionDefinitionAST {
-  std::string Name;
+  Atom Name;
   cvm::BasicType Type;
   std::list<Parameter> ParameterList;
   std::unique_ptr<StatementAST> Statement;
+  mutable SlotNameList Slots;
+  /// Calls counted until the function is compiled by CMMJit, and the result
+  /// of compiling it, null if it's not tried yet.
+  mutable unsigned CallCount = 0;
+  mutable const JitFunction *Jitted = nullptr;
   // std::list<std::unique_ptr<DeclarationAST>> LocalVariableList;
   // int Index;
 public:
   FunctionDefinitionAST() = default;
-  FunctionDefinitionAST(const std::string &Name,
+  FunctionDefinitionAST(Atom Name,
                         cvm::BasicType Type,
                         std::list<Parameter> &&ParameterList,
                         std::unique_ptr<StatementAST> Statement)
@@ -549,10 +1030,17 @@ public:
     , Statement(std::move(Statement)) {}
 
   cvm::BasicType getType() const { return Type; }
-  const std::string &getName() const { return Name; }
+  Atom getName() const { return Name; }
   size_t getParameterCount() const { return ParameterList.size(); }
   const std::list<Parameter> &getParameterList() const { return ParameterList; }
   const StatementAST *getStatement() const { return Statement.get(); }
+  std::unique_ptr<StatementAST> &getStatement() { return Statement; }
+  /// Parameters take the first slots in order.
+  SlotNameList &getSlots() const { return Slots; }
+
+  unsigned countCall() const { return ++CallCount; }
+  const JitFunction *getJitFunction() const { return Jitted; }
+  void setJitFunction(const JitFunction *J) const { Jitted = J; }
 
   void dump() const;
 };
@@ -581,6 +1069,9 @@ public:
   const ExpressionAST *getCondition() const { return Condition.get(); }
   const StatementAST *getStatementThen() const { return StatementThen.get(); }
   const StatementAST *getStatementElse() const { return StatementElse.get(); }
+  std::unique_ptr<ExpressionAST> &getCondition() { return Condition; }
+  std::unique_ptr<StatementAST> &getStatementThen() { return StatementThen; }
+  std::unique_ptr<StatementAST> &getStatementElse() { return StatementElse; }
 
   void dump(const std::string &prefix = "") const override;
 
@@ -595,6 +1086,10 @@ public:
 class WhileStatementAST : public StatementAST {
   std::unique_ptr<ExpressionAST> Condition;
   std::unique_ptr<StatementAST> Statement;
+  /// Iterations counted until the loop is traced by CMMJit, and the trace,
+  /// null if it's not recorded yet.
+  mutable unsigned Iterations = 0;
+  mutable const JitTrace *Trace = nullptr;
 public:
   WhileStatementAST(std::unique_ptr<ExpressionAST> Condition,
                     std::unique_ptr<StatementAST> Statement)
@@ -604,6 +1099,12 @@ public:
 
   const ExpressionAST *getCondition() const { return Condition.get(); }
   const StatementAST *getStatement() const { return Statement.get(); }
+  std::unique_ptr<ExpressionAST> &getCondition() { return Condition; }
+  std::unique_ptr<StatementAST> &getStatement() { return Statement; }
+
+  unsigned countIteration() const { return ++Iterations; }
+  const JitTrace *getJitTrace() const { return Trace; }
+  void setJitTrace(const JitTrace *T) const { Trace = T; }
 
   void dump(const std::string &prefix = "") const override;
 
@@ -619,6 +1120,10 @@ class ForStatementAST : public StatementAST {
   std::unique_ptr<ExpressionAST> Condition;
   std::unique_ptr<ExpressionAST> Post;
   std::unique_ptr<StatementAST> Statement;
+  /// Iterations counted until the loop is traced by CMMJit, and the trace,
+  /// null if it's not recorded yet.
+  mutable unsigned Iterations = 0;
+  mutable const JitTrace *Trace = nullptr;
 public:
   ForStatementAST(std::unique_ptr<ExpressionAST> Init,
                   std::unique_ptr<ExpressionAST> Condition,
@@ -632,6 +1137,14 @@ public:
   const ExpressionAST *getCondition() const { return Condition.get(); }
   const ExpressionAST *getPost() const { return Post.get(); }
   const StatementAST *getStatement() const { return Statement.get(); }
+  std::unique_ptr<ExpressionAST> &getInit() { return Init; }
+  std::unique_ptr<ExpressionAST> &getCondition() { return Condition; }
+  std::unique_ptr<ExpressionAST> &getPost() { return Post; }
+  std::unique_ptr<StatementAST> &getStatement() { return Statement; }
+
+  unsigned countIteration() const { return ++Iterations; }
+  const JitTrace *getJitTrace() const { return Trace; }
+  void setJitTrace(const JitTrace *T) const { Trace = T; }
 
   void dump(const std::string &prefix) const override;
 
@@ -647,11 +1160,16 @@ public:
 
 class ReturnStatementAST : public StatementAST {
   std::unique_ptr<ExpressionAST> ReturnValue;
+  CMMLexer::LocTy Loc;
 public:
-  ReturnStatementAST(std::unique_ptr<ExpressionAST> ReturnValue)
-    : StatementAST(ReturnStatement), ReturnValue(std::move(ReturnValue)) {}
+  ReturnStatementAST(std::unique_ptr<ExpressionAST> ReturnValue,
+                     CMMLexer::LocTy Loc = CMMLexer::LocTy())
+    : StatementAST(ReturnStatement), ReturnValue(std::move(ReturnValue))
+    , Loc(Loc) {}
 
   const ExpressionAST *getReturnValue() const { return ReturnValue.get(); }
+  std::unique_ptr<ExpressionAST> &getReturnValue() { return ReturnValue; }
+  CMMLexer::LocTy getLoc() const { return Loc; }
 
   void dump(const std::string &prefix = "") const override;
 };
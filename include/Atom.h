@@ -0,0 +1,46 @@
+#ifndef ATOM_H
+#define ATOM_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace cmm {
+/// \brief An interned string.
+///
+/// Equal strings are interned to the same atom, so atoms are compared and
+/// hashed as small integers, and can index dense tables. Atoms are numbered
+/// from 0 in the order they're first seen; atom 0 is the empty string. The
+/// strings live as long as the program does.
+class Atom {
+private:  /*  private member variables  */
+  unsigned Id;
+
+public:   /* public member functions */
+  Atom() : Id(0) {}
+  Atom(const std::string &S) : Id(intern(S)) {}
+  Atom(const char *S) : Id(intern(S)) {}
+
+  unsigned getId() const { return Id; }
+  bool empty() const { return Id == 0; }
+  const std::string &str() const;
+
+  bool operator==(Atom RHS) const { return Id == RHS.Id; }
+  bool operator!=(Atom RHS) const { return Id != RHS.Id; }
+  bool operator<(Atom RHS) const { return Id < RHS.Id; }
+
+  /// \brief Return the number of atoms, all ids are less than it.
+  static size_t getCount();
+
+private:  /* private member functions */
+  static unsigned intern(const std::string &S);
+};
+}
+
+namespace std {
+template <> struct hash<cmm::Atom> {
+  size_t operator()(cmm::Atom A) const { return A.getId(); }
+};
+}
+
+#endif // !ATOM_H
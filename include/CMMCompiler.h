@@ -0,0 +1,95 @@
+#ifndef CMMCOMPILER_H
+#define CMMCOMPILER_H
+
+#include "AST.h"
+#include "Code.h"
+#include "NativeFunctions.h"
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+namespace cmm {
+/// \brief Translate the AST built by CMMParser into bytecode for the
+/// virtual machine.
+class CMMCompiler {
+private:  /* private data types */
+  struct LoopContext {
+    size_t ScopeDepth;
+    size_t HoistedDepth;
+    std::vector<size_t> BreakJumps;
+    std::vector<size_t> ContinueJumps;
+  };
+
+private:  /*  private member variables  */
+  SourceMgr &SrcMgr;
+  const BlockAST &TopLevelBlock;
+  const std::map<std::string, FunctionDefinitionAST> &UserFunctionMap;
+  const std::map<std::string, InfixOpDefinitionAST> &InfixOpMap;
+  std::map<std::string, cvm::NativeFunctionInfo> NativeFunctionMap;
+
+  std::unique_ptr<cvm::Program> Prog;
+  std::unordered_map<Atom, int32_t> NameIndex;
+  /// Constants by their types and bits, and string constants.
+  std::map<std::pair<cvm::BasicType, uint64_t>, int32_t> ConstantIndex;
+  std::map<std::string, int32_t> StringConstantIndex;
+  std::map<std::string, int32_t> FunctionIndex;
+  std::map<std::string, int32_t> InfixOpIndex;
+  std::map<std::string, int32_t> NativeIndex;
+
+  /// State of the code object being compiled.
+  cvm::CodeObject *Code;
+  size_t ScopeDepth;
+  /// Hoisted blocks being compiled, in the innermost scope.
+  std::vector<const BlockAST *> HoistedBlocks;
+  std::vector<LoopContext> LoopStack;
+
+public:   /* public member functions */
+  CMMCompiler(SourceMgr &SrcMgr, const BlockAST &Block,
+              const std::map<std::string, FunctionDefinitionAST> &F,
+              const std::map<std::string, InfixOpDefinitionAST> &I);
+
+  std::unique_ptr<cvm::Program> compile();
+
+private:  /* private member functions */
+  size_t emit(cvm::OpCode Op, int32_t A = 0, uint16_t Aux = 0);
+  void setLine(size_t At, SourceMgr::LocTy Loc);
+  void patchJump(size_t At) { patchJump(At, Code->Code.size()); }
+  void patchJump(size_t At, size_t Target);
+  int32_t addConstant(const cvm::BasicValue &Value);
+  int32_t addName(Atom Name);
+  int32_t addScope(const SlotNameList &Slots);
+  int32_t addNative(const std::string &Name, cvm::NativeFunction Function);
+
+  void compileFunction(const FunctionDefinitionAST &Function,
+                       cvm::CodeObject &Code);
+  void compileInfixOp(const InfixOpDefinitionAST &InfixOp,
+                      cvm::CodeObject &Code);
+
+  void compileStatement(const StatementAST *Stmt);
+  void compileBlock(const BlockAST *Block);
+  void compileStatementList(
+      const std::list<std::unique_ptr<StatementAST>> &List);
+  void emitClearSlots(const BlockAST *Block);
+  void compileIfStatement(const IfStatementAST *IfStmt);
+  void compileWhileStatement(const WhileStatementAST *WhileStmt);
+  void compileForStatement(const ForStatementAST *ForStmt);
+  void compileBreakStatement(const BreakStatementAST *BreakStmt);
+  void compileContinueStatement(const ContinueStatementAST *ContStmt);
+  void compileReturnStatement(const ReturnStatementAST *RetStmt);
+  void compileDeclarationList(const DeclarationListAST *DeclList);
+  void compileDeclaration(const DeclarationAST *Decl);
+  void compileLoopExit(const char *What, bool IsBreak);
+
+  void compileExpression(const ExpressionAST *Expr);
+  void compileLvalueExpr(const ExpressionAST *Expr);
+  void compileIdentifierExpr(const IdentifierAST *IdExpr, bool IsLvalue);
+  void compileBinaryOpExpr(const BinaryOperatorAST *Expr);
+  void compileUnaryOpExpr(const UnaryOperatorAST *Expr);
+  void compileLogicalOp(const BinaryOperatorAST *Expr);
+  void compileFunctionCallExpr(const FunctionCallAST *FuncCall);
+  void compileTailCall(const FunctionCallAST *FuncCall, bool Returned);
+  void compileInfixOpExpr(const InfixOpExprAST *Expr);
+};
+}
+
+#endif // !CMMCOMPILER_H
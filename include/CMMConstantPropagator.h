@@ -0,0 +1,79 @@
+#ifndef CMMCONSTANTPROPAGATOR_H
+#define CMMCONSTANTPROPAGATOR_H
+
+#include "AST.h"
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace cmm {
+/// \brief Substitute the values of variables that never change, so that the
+/// expressions using them are folded, and if and loop statements on constant
+/// conditions are eliminated as the parser does for literals.
+///
+/// A variable is constant if it's a scalar declared by a statement of a
+/// block, initialized with a value of its type which folds to a literal, the
+/// only variable or parameter of its name in the whole program, and never
+/// assigned to. As names are unique, no assignment can reach it by dynamic
+/// binding either. Identifiers bound to it by CMMResolver are replaced by
+/// its value, those searched by name are left alone. A top level constant is
+/// only substituted into functions and infix operators if top level code
+/// calls none of them before declaring it.
+///
+/// Folding is done only where the interpreter would succeed, so that errors
+/// such as int division by zero are still reported when they happen.
+///
+/// It must run after CMMResolver, which binds identifiers and links calls,
+/// and before CMMTypeChecker, so that the types of the values are known.
+class CMMConstantPropagator {
+private:  /* private data types */
+  typedef std::list<std::unique_ptr<StatementAST>> StatementList;
+
+  struct Constant {
+    cvm::BasicValue Value;
+    /// Set if functions and infix operators see the value.
+    bool Global;
+  };
+
+private:  /*  private member variables  */
+  BlockAST &TopLevelBlock;
+  std::map<std::string, FunctionDefinitionAST> &UserFunctionMap;
+  std::map<std::string, InfixOpDefinitionAST> &InfixOpMap;
+
+  /// Number of variables and parameters declared of each name.
+  std::unordered_map<Atom, unsigned> DeclarationCount;
+  std::unordered_set<Atom> AssignedNames;
+  std::unordered_map<Atom, Constant> Constants;
+
+  /// Set while propagating functions and infix operators.
+  bool InFunction;
+  /// Set once top level code may have called a function or infix operator.
+  bool CalledUserCode;
+
+public:   /* public member functions */
+  CMMConstantPropagator(BlockAST &Block,
+                        std::map<std::string, FunctionDefinitionAST> &F,
+                        std::map<std::string, InfixOpDefinitionAST> &I)
+      : TopLevelBlock(Block), UserFunctionMap(F), InfixOpMap(I)
+      , InFunction(false), CalledUserCode(false) {}
+
+  /// \brief Propagate constants through the program.
+  void propagate();
+
+private:  /* private member functions */
+  void countStatement(const StatementAST *Stmt);
+  void countExpression(const ExpressionAST *Expr);
+
+  void propagateStatementList(StatementList &List);
+  void propagateStatement(std::unique_ptr<StatementAST> &Stmt,
+                          bool Direct = false);
+  void propagateDeclaration(DeclarationAST *Decl, bool Direct);
+  void propagateExpression(std::unique_ptr<ExpressionAST> &Expr);
+  void propagateIdentifier(std::unique_ptr<ExpressionAST> &Expr);
+  void propagateUnaryOperator(std::unique_ptr<ExpressionAST> &Expr);
+  void propagateBinaryOperator(std::unique_ptr<ExpressionAST> &Expr);
+};
+}
+
+#endif // !CMMCONSTANTPROPAGATOR_H
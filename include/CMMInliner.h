@@ -0,0 +1,122 @@
+#ifndef CMMINLINER_H
+#define CMMINLINER_H
+
+#include "AST.h"
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace cmm {
+/// \brief Substitute the bodies of small functions and infix operators for
+/// the calls to them.
+///
+/// A function or infix operator is inlined if its body is a single
+/// expression, returned or left as the last statement, of at most
+/// InlineBudget nodes, which reads nothing but its parameters and assigns
+/// nothing. The arguments are substituted for the parameters, so they must
+/// be evaluated the same as if they were passed:
+///  - A literal is copied to every use, an int literal passed to a double
+///    parameter is converted.
+///  - A variable is read at every use, which gives the same value as long as
+///    nothing that may assign it runs in between.
+///  - Any other argument is moved to its only use, which must come before
+///    anything in the body may fail or have side effects, in the order of
+///    the parameters. Operators which can't fail on scalars of the parameter
+///    types don't count if all arguments are proven scalars.
+/// A function argument must be proven of the parameter type, and a returned
+/// value of the function type, as there would be no runtime check left. An
+/// infix operator must be proven to return a value.
+///
+/// Inlined bodies are inlined into in turn, up to InlineDepth levels, but a
+/// function or infix operator is never inlined into itself.
+///
+/// It must run after CMMTypeChecker, whose static types and checks on the
+/// bodies stay valid for arguments of the parameter types.
+class CMMInliner {
+public:
+  /// Maximum number of nodes of a body to be inlined.
+  static const unsigned InlineBudget = 16;
+  /// Maximum number of bodies inlined into each other.
+  static const unsigned InlineDepth = 4;
+
+private:  /* private data types */
+  /// How a parameter is used in a body.
+  struct ParamUse {
+    unsigned Count = 0;
+    /// Position of its first use among the uses of parameters.
+    unsigned First = 0;
+    /// Set if it's used after something that may fail or have side effects.
+    bool Late = false;
+    /// Set if it's used after an operator, which can't fail on scalars of
+    /// the parameter types.
+    bool AfterOperator = false;
+    /// Set if it's the base of an index expression, which takes variables
+    /// only.
+    bool Indexed = false;
+  };
+
+  struct Inlinee {
+    /// A copy of the expression of the body, null if it can't be inlined.
+    std::unique_ptr<ExpressionAST> Body;
+    /// Types of the parameters, VoidType for operands of infix operators.
+    std::vector<cvm::BasicType> ParamTypes;
+    std::vector<ParamUse> Params;
+    /// Set if the body calls a function or infix operator, which may assign
+    /// variables.
+    bool CallsUserCode = false;
+  };
+
+  /// State of analyzing a body in the order of evaluation.
+  struct BodyAnalysis {
+    const void *Definition;
+    Inlinee &Callee;
+    unsigned Size = 0;
+    unsigned Uses = 0;
+    /// Set once anything that may fail or have side effects is evaluated.
+    bool Effects = false;
+    /// Set once an operator is evaluated.
+    bool Operators = false;
+
+    BodyAnalysis(const void *D, Inlinee &C) : Definition(D), Callee(C) {}
+  };
+
+private:  /*  private member variables  */
+  BlockAST &TopLevelBlock;
+  std::map<std::string, FunctionDefinitionAST> &UserFunctionMap;
+  std::map<std::string, InfixOpDefinitionAST> &InfixOpMap;
+
+  /// Functions and infix operators analyzed, by their definitions.
+  std::unordered_map<const void *, Inlinee> Inlinees;
+  /// Definitions being inlined into the current expression.
+  std::vector<const void *> InlineStack;
+
+public:   /* public member functions */
+  CMMInliner(BlockAST &Block,
+             std::map<std::string, FunctionDefinitionAST> &F,
+             std::map<std::string, InfixOpDefinitionAST> &I)
+      : TopLevelBlock(Block), UserFunctionMap(F), InfixOpMap(I) {}
+
+  /// \brief Inline calls throughout the program.
+  void inlineCalls();
+
+private:  /* private member functions */
+  const Inlinee &getInlinee(const FunctionDefinitionAST &Function);
+  const Inlinee &getInlinee(const InfixOpDefinitionAST &InfixOp);
+  void analyzeBody(const ExpressionAST *Body, const void *Definition,
+                   Inlinee &Callee);
+  bool analyzeExpression(const ExpressionAST *Expr, BodyAnalysis &Analysis,
+                         cvm::BasicType &Type);
+
+  void tryInline(std::unique_ptr<ExpressionAST> &Expr,
+                 const void *Definition, const Inlinee &Callee,
+                 const std::vector<std::unique_ptr<ExpressionAST> *> &Args);
+  std::unique_ptr<ExpressionAST>
+  substitute(const ExpressionAST *Expr,
+             std::vector<std::unique_ptr<ExpressionAST>> *Args);
+
+  void inlineStatement(std::unique_ptr<StatementAST> &Stmt);
+  void inlineExpression(std::unique_ptr<ExpressionAST> &Expr);
+};
+}
+
+#endif // !CMMINLINER_H
@@ -2,95 +2,165 @@
 #define CMMINTERPRETER_H
 
 #include "AST.h"
+#include "CMMRuntime.h"
+#include "SlotStack.h"
+#include <algorithm>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <vector>
 
 namespace cmm {
+class CMMJit;
+
 class CMMInterpreter {
+  friend class CMMJit;
 
 private:  /* private data types */
-  struct ExecutionResult {
-    enum ExecutionResultKind {
-      NormalStatementResult,
-      ReturnStatementResult,
-      BreakStatementResult,
-      ContinueStatementResult
-    } Kind;
-    cvm::BasicValue ReturnValue;
-
-    ExecutionResult() : Kind(NormalStatementResult) {}
-    ExecutionResult(ExecutionResultKind K) : Kind(K) {}
-    ExecutionResult(ExecutionResultKind K, const cvm::BasicValue &V)
-        : Kind(K), ReturnValue(V) {}
+  /// How a statement completes. The value a function returns is left in
+  /// ReturnValue rather than carried along. A tail call leaves its arguments
+  /// on the argument stack and the function being called is called again.
+  enum ExecutionResult {
+    NormalStatementResult,
+    ReturnStatementResult,
+    BreakStatementResult,
+    ContinueStatementResult,
+    TailCallResult
+  };
+
+  struct Variable {
+    cvm::BasicValue Value;
+    bool Declared = false;
   };
 
+  typedef cvm::SlotStack<Variable> SlotStack;
+
+  /// Variables of a scope live in slots assigned by CMMResolver. A function
+  /// call may take more slots than the callee has, so that all arguments
+  /// are evaluated into the frame before their count is checked.
   struct VariableEnv {
     VariableEnv *OuterEnv;
-    std::map<std::string, cvm::BasicValue> VarMap;
+    const SlotNameList *Names;
+    SlotStack &Stack;
+    Variable *Vars;
+    size_t Size;
+    SlotStack::Mark Mark;
 
   public:
-    VariableEnv(VariableEnv *OuterEnv = nullptr) : OuterEnv(OuterEnv) {}
+    VariableEnv(SlotStack &Stack, VariableEnv *OuterEnv,
+                const SlotNameList &Names, size_t MinSize = 0)
+        : OuterEnv(OuterEnv), Names(&Names), Stack(Stack)
+        , Size(std::max(Names.size(), MinSize)) {
+      Vars = Stack.allocate(Size, Mark);
+    }
+    VariableEnv(const VariableEnv &) = delete;
+    VariableEnv &operator=(const VariableEnv &) = delete;
+    ~VariableEnv() { Stack.release(Vars, Size, Mark); }
 
-    bool contain(const std::string &Name) const {
-      return VarMap.count(Name) != 0;
+    void declare(unsigned Slot, const cvm::BasicValue &Value) {
+      Vars[Slot].Value = Value;
+      Vars[Slot].Declared = true;
     }
-  };
 
-  typedef cvm::BasicValue (*NativeFunction)(std::list<cvm::BasicValue> &);
+    /// \brief Clear the variables of a hoisted block.
+    void clear(unsigned Begin, unsigned End) {
+      for (unsigned Slot = Begin; Slot != End; ++Slot) {
+        Vars[Slot].Value = cvm::BasicValue();
+        Vars[Slot].Declared = false;
+      }
+    }
+  };
 
 private:  /*  private member variables  */
+  SourceMgr &SrcMgr;
   const BlockAST &TopLevelBlock;
   const std::map<std::string, FunctionDefinitionAST> &UserFunctionMap;
   const std::map<std::string, InfixOpDefinitionAST> &InfixOpMap;
-  std::map<std::string, NativeFunction> NativeFunctionMap;
+  SlotStack Stack;
   VariableEnv TopLevelEnv;
+  /// Arguments of native function calls being evaluated.
+  std::vector<cvm::BasicValue> ArgumentStack;
+  /// Value of a return statement, or of the last statement of the function
+  /// being called, which is its return value by default. It's taken by the
+  /// caller, so it's void otherwise.
+  cvm::BasicValue ReturnValue;
+  /// The tail call that completed the body, and whether it's returned by a
+  /// return statement, so that its value is checked.
+  const FunctionCallAST *TailCall = nullptr;
+  bool TailCallReturned = false;
+  /// Runs the program on a stack deep enough, and limits the depth of
+  /// nested calls.
+  CMMRuntime RT;
+  /// Compiles functions called often, null if they're always interpreted.
+  std::unique_ptr<CMMJit> Jit;
 
 public:   /* public member functions */
-  CMMInterpreter(const BlockAST &Block,
+  CMMInterpreter(SourceMgr &SrcMgr, const BlockAST &Block,
                  const std::map<std::string, FunctionDefinitionAST> &F,
-                 const std::map<std::string, InfixOpDefinitionAST> &I)
-      : TopLevelBlock(Block), UserFunctionMap(F), InfixOpMap(I) {
-    addNativeFunctions();
-  }
+                 const std::map<std::string, InfixOpDefinitionAST> &I,
+                 size_t MaxStack, bool EnableJit = false);
+  ~CMMInterpreter();
 
   int interpret(int Argc, char *Argv[]);
 
 private:  /* private member functions */
-  void addNativeFunctions();
+  int run(int Argc, char *Argv[]);
   void RuntimeError(const std::string &Msg);
-
-  ExecutionResult executeBlock(VariableEnv *Env, const BlockAST *Block);
-  ExecutionResult executeStatement(VariableEnv *Env, const StatementAST *Stmt);
+  void enterCall(SourceMgr::LocTy Loc) {
+    if (!RT.tryEnterCall())
+      stackOverflow(Loc);
+  }
+  void leaveCall() { RT.leaveCall(); }
+  [[noreturn]] void stackOverflow(SourceMgr::LocTy Loc);
+
+  ExecutionResult executeBlock(VariableEnv *Env, const BlockAST *Block,
+                               bool Tail);
+  ExecutionResult executeStatementList(VariableEnv *Env,
+                      const std::list<std::unique_ptr<StatementAST>> &List,
+                      bool Tail);
+  ExecutionResult executeStatement(VariableEnv *Env, const StatementAST *Stmt,
+                                   bool Tail = false);
   ExecutionResult executeIfStatement(VariableEnv *Env,
-                                     const IfStatementAST *IfStmt);
+                                     const IfStatementAST *IfStmt, bool Tail);
   ExecutionResult executeWhileStatement(VariableEnv *Env,
                                         const WhileStatementAST *WhileStmt);
   ExecutionResult executeForStatement(VariableEnv *Env,
                                       const ForStatementAST *ForStmt);
+  ExecutionResult executeForLoop(VariableEnv *Env,
+                                 const ForStatementAST *ForStmt);
   ExecutionResult executeBreakStatement(VariableEnv *Env,
                                         const BreakStatementAST *BreakStmt);
   ExecutionResult executeContinueStatement(VariableEnv *Env,
                                            const ContinueStatementAST *ConStmt);
   ExecutionResult executeExprStatement(VariableEnv *Env,
-                                       const ExprStatementAST *ExprStmt);
+                                       const ExprStatementAST *ExprStmt,
+                                       bool Tail);
   ExecutionResult executeReturnStatement(VariableEnv *Env,
                                          const ReturnStatementAST *RetStmt);
+  ExecutionResult executeTailCall(VariableEnv *Env,
+                                  const FunctionCallAST *FuncCall,
+                                  bool Returned);
   ExecutionResult executeDeclarationList(VariableEnv *Env,
                                          const DeclarationListAST *DeclList);
   ExecutionResult executeDeclaration(VariableEnv *Env,
                                      const DeclarationAST *Decl);
+  ExecutionResult resumeIteration(VariableEnv *Env,
+                          const std::vector<const StatementAST *> &Path,
+                          const StatementAST *Leaf, size_t Level);
 
   cvm::BasicValue evaluateExpression(VariableEnv *Env,
                                      const ExpressionAST *Expr);
-  cvm::BasicValue &evaluateLvalueExpr(VariableEnv *Env,
-                                      const ExpressionAST *Expr);
+  cvm::ValueRef evaluateLvalueExpr(VariableEnv *Env,
+                                   const ExpressionAST *Expr);
   cvm::BasicValue &evaluateIdentifierExpr(VariableEnv *Env,
                                           const IdentifierAST *Expr);
-  cvm::BasicValue &evaluateIndexExpr(VariableEnv *Env,
-                                     const ExpressionAST *BaseExpr,
-                                     const ExpressionAST *IndexExpr);
-  cvm::BasicValue &evaluateAssignment(VariableEnv *Env,
-                                      const ExpressionAST *RefExpr,
-                                      const ExpressionAST *VarExpr);
+  cvm::ValueRef evaluateIndexExpr(VariableEnv *Env,
+                                  const ExpressionAST *BaseExpr,
+                                  const ExpressionAST *IndexExpr);
+  cvm::ValueRef evaluateAssignment(VariableEnv *Env,
+                                   const ExpressionAST *RefExpr,
+                                   const ExpressionAST *VarExpr,
+                                   bool Checked = false);
   cvm::BasicValue evaluateLogicalAnd(VariableEnv *Env,
                                      const ExpressionAST *LHS,
                                      const ExpressionAST *RHS);
@@ -103,38 +173,33 @@ private:  /* private member functions */
                                       const InfixOpExprAST *Expr);
   cvm::BasicValue evaluateUnaryOpExpr(VariableEnv *Env,
                                       const UnaryOperatorAST *Expr);
-  cvm::BasicValue evaluateUnaryArith(UnaryOperatorAST::OperatorKind OpKind,
-                                     cvm::BasicValue Operand);
-  cvm::BasicValue evaluateUnaryLogical(UnaryOperatorAST::OperatorKind OpKind,
-                                       cvm::BasicValue Operand);
-  cvm::BasicValue evaluateUnaryBitwise(UnaryOperatorAST::OperatorKind OpKind,
-                                       cvm::BasicValue Operand);
   cvm::BasicValue evaluateBinaryOpExpr(VariableEnv *Env,
                                        const BinaryOperatorAST *Expr);
   cvm::BasicValue evaluateAssignExpr(VariableEnv *Env,
                                      const BinaryOperatorAST *Expr);
+  cvm::BasicValue evaluateQuickenedBinOp(const BinaryOperatorAST *Expr,
+                                         const cvm::BasicValue &LHS,
+                                         const cvm::BasicValue &RHS);
+  cvm::BasicValue evaluateIntBinOp(BinaryOperatorAST::OperatorKind OpKind,
+                                   int LHS, int RHS);
+  cvm::BasicValue evaluateDoubleBinOp(BinaryOperatorAST::OperatorKind OpKind,
+                                      double LHS, double RHS);
   cvm::BasicValue evaluateBinaryCalc(BinaryOperatorAST::OperatorKind OpKind,
                                      cvm::BasicValue LHS, cvm::BasicValue RHS);
-  cvm::BasicValue evaluateBinArith(BinaryOperatorAST::OperatorKind OpKind,
-                                   cvm::BasicValue LHS, cvm::BasicValue RHS);
-  cvm::BasicValue evaluateBinRelation(BinaryOperatorAST::OperatorKind OpKind,
-                                      cvm::BasicValue LHS, cvm::BasicValue RHS);
-  cvm::BasicValue evaluateBinBitwise(BinaryOperatorAST::OperatorKind OpKind,
-                                     cvm::BasicValue LHS, cvm::BasicValue RHS);
-
 
-  std::list<cvm::BasicValue>
-  evaluateArgumentList(VariableEnv *Env,
-                       const std::list<std::unique_ptr<ExpressionAST>> &Args);
+  void evaluateArgumentList(VariableEnv *Env,
+                        const std::list<std::unique_ptr<ExpressionAST>> &Args,
+                        VariableEnv &FuncEnv);
 
-  cvm::BasicValue callNativeFunction(const NativeFunction &Function,
-                                     std::list<cvm::BasicValue> &Args);
+  cvm::BasicValue callNativeFunction(VariableEnv *Env,
+                        cvm::NativeFunction Function,
+                        const std::list<std::unique_ptr<ExpressionAST>> &Args);
   cvm::BasicValue callUserFunction(const FunctionDefinitionAST &Function,
-                                   std::list<cvm::BasicValue> &Args,
-                                   VariableEnv *Env = nullptr);
+                                   VariableEnv &FuncEnv, size_t ArgCount,
+                                   bool Checked = false);
 
-  std::map<std::string, cvm::BasicValue>::iterator
-  searchVariable(VariableEnv *Env, const std::string &Name);
+  cvm::BasicValue &searchVariable(VariableEnv *Env, const IdentifierAST *Id);
+  cvm::BasicValue &searchVariable(VariableEnv *Env, Atom Name);
 };
 }
 
@@ -0,0 +1,277 @@
+#ifndef CMMJIT_H
+#define CMMJIT_H
+
+#include "AST.h"
+#include "CMMInterpreter.h"
+#include "NativeFunctions.h"
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cmm {
+class CMMJit;
+
+/// \brief Native code of a function compiled by CMMJit.
+struct JitFunction {
+  /// Takes the frame of the function with its arguments bound, and returns
+  /// the payload of the value of the function type.
+  typedef uint64_t (*EntryTy)(CMMJit *Jit, void *Slots);
+
+  /// Null if the function can't be compiled.
+  EntryTy Entry = nullptr;
+};
+
+/// \brief Native code of a loop traced by CMMJit.
+struct JitTrace {
+  /// Takes the context of the loop being run, and returns how it's left.
+  typedef int (*EntryTy)(CMMJit *Jit, void *Context);
+
+  /// Null if the loop can't be compiled.
+  EntryTy Entry = nullptr;
+};
+
+/// \brief Compile functions called often and loops run often by
+/// CMMInterpreter to x86-64 code.
+///
+/// A function is compiled once it has been called CallThreshold times. Each
+/// node of its body is translated to a fixed sequence of instructions, with
+/// ints and bools in eax and doubles in xmm0, and operands waiting for the
+/// other on the native stack. Variables stay in the slots of the frame the
+/// interpreter allocates, so that the code works on the same frames.
+///
+/// Only functions of int, double and bool can be compiled, whose parameters
+/// are of these types too, and whose value is proven of the function type
+/// however they return. The body may only use variables of these types and
+/// arrays of them, whose identifiers are bound to the slots of the function
+/// and of known static types, so that no type is checked at runtime. It may
+/// call natives, passing scalars and string literals, and functions which
+/// can be compiled too, which are compiled along. Natives, arrays and frames
+/// of callees are handled by calling back into the runtime, so are errors.
+///
+/// Loops run often outside compiled functions are traced. Once a loop has
+/// iterated TraceThreshold times, the branches its iterations take are
+/// recorded for RecordIterations more, then the loop is compiled along the
+/// recorded path, from its head back to its head. Variables are resolved to
+/// their slots at compile time rather than searched for by name, and their
+/// types are observed then. Those types are guarded once when the trace is
+/// entered, rather than on every access, and the payloads are accessed as
+/// they are in the slots. A branch not recorded, and a statement that can't
+/// be compiled, leave the trace through a side exit: the interpreter runs
+/// the rest of the iteration, and the trace goes on once the guards hold
+/// again. A loop entered once is traced as well, from a head reached while
+/// it runs: the ints and bools the trace uses the most are moved from their
+/// slots to registers then, and written back whenever the interpreter runs.
+///
+/// Native code is written to memory mapped executable once it's complete.
+/// It's only generated on x86-64 Linux and macOS, nothing is compiled
+/// elsewhere.
+class CMMJit {
+public:
+  /// Calls to a function interpreted before it's compiled.
+  static const unsigned CallThreshold = 100;
+  /// Iterations of a loop interpreted before it's traced, and those recorded.
+  static const unsigned TraceThreshold = 200;
+  static const unsigned RecordIterations = 16;
+
+  /// How a loop continues at its head.
+  enum TraceResult {
+    TraceNotEntered,  // Interpret the next iteration.
+    TraceDone,        // The loop has completed.
+    TraceNext,        // Go on with the next iteration, after the post of a
+                      // for loop.
+    TraceReturned,    // A return statement has completed the loop.
+    TraceTailCalled   // So has a tail call.
+  };
+
+private:  /* private data types */
+  class CodeGenerator;
+
+  /// Offsets in the frames of the interpreter.
+  struct FrameLayout {
+    int32_t VariableSize;
+    int32_t Type;
+    int32_t Payload;
+    int32_t Declared;
+  };
+
+  /// A native function call, whose arguments are passed as payloads.
+  struct NativeCall {
+    cvm::NativeFunction Function;
+    std::vector<cvm::BasicType> ArgTypes;
+    /// String literals passed, by the arguments.
+    std::vector<cvm::BasicValue> Strings;
+  };
+
+  struct ArrayDeclaration {
+    std::string Name;
+    cvm::BasicType Type;
+    size_t Rank;
+  };
+
+  /// A function being compiled along with the others it calls.
+  struct Candidate {
+    const JitFunction *Function;
+    std::vector<uint8_t> Code;
+    std::vector<const FunctionDefinitionAST *> Callees;
+    bool Compiled = false;
+  };
+
+  /// Variables of the trace are in the scopes \p Depth levels out from the
+  /// loop. A global one must be the top level scope.
+  struct TraceBase {
+    unsigned Depth;
+    bool Global;
+  };
+
+  /// A variable whose state at the head of the loop the trace relies on.
+  /// Rank is the number of dimensions of an array, 0 for a scalar.
+  struct TraceGuard {
+    unsigned Base;
+    unsigned Slot;
+    bool Declared;
+    cvm::BasicType Type;
+    int Rank;
+  };
+
+  struct Trace : JitTrace {
+    const StatementAST *Loop;
+    /// The body of the loop if it's a block with a scope of its own.
+    const BlockAST *Scope = nullptr;
+    std::vector<TraceBase> Bases;
+    std::vector<TraceGuard> Guards;
+    /// Branches of if statements recorded, 1 if the then branch is taken, 2
+    /// if the else branch is, or both.
+    std::unordered_map<const IfStatementAST *, unsigned> Branches;
+  };
+
+  /// Where a trace is left for the interpreter: \p Leaf is executed, then
+  /// the rest of each statement of \p Path, from the body of the loop down.
+  struct SideExit {
+    std::vector<const StatementAST *> Path;
+    const StatementAST *Leaf;
+    /// Set if it's in the scope of the body.
+    bool InScope;
+  };
+
+  /// The state of a trace being run, which is passed to the native code.
+  static const unsigned MaxTraceBases = 8;
+  struct TraceContext {
+    CMMInterpreter::VariableEnv *Env;
+    const Trace *T;
+    CMMInterpreter::Variable *Bases[MaxTraceBases];
+    CMMInterpreter::VariableEnv *Scope;
+    alignas(CMMInterpreter::VariableEnv)
+    unsigned char ScopeStorage[sizeof(CMMInterpreter::VariableEnv)];
+  };
+
+private:  /*  private member variables  */
+  CMMInterpreter &Interp;
+  FrameLayout Layout;
+  std::map<cvm::NativeFunction, cvm::NativeFunctionInfo> NativeFunctions;
+
+  /// Referred to by native code, so that none of them ever moves.
+  std::deque<JitFunction> Functions;
+  std::deque<NativeCall> NativeCalls;
+  std::deque<ArrayDeclaration> ArrayDeclarations;
+  std::deque<std::string> Messages;
+  std::deque<Trace> Traces;
+  std::deque<SideExit> SideExits;
+  /// Executable memory mapped.
+  std::vector<std::pair<void *, size_t>> CodeBlocks;
+
+  /// Functions being compiled, and those of them not compiled yet.
+  std::map<const FunctionDefinitionAST *, Candidate> Candidates;
+  std::vector<const FunctionDefinitionAST *> Worklist;
+
+  /// The loop whose branches are being recorded, the iterations recorded,
+  /// and the heads of other loops reached meanwhile. It's given up once
+  /// they're over RecordBudget, so that a loop left early can't hold it.
+  static const unsigned RecordBudget = 10000;
+  const StatementAST *RecordingLoop = nullptr;
+  unsigned RecordedIterations = 0;
+  unsigned OtherHeads = 0;
+  std::unordered_map<const IfStatementAST *, unsigned> Branches;
+
+public:   /* public member functions */
+  explicit CMMJit(CMMInterpreter &Interp);
+  CMMJit(const CMMJit &) = delete;
+  CMMJit &operator=(const CMMJit &) = delete;
+  ~CMMJit();
+
+  /// \brief Count a call to \p Function, and return the native code of it
+  /// once it's compiled, null if it isn't (yet).
+  JitFunction::EntryTy getEntry(const FunctionDefinitionAST &Function) {
+    if (const JitFunction *J = Function.getJitFunction())
+      return J->Entry;
+    if (Function.countCall() < CallThreshold)
+      return nullptr;
+    return compile(Function).Entry;
+  }
+
+  /// \brief Count an iteration of \p Loop at its head, and run the trace of
+  /// it once it's compiled.
+  template <typename LoopAST>
+  TraceResult enterLoop(CMMInterpreter::VariableEnv *Env,
+                        const LoopAST &Loop) {
+    const JitTrace *T = Loop.getJitTrace();
+    if (!T) {
+      if (Loop.countIteration() < TraceThreshold && !RecordingLoop)
+        return TraceNotEntered;
+      if (!(T = recordLoop(Env, Loop)))
+        return TraceNotEntered;
+      Loop.setJitTrace(T);
+    }
+    return T->Entry ? runTrace(Env, *T) : TraceNotEntered;
+  }
+
+  bool isRecording() const { return RecordingLoop != nullptr; }
+  void recordBranch(const IfStatementAST &IfStmt, bool Taken) {
+    Branches[&IfStmt] |= Taken ? 1 : 2;
+  }
+
+  /// \brief Return the value of \p Type of a payload returned by native code.
+  static cvm::BasicValue makeValue(cvm::BasicType Type, uint64_t Payload);
+
+private:  /* private member functions */
+  const JitFunction &compile(const FunctionDefinitionAST &Function);
+  const JitFunction *getCallee(const FunctionDefinitionAST &Function);
+  bool install();
+  const uint8_t *mapCode(const std::vector<uint8_t> &Code);
+
+  const JitTrace *recordLoop(CMMInterpreter::VariableEnv *Env,
+                             const StatementAST &Loop);
+  const Trace &compileTrace(CMMInterpreter::VariableEnv *Env,
+                            const StatementAST &Loop);
+  TraceResult runTrace(CMMInterpreter::VariableEnv *Env,
+                       const JitTrace &T);
+  bool checkGuards(const TraceContext &Ctx) const;
+
+  const std::string *addMessage(std::string Msg);
+
+  // Runtime called back by native code.
+  static void *enterFrame(CMMJit *Jit, size_t Size, SourceMgr::LocTy Loc,
+                          void *Mark);
+  static uint64_t leaveFrame(CMMJit *Jit, void *Slots, size_t Size,
+                             const void *Mark, uint64_t Result);
+  static void clearSlots(CMMJit *Jit, void *Slots, size_t Count);
+  static void declareArray(CMMJit *Jit, void *Slot,
+                           const ArrayDeclaration *Decl,
+                           const uint64_t *Dims);
+  static void *indexArray(CMMJit *Jit, void *Slot, const uint64_t *Indices,
+                          size_t Count);
+  static uint64_t callNative(CMMJit *Jit, const NativeCall *Call,
+                             const uint64_t *Args);
+  static double modulo(double LHS, double RHS);
+  static void fail(CMMJit *Jit, const std::string *Msg);
+  static CMMInterpreter::Variable *enterScope(CMMJit *Jit,
+                                              TraceContext *Ctx);
+  static void leaveScope(CMMJit *Jit, TraceContext *Ctx);
+  static int resumeTrace(CMMJit *Jit, TraceContext *Ctx,
+                         const SideExit *Exit);
+};
+}
+
+#endif // !CMMJIT_H
@@ -1,8 +1,10 @@
 #ifndef CMMLEXER_H
 #define CMMLEXER_H
 
+#include "Atom.h"
 #include "SourceMgr.h"
 #include <string>
+#include <vector>
 
 namespace cmm {
 
@@ -53,15 +55,51 @@ public:
   //}
 };
 
+/// \brief Lexer of CMM source code.
+///
+/// The whole source is tokenized in one pass when the lexer is created, into
+/// an array of tokens the parser walks by index. Identifiers, infix
+/// operators and string literals are interned as atoms.
+///
+/// Diagnostics found while tokenizing are held back and reported when the
+/// parser reaches the token they belong to, so they're interleaved with
+/// errors of the parser just as if tokens were lexed on demand.
 class CMMLexer {
 public:
   using LocTy = SourceMgr::LocTy;
 
-private:
+private:  /* private data types */
+  struct LexedToken {
+    LocTy Loc;
+    Token::TokenKind Kind;
+    /// For identifiers, strings and infix operators.
+    Atom StrVal;
+    union {
+      int IntVal;
+      double DoubleVal;
+      bool BoolVal;
+    };
+  };
+
+  struct Diagnostic {
+    size_t TokenIndex;
+    LocTy Loc;
+    bool IsError;
+    std::string Msg;
+  };
+
+private:  /*  private member variables  */
   SourceMgr &SrcMgr;
-  /// Information about the current token.
-  Token CurTok;
-  LocTy TokStartLoc;
+  std::vector<LexedToken> Tokens;
+  std::vector<Diagnostic> Diagnostics;
+  /// Index of the current token, -1 before the first Lex().
+  size_t TokIndex = static_cast<size_t>(-1);
+
+  /// State of tokenizing.
+  const char *Buffer;
+  LocTy BufferSize;
+  LocTy CurLoc = 0;
+  LocTy TokStartLoc = 0;
   std::string StrVal;
   union {
     int IntVal;
@@ -70,23 +108,29 @@ private:
   };
 
 public:
-  CMMLexer(SourceMgr &SrcMgr) :
-      SrcMgr(SrcMgr), CurTok(Token::Boolean) {}
+  CMMLexer(SourceMgr &SrcMgr);
+
+  /// \brief Move to the next token. Eof is the last one and is never passed.
   Token Lex() {
-    return CurTok = LexToken();
+    if (TokIndex + 1 < Tokens.size())
+      ++TokIndex;
+    if (!Diagnostics.empty())
+      reportDiagnostics();
+    return Tokens[TokIndex].Kind;
   }
 
   /// Getters
-  Token getTok() const { return CurTok; }
-  Token::TokenKind getKind() const { return CurTok.getKind(); }
-  const std::string &getStrVal() const { return StrVal; }
-  LocTy getLoc() const { return TokStartLoc; }
-  int getIntVal() const { return IntVal; }
-  double getDoubleVal() const { return DoubleVal; }
-  bool getBoolVal() const { return BoolVal; }
-
-  bool is(Token::TokenKind K) const { return CurTok.is(K); }
-  bool isNot(Token::TokenKind K) const { return CurTok.isNot(K); }
+  Token getTok() const { return getKind(); }
+  Token::TokenKind getKind() const { return Tokens[TokIndex].Kind; }
+  const std::string &getStrVal() const { return getAtomVal().str(); }
+  Atom getAtomVal() const { return Tokens[TokIndex].StrVal; }
+  LocTy getLoc() const { return Tokens[TokIndex].Loc; }
+  int getIntVal() const { return Tokens[TokIndex].IntVal; }
+  double getDoubleVal() const { return Tokens[TokIndex].DoubleVal; }
+  bool getBoolVal() const { return Tokens[TokIndex].BoolVal; }
+
+  bool is(Token::TokenKind K) const { return getKind() == K; }
+  bool isNot(Token::TokenKind K) const { return getKind() != K; }
   bool isOneOf(Token::TokenKind K1, Token::TokenKind K2) const {
     return is(K1) || is(K2);
   }
@@ -96,7 +140,9 @@ public:
   }
 
   /// State change
-  void seekLoc(LocTy Loc) { SrcMgr.seekLoc(Loc); }
+  size_t getTokenIndex() const { return TokIndex; }
+  /// \brief Go back to a token, it's lexed again by the next Lex().
+  void seekToken(size_t Index) { TokIndex = Index - 1; }
 
   bool Error(LocTy ErrorLoc, const std::string &Msg);
   bool Error(const std::string &Msg) { return Error(getLoc(), Msg); }
@@ -104,11 +150,30 @@ public:
   void Warning(const std::string &Msg) { Warning(getLoc(), Msg); }
 
 private:
+  void tokenize();
+  void reportDiagnostics() const;
+
   Token LexToken();
 
-  int peekNextChar();
-  int getNextChar();
-  void ungetChar();
+  int peekNextChar() const {
+    if (CurLoc == BufferSize)
+      return std::char_traits<char>::eof();
+    return Buffer[CurLoc];
+  }
+  int getNextChar() {
+    if (CurLoc == BufferSize)
+      return std::char_traits<char>::eof();
+    return Buffer[CurLoc++];
+  }
+  void ungetChar() {
+    if (CurLoc > 0)
+      --CurLoc;
+  }
+
+  bool lexError(LocTy ErrorLoc, const std::string &Msg);
+  bool lexError(const std::string &Msg) { return lexError(TokStartLoc, Msg); }
+  void lexWarning(LocTy ErrorLoc, const std::string &Msg);
+  void lexWarning(const std::string &Msg) { lexWarning(TokStartLoc, Msg); }
 
   Token LexIdentifier();
   Token LexString();
@@ -5,6 +5,7 @@
 #include "AST.h"
 #include <list>
 #include <memory>
+#include <unordered_map>
 
 
 namespace cmm {
@@ -19,7 +20,8 @@ private:
   BlockAST TopLevelBlock;
   BlockAST *CurrentBlock;
 
-  std::map<std::string, int8_t> BinOpPrecedence;
+  std::unordered_map<Atom, int8_t> BinOpPrecedence;
+  std::unordered_map<Atom, cvm::BasicValue> StringLiterals;
   std::map<std::string, FunctionDefinitionAST> FunctionDefinition;
   std::map<std::string, InfixOpDefinitionAST> InfixOpDefinition;
 
@@ -33,11 +35,12 @@ private:
   void Warning(const std::string &Msg) { Lexer.Warning(Msg); }
 
   int8_t getBinOpPrecedence();
+  const cvm::BasicValue &getStringLiteral(Atom Literal);
 
   bool parseTopLevel();
   bool parseInfixOpDefinition();
   bool parseFunctionDefinition();
-  bool parseFunctionDefinition(cvm::BasicType Type, const std::string &Name);
+  bool parseFunctionDefinition(cvm::BasicType Type, Atom Name);
   bool parseStatement(std::unique_ptr<StatementAST> &Res);
   bool parseEmptyStatement(std::unique_ptr<StatementAST> &Res);
   bool parseBlock(std::unique_ptr<StatementAST> &Res);
@@ -77,6 +80,14 @@ public:
 
   const std::map<std::string, InfixOpDefinitionAST> &
       getInfixOpDefinition() const { return InfixOpDefinition; };
+
+  BlockAST &getTopLevelBlock() { return TopLevelBlock; }
+
+  std::map<std::string, FunctionDefinitionAST> &
+      getFunctionDefinition() { return FunctionDefinition; };
+
+  std::map<std::string, InfixOpDefinitionAST> &
+      getInfixOpDefinition() { return InfixOpDefinition; };
 };
 }
 
@@ -0,0 +1,98 @@
+#ifndef CMMRESOLVER_H
+#define CMMRESOLVER_H
+
+#include "AST.h"
+#include "NativeFunctions.h"
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace cmm {
+/// \brief Bind every identifier to a slot in the scope that declares it, so
+/// that variables can be accessed without searching by name at runtime.
+///
+/// Every function and infix operator gets a flat array of slots, one for each
+/// distinct name declared in it. Blocks in them are hoisted: a block takes
+/// the slots after those of the enclosing block in the same array, so that
+/// entering it creates no scope at runtime. Blocks of top level code declare
+/// variables invisible to functions, so those declaring any get a scope of
+/// their own, which the blocks in them are hoisted into. An identifier is
+/// bound to (depth, slot), which is checked against the runtime scope chain,
+/// and falls back to searching by name when the variable turns out not
+/// declared yet (e.g. declared by the branch of an if statement) or the
+/// function is called with dynamic binding.
+///
+/// Function calls and infix operator expressions are linked to what they
+/// call as well, since functions can't be redefined after parsing. Calling
+/// something undefined is still an error at runtime only, as the call may
+/// never be executed, but calling a native function of fixed arity with a
+/// wrong number of arguments is an error here. A function calling itself
+/// from tail position, i.e. as the value of a return statement or of the
+/// last statement, is marked so that the call reuses the frame.
+class CMMResolver {
+private:  /* private data types */
+  struct Scope {
+    SlotNameList *Slots;
+    std::unordered_map<Atom, unsigned> SlotMap;
+    /// Index of the scope whose slots it takes, itself unless it's hoisted.
+    size_t Frame;
+
+    /// A hoisted block takes the slots of the enclosing scope, which are
+    /// not cleared then.
+    Scope(SlotNameList &Slots, size_t Frame, bool Hoisted = false)
+        : Slots(&Slots), Frame(Frame) {
+      if (!Hoisted)
+        Slots.clear();
+    }
+  };
+
+private:  /*  private member variables  */
+  SourceMgr &SrcMgr;
+  const BlockAST &TopLevelBlock;
+  const std::map<std::string, FunctionDefinitionAST> &UserFunctionMap;
+  const std::map<std::string, InfixOpDefinitionAST> &InfixOpMap;
+  std::map<std::string, cvm::NativeFunctionInfo> NativeFunctionMap;
+  bool HadError;
+
+  std::vector<Scope> ScopeStack;
+  /// Index of the outermost scope of the function being resolved.
+  size_t FunctionScope;
+  /// Identifiers in loops that may declare variables into the enclosing
+  /// scope are always searched by name.
+  unsigned DynamicLevel;
+
+public:   /* public member functions */
+  CMMResolver(SourceMgr &SrcMgr, const BlockAST &Block,
+              const std::map<std::string, FunctionDefinitionAST> &F,
+              const std::map<std::string, InfixOpDefinitionAST> &I)
+      : SrcMgr(SrcMgr), TopLevelBlock(Block), UserFunctionMap(F)
+      , InfixOpMap(I), HadError(false), FunctionScope(0), DynamicLevel(0) {
+    addNativeFunctions();
+  }
+
+  /// \brief Resolve and link the program, return true on error.
+  bool resolve();
+
+private:  /* private member functions */
+  void addNativeFunctions();
+  void linkFunctionCall(const FunctionCallAST *FuncCall);
+  void linkInfixOp(const InfixOpExprAST *Expr) const;
+
+  unsigned declareSlot(Atom Name);
+  VariableBinding lookup(Atom Name) const;
+
+  void resolveFunction(const FunctionDefinitionAST &Function);
+  void markTailCalls(const FunctionDefinitionAST &Function,
+                     const StatementAST *Stmt, bool Tail) const;
+  void resolveInfixOp(const InfixOpDefinitionAST &InfixOp);
+
+  void resolveStatement(const StatementAST *Stmt);
+  void resolveBlock(const BlockAST *Block);
+  void resolveLoop(const ExpressionAST *Init, const ExpressionAST *Condition,
+                   const ExpressionAST *Post, const StatementAST *Body);
+  void resolveDeclaration(const DeclarationAST *Decl);
+  void resolveExpression(const ExpressionAST *Expr);
+};
+}
+
+#endif // !CMMRESOLVER_H
@@ -0,0 +1,296 @@
+#ifndef CMMRUNTIME_H
+#define CMMRUNTIME_H
+
+#include "AST.h"
+#include "NativeFunctions.h"
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <string>
+
+namespace cmm {
+/// \brief Runtime of the C++ programs CMMTranspiler emits, and the operations
+/// on values CMMInterpreter shares with them.
+///
+/// Variables live in scopes laid out and chained as the interpreter's, with
+/// the slots assigned by CMMResolver and their names, so that variables are
+/// searched by name and dynamic binding works the same. A scope is a Frame
+/// on the native stack of the code it belongs to, and the program runs on a
+/// thread whose stack is large enough for MaxStack nested calls.
+///
+/// The operations an emitted program does on values are those of the
+/// interpreter and the virtual machine: generic operators go through
+/// binaryOp() and unaryOp(), which they call for the operands they haven't
+/// quickened, and errors are reported by error() the same way. The
+/// interpreter also runs on run() and counts its calls by enterCall().
+class CMMRuntime {
+public:
+  struct Variable {
+    cvm::BasicValue Value;
+    bool Declared = false;
+  };
+
+  struct Env {
+    Env *OuterEnv;
+    const SlotNameList *Names;
+    Variable *Vars;
+
+    void declare(unsigned Slot, const cvm::BasicValue &Value) {
+      Vars[Slot].Value = Value;
+      Vars[Slot].Declared = true;
+    }
+
+    /// \brief Clear the variables of a hoisted block.
+    void clear(unsigned Begin, unsigned End) {
+      for (unsigned Slot = Begin; Slot != End; ++Slot) {
+        Vars[Slot].Value = cvm::BasicValue();
+        Vars[Slot].Declared = false;
+      }
+    }
+  };
+
+  /// \brief A scope of N slots.
+  template <size_t N>
+  struct Frame : Env {
+    Variable Slots[N == 0 ? 1 : N];
+
+    Frame(Env *Outer, const SlotNameList &SlotNames) {
+      OuterEnv = Outer;
+      Names = &SlotNames;
+      Vars = Slots;
+    }
+    Frame(const Frame &) = delete;
+    Frame &operator=(const Frame &) = delete;
+  };
+
+  /// \brief Clear the variables of a hoisted block however it's left.
+  struct HoistedScope {
+    Env &Scope;
+    unsigned Begin, End;
+    ~HoistedScope() { Scope.clear(Begin, End); }
+  };
+
+  /// Runs the top level code and main(), returns the exit code.
+  typedef std::function<int(int Argc, char *Argv[])> ProgramTy;
+
+private:  /*  private member variables  */
+  /// Native stack taken by a call at most in common cases, and the room kept
+  /// for native functions and reporting errors.
+  static const size_t NativeFrameSize = 4096;
+  static const size_t NativeStackReserve = 256 * 1024;
+
+  size_t MaxStack;
+  size_t CallDepth = 0;
+  uintptr_t StackBase = 0;
+  size_t NativeStackLimit = 0;
+  Env *TopLevelEnv = nullptr;
+  std::map<std::string, cvm::NativeFunctionInfo> NativeFunctions;
+
+public:   /* public member functions */
+  explicit CMMRuntime(size_t MaxStack);
+  CMMRuntime(const CMMRuntime &) = delete;
+  CMMRuntime &operator=(const CMMRuntime &) = delete;
+
+  /// \brief Run \p Program on a stack large enough for MaxStack nested calls.
+  int run(int Argc, char *Argv[], ProgramTy Program);
+
+  /// \brief Return the size of the native stack of the main thread.
+  static size_t getMainStackSize();
+
+  /// \brief Return the native function of \p Name, null if there is none.
+  cvm::NativeFunction getNative(const std::string &Name) const;
+
+  Env *getTopLevelEnv() const { return TopLevelEnv; }
+  void setTopLevelEnv(Env *E) { TopLevelEnv = E; }
+
+  /// \brief Count a call, return false if calls nest deeper than MaxStack
+  /// or the native stack is about to run out.
+  bool tryEnterCall() {
+    char Here;
+    return ++CallDepth <= MaxStack &&
+           StackBase - reinterpret_cast<uintptr_t>(&Here) <= NativeStackLimit;
+  }
+  /// \brief Count a call made at \p Line, which overflows the stack if it
+  /// goes too deep.
+  void enterCall(unsigned Line) {
+    if (!tryEnterCall())
+      stackOverflow(Line);
+  }
+  void leaveCall() { --CallDepth; }
+
+  /// \brief Return the variable in \p Slot of \p Scope if it's declared, and
+  /// search \p Name from \p E otherwise.
+  cvm::BasicValue &local(Env &Scope, unsigned Slot, Env *E, Atom Name) {
+    Variable &Var = Scope.Vars[Slot];
+    return Var.Declared ? Var.Value : search(E, Name);
+  }
+  /// \brief Return the top level variable in \p Slot, \p Depth scopes out
+  /// from \p E, and search \p Name if it's not the top level scope.
+  cvm::BasicValue &global(Env *E, unsigned Depth, unsigned Slot, Atom Name) {
+    Env *Scope = E;
+    for (; Depth != 0; --Depth)
+      Scope = Scope->OuterEnv;
+    Variable &Var = Scope->Vars[Slot];
+    return Scope == TopLevelEnv && Var.Declared ? Var.Value : search(E, Name);
+  }
+  cvm::BasicValue &search(Env *E, Atom Name);
+
+  /// \brief Print a runtime error after what the program printed, and exit.
+  [[noreturn]] static void error(const std::string &Msg);
+  [[noreturn]] static void stackOverflow(unsigned Line);
+  [[noreturn]] static void undefinedVariable(Atom Name);
+  [[noreturn]] static void noInfixResult();
+
+  // Operations on values.
+  static cvm::BasicValue binaryOp(BinaryOperatorAST::OperatorKind OpKind,
+                                  const cvm::BasicValue &LHS,
+                                  const cvm::BasicValue &RHS);
+  static cvm::BasicValue unaryOp(UnaryOperatorAST::OperatorKind OpKind,
+                                 const cvm::BasicValue &Operand);
+
+  // Ints wrap around, and shifts take the count modulo 32, as on x86-64.
+  static int add(int L, int R) {
+    return static_cast<int>(static_cast<unsigned>(L) +
+                            static_cast<unsigned>(R));
+  }
+  static int subtract(int L, int R) {
+    return static_cast<int>(static_cast<unsigned>(L) -
+                            static_cast<unsigned>(R));
+  }
+  static int multiply(int L, int R) {
+    return static_cast<int>(static_cast<unsigned>(L) *
+                            static_cast<unsigned>(R));
+  }
+  static int negate(int I) { return subtract(0, I); }
+  static int divide(int L, int R) {
+    if (R == 0)
+      error("int division by zero");
+    return L / R;
+  }
+  static int modulo(int L, int R) {
+    if (R == 0)
+      error("int modulo by zero");
+    return L % R;
+  }
+  static int shiftLeft(int L, int R) {
+    return static_cast<int>(static_cast<unsigned>(L) << (R & 31));
+  }
+  static int shiftRight(int L, int R) { return L >> (R & 31); }
+
+  /// \brief Store a scalar into a variable holding a scalar of its type,
+  /// unless it's an alias of an array.
+  static void store(cvm::BasicValue &Var, int Value) {
+    if (Var.isArray())
+      error("cannot assign value to array directly");
+    Var.IntVal = Value;
+  }
+  static void store(cvm::BasicValue &Var, double Value) {
+    if (Var.isArray())
+      error("cannot assign value to array directly");
+    Var.DoubleVal = Value;
+  }
+  static void store(cvm::BasicValue &Var, bool Value) {
+    if (Var.isArray())
+      error("cannot assign value to array directly");
+    Var.BoolVal = Value;
+  }
+  /// \brief Assign a value to a variable, or an element of an array. Its
+  /// type isn't checked if it's \p Checked statically.
+  static void assign(cvm::ValueRef Var, cvm::BasicValue Value, bool Checked);
+
+  /// \brief Return the array a reference to an array expression views.
+  static cvm::ValueRef getArrayView(cvm::ValueRef Base) {
+    cvm::ValueRef View = Base.getArrayView();
+    if (!View.isValid())
+      error("too many index or index expression didn't start with array");
+    return View;
+  }
+  static cvm::ValueRef index(cvm::ValueRef View, int Index) {
+    size_t ArraySize = View.getArraySize();
+    if (Index < 0 || Index >= static_cast<int>(ArraySize))
+      indexOutOfRange(ArraySize, Index);
+    return View.getElement(static_cast<size_t>(Index));
+  }
+  static cvm::ValueRef index(cvm::ValueRef View,
+                             const cvm::BasicValue &Index) {
+    if (!Index.isInt())
+      error("non-int index in index expression");
+    return index(View, Index.IntVal);
+  }
+  [[noreturn]] static void indexOutOfRange(size_t ArraySize, int Index);
+
+  /// \brief Check that the variable in \p Slot of \p E isn't declared yet,
+  /// before its dimensions and initializer are evaluated.
+  static void checkUndeclared(Env &E, unsigned Slot, Atom Name) {
+    if (E.Vars[Slot].Declared)
+      redeclared(Name);
+  }
+  [[noreturn]] static void redeclared(Atom Name);
+  /// \brief Return a dimension of the array \p Name, which must be a
+  /// positive int.
+  static int dimension(Atom Name, const cvm::BasicValue &Dim) {
+    if (!Dim.isInt())
+      badDimension(Name, Dim);
+    return dimension(Name, Dim.IntVal);
+  }
+  static int dimension(Atom Name, int Dim) {
+    if (Dim <= 0)
+      badDimension(Name, Dim);
+    return Dim;
+  }
+  [[noreturn]] static void badDimension(Atom Name,
+                                        const cvm::BasicValue &Dim);
+  /// \brief Declare the array in \p Slot of \p E, of \p Rank dimensions.
+  static void declareArray(Env &E, unsigned Slot, cvm::BasicType Type,
+                           const int *Dims, size_t Rank) {
+    E.declare(Slot, cvm::BasicValue(Type, std::list<int>(Dims, Dims + Rank)));
+  }
+  /// \brief Return the initializer of a variable converted to its type,
+  /// which isn't checked if it's \p Checked statically.
+  static cvm::BasicValue initialize(Atom Name, cvm::BasicType Type,
+                                    cvm::BasicValue Init, bool Checked) {
+    if (!Checked && Init.Type != Type) {
+      if (Type != cvm::DoubleType || !Init.isInt())
+        badInitializer(Name, Type, Init);
+      Init.promoteToDouble();
+    }
+    return Init;
+  }
+  [[noreturn]] static void badInitializer(Atom Name, cvm::BasicType Type,
+                                          const cvm::BasicValue &Init);
+
+  /// \brief Check an argument against the type of its parameter, unless
+  /// it's checked statically, converting an int to double.
+  static void passArgument(cvm::BasicValue &Arg, cvm::BasicType ParamType,
+                           Atom Function, Atom Param) {
+    if (Arg.Type == ParamType)
+      return;
+    if (Arg.isInt() && ParamType == cvm::DoubleType) {
+      Arg.promoteToDouble();
+      return;
+    }
+    badArgument(Arg, ParamType, Function, Param);
+  }
+  [[noreturn]] static void badArgument(const cvm::BasicValue &Arg,
+                                       cvm::BasicType ParamType,
+                                       Atom Function, Atom Param);
+  [[noreturn]] static void badArgumentCount(Atom Function, size_t Params,
+                                            size_t Args);
+  static void checkReturnValue(const cvm::BasicValue &Value,
+                               cvm::BasicType Type, Atom Function) {
+    if (Value.Type != Type)
+      badReturnValue(Value, Type, Function);
+  }
+  [[noreturn]] static void badReturnValue(const cvm::BasicValue &Value,
+                                          cvm::BasicType Type,
+                                          Atom Function);
+
+  /// \brief Return the arguments of main(), the strings of \p Argv.
+  static cvm::BasicValue makeArguments(int Argc, char *Argv[]);
+  /// \brief Return the exit code returned by the top level code.
+  static int exitCode(const cvm::BasicValue &Value);
+};
+}
+
+#endif // !CMMRUNTIME_H
@@ -0,0 +1,165 @@
+#ifndef CMMTRANSPILER_H
+#define CMMTRANSPILER_H
+
+#include "AST.h"
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cmm {
+/// \brief Translate the AST built by CMMParser into a C++ translation unit,
+/// which is linked against CMMRuntime to run the program ahead of time.
+///
+/// Each function and infix operator becomes a C++ function, and statements
+/// become the C++ statements that do what the interpreter does for them,
+/// with scopes, dynamic binding, tail calls, checks and error messages all
+/// as the interpreter has them. Expressions are evaluated into temporaries
+/// in the order the interpreter evaluates them.
+///
+/// Values are held in cvm::BasicValue, except where CMMTypeChecker proves
+/// their types: variables proven int, double or bool are read straight from
+/// their slots, and operators on such values are C++ operators on ints,
+/// doubles and bools, whose temporaries the C++ compiler keeps in
+/// registers. A variable may still be an alias of an array of its type, and
+/// is read as a whole where that matters, i.e. where it's not an operand.
+///
+/// It must run after CMMInliner, on the AST the interpreter would run.
+class CMMTranspiler {
+private:  /* private data types */
+  /// How the value of an expression is held in C++.
+  enum RepKind { IntRep, DoubleRep, BoolRep, ValueRep };
+
+  struct Operand {
+    RepKind Rep;
+    /// A C++ expression without side effects, a temporary or a literal.
+    std::string Code;
+  };
+
+  /// A reference to a variable, cvm::BasicValue &, or to an element or a
+  /// sub-array of an array, cvm::ValueRef.
+  struct Lvalue {
+    std::string Code;
+    bool Variable;
+  };
+
+  /// Labels of a loop, B<Label> after it and C<Label> after its body.
+  struct LoopContext {
+    unsigned Label;
+    bool Broken;
+    bool Continued;
+  };
+
+  /// What a body being translated belongs to.
+  enum BodyKind { TopLevelBody, FunctionBody, InfixOpBody };
+
+private:  /*  private member variables  */
+  SourceMgr &SrcMgr;
+  const BlockAST &TopLevelBlock;
+  const std::map<std::string, FunctionDefinitionAST> &UserFunctionMap;
+  const std::map<std::string, InfixOpDefinitionAST> &InfixOpMap;
+  size_t MaxStack;
+
+  /// Tables of the program, initialized when it starts.
+  std::unordered_map<Atom, unsigned> AtomIndex;
+  std::vector<Atom> Atoms;
+  std::map<const SlotNameList *, unsigned> ScopeIndex;
+  std::vector<const SlotNameList *> Scopes;
+  std::map<std::string, unsigned> StringIndex;
+  std::vector<std::string> Strings;
+  std::map<std::string, unsigned> NativeIndex;
+  std::vector<std::string> Natives;
+  std::map<const FunctionDefinitionAST *, unsigned> FunctionIndex;
+  std::map<const InfixOpDefinitionAST *, unsigned> InfixOpIndex;
+
+  /// State of the body being translated.
+  std::string Out;
+  unsigned Indent;
+  unsigned Temps;
+  unsigned Labels;
+  BodyKind Body;
+  const FunctionDefinitionAST *Function;
+  /// C++ names of the scopes, the innermost last.
+  std::vector<std::string> EnvStack;
+  std::vector<LoopContext> LoopStack;
+  /// Labels and variables of a function used by the body.
+  bool UsesEntry, UsesDone, UsesReturn, UsesReturned;
+
+public:   /* public member functions */
+  CMMTranspiler(SourceMgr &SrcMgr, const BlockAST &Block,
+                const std::map<std::string, FunctionDefinitionAST> &F,
+                const std::map<std::string, InfixOpDefinitionAST> &I,
+                size_t MaxStack)
+      : SrcMgr(SrcMgr), TopLevelBlock(Block), UserFunctionMap(F)
+      , InfixOpMap(I), MaxStack(MaxStack), Indent(0), Temps(0), Labels(0)
+      , Body(TopLevelBody), Function(nullptr), UsesEntry(false)
+      , UsesDone(false), UsesReturn(false), UsesReturned(false) {}
+
+  /// \brief Write the translation unit of the program to \p OS.
+  void transpile(std::ostream &OS, const std::string &SourcePath);
+
+private:  /* private member functions */
+  void line(const std::string &Code);
+  void label(const std::string &Name);
+  void open(const std::string &Code = "{");
+  void close(const std::string &Code = "}");
+  std::string newTemp();
+  unsigned newLabel() { return Labels++; }
+  const std::string &env() const { return EnvStack.back(); }
+  unsigned getLine(SourceMgr::LocTy Loc) const;
+
+  std::string addAtom(Atom Name);
+  std::string addScope(const SlotNameList &Slots);
+  std::string addString(const std::string &S);
+  std::string addNative(const std::string &Name);
+
+  std::string translateFunction(const FunctionDefinitionAST &Function);
+  std::string translateInfixOp(const InfixOpDefinitionAST &InfixOp);
+  std::string translateTopLevel();
+  void beginBody(BodyKind Kind);
+
+  void translateStatement(const StatementAST *Stmt, bool Tail = false);
+  void translateBlock(const BlockAST *Block, bool Tail);
+  void translateIfStatement(const IfStatementAST *IfStmt, bool Tail);
+  void translateLoop(const ExpressionAST *Init,
+                     const ExpressionAST *Condition,
+                     const ExpressionAST *Post, const StatementAST *Body);
+  void translateLoopExit(bool IsBreak);
+  void translateExprStatement(const ExprStatementAST *ExprStmt, bool Tail);
+  void translateDiscarded(const ExpressionAST *Expr);
+  void translateReturnStatement(const ReturnStatementAST *RetStmt);
+  void translateTailCall(const FunctionCallAST *FuncCall, bool Returned);
+  void translateDeclaration(const DeclarationAST *Decl);
+  std::string translateCondition(const ExpressionAST *Cond);
+
+  static cvm::BasicType getScalarType(const ExpressionAST *Expr);
+  Operand translateExpression(const ExpressionAST *Expr,
+                              bool Scalar = false);
+  Lvalue translateLvalue(const ExpressionAST *Expr);
+  std::string translateIdentifier(const IdentifierAST *IdExpr);
+  Operand translateBinaryOp(const BinaryOperatorAST *Expr);
+  Operand translateUnaryOp(const UnaryOperatorAST *Expr, bool Scalar);
+  Operand translateLogicalOp(const BinaryOperatorAST *Expr);
+  Operand translateAssignment(const BinaryOperatorAST *Expr, bool Scalar,
+                              bool Discarded = false);
+  Lvalue translateStore(const BinaryOperatorAST *Expr, Operand &Stored);
+  Lvalue translateIndex(const BinaryOperatorAST *Expr);
+  Operand translateFunctionCall(const FunctionCallAST *FuncCall);
+  std::string translateArguments(const FunctionCallAST *FuncCall);
+  void checkArguments(const FunctionDefinitionAST &Callee,
+                      const std::string &Args);
+  Operand translateInfixOp(const InfixOpExprAST *Expr);
+
+  Operand makeTemp(RepKind Rep, const std::string &Code);
+  static Operand narrow(const Operand &Value, const ExpressionAST *Expr,
+                        bool Scalar);
+  static std::string as(const Operand &Op, RepKind Rep);
+  static std::string asBool(const Operand &Op);
+  static const char *getRepType(RepKind Rep);
+  static RepKind getRep(cvm::BasicType Type);
+  static const char *getPayload(cvm::BasicType Type);
+};
+}
+
+#endif // !CMMTRANSPILER_H
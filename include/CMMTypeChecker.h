@@ -0,0 +1,79 @@
+#ifndef CMMTYPECHECKER_H
+#define CMMTYPECHECKER_H
+
+#include "AST.h"
+#include "NativeFunctions.h"
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace cmm {
+/// \brief Infer the static types of expressions and report type errors before
+/// the program runs.
+///
+/// A variable's type is known where its identifier is bound to a slot which
+/// has been declared unconditionally before, i.e. by a declaration that is a
+/// statement of the block itself rather than the branch of an if statement
+/// or the body of a loop. Variables searched by name, top level variables
+/// seen from functions (which may be dynamic bound) and the operands of
+/// infix operators are of unknown types, as are the results of user-defined
+/// functions and infix operators.
+///
+/// An expression whose operands are of known types that always fails the
+/// type check the interpreter does is an error. Nodes proven to pass their
+/// checks are marked, so that the interpreter skips them, and binary
+/// operators of int or double operands are quickened in advance.
+///
+/// It must run after CMMResolver, which binds identifiers and links calls.
+class CMMTypeChecker {
+private:  /* private data types */
+  /// Types of the variables in the slots of a scope.
+  typedef std::vector<StaticType> ScopeTypes;
+
+private:  /*  private member variables  */
+  SourceMgr &SrcMgr;
+  const BlockAST &TopLevelBlock;
+  const std::map<std::string, FunctionDefinitionAST> &UserFunctionMap;
+  const std::map<std::string, InfixOpDefinitionAST> &InfixOpMap;
+  std::map<std::string, cvm::NativeFunctionInfo> NativeFunctionMap;
+
+  std::vector<ScopeTypes> ScopeStack;
+  /// The function being checked, null at top level and in infix operators.
+  const FunctionDefinitionAST *CurrentFunction;
+  /// Errors are reported in the order of their locations.
+  std::vector<std::pair<SourceMgr::LocTy, std::string>> Errors;
+
+public:   /* public member functions */
+  CMMTypeChecker(SourceMgr &SrcMgr, const BlockAST &Block,
+                 const std::map<std::string, FunctionDefinitionAST> &F,
+                 const std::map<std::string, InfixOpDefinitionAST> &I)
+      : SrcMgr(SrcMgr), TopLevelBlock(Block), UserFunctionMap(F)
+      , InfixOpMap(I), CurrentFunction(nullptr) {
+    cvm::addNativeFunctions(NativeFunctionMap);
+  }
+
+  /// \brief Check the program, return true on error.
+  bool check();
+
+private:  /* private member functions */
+  void error(SourceMgr::LocTy Loc, const std::string &Msg);
+
+  void checkFunction(const FunctionDefinitionAST &Function);
+  void checkInfixOp(const InfixOpDefinitionAST &InfixOp);
+
+  void checkStatement(const StatementAST *Stmt, bool Unconditional);
+  void checkBlock(const BlockAST *Block);
+  void checkReturn(const ReturnStatementAST *RetStmt);
+  void checkDeclaration(const DeclarationAST *Decl, bool Unconditional);
+
+  StaticType checkExpression(const ExpressionAST *Expr);
+  StaticType checkIdentifier(const IdentifierAST *IdExpr);
+  StaticType checkFunctionCall(const FunctionCallAST *FuncCall);
+  StaticType checkUnaryOperator(const UnaryOperatorAST *Expr);
+  StaticType checkBinaryOperator(const BinaryOperatorAST *Expr);
+  StaticType checkAssignment(const BinaryOperatorAST *Expr);
+  StaticType checkIndex(const BinaryOperatorAST *Expr);
+};
+}
+
+#endif // !CMMTYPECHECKER_H
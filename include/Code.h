@@ -0,0 +1,151 @@
+#ifndef CODE_H
+#define CODE_H
+
+#include "AST.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cvm {
+
+/// Instruction set of the CMM virtual machine.
+///
+/// The machine has an operand stack of values, a stack of references
+/// (lvalues) used by assignment and indexing, and a result register per
+/// frame that holds the value of the last executed statement, which is the
+/// default return value of a function.
+enum OpCode : uint8_t {
+  Nop,
+  PushConst,      // push Constants[A]
+  Pop,            // discard the top of operand stack
+  PopResult,      // pop the top of operand stack into the result register
+  ClearResult,    // set the result register to void
+
+  LoadLocal,      // push the variable in slot A of the scope Aux levels out
+  AddrLocal,      // push a reference to it
+  LoadGlobal,     // push the top level variable in slot A, which is Aux
+                  // levels out unless the function is dynamic bound
+  AddrGlobal,     // push a reference to it
+  LoadVar,        // push the value of variable Names[A], searched by name
+  AddrVar,        // push a reference to it
+  AddrIndex,      // pop an index, replace the top reference by its element
+  LoadRef,        // pop a reference, push the value it refers to
+  StoreRef,       // pop a value and a reference, assign, push the value;
+                  // if Aux != 0, push the reference back instead
+
+  DeclareVar,     // declare slot A, Aux = type | DeclHasInit | DeclNoCheck
+  DeclareArray,   // pop Aux >> 8 dimensions, declare array in slot A of
+                  // type Aux & DeclTypeMask
+  EnterScope,     // open a new variable scope with slots Scopes[A]
+  LeaveScope,     // close Aux variable scopes
+  ClearSlots,     // clear Aux slots from slot A of a hoisted block
+
+  Jump,           // PC = A
+  JumpIfFalse,    // pop, PC = A if the value is false
+  JumpIfTrue,     // pop, PC = A if the value is true
+  ToBool,         // convert the top of operand stack to bool
+
+  Add, Sub, Mul, Div, Mod,
+  Less, LessEqual, Equal, NotEqual, Greater, GreaterEqual,
+  BitAnd, BitOr, BitXor, Shl, Shr,
+  Pos, Neg, Not, BitNot,
+
+  Call,           // call Functions[A] with Aux arguments (lexical binding)
+  CallDynamic,    // call Functions[A] with Aux arguments (dynamic binding)
+  CallNative,     // call Natives[A] with Aux arguments
+  CallInfix,      // call Functions[A] with the two topmost values
+  TailCall,       // call Functions[A], the function itself, with
+                  // Aux & TailArgCountMask arguments in place of the frame
+  Return,         // return the result register (explicit `return')
+  ReturnDefault,  // return the result register (end of function body)
+  Error           // raise a runtime error with message Constants[A]
+};
+
+/// Flags packed with the type into Aux of DeclareVar.
+enum : uint16_t {
+  DeclTypeMask = 0xff,
+  DeclHasInit = 0x100,  // initializer value is on the operand stack
+  DeclNoCheck = 0x200   // don't complain if the slot is already declared,
+                        // and keep its value
+};
+
+/// Flags packed with the argument count into Aux of TailCall.
+enum : uint16_t {
+  TailArgCountMask = 0x7fff,
+  TailReturned = 0x8000 // returned by a return statement, the value
+                        // eventually returned is checked
+};
+
+struct Instruction {
+  OpCode Op;
+  uint16_t Aux;
+  int32_t A;
+
+  Instruction(OpCode Op, int32_t A = 0, uint16_t Aux = 0)
+      : Op(Op), Aux(Aux), A(A) {}
+};
+
+class CodeObject {
+public:
+  enum CodeKind { TopLevelCode, FunctionCode, InfixOpCode };
+
+  CodeKind Kind;
+  std::string Name;
+  BasicType ReturnType;
+  /// Name index and type of each parameter. A name index of -1 means the
+  /// parameter has no name.
+  std::vector<std::pair<int32_t, BasicType>> Parameters;
+  /// Index of the scope for parameters (or top level variables) in
+  /// Program::Scopes. Parameters take the first slots.
+  int32_t Scope = -1;
+  std::vector<Instruction> Code;
+  /// Source line of each instruction, 0 if it's unknown. Only calls have
+  /// theirs for now.
+  std::vector<uint32_t> Lines;
+  /// Instructions and lines of a code object loaded from a .cmmc file, which
+  /// are run in place, instead of Code and Lines.
+  const Instruction *MappedCode = nullptr;
+  const uint32_t *MappedLines = nullptr;
+  size_t MappedSize = 0;
+
+public:
+  CodeObject(CodeKind Kind, const std::string &Name,
+             BasicType ReturnType = VoidType)
+      : Kind(Kind), Name(Name), ReturnType(ReturnType) {}
+
+  bool isTopLevel() const { return Kind == TopLevelCode; }
+  bool isInfixOp() const { return Kind == InfixOpCode; }
+
+  const Instruction *getCode() const {
+    return MappedCode ? MappedCode : Code.data();
+  }
+  size_t getCodeSize() const { return MappedCode ? MappedSize : Code.size(); }
+  uint32_t getLine(size_t At) const {
+    return MappedCode ? MappedLines[At] : Lines[At];
+  }
+};
+
+/// A compiled CMM program. Functions[0] is always the top level code.
+class Program {
+public:
+  std::vector<BasicValue> Constants;
+  std::vector<std::string> Names;
+  /// Name index of each slot of a scope.
+  std::vector<std::vector<int32_t>> Scopes;
+  std::vector<CodeObject> Functions;
+  std::vector<NativeFunction> Natives;
+  std::vector<std::string> NativeNames;
+  int32_t MainIndex = -1;
+  /// The .cmmc file the program is loaded from, if it's to be kept in
+  /// memory as long as the program.
+  std::shared_ptr<const void> Image;
+
+public:
+  void dump() const;
+  void dump(const CodeObject &Code) const;
+};
+
+}
+
+#endif // !CODE_H
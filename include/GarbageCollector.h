@@ -0,0 +1,66 @@
+#ifndef GARBAGECOLLECTOR_H
+#define GARBAGECOLLECTOR_H
+
+#include "AST.h"
+#include <ostream>
+
+namespace cvm {
+/// \brief Backup collector for reference cycles among arrays.
+///
+/// Arrays are still freed by reference counting as soon as they become
+/// unreachable. Those referencing each other in a cycle never get there, so
+/// all arrays are tracked, and when the number of tracked arrays doubles the
+/// collector runs trial deletion: references from array storages are
+/// subtracted from their reference counts, arrays left with a positive count
+/// are referenced from outside (variables, temporaries) and anything
+/// reachable from them is alive. The rest are cycles of garbage.
+///
+/// A storage is shared by an array and its sub-arrays and is alive as long
+/// as any of them is, so it's scanned once, not once per array.
+///
+/// Trial deletion needs no knowledge of roots, so it's safe to run at any
+/// time by both engines. Tracked arrays are kept in an intrusive list, so
+/// tracking costs no allocation.
+class GarbageCollector {
+public:  /* public data types */
+  struct Statistics {
+    size_t Allocated = 0;
+    size_t Collections = 0;
+    size_t Reclaimed = 0;
+    double Seconds = 0.0;
+  };
+
+private:  /*  private member variables  */
+  static const size_t InitialThreshold = 1024;
+
+  /// Sentinel of the list of tracked arrays.
+  ArrayObject Tracked;
+  size_t TrackedCount = 0;
+  size_t Threshold = InitialThreshold;
+  bool Collecting = false;
+  Statistics Stats;
+
+public:   /* public member functions */
+  static GarbageCollector &get();
+
+  /// \brief Allocate an array viewing the storage, tracked by the collector.
+  /// The caller should take a reference to it before allocating another one.
+  ArrayObject *newArray(ArrayStorage *Storage, size_t Offset, unsigned Level);
+
+  /// \brief Untrack and delete an array, called when it's no longer
+  /// referenced.
+  void freeArray(ArrayObject *Array);
+
+  /// \brief Reclaim unreachable cycles now, return how many arrays are freed.
+  size_t collect();
+
+  size_t getTrackedCount() const { return TrackedCount; }
+  const Statistics &getStatistics() const { return Stats; }
+  void dumpStatistics(std::ostream &OS) const;
+
+private:  /* private member functions */
+  GarbageCollector() { Tracked.Prev = Tracked.Next = &Tracked; }
+};
+}
+
+#endif // !GARBAGECOLLECTOR_H
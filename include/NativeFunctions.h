@@ -2,61 +2,180 @@
 #define NATIVEFUNCTIONS_H
 
 #include "CMMParser.h"
+#include "Code.h"
+#include <map>
+#include <type_traits>
+#include <utility>
 
 namespace cvm {
-#define ADD_FUNCTION(FUNC) BasicValue FUNC(std::list<BasicValue> &Args)
+/// \brief A built-in function and its signature.
+struct NativeFunctionInfo {
+  NativeFunction Function;
+  /// Number of parameters, -1 if it takes any number of arguments.
+  int Arity;
+  /// Types of the parameters, VoidType for any type. Null if it takes any
+  /// number of arguments.
+  const BasicType *ParamTypes;
+  BasicType ReturnType;
+};
+
+/// \brief Register all built-in functions by their names in CMM.
+void addNativeFunctions(
+    std::map<std::string, NativeFunctionInfo> &FunctionMap);
+
+/// \brief How values of a C++ type are passed to and returned by natives.
+/// Arguments are converted as BasicValue::toInt() etc. do.
+template <typename T> struct NativeType;
+
+template <> struct NativeType<int> {
+  static const BasicType Type = IntType;
+  static int fromValue(const BasicValue &V) { return V.toInt(); }
+};
+
+template <> struct NativeType<double> {
+  static const BasicType Type = DoubleType;
+  static double fromValue(const BasicValue &V) { return V.toDouble(); }
+};
+
+template <> struct NativeType<bool> {
+  static const BasicType Type = BoolType;
+  static bool fromValue(const BasicValue &V) { return V.toBool(); }
+};
+
+template <> struct NativeType<std::string> {
+  static const BasicType Type = StringType;
+  static std::string fromValue(const BasicValue &V) { return V.toString(); }
+};
+
+/// Values of any type are passed as they are.
+template <> struct NativeType<BasicValue> {
+  static const BasicType Type = VoidType;
+  static const BasicValue &fromValue(const BasicValue &V) { return V; }
+};
+
+template <> struct NativeType<void> {
+  static const BasicType Type = VoidType;
+};
+
+namespace detail {
+template <size_t... Is> struct IndexSequence {};
+
+template <size_t N, size_t... Is>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, Is...> {};
+
+template <size_t... Is>
+struct MakeIndexSequence<0, Is...> : IndexSequence<Is...> {};
+
+template <typename R> struct Invoke {
+  template <typename F, typename... As>
+  static BasicValue call(F Function, As &&...Args) {
+    return BasicValue(Function(std::forward<As>(Args)...));
+  }
+};
+
+template <> struct Invoke<void> {
+  template <typename F, typename... As>
+  static BasicValue call(F Function, As &&...Args) {
+    Function(std::forward<As>(Args)...);
+    return BasicValue();
+  }
+};
+}
+
+/// \brief Generate a native function calling a C++ function, which converts
+/// arguments to its parameter types and its result to a value.
+template <typename F, F Function> struct NativeBinder;
+
+template <typename R, typename... Ps, R (*Function)(Ps...)>
+struct NativeBinder<R (*)(Ps...), Function> {
+  static BasicValue call(ValueSpan Args) {
+    return call(Args, detail::MakeIndexSequence<sizeof...(Ps)>());
+  }
+
+  template <size_t... Is>
+  static BasicValue call(ValueSpan Args, detail::IndexSequence<Is...>) {
+    (void)Args; // Unused if there is no parameter.
+    return detail::Invoke<R>::call(Function,
+        NativeType<typename std::decay<Ps>::type>::fromValue(Args[Is])...);
+  }
+
+  static NativeFunctionInfo getInfo() {
+    // One more element, as an array can't be empty.
+    static const BasicType ParamTypes[] = {
+      NativeType<typename std::decay<Ps>::type>::Type..., VoidType
+    };
+    return {call, static_cast<int>(sizeof...(Ps)), ParamTypes,
+            NativeType<R>::Type};
+  }
+};
+
+/// \brief Bind a C++ function of int, double, bool, std::string and
+/// BasicValue parameters as a native function of fixed arity.
+#define BIND_NATIVE(FUNC) \
+  ::cvm::NativeBinder<decltype(&FUNC), &FUNC>::getInfo()
+
+/// \brief Register a native function taking any number of arguments.
+inline NativeFunctionInfo variadicNative(NativeFunction Function,
+                                         BasicType ReturnType) {
+  return {Function, -1, nullptr, ReturnType};
+}
+
+#define ADD_FUNCTION(FUNC) BasicValue FUNC(ValueSpan Args)
 
 namespace Native {
 ADD_FUNCTION(TypeOf);
 ADD_FUNCTION(Length);
-ADD_FUNCTION(StrLength);
 ADD_FUNCTION(Random);
 ADD_FUNCTION(Srand);
 ADD_FUNCTION(Print);
 ADD_FUNCTION(PrintLn);
 ADD_FUNCTION(System);
-ADD_FUNCTION(Time);
 ADD_FUNCTION(Exit);
+ADD_FUNCTION(Time);
+
+int StrLength(const BasicValue &S);
+void Flush();
+int GC();
 
-ADD_FUNCTION(ToInt);
-ADD_FUNCTION(ToBool);
-ADD_FUNCTION(ToString);
-ADD_FUNCTION(ToDouble);
+int ToInt(const BasicValue &V);
+bool ToBool(const BasicValue &V);
+std::string ToString(const BasicValue &V);
+double ToDouble(const BasicValue &V);
 
-ADD_FUNCTION(Read);
-ADD_FUNCTION(ReadLn);
-ADD_FUNCTION(ReadInt);
+std::string Read();
+std::string ReadLn();
+int ReadInt();
 
-ADD_FUNCTION(Sqrt);
-ADD_FUNCTION(Pow);
-ADD_FUNCTION(Exp);
-ADD_FUNCTION(Log);
-ADD_FUNCTION(Log10);
+double Sqrt(double X);
+double Pow(double X, double Y);
+double Exp(double X);
+double Log(double X);
+double Log10(double X);
 }
 
 #if defined(__APPLE__) || defined(__linux__)
 namespace Ncurses {
-ADD_FUNCTION(InitScreen);
-ADD_FUNCTION(GetMaxY);
-ADD_FUNCTION(GetMaxX);
-ADD_FUNCTION(EndWindow);
-ADD_FUNCTION(NoEcho);
-ADD_FUNCTION(CursSet);
-ADD_FUNCTION(Keypad);
-ADD_FUNCTION(Timeout);
-ADD_FUNCTION(GetChar);
-ADD_FUNCTION(MoveAddChar);
-ADD_FUNCTION(MoveAddString);
+void InitScreen();
+int GetMaxY();
+int GetMaxX();
+int EndWindow();
+int NoEcho();
+int CursSet(bool Visible);
+int Keypad(bool Enable);
+void Timeout(int Delay);
+int GetChar();
+int MoveAddChar(int Y, int X, int C);
+int MoveAddString(int Y, int X, const std::string &S);
 ADD_FUNCTION(MessageBox);
-ADD_FUNCTION(StartColor);
-ADD_FUNCTION(InitPair);
-ADD_FUNCTION(AttrOn);
-ADD_FUNCTION(AttrOff);
-ADD_FUNCTION(ColorPair);
+int StartColor();
+int InitPair(int PairNo, int FgColor, int BgColor);
+int AttrOn(int Attrs);
+int AttrOff(int Attrs);
+int ColorPair(int PairNo);
 }
 
 namespace Unix {
-ADD_FUNCTION(Fork);
+int Fork();
 }
 #endif // defined(__APPLE__) || defined(__linux__)
 
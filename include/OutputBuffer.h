@@ -0,0 +1,68 @@
+#ifndef OUTPUTBUFFER_H
+#define OUTPUTBUFFER_H
+
+#include "AST.h"
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace cvm {
+/// \brief Buffer of the standard output written by CMM programs.
+///
+/// print() and println() format values straight into the buffer, which is
+/// written out when it's full, before reading input or handing the terminal
+/// to someone else (system(), fork(), ncurses), and on exit. Writes larger
+/// than the buffer go through directly. If the standard output is a
+/// terminal, it's also flushed at the end of each line.
+class OutputBuffer {
+private:  /*  private member variables  */
+  static const size_t Capacity = 64 * 1024;
+
+  char Buffer[Capacity];
+  size_t Size = 0;
+  bool LineBuffered = false;
+
+public:   /* public member functions */
+  static OutputBuffer &get();
+
+  void write(const char *Data, size_t Length) {
+    if (Length > Capacity - Size) {
+      writeSlow(Data, Length);
+      return;
+    }
+    std::memcpy(Buffer + Size, Data, Length);
+    Size += Length;
+  }
+  void write(const std::string &S) { write(S.data(), S.size()); }
+  void write(char C) {
+    if (Size == Capacity)
+      flush();
+    Buffer[Size++] = C;
+  }
+  void write(int I);
+  void write(double D);
+
+  /// \brief Write a value as BasicValue::toString() would.
+  void write(const BasicValue &V) { write(V, nullptr); }
+
+  /// \brief End a line, flushing it if the output is line buffered.
+  void writeLine() {
+    write('\n');
+    if (LineBuffered)
+      flush();
+  }
+
+  void flush();
+
+private:  /* private member functions */
+  OutputBuffer();
+
+  void writeSlow(const char *Data, size_t Length);
+  void write(const BasicValue &V, const ArrayObject *Outermost);
+};
+
+/// \brief Flush the output of CMM programs.
+inline void flushOutput() { OutputBuffer::get().flush(); }
+}
+
+#endif // !OUTPUTBUFFER_H
@@ -0,0 +1,62 @@
+#ifndef PROGRAMFILE_H
+#define PROGRAMFILE_H
+
+#include "Code.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace cvm {
+/// \brief Saving and loading a compiled Program as a .cmmc file, so that a
+/// script run again needn't be lexed, parsed and compiled again.
+///
+/// The file is an image of the program with no pointers in it: a header,
+/// tables of fixed-size records and the instructions, source lines, names
+/// and strings they refer to by offsets from the start of the file. It's
+/// mapped into memory, and the instructions and lines of code objects are
+/// run in place. Only constants, names and tables are built from it, and
+/// native functions are looked up by name.
+///
+/// The header records the hash and size of the source compiled, so that a
+/// cached program is only used for the very source it was compiled from. A
+/// file written for another format, instruction set or set of native
+/// functions, or for a machine of other byte order, is refused. So is a
+/// file that doesn't match its checksum, or whose tables or instruction
+/// operands refer past what it holds.
+class ProgramFile {
+public:   /* public member functions */
+  /// \brief Hash the content of a source file.
+  static uint64_t hashSource(const char *Data, size_t Size);
+
+  /// \brief Return true if \p Data starts like a .cmmc file.
+  static bool isProgramFile(const char *Data, size_t Size);
+
+  /// \brief Write \p Prog compiled from a source of \p SourceHash and
+  /// \p SourceSize to \p Path. The file is written under another name and
+  /// renamed, so that it's never seen half written.
+  static bool write(const Program &Prog, uint64_t SourceHash,
+                    uint64_t SourceSize, const std::string &Path);
+
+  /// \brief Load the program in \p Data, null if it's not a valid .cmmc
+  /// file. \p SourceHash and \p SourceSize are set to those recorded. The
+  /// program refers into \p Data, which must outlive it.
+  static std::unique_ptr<Program> read(const char *Data, size_t Size,
+                                       uint64_t &SourceHash,
+                                       uint64_t &SourceSize);
+
+  /// \brief Return where the program compiled from a source of
+  /// \p SourceHash is cached, creating the cache directory if needed. It's
+  /// $CMM_CACHE_DIR, $XDG_CACHE_HOME/cmm or ~/.cache/cmm. Return an empty
+  /// string if there is none, or $CMM_CACHE_DIR is set empty.
+  static std::string getCachePath(uint64_t SourceHash);
+
+  /// \brief Map the file at \p Path and load the program in it, null if
+  /// there is none or it's not compiled from a source of \p SourceHash and
+  /// \p SourceSize.
+  static std::unique_ptr<Program> load(const std::string &Path,
+                                       uint64_t SourceHash,
+                                       uint64_t SourceSize);
+};
+}
+
+#endif // !PROGRAMFILE_H
@@ -0,0 +1,80 @@
+#ifndef SLOTSTACK_H
+#define SLOTSTACK_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace cvm {
+/// \brief Stack of variable slots, scopes take their slots from it on
+/// entry and give them back on exit.
+///
+/// It grows by chunks which are kept once allocated, so entering a scope
+/// allocates no memory in the steady state, and slots never move while
+/// references to them are held.
+template <typename SlotTy>
+class SlotStack {
+public:   /* public data types */
+  /// The top of the stack before an allocation.
+  struct Mark {
+    size_t Chunk;
+    size_t Top;
+  };
+
+private:  /* private data types */
+  struct Chunk {
+    std::unique_ptr<SlotTy[]> Slots;
+    size_t Size = 0;
+  };
+
+private:  /*  private member variables  */
+  static const size_t ChunkSize = 4096;
+
+  std::vector<Chunk> Chunks;
+  size_t Current = 0;
+  size_t Top = 0;
+
+public:   /* public member functions */
+  SlotTy *allocate(size_t N, Mark &M) {
+    M = {Current, Top};
+    if (Current < Chunks.size() && N <= Chunks[Current].Size - Top) {
+      SlotTy *Slots = Chunks[Current].Slots.get() + Top;
+      Top += N;
+      return Slots;
+    }
+    return allocateSlow(N);
+  }
+
+  /// \brief Clear the slots of the last allocation and pop them.
+  void release(SlotTy *Slots, size_t N, const Mark &M) {
+    for (size_t I = 0; I < N; ++I)
+      Slots[I] = SlotTy();
+    Current = M.Chunk;
+    Top = M.Top;
+  }
+
+private:  /* private member functions */
+  SlotTy *allocateSlow(size_t N) {
+    // Slots above the top are unused, so a chunk too small can be replaced.
+    // A chunk always has slots, even if none are asked for, so that later
+    // allocations from it point into memory.
+    size_t Next = Chunks.empty() ? 0 : Current + 1;
+    if (Next == Chunks.size())
+      Chunks.emplace_back();
+    Chunk &C = Chunks[Next];
+    if (!C.Slots || C.Size < N) {
+      C.Size = std::max(N, ChunkSize);
+      C.Slots.reset(new SlotTy[C.Size]);
+    }
+    Current = Next;
+    Top = N;
+    return C.Slots.get();
+  }
+};
+
+template <typename SlotTy>
+const size_t SlotStack<SlotTy>::ChunkSize;
+}
+
+#endif // !SLOTSTACK_H
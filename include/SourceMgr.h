@@ -8,7 +8,6 @@
 #ifndef SOURCEMGR_H
 #define SOURCEMGR_H
 
-#include <fstream>
 #include <string>
 #include <vector>
 #include <tuple>
@@ -23,22 +22,37 @@ public:
   using ErrorTy = std::tuple<LocTy, ErrorKind, std::string>;
 
 private:
-  static const size_t ReservedLineNo = 120;
-  std::ifstream SourceStream;
-  std::vector<LocTy> LineNoOffsets;
+  /// The file is mapped into memory if possible, otherwise read into Buffer.
+  const char *Content = nullptr;
+  size_t ContentSize = 0;
+  bool Mapped = false;
+  std::string Buffer;
+
+  /// Offsets of the newline before each line (0 for the first line),
+  /// computed when first needed.
+  mutable std::vector<LocTy> LineNoOffsets;
   std::vector<ErrorTy> ErrorList;
-  std::string SourceContent;
+  /// Number of errors and warnings reported.
+  unsigned DiagnosticCount = 0;
   LocTy CurrentLoc;
   bool DumpInstantly : 1;
 
   void dumpError(LocTy L, ErrorKind K, const std::string &Msg) const;
+  bool mapFile(const std::string &SourcePath);
+  bool readFile(const std::string &SourcePath);
+  void computeLineNoOffsets() const;
 
 public:
   SourceMgr(const std::string &SourcePath,
                 bool DumpInstantly = true);
+  ~SourceMgr();
+  SourceMgr(const SourceMgr &) = delete;
+  SourceMgr &operator=(const SourceMgr &) = delete;
+
+  const char *getBuffer() const { return Content; }
+  size_t getBufferSize() const { return ContentSize; }
 
   /// Functions that simulate member functions of std::fstream
-  bool fail() const { return SourceStream.fail(); };
   int get();
   int peek();
   void unget();
@@ -49,6 +63,7 @@ public:
   void Error(const std::string &Msg);
   void Warning(LocTy L, const std::string &Msg);
   void Warning(const std::string &Msg);
+  unsigned getDiagnosticCount() const { return DiagnosticCount; }
 
   std::pair<size_t, size_t> getLineColByLoc(LocTy Loc) const;
 
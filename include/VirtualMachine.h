@@ -0,0 +1,82 @@
+#ifndef VIRTUALMACHINE_H
+#define VIRTUALMACHINE_H
+
+#include "Code.h"
+#include "SlotStack.h"
+#include <deque>
+
+namespace cvm {
+/// \brief A stack based virtual machine which executes a Program compiled
+/// by cmm::CMMCompiler. It follows the semantics of cmm::CMMInterpreter.
+class VirtualMachine {
+private:  /* private data types */
+  struct Variable {
+    BasicValue Value;
+    bool Declared = false;
+  };
+
+  /// Variables of a scope, whose slots are taken from the slot stack.
+  struct VariableEnv {
+    VariableEnv *OuterEnv = nullptr;
+    const std::vector<int32_t> *Names = nullptr;
+    Variable *Vars = nullptr;
+    size_t Size = 0;
+    SlotStack<Variable>::Mark Mark;
+  };
+
+  struct Frame {
+    const CodeObject *Code;
+    const Instruction *PC;
+    VariableEnv *Env;
+    size_t ScopeBase;
+    BasicValue Result;
+    /// Set if a tail call made in the frame was returned explicitly.
+    bool Returned = false;
+
+    Frame(const CodeObject *Code, VariableEnv *Env, size_t ScopeBase)
+        : Code(Code), PC(Code->getCode()), Env(Env), ScopeBase(ScopeBase) {}
+  };
+
+private:  /*  private member variables  */
+  const Program &Prog;
+  /// Maximum depth of nested calls.
+  size_t MaxStack;
+  SlotStack<Variable> Slots;
+  VariableEnv TopLevelEnv;
+  /// Scopes entered, only the first ScopeDepth of which are in use. The
+  /// rest are kept to be entered again.
+  std::deque<VariableEnv> ScopeStack;
+  size_t ScopeDepth = 0;
+  std::vector<Frame> FrameStack;
+  std::vector<BasicValue> Stack;
+  std::vector<ValueRef> RefStack;
+  bool ExplicitReturn = false;
+
+public:   /* public member functions */
+  VirtualMachine(const Program &Prog, size_t MaxStack);
+
+  int run(int Argc, char *Argv[]);
+
+private:  /* private member functions */
+  void execute();
+  void enterFunction(const CodeObject &Function, size_t ArgCount,
+                     VariableEnv *OuterEnv);
+  void bindArguments(const CodeObject &Function, size_t ArgCount,
+                     VariableEnv *FuncEnv);
+  void tailCall(size_t ArgCount, bool Returned);
+  void leaveFunction(bool Explicit);
+
+  VariableEnv *enterScope(VariableEnv *OuterEnv, int32_t Scope);
+  void leaveScope(size_t Count);
+
+  BasicValue &localVariable(VariableEnv *Env, uint16_t Depth, int32_t Slot);
+  BasicValue &globalVariable(VariableEnv *Env, uint16_t Depth, int32_t Slot);
+  BasicValue &searchVariable(VariableEnv *Env, int32_t Name);
+  void declareVariable(VariableEnv *Env, int32_t Slot, uint16_t Flags);
+  void declareArray(VariableEnv *Env, int32_t Slot, uint16_t Flags);
+  ValueRef indexArray(const ValueRef &Base, const BasicValue &Index);
+  void assign(const ValueRef &Variable, const BasicValue &Value);
+};
+}
+
+#endif // !VIRTUALMACHINE_H
@@ -1,5 +1,5 @@
 #include "AST.h"
-#include <numeric>
+#include "GarbageCollector.h"
 #include <cmath>
 #include <limits>
 
@@ -17,12 +17,29 @@ std::string TypeToStr(BasicType Type) {
 }
 
 // Constructors and member functions of BasicValue
-BasicValue::BasicValue(BasicType T) : Type(T) {
+BasicValue::BasicValue(const std::string &S)
+    : Type(StringType), IsArray(false), StrObj(nullptr) {
+  if (!S.empty()) {
+    StrObj = new StringObject(S);
+    StrObj->RefCount = 1;
+  }
+}
+
+BasicValue::BasicValue(std::string &&S)
+    : Type(StringType), IsArray(false), StrObj(nullptr) {
+  if (!S.empty()) {
+    StrObj = new StringObject(std::move(S));
+    StrObj->RefCount = 1;
+  }
+}
+
+BasicValue::BasicValue(BasicType T) : Type(T), IsArray(false) {
   switch (Type) {
-  default: break;
+  default:              DoubleVal = 0.0;  break;
   case cvm::BoolType:   BoolVal = false;  break;
   case cvm::IntType:    IntVal = 0;       break;
   case cvm::DoubleType: DoubleVal = 0.0;  break;
+  case cvm::StringType: StrObj = nullptr; break;
   }
 }
 
@@ -35,16 +52,20 @@ BasicValue::BasicValue(BasicType T,
   if (I == E)
     return;
 
-  int N = *I++;
-  ArrayPtr = std::make_shared<std::vector<BasicValue>>();
-  ArrayPtr->reserve(N);
-  for (size_t Idx = 0; Idx < N; ++Idx)
-    ArrayPtr->emplace_back(T, I, E);
+  std::vector<size_t> Dims;
+  for (; I != E; ++I)
+    Dims.push_back(static_cast<size_t>(*I));
+
+  auto *Storage = new ArrayStorage(T, std::move(Dims));
+  IsArray = true;
+  ArrObj = GarbageCollector::get().newArray(Storage, 0, 0);
+  ArrObj->RefCount = 1;
 }
 
-BasicValue::BasicValue(BasicType T,
-                       std::shared_ptr<std::vector<BasicValue>> P)
-    : Type(T), ArrayPtr(P) {}
+BasicValue::BasicValue(BasicType T, ArrayObject *Array)
+    : Type(T), IsArray(true), ArrObj(Array) {
+  ++ArrObj->RefCount;
+}
 
 int BasicValue::toInt() const {
   switch (Type) {
@@ -52,7 +73,7 @@ int BasicValue::toInt() const {
   case IntType:     return IntVal;
   case DoubleType:  return static_cast<int>(DoubleVal);
   case BoolType:    return BoolVal;
-  case StringType:  return std::stoi(StrVal);
+  case StringType:  return std::stoi(getString());
   }
 }
 
@@ -62,7 +83,7 @@ double BasicValue::toDouble() const {
   case IntType:     return static_cast<double>(IntVal);
   case DoubleType:  return DoubleVal;
   case BoolType:    return static_cast<double>(BoolVal);
-  case StringType:  return std::stod(StrVal.c_str());
+  case StringType:  return std::stod(getString());
   }
 }
 
@@ -72,25 +93,26 @@ bool BasicValue::toBool() const {
   case IntType:     return IntVal != 0;
   case DoubleType:  return DoubleVal != 0.0;
   case BoolType:    return BoolVal;
-  case StringType:  return !StrVal.empty();
+  case StringType:  return StrObj && !StrObj->Str.empty();
   }
 }
 
-std::string BasicValue::toString(decltype(ArrayPtr) P) const {
+std::string BasicValue::toString(const ArrayObject *P) const {
   if (isArray()) {
-    if (P == ArrayPtr)
+    if (P == ArrObj)
       return "[...]";
 
     if (P == nullptr)
-      P = ArrayPtr;
-
-    return "[" +
-        std::accumulate(ArrayPtr->begin() + 1,
-                        ArrayPtr->end(),
-                        ArrayPtr->front().toString(P),
-                        [P](std::string S, BasicValue &X) {
-                          return S + ", " + X.toString(P);
-                        }) + "]";
+      P = ArrObj;
+
+    const ArrayObject &Array = getArray();
+    std::string S = "[";
+    for (size_t I = 0; I < Array.size(); ++I) {
+      if (I > 0)
+        S += ", ";
+      S += Array.get(I).toString(P);
+    }
+    return S + "]";
   }
 
   switch (Type) {
@@ -98,7 +120,7 @@ std::string BasicValue::toString(decltype(ArrayPtr) P) const {
   case IntType:     return std::to_string(IntVal);
   case DoubleType:  return std::to_string(DoubleVal);
   case BoolType:    return BoolVal ? "true" : "false";
-  case StringType:  return StrVal;
+  case StringType:  return getString();
   }
 }
 
@@ -113,7 +135,7 @@ bool BasicValue::operator<(const BasicValue &RHS) const {
   case DoubleType:
     return DoubleVal < RHS.DoubleVal;
   case StringType:
-    return StrVal < RHS.StrVal;
+    return getString() < RHS.getString();
   default:
     return false;
   }
@@ -134,7 +156,7 @@ bool BasicValue::operator==(const BasicValue &RHS) const {
   case DoubleType:
     return DoubleVal == RHS.DoubleVal;
   case StringType:
-    return StrVal == RHS.StrVal;
+    return getString() == RHS.getString();
   case VoidType:
     return true;
   default:
@@ -154,6 +176,43 @@ bool BasicValue::operator>=(const BasicValue &RHS) const {
   // L >= R  <===>  not L < R;
   return !(*this < RHS);
 }
+
+// Constructors and member functions of ArrayStorage
+ArrayStorage::ArrayStorage(BasicType T, std::vector<size_t> D)
+    : ElementType(T), Dims(std::move(D)), Strides(Dims.size()) {
+  size_t Count = 1;
+  for (size_t I = Dims.size(); I-- > 0; ) {
+    Strides[I] = Count;
+    Count *= Dims[I];
+  }
+
+  switch (T) {
+  case IntType:     Kind = IntStorage;    Ints.assign(Count, 0);        break;
+  case DoubleType:  Kind = DoubleStorage; Doubles.assign(Count, 0.0);   break;
+  case BoolType:    Kind = BoolStorage;   Bools.assign(Count, false);   break;
+  default:          Kind = BoxedStorage;  Values.assign(Count, BasicValue(T));
+  }
+}
+
+void ArrayStorage::box() {
+  if (Kind == BoxedStorage)
+    return;
+
+  size_t Count = Dims.empty() ? 0 : Dims[0] * Strides[0];
+  Values.reserve(Count);
+  for (size_t I = 0; I < Count; ++I)
+    Values.push_back(getElement(I));
+  std::vector<int>().swap(Ints);
+  std::vector<double>().swap(Doubles);
+  std::vector<char>().swap(Bools);
+  Kind = BoxedStorage;
+}
+// Member functions of ValueRef
+BasicValue ValueRef::getSubArray() const {
+  return BasicValue(Storage->ElementType,
+                    GarbageCollector::get().newArray(Storage, getOffset(),
+                                                     getLevel()));
+}
 }
 
 /******************************************************************************/
@@ -565,11 +624,11 @@ void StringAST::dump(const std::string &prefix) const {
 }
 
 void IdentifierAST::dump(const std::string &prefix) const {
-  std::cout << "(id)" << Name << "\n";
+  std::cout << "(id)" << Name.str() << "\n";
 }
 
 void InfixOpExprAST::dump(const std::string &prefix) const {
-  std::cout << getSymbol() << "\n";
+  std::cout << getSymbol().str() << "\n";
 
   std::cout << prefix << "|---";
   LHS->dump(prefix + "|   ");
@@ -646,7 +705,7 @@ void UnaryOperatorAST::dump(const std::string &prefix) const {
 }
 
 void DeclarationAST::dump(const std::string &prefix) const {
-  std::cout << cvm::TypeToStr(Type) << " " << Name << "\n";
+  std::cout << cvm::TypeToStr(Type) << " " << Name.str() << "\n";
 
   if (Initializer) {
     std::cout << prefix << " `==";
@@ -701,8 +760,8 @@ void ExprStatementAST::dump(const std::string &prefix) const {
 }
 
 void InfixOpDefinitionAST::dump() const {
-  std::cout << "infix " << getLHSName() << " " << getSymbol()
-            << " " << getRHSName() << " = ";
+  std::cout << "infix " << getLHSName().str() << " " << getSymbol().str()
+            << " " << getRHSName().str() << " = ";
   if (Statement) {
     std::cout << "\n";
     Statement->dump();
@@ -712,7 +771,8 @@ void InfixOpDefinitionAST::dump() const {
 }
 
 void FunctionDefinitionAST::dump() const {
-  std::cout << "Function: " << cvm::TypeToStr(getType()) << " " << Name << "(";
+  std::cout << "Function: " << cvm::TypeToStr(getType()) << " " << Name.str()
+            << "(";
 
   for (const auto &P : getParameterList()) {
     std::cout << P.toString() << (&P == &ParameterList.back() ? "" : ", ");
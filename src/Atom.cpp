@@ -0,0 +1,40 @@
+#include "Atom.h"
+#include <unordered_map>
+#include <vector>
+
+using namespace cmm;
+
+namespace {
+struct AtomTable {
+  std::unordered_map<std::string, unsigned> Ids;
+  /// Point to the keys of Ids, which never move.
+  std::vector<const std::string *> Strings;
+
+  AtomTable() { intern(std::string()); }
+
+  unsigned intern(const std::string &S) {
+    auto Res = Ids.emplace(S, static_cast<unsigned>(Strings.size()));
+    if (Res.second)
+      Strings.push_back(&Res.first->first);
+    return Res.first->second;
+  }
+};
+}
+
+static AtomTable &getTable() {
+  // Never destroyed, atoms may outlive static objects.
+  static AtomTable *Table = new AtomTable;
+  return *Table;
+}
+
+unsigned Atom::intern(const std::string &S) {
+  return getTable().intern(S);
+}
+
+const std::string &Atom::str() const {
+  return *getTable().Strings[Id];
+}
+
+size_t Atom::getCount() {
+  return getTable().Strings.size();
+}
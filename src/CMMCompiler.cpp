@@ -0,0 +1,616 @@
+#include "CMMCompiler.h"
+#include <cassert>
+#include <cstring>
+
+using namespace cmm;
+
+CMMCompiler::CMMCompiler(SourceMgr &SrcMgr, const BlockAST &Block,
+                         const std::map<std::string, FunctionDefinitionAST> &F,
+                         const std::map<std::string, InfixOpDefinitionAST> &I)
+    : SrcMgr(SrcMgr), TopLevelBlock(Block), UserFunctionMap(F), InfixOpMap(I)
+    , Code(nullptr), ScopeDepth(0) {
+  cvm::addNativeFunctions(NativeFunctionMap);
+}
+
+std::unique_ptr<cvm::Program> CMMCompiler::compile() {
+  Prog.reset(new cvm::Program);
+
+  // Create all code objects first so that calls can refer to their indices
+  // before the callee is compiled.
+  Prog->Functions.emplace_back(cvm::CodeObject::TopLevelCode, "<toplevel>");
+  for (const auto &F : UserFunctionMap) {
+    FunctionIndex[F.first] = static_cast<int32_t>(Prog->Functions.size());
+    Prog->Functions.emplace_back(cvm::CodeObject::FunctionCode, F.first,
+                                 F.second.getType());
+  }
+  for (const auto &I : InfixOpMap) {
+    InfixOpIndex[I.first] = static_cast<int32_t>(Prog->Functions.size());
+    Prog->Functions.emplace_back(cvm::CodeObject::InfixOpCode, I.first);
+  }
+
+  auto MainIt = FunctionIndex.find("main");
+  if (MainIt != FunctionIndex.end())
+    Prog->MainIndex = MainIt->second;
+
+  Code = &Prog->Functions.front();
+  Code->Scope = addScope(TopLevelBlock.getSlots());
+  for (auto &Stmt : TopLevelBlock.getStatementList())
+    compileStatement(Stmt.get());
+  emit(cvm::ReturnDefault);
+
+  for (const auto &F : UserFunctionMap)
+    compileFunction(F.second, Prog->Functions[FunctionIndex[F.first]]);
+  for (const auto &I : InfixOpMap)
+    compileInfixOp(I.second, Prog->Functions[InfixOpIndex[I.first]]);
+
+  return std::move(Prog);
+}
+
+size_t CMMCompiler::emit(cvm::OpCode Op, int32_t A, uint16_t Aux) {
+  Code->Code.emplace_back(Op, A, Aux);
+  Code->Lines.push_back(0);
+  return Code->Code.size() - 1;
+}
+
+void CMMCompiler::setLine(size_t At, SourceMgr::LocTy Loc) {
+  Code->Lines[At] =
+      static_cast<uint32_t>(SrcMgr.getLineColByLoc(Loc).first + 1);
+}
+
+void CMMCompiler::patchJump(size_t At, size_t Target) {
+  Code->Code[At].A = static_cast<int32_t>(Target);
+}
+
+int32_t CMMCompiler::addConstant(const cvm::BasicValue &Value) {
+  // Equal constants are shared, large scripts repeat the same few a lot.
+  int32_t Index = static_cast<int32_t>(Prog->Constants.size());
+  if (Value.isString()) {
+    auto Res = StringConstantIndex.emplace(Value.getString(), Index);
+    if (!Res.second)
+      return Res.first->second;
+  } else {
+    uint64_t Bits = 0;
+    switch (Value.Type) {
+    default:              break;
+    case cvm::IntType:    Bits = static_cast<uint32_t>(Value.IntVal); break;
+    case cvm::BoolType:   Bits = Value.BoolVal; break;
+    case cvm::DoubleType: std::memcpy(&Bits, &Value.DoubleVal, sizeof(Bits));
+                          break;
+    }
+    auto Res = ConstantIndex.emplace(std::make_pair(Value.Type, Bits), Index);
+    if (!Res.second)
+      return Res.first->second;
+  }
+
+  Prog->Constants.push_back(Value);
+  return Index;
+}
+
+int32_t CMMCompiler::addName(Atom Name) {
+  auto It = NameIndex.find(Name);
+  if (It != NameIndex.end())
+    return It->second;
+
+  Prog->Names.push_back(Name.str());
+  return NameIndex[Name] = static_cast<int32_t>(Prog->Names.size() - 1);
+}
+
+int32_t CMMCompiler::addScope(const SlotNameList &Slots) {
+  std::vector<int32_t> Scope;
+  for (Atom Name : Slots)
+    Scope.push_back(Name.empty() ? -1 : addName(Name));
+
+  Prog->Scopes.push_back(std::move(Scope));
+  return static_cast<int32_t>(Prog->Scopes.size() - 1);
+}
+
+int32_t CMMCompiler::addNative(const std::string &Name,
+                               cvm::NativeFunction Function) {
+  auto It = NativeIndex.find(Name);
+  if (It != NativeIndex.end())
+    return It->second;
+
+  Prog->Natives.push_back(Function);
+  Prog->NativeNames.push_back(Name);
+  return NativeIndex[Name] = static_cast<int32_t>(Prog->Natives.size() - 1);
+}
+
+void CMMCompiler::compileFunction(const FunctionDefinitionAST &Function,
+                                  cvm::CodeObject &Object) {
+  Code = &Object;
+  Code->Scope = addScope(Function.getSlots());
+  ScopeDepth = 0;
+
+  for (const Parameter &P : Function.getParameterList()) {
+    // We allow empty parameter name.
+    int32_t Name = P.getName().empty() ? -1 : addName(P.getName());
+    Code->Parameters.emplace_back(Name, P.getType());
+  }
+
+  compileStatement(Function.getStatement());
+  emit(cvm::ReturnDefault);
+}
+
+void CMMCompiler::compileInfixOp(const InfixOpDefinitionAST &InfixOp,
+                                 cvm::CodeObject &Object) {
+  Code = &Object;
+  Code->Scope = addScope(InfixOp.getSlots());
+  ScopeDepth = 0;
+
+  // Operands of infix operators are untyped.
+  Code->Parameters.emplace_back(addName(InfixOp.getLHSName()), cvm::VoidType);
+  Code->Parameters.emplace_back(addName(InfixOp.getRHSName()), cvm::VoidType);
+
+  compileStatement(InfixOp.getStatement());
+  emit(cvm::ReturnDefault);
+}
+
+/// \brief Compile a statement. Every statement leaves its value in the result
+/// register, which becomes the default return value of the function.
+void CMMCompiler::compileStatement(const StatementAST *Stmt) {
+  if (!Stmt) {
+    emit(cvm::ClearResult);
+    return;
+  }
+
+  switch (Stmt->getKind()) {
+  default:
+    assert(false && "compileStatement: unknown statement kind");
+  case StatementAST::DeclarationStatement:
+    compileDeclaration(Stmt->as_cptr<DeclarationAST>());
+    emit(cvm::ClearResult);
+    break;
+  case StatementAST::DeclarationListStatement:
+    compileDeclarationList(Stmt->as_cptr<DeclarationListAST>());
+    break;
+  case StatementAST::ExprStatement:
+    compileExpression(Stmt->as_cptr<ExprStatementAST>()->getExpression());
+    // Values of top level statements are never used, don't keep them alive.
+    emit(Code->isTopLevel() ? cvm::Pop : cvm::PopResult);
+    break;
+  case StatementAST::BlockStatement:
+    compileBlock(Stmt->as_cptr<BlockAST>());
+    break;
+  case StatementAST::IfStatement:
+    compileIfStatement(Stmt->as_cptr<IfStatementAST>());
+    break;
+  case StatementAST::ReturnStatement:
+    compileReturnStatement(Stmt->as_cptr<ReturnStatementAST>());
+    break;
+  case StatementAST::WhileStatement:
+    compileWhileStatement(Stmt->as_cptr<WhileStatementAST>());
+    break;
+  case StatementAST::ForStatement:
+    compileForStatement(Stmt->as_cptr<ForStatementAST>());
+    break;
+  case StatementAST::ContinueStatement:
+    compileContinueStatement(Stmt->as_cptr<ContinueStatementAST>());
+    break;
+  case StatementAST::BreakStatement:
+    compileBreakStatement(Stmt->as_cptr<BreakStatementAST>());
+    break;
+  }
+}
+
+void CMMCompiler::compileBlock(const BlockAST *Block) {
+  if (Block->isHoisted()) {
+    HoistedBlocks.push_back(Block);
+    compileStatementList(Block->getStatementList());
+    HoistedBlocks.pop_back();
+    emitClearSlots(Block);
+    return;
+  }
+
+  // Blocks hoisted into the new scope go away with it.
+  std::vector<const BlockAST *> OuterHoistedBlocks;
+  OuterHoistedBlocks.swap(HoistedBlocks);
+  emit(cvm::EnterScope, addScope(Block->getSlots()));
+  ++ScopeDepth;
+
+  compileStatementList(Block->getStatementList());
+
+  --ScopeDepth;
+  emit(cvm::LeaveScope, 0, 1);
+  HoistedBlocks.swap(OuterHoistedBlocks);
+}
+
+void CMMCompiler::compileStatementList(
+    const std::list<std::unique_ptr<StatementAST>> &List) {
+  if (List.empty())
+    emit(cvm::ClearResult);
+  for (auto &Stmt : List)
+    compileStatement(Stmt.get());
+}
+
+/// \brief Clear the variables of a hoisted block on leaving it.
+void CMMCompiler::emitClearSlots(const BlockAST *Block) {
+  unsigned Begin = Block->getHoistedBegin();
+  unsigned End = Block->getHoistedEnd();
+  if (Begin != End) {
+    emit(cvm::ClearSlots, static_cast<int32_t>(Begin),
+         static_cast<uint16_t>(End - Begin));
+  }
+}
+
+void CMMCompiler::compileIfStatement(const IfStatementAST *Stmt) {
+  compileExpression(Stmt->getCondition());
+  size_t ElseJump = emit(cvm::JumpIfFalse);
+
+  compileStatement(Stmt->getStatementThen());
+  size_t EndJump = emit(cvm::Jump);
+
+  patchJump(ElseJump);
+  // Without an else branch, the if statement yields nothing.
+  compileStatement(Stmt->getStatementElse());
+  patchJump(EndJump);
+}
+
+void CMMCompiler::compileWhileStatement(const WhileStatementAST *WhileStmt) {
+  const ExpressionAST *Condition = WhileStmt->getCondition();
+  size_t CondLabel = Code->Code.size();
+  size_t ExitJump = 0;
+
+  if (Condition) {
+    compileExpression(Condition);
+    ExitJump = emit(cvm::JumpIfFalse);
+  }
+
+  LoopStack.push_back(LoopContext{ScopeDepth, HoistedBlocks.size(), {}, {}});
+  compileStatement(WhileStmt->getStatement());
+  emit(cvm::Jump, static_cast<int32_t>(CondLabel));
+
+  LoopContext Loop = std::move(LoopStack.back());
+  LoopStack.pop_back();
+
+  if (Condition)
+    patchJump(ExitJump);
+  for (size_t At : Loop.BreakJumps)
+    patchJump(At);
+  for (size_t At : Loop.ContinueJumps)
+    patchJump(At, CondLabel);
+  emit(cvm::ClearResult);
+}
+
+void CMMCompiler::compileForStatement(const ForStatementAST *ForStmt) {
+  const ExpressionAST *Condition = ForStmt->getCondition();
+  size_t ExitJump = 0;
+
+  if (const ExpressionAST *Init = ForStmt->getInit()) {
+    compileExpression(Init);
+    emit(cvm::Pop);
+  }
+
+  size_t CondLabel = Code->Code.size();
+  if (Condition) {
+    compileExpression(Condition);
+    ExitJump = emit(cvm::JumpIfFalse);
+  }
+
+  LoopStack.push_back(LoopContext{ScopeDepth, HoistedBlocks.size(), {}, {}});
+  compileStatement(ForStmt->getStatement());
+
+  size_t PostLabel = Code->Code.size();
+  if (const ExpressionAST *Post = ForStmt->getPost()) {
+    compileExpression(Post);
+    emit(cvm::Pop);
+  }
+  emit(cvm::Jump, static_cast<int32_t>(CondLabel));
+
+  LoopContext Loop = std::move(LoopStack.back());
+  LoopStack.pop_back();
+
+  if (Condition)
+    patchJump(ExitJump);
+  for (size_t At : Loop.BreakJumps)
+    patchJump(At);
+  for (size_t At : Loop.ContinueJumps)
+    patchJump(At, PostLabel);
+  emit(cvm::ClearResult);
+}
+
+/// \brief Leave the innermost loop, or the function if there's no loop.
+/// A break or continue out of a loop terminates the function with no value,
+/// and is an error at top level.
+void CMMCompiler::compileLoopExit(const char *What, bool IsBreak) {
+  if (LoopStack.empty()) {
+    if (Code->isTopLevel()) {
+      emit(cvm::Error, addConstant(std::string(What) +
+          " statement should be in a loop"));
+      return;
+    }
+    emit(cvm::ClearResult);
+    emit(cvm::ReturnDefault);
+    return;
+  }
+
+  // Blocks hoisted into a scope being left needn't be cleared, otherwise
+  // the outermost block left covers the slots of those in it.
+  LoopContext &Loop = LoopStack.back();
+  if (ScopeDepth > Loop.ScopeDepth)
+    emit(cvm::LeaveScope, 0, static_cast<uint16_t>(ScopeDepth -
+                                                   Loop.ScopeDepth));
+  else if (HoistedBlocks.size() > Loop.HoistedDepth)
+    emitClearSlots(HoistedBlocks[Loop.HoistedDepth]);
+  if (IsBreak)
+    Loop.BreakJumps.push_back(emit(cvm::Jump));
+  else
+    Loop.ContinueJumps.push_back(emit(cvm::Jump));
+}
+
+void CMMCompiler::compileBreakStatement(const BreakStatementAST *) {
+  compileLoopExit("break", true);
+}
+
+void CMMCompiler::compileContinueStatement(const ContinueStatementAST *) {
+  compileLoopExit("continue", false);
+}
+
+void CMMCompiler::compileReturnStatement(const ReturnStatementAST *Stmt) {
+  // ReturnValueExpr can be null.
+  if (const ExpressionAST *ReturnValueExpr = Stmt->getReturnValue()) {
+    if (ReturnValueExpr->isFunctionCallExpr() &&
+        ReturnValueExpr->as_cptr<FunctionCallAST>()->isTailCall()) {
+      compileTailCall(ReturnValueExpr->as_cptr<FunctionCallAST>(), true);
+      return;
+    }
+    compileExpression(ReturnValueExpr);
+    emit(cvm::PopResult);
+  } else {
+    emit(cvm::ClearResult);
+  }
+  emit(cvm::Return);
+}
+
+void CMMCompiler::compileDeclarationList(const DeclarationListAST *DeclList) {
+  for (auto &Declaration : DeclList->getDeclarationList())
+    compileDeclaration(Declaration.get());
+  emit(cvm::ClearResult);
+}
+
+void CMMCompiler::compileDeclaration(const DeclarationAST *Decl) {
+  int32_t Slot = static_cast<int32_t>(Decl->getSlot());
+  uint16_t Type = static_cast<uint16_t>(Decl->getType());
+  uint16_t Flags = 0;
+
+  if (Decl->isArray()) {
+    for (auto &E : Decl->getElementCountList())
+      compileExpression(E.get());
+    size_t DimensionCount = Decl->getElementCountList().size();
+    emit(cvm::DeclareArray, Slot,
+         static_cast<uint16_t>(Type | DimensionCount << 8));
+
+    // An initializer of an array is evaluated and checked, but discarded.
+    if (!Decl->getInitializer())
+      return;
+    Flags |= cvm::DeclNoCheck;
+  }
+
+  if (const ExpressionAST *Initializer = Decl->getInitializer()) {
+    compileExpression(Initializer);
+    Flags |= cvm::DeclHasInit;
+  }
+  emit(cvm::DeclareVar, Slot, Type | Flags);
+}
+
+void CMMCompiler::compileExpression(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  default:
+    assert(false && "compileExpression: unknown expression kind");
+  case ExpressionAST::IntExpression:
+    emit(cvm::PushConst, addConstant(Expr->as_cptr<IntAST>()->getValue()));
+    break;
+  case ExpressionAST::DoubleExpression:
+    emit(cvm::PushConst, addConstant(Expr->as_cptr<DoubleAST>()->getValue()));
+    break;
+  case ExpressionAST::BoolExpression:
+    emit(cvm::PushConst, addConstant(Expr->as_cptr<BoolAST>()->getValue()));
+    break;
+  case ExpressionAST::StringExpression:
+    emit(cvm::PushConst,
+         addConstant(Expr->as_cptr<StringAST>()->getBasicValue()));
+    break;
+  case ExpressionAST::IdentifierExpression:
+    compileIdentifierExpr(Expr->as_cptr<IdentifierAST>(), false);
+    break;
+  case ExpressionAST::FunctionCallExpression:
+    compileFunctionCallExpr(Expr->as_cptr<FunctionCallAST>());
+    break;
+  case ExpressionAST::InfixOpExpression:
+    compileInfixOpExpr(Expr->as_cptr<InfixOpExprAST>());
+    break;
+  case ExpressionAST::BinaryOperatorExpression:
+    compileBinaryOpExpr(Expr->as_cptr<BinaryOperatorAST>());
+    break;
+  case ExpressionAST::UnaryOperatorExpression:
+    compileUnaryOpExpr(Expr->as_cptr<UnaryOperatorAST>());
+    break;
+  }
+}
+
+/// \brief Compile an expression that leaves a reference on the reference
+/// stack. See CMMInterpreter::evaluateLvalueExpr for the lvalue kinds.
+void CMMCompiler::compileLvalueExpr(const ExpressionAST *Expr) {
+  if (Expr->isIdentifierExpr()) {
+    compileIdentifierExpr(Expr->as_cptr<IdentifierAST>(), true);
+    return;
+  }
+
+  if (Expr->isBinaryOperatorExpression()) {
+    auto *BinOpExpr = Expr->as_cptr<BinaryOperatorAST>();
+
+    if (BinOpExpr->getOpKind() == BinaryOperatorAST::Index) {
+      compileLvalueExpr(BinOpExpr->getLHS());
+      compileExpression(BinOpExpr->getRHS());
+      emit(cvm::AddrIndex);
+      return;
+    }
+    if (BinOpExpr->getOpKind() == BinaryOperatorAST::Assign) {
+      compileLvalueExpr(BinOpExpr->getLHS());
+      compileExpression(BinOpExpr->getRHS());
+      emit(cvm::StoreRef, 0, 1);
+      return;
+    }
+
+    emit(cvm::Error,
+         addConstant(std::string("try to evaluate a rvalue binOpExpr as "
+                                 "lvalue")));
+    return;
+  }
+
+  emit(cvm::Error,
+       addConstant(std::string("try to evaluate a rvalue expression as "
+                               "lvalue")));
+}
+
+/// \brief Load a variable, or its reference if IsLvalue, according to the
+/// binding computed by CMMResolver.
+void CMMCompiler::compileIdentifierExpr(const IdentifierAST *IdExpr,
+                                        bool IsLvalue) {
+  const VariableBinding &Binding = IdExpr->getBinding();
+  int32_t Slot = static_cast<int32_t>(Binding.Slot);
+  uint16_t Depth = static_cast<uint16_t>(Binding.Depth);
+
+  switch (Binding.Kind) {
+  case VariableBinding::LocalBinding:
+    emit(IsLvalue ? cvm::AddrLocal : cvm::LoadLocal, Slot, Depth);
+    break;
+  case VariableBinding::GlobalBinding:
+    emit(IsLvalue ? cvm::AddrGlobal : cvm::LoadGlobal, Slot, Depth);
+    break;
+  case VariableBinding::DynamicBinding:
+    emit(IsLvalue ? cvm::AddrVar : cvm::LoadVar, addName(IdExpr->getName()));
+    break;
+  }
+}
+
+void CMMCompiler::compileBinaryOpExpr(const BinaryOperatorAST *Expr) {
+  cvm::OpCode Op;
+
+  switch (Expr->getOpKind()) {
+  default:
+    assert(false && "compileBinaryOpExpr: unknown binary operator kind");
+  case BinaryOperatorAST::Assign:
+    compileLvalueExpr(Expr->getLHS());
+    compileExpression(Expr->getRHS());
+    emit(cvm::StoreRef);
+    return;
+  case BinaryOperatorAST::Index:
+    compileLvalueExpr(Expr);
+    emit(cvm::LoadRef);
+    return;
+  case BinaryOperatorAST::LogicalAnd:
+  case BinaryOperatorAST::LogicalOr:
+    compileLogicalOp(Expr);
+    return;
+
+  case BinaryOperatorAST::Add:          Op = cvm::Add; break;
+  case BinaryOperatorAST::Minus:        Op = cvm::Sub; break;
+  case BinaryOperatorAST::Multiply:     Op = cvm::Mul; break;
+  case BinaryOperatorAST::Division:     Op = cvm::Div; break;
+  case BinaryOperatorAST::Modulo:       Op = cvm::Mod; break;
+  case BinaryOperatorAST::Less:         Op = cvm::Less; break;
+  case BinaryOperatorAST::LessEqual:    Op = cvm::LessEqual; break;
+  case BinaryOperatorAST::Equal:        Op = cvm::Equal; break;
+  case BinaryOperatorAST::NotEqual:     Op = cvm::NotEqual; break;
+  case BinaryOperatorAST::Greater:      Op = cvm::Greater; break;
+  case BinaryOperatorAST::GreaterEqual: Op = cvm::GreaterEqual; break;
+  case BinaryOperatorAST::BitwiseAnd:   Op = cvm::BitAnd; break;
+  case BinaryOperatorAST::BitwiseOr:    Op = cvm::BitOr; break;
+  case BinaryOperatorAST::BitwiseXor:   Op = cvm::BitXor; break;
+  case BinaryOperatorAST::LeftShift:    Op = cvm::Shl; break;
+  case BinaryOperatorAST::RightShift:   Op = cvm::Shr; break;
+  }
+
+  compileExpression(Expr->getLHS());
+  compileExpression(Expr->getRHS());
+  emit(Op);
+}
+
+void CMMCompiler::compileUnaryOpExpr(const UnaryOperatorAST *Expr) {
+  compileExpression(Expr->getOperand());
+
+  switch (Expr->getOpKind()) {
+  case UnaryOperatorAST::Plus:        emit(cvm::Pos); break;
+  case UnaryOperatorAST::Minus:       emit(cvm::Neg); break;
+  case UnaryOperatorAST::LogicalNot:  emit(cvm::Not); break;
+  case UnaryOperatorAST::BitwiseNot:  emit(cvm::BitNot); break;
+  }
+}
+
+/// \brief Compile && and || with short circuit. Both yield a bool.
+void CMMCompiler::compileLogicalOp(const BinaryOperatorAST *Expr) {
+  bool IsAnd = Expr->getOpKind() == BinaryOperatorAST::LogicalAnd;
+
+  compileExpression(Expr->getLHS());
+  size_t ShortJump = emit(IsAnd ? cvm::JumpIfFalse : cvm::JumpIfTrue);
+
+  compileExpression(Expr->getRHS());
+  emit(cvm::ToBool);
+  size_t EndJump = emit(cvm::Jump);
+
+  patchJump(ShortJump);
+  emit(cvm::PushConst, addConstant(!IsAnd));
+  patchJump(EndJump);
+}
+
+void CMMCompiler::compileFunctionCallExpr(const FunctionCallAST *FuncCall) {
+  // Only the value of the last statement, as that of a return statement is
+  // compiled there.
+  if (FuncCall->isTailCall()) {
+    compileTailCall(FuncCall, false);
+    return;
+  }
+
+  const std::string &Callee = FuncCall->getCallee().str();
+  uint16_t ArgCount = static_cast<uint16_t>(FuncCall->getArguments().size());
+
+  auto UserFuncIt = FunctionIndex.find(Callee);
+  auto NativeFuncIt = NativeFunctionMap.find(Callee);
+
+  if (UserFuncIt == FunctionIndex.end() &&
+      NativeFuncIt == NativeFunctionMap.end()) {
+    emit(cvm::Error, addConstant("function `" + Callee + "' is undefined"));
+    return;
+  }
+
+  for (auto &Arg : FuncCall->getArguments())
+    compileExpression(Arg.get());
+
+  if (UserFuncIt != FunctionIndex.end()) {
+    size_t At = emit(FuncCall->isDynamicBound() ? cvm::CallDynamic :
+                                                  cvm::Call,
+                     UserFuncIt->second, ArgCount);
+    setLine(At, FuncCall->getLoc());
+    return;
+  }
+
+  emit(cvm::CallNative, addNative(Callee, NativeFuncIt->second.Function),
+       ArgCount);
+}
+
+/// \brief Compile a call of the function being compiled to itself, which
+/// jumps to its start in the same frame. Nothing after it is executed.
+void CMMCompiler::compileTailCall(const FunctionCallAST *FuncCall,
+                                  bool Returned) {
+  uint16_t ArgCount = static_cast<uint16_t>(FuncCall->getArguments().size());
+  for (auto &Arg : FuncCall->getArguments())
+    compileExpression(Arg.get());
+  size_t At = emit(cvm::TailCall, FunctionIndex[FuncCall->getCallee().str()],
+                   ArgCount | (Returned ? cvm::TailReturned : 0));
+  setLine(At, FuncCall->getLoc());
+}
+
+void CMMCompiler::compileInfixOpExpr(const InfixOpExprAST *Expr) {
+  const std::string &Symbol = Expr->getSymbol().str();
+  auto InfixOpIt = InfixOpIndex.find(Symbol);
+
+  if (InfixOpIt == InfixOpIndex.end()) {
+    emit(cvm::Error, addConstant("Infix operator " + Symbol +
+        " is undefined"));
+    return;
+  }
+
+  compileExpression(Expr->getLHS());
+  compileExpression(Expr->getRHS());
+  setLine(emit(cvm::CallInfix, InfixOpIt->second, 2), Expr->getLoc());
+}
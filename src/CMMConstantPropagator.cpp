@@ -0,0 +1,505 @@
+#include "CMMConstantPropagator.h"
+#include <cassert>
+#include <cmath>
+#include <iterator>
+
+using namespace cmm;
+
+/// \brief Return the value of a literal.
+static cvm::BasicValue getLiteralValue(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  default:
+    assert(false && "getLiteralValue: not a literal");
+  case ExpressionAST::IntExpression:
+    return Expr->as_cptr<IntAST>()->getValue();
+  case ExpressionAST::DoubleExpression:
+    return Expr->as_cptr<DoubleAST>()->getValue();
+  case ExpressionAST::BoolExpression:
+    return Expr->as_cptr<BoolAST>()->getValue();
+  case ExpressionAST::StringExpression:
+    return Expr->as_cptr<StringAST>()->getBasicValue();
+  }
+  return cvm::BasicValue(); // Make the compiler happy.
+}
+
+/// \brief Make a literal of a scalar value at \p Loc.
+static std::unique_ptr<ExpressionAST>
+makeLiteral(const cvm::BasicValue &Value, CMMLexer::LocTy Loc) {
+  std::unique_ptr<ExpressionAST> Res;
+  switch (Value.Type) {
+  default:
+    assert(false && "makeLiteral: not a scalar value");
+  case cvm::IntType:    Res.reset(new IntAST(Value.IntVal)); break;
+  case cvm::DoubleType: Res.reset(new DoubleAST(Value.DoubleVal)); break;
+  case cvm::BoolType:   Res.reset(new BoolAST(Value.BoolVal)); break;
+  case cvm::StringType: Res.reset(new StringAST(Value)); break;
+  }
+  Res->setLoc(Loc);
+  return Res;
+}
+
+/// \brief Fold a unary operator on a value as the interpreter evaluates it.
+/// Return false if it would fail at runtime.
+static bool foldUnaryOperator(UnaryOperatorAST::OperatorKind OpKind,
+                              const cvm::BasicValue &Operand,
+                              cvm::BasicValue &Result) {
+  switch (OpKind) {
+  default:
+    return false;
+  case UnaryOperatorAST::Plus:
+    if (!Operand.isNumeric())
+      return false;
+    Result = Operand;
+    return true;
+  case UnaryOperatorAST::Minus:
+    if (!Operand.isNumeric())
+      return false;
+    if (Operand.isInt())
+      Result = -Operand.IntVal;
+    else
+      Result = -Operand.DoubleVal;
+    return true;
+  case UnaryOperatorAST::LogicalNot:
+    Result = !Operand.toBool();
+    return true;
+  case UnaryOperatorAST::BitwiseNot:
+    if (!Operand.isInt())
+      return false;
+    Result = ~Operand.IntVal;
+    return true;
+  }
+}
+
+/// \brief Fold a binary operator on values as the interpreter evaluates it.
+/// Return false if it would fail at runtime, or it's not to be folded.
+static bool foldBinaryOperator(BinaryOperatorAST::OperatorKind OpKind,
+                               const cvm::BasicValue &L,
+                               const cvm::BasicValue &R,
+                               cvm::BasicValue &Result) {
+  switch (OpKind) {
+  default:
+    return false;
+
+  case BinaryOperatorAST::Add:
+    if (L.isString() || R.isString()) {
+      Result = L.toString() + R.toString();
+      return true;
+    }
+    /* fall through */
+  case BinaryOperatorAST::Minus:
+  case BinaryOperatorAST::Multiply:
+  case BinaryOperatorAST::Division:
+  case BinaryOperatorAST::Modulo:
+    if (!L.isNumeric() || !R.isNumeric())
+      return false;
+    if (L.isInt() && R.isInt()) {
+      switch (OpKind) {
+      default:                          return false;
+      case BinaryOperatorAST::Add:      Result = L.IntVal + R.IntVal; break;
+      case BinaryOperatorAST::Minus:    Result = L.IntVal - R.IntVal; break;
+      case BinaryOperatorAST::Multiply: Result = L.IntVal * R.IntVal; break;
+      case BinaryOperatorAST::Division:
+        if (R.IntVal == 0)
+          return false;
+        Result = L.IntVal / R.IntVal;
+        break;
+      case BinaryOperatorAST::Modulo:
+        if (R.IntVal == 0)
+          return false;
+        Result = L.IntVal % R.IntVal;
+        break;
+      }
+      return true;
+    }
+    {
+      double DL = L.toDouble(), DR = R.toDouble();
+      switch (OpKind) {
+      default:                          return false;
+      case BinaryOperatorAST::Add:      Result = DL + DR; break;
+      case BinaryOperatorAST::Minus:    Result = DL - DR; break;
+      case BinaryOperatorAST::Multiply: Result = DL * DR; break;
+      case BinaryOperatorAST::Division: Result = DL / DR; break;
+      case BinaryOperatorAST::Modulo:   Result = std::fmod(DL, DR); break;
+      }
+    }
+    return true;
+
+  case BinaryOperatorAST::LogicalAnd:
+    Result = L.toBool() && R.toBool();
+    return true;
+  case BinaryOperatorAST::LogicalOr:
+    Result = L.toBool() || R.toBool();
+    return true;
+
+  case BinaryOperatorAST::Less:
+  case BinaryOperatorAST::LessEqual:
+  case BinaryOperatorAST::Equal:
+  case BinaryOperatorAST::NotEqual:
+  case BinaryOperatorAST::Greater:
+  case BinaryOperatorAST::GreaterEqual:
+    if (L.Type != R.Type) {
+      if (!L.isNumeric() || !R.isNumeric())
+        return false;
+      return foldBinaryOperator(OpKind, cvm::BasicValue(L.toDouble()),
+                                cvm::BasicValue(R.toDouble()), Result);
+    }
+    switch (OpKind) {
+    default:                              return false;
+    case BinaryOperatorAST::Less:         Result = L < R;  break;
+    case BinaryOperatorAST::LessEqual:    Result = L <= R; break;
+    case BinaryOperatorAST::Equal:        Result = L == R; break;
+    case BinaryOperatorAST::NotEqual:     Result = L != R; break;
+    case BinaryOperatorAST::Greater:      Result = L > R;  break;
+    case BinaryOperatorAST::GreaterEqual: Result = L >= R; break;
+    }
+    return true;
+
+  case BinaryOperatorAST::BitwiseAnd:
+  case BinaryOperatorAST::BitwiseOr:
+  case BinaryOperatorAST::BitwiseXor:
+  case BinaryOperatorAST::LeftShift:
+  case BinaryOperatorAST::RightShift:
+    if (!L.isInt() || !R.isInt())
+      return false;
+    switch (OpKind) {
+    default:                            return false;
+    case BinaryOperatorAST::BitwiseAnd: Result = L.IntVal & R.IntVal;  break;
+    case BinaryOperatorAST::BitwiseOr:  Result = L.IntVal | R.IntVal;  break;
+    case BinaryOperatorAST::BitwiseXor: Result = L.IntVal ^ R.IntVal;  break;
+    case BinaryOperatorAST::LeftShift:  Result = L.IntVal << R.IntVal; break;
+    case BinaryOperatorAST::RightShift: Result = L.IntVal >> R.IntVal; break;
+    }
+    return true;
+  }
+}
+
+void CMMConstantPropagator::propagate() {
+  // Count declarations and assignments of every name in the whole program
+  // first, constants can't be told apart otherwise.
+  for (auto &Stmt : TopLevelBlock.getStatementList())
+    countStatement(Stmt.get());
+  for (const auto &F : UserFunctionMap) {
+    for (const Parameter &P : F.second.getParameterList())
+      ++DeclarationCount[P.getName()];
+    countStatement(F.second.getStatement());
+  }
+  for (const auto &I : InfixOpMap) {
+    ++DeclarationCount[I.second.getLHSName()];
+    ++DeclarationCount[I.second.getRHSName()];
+    countStatement(I.second.getStatement());
+  }
+
+  // Then in the order CMMResolver resolves them, top level variables are
+  // known when propagating functions.
+  InFunction = false;
+  propagateStatementList(TopLevelBlock.getStatementList());
+
+  InFunction = true;
+  for (auto &F : UserFunctionMap)
+    propagateStatement(F.second.getStatement());
+  for (auto &I : InfixOpMap)
+    propagateStatement(I.second.getStatement());
+}
+
+void CMMConstantPropagator::countStatement(const StatementAST *Stmt) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  default:
+    assert(false && "countStatement: unknown statement kind");
+  case StatementAST::DeclarationStatement: {
+    auto *Decl = Stmt->as_cptr<DeclarationAST>();
+    ++DeclarationCount[Decl->getName()];
+    countExpression(Decl->getInitializer());
+    for (auto &Count : Decl->getElementCountList())
+      countExpression(Count.get());
+    break;
+  }
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      countStatement(Decl.get());
+    break;
+  case StatementAST::ExprStatement:
+    countExpression(Stmt->as_cptr<ExprStatementAST>()->getExpression());
+    break;
+  case StatementAST::BlockStatement:
+    for (auto &S : Stmt->as_cptr<BlockAST>()->getStatementList())
+      countStatement(S.get());
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    countExpression(IfStmt->getCondition());
+    countStatement(IfStmt->getStatementThen());
+    countStatement(IfStmt->getStatementElse());
+    break;
+  }
+  case StatementAST::ReturnStatement:
+    countExpression(Stmt->as_cptr<ReturnStatementAST>()->getReturnValue());
+    break;
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    countExpression(WhileStmt->getCondition());
+    countStatement(WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    countExpression(ForStmt->getInit());
+    countExpression(ForStmt->getCondition());
+    countExpression(ForStmt->getPost());
+    countStatement(ForStmt->getStatement());
+    break;
+  }
+  case StatementAST::ContinueStatement:
+  case StatementAST::BreakStatement:
+    break;
+  }
+}
+
+void CMMConstantPropagator::countExpression(const ExpressionAST *Expr) {
+  if (!Expr)
+    return;
+
+  switch (Expr->getKind()) {
+  default:
+    break;
+  case ExpressionAST::FunctionCallExpression:
+    for (auto &Arg : Expr->as_cptr<FunctionCallAST>()->getArguments())
+      countExpression(Arg.get());
+    break;
+  case ExpressionAST::InfixOpExpression:
+    countExpression(Expr->as_cptr<InfixOpExprAST>()->getLHS());
+    countExpression(Expr->as_cptr<InfixOpExprAST>()->getRHS());
+    break;
+  case ExpressionAST::UnaryOperatorExpression:
+    countExpression(Expr->as_cptr<UnaryOperatorAST>()->getOperand());
+    break;
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    const ExpressionAST *LHS = BinOp->getLHS();
+    if (BinOp->getOpKind() == BinaryOperatorAST::Assign &&
+        LHS->isIdentifierExpr())
+      AssignedNames.insert(LHS->as_cptr<IdentifierAST>()->getName());
+    countExpression(LHS);
+    countExpression(BinOp->getRHS());
+    break;
+  }
+  }
+}
+
+/// \brief Propagate the statements of a block. Statements eliminated are
+/// removed, except the last one, whose value a function returns by default.
+void CMMConstantPropagator::propagateStatementList(StatementList &List) {
+  for (auto It = List.begin(), E = List.end(); It != E; ) {
+    propagateStatement(*It, true);
+    auto Next = std::next(It);
+    if (!*It && Next != E)
+      List.erase(It);
+    It = Next;
+  }
+}
+
+/// \brief Propagate a statement, and replace it if its condition turns out
+/// constant. It's \p Direct if it's a statement of a block.
+void CMMConstantPropagator::propagateStatement(
+    std::unique_ptr<StatementAST> &Stmt, bool Direct) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  default:
+    assert(false && "propagateStatement: unknown statement kind");
+  case StatementAST::DeclarationStatement:
+    propagateDeclaration(static_cast<DeclarationAST *>(Stmt.get()), Direct);
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl :
+         static_cast<DeclarationListAST *>(Stmt.get())->getDeclarationList())
+      propagateDeclaration(Decl.get(), Direct);
+    break;
+  case StatementAST::ExprStatement:
+    propagateExpression(
+        static_cast<ExprStatementAST *>(Stmt.get())->getExpression());
+    break;
+  case StatementAST::BlockStatement:
+    propagateStatementList(
+        static_cast<BlockAST *>(Stmt.get())->getStatementList());
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = static_cast<IfStatementAST *>(Stmt.get());
+    propagateExpression(IfStmt->getCondition());
+    if (IfStmt->getCondition()->isConstant()) {
+      // Only the branch taken is left, propagate it in place of the if.
+      Stmt = IfStatementAST::create(std::move(IfStmt->getCondition()),
+                                    std::move(IfStmt->getStatementThen()),
+                                    std::move(IfStmt->getStatementElse()));
+      propagateStatement(Stmt);
+      break;
+    }
+    propagateStatement(IfStmt->getStatementThen());
+    propagateStatement(IfStmt->getStatementElse());
+    break;
+  }
+  case StatementAST::ReturnStatement:
+    propagateExpression(
+        static_cast<ReturnStatementAST *>(Stmt.get())->getReturnValue());
+    break;
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = static_cast<WhileStatementAST *>(Stmt.get());
+    propagateExpression(WhileStmt->getCondition());
+    auto &Cond = WhileStmt->getCondition();
+    if (Cond && Cond->isConstant()) {
+      Stmt = WhileStatementAST::create(std::move(Cond),
+                                       std::move(WhileStmt->getStatement()));
+      if (!Stmt)
+        break;
+      WhileStmt = static_cast<WhileStatementAST *>(Stmt.get());
+    }
+    propagateStatement(WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = static_cast<ForStatementAST *>(Stmt.get());
+    propagateExpression(ForStmt->getInit());
+    propagateExpression(ForStmt->getCondition());
+    if (ForStmt->getCondition() && ForStmt->getCondition()->isConstant()) {
+      Stmt = ForStatementAST::create(std::move(ForStmt->getInit()),
+                                     std::move(ForStmt->getCondition()),
+                                     std::move(ForStmt->getPost()),
+                                     std::move(ForStmt->getStatement()));
+      // Only the init expression is left if the loop never runs.
+      if (!Stmt || Stmt->getKind() != StatementAST::ForStatement)
+        break;
+      ForStmt = static_cast<ForStatementAST *>(Stmt.get());
+    }
+    propagateStatement(ForStmt->getStatement());
+    propagateExpression(ForStmt->getPost());
+    break;
+  }
+  case StatementAST::ContinueStatement:
+  case StatementAST::BreakStatement:
+    break;
+  }
+}
+
+/// \brief Propagate a declaration, and record the variable if it's constant.
+/// Only a \p Direct statement of a block is run whenever the statements
+/// after it are.
+void CMMConstantPropagator::propagateDeclaration(DeclarationAST *Decl,
+                                                 bool Direct) {
+  for (auto &Count : Decl->getElementCountList())
+    propagateExpression(Count);
+  std::unique_ptr<ExpressionAST> &Init = Decl->getInitializer();
+  propagateExpression(Init);
+
+  if (!Direct || Decl->isArray() || !Init || !Init->isConstant())
+    return;
+
+  Atom Name = Decl->getName();
+  if (DeclarationCount[Name] != 1 || AssignedNames.count(Name))
+    return;
+
+  cvm::BasicValue Value = getLiteralValue(Init.get());
+  if (Value.Type != Decl->getType()) {
+    // Leave the type error to be reported.
+    if (!Value.isInt() || Decl->getType() != cvm::DoubleType)
+      return;
+    Value.promoteToDouble();
+  }
+  Constants[Name] = Constant{std::move(Value),
+                             !InFunction && !CalledUserCode};
+}
+
+void CMMConstantPropagator::propagateExpression(
+    std::unique_ptr<ExpressionAST> &Expr) {
+  if (!Expr)
+    return;
+
+  switch (Expr->getKind()) {
+  default:
+    break;
+  case ExpressionAST::IdentifierExpression:
+    propagateIdentifier(Expr);
+    break;
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = static_cast<FunctionCallAST *>(Expr.get());
+    for (auto &Arg : FuncCall->getArguments())
+      propagateExpression(Arg);
+    if (FuncCall->getUserFunction() && !InFunction)
+      CalledUserCode = true;
+    break;
+  }
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixExpr = static_cast<InfixOpExprAST *>(Expr.get());
+    propagateExpression(InfixExpr->getLHS());
+    propagateExpression(InfixExpr->getRHS());
+    if (!InFunction)
+      CalledUserCode = true;
+    break;
+  }
+  case ExpressionAST::UnaryOperatorExpression:
+    propagateUnaryOperator(Expr);
+    break;
+  case ExpressionAST::BinaryOperatorExpression:
+    propagateBinaryOperator(Expr);
+    break;
+  }
+}
+
+/// \brief Replace an identifier bound to a constant by its value. Those
+/// searched by name may refer to other variables by dynamic binding.
+void CMMConstantPropagator::propagateIdentifier(
+    std::unique_ptr<ExpressionAST> &Expr) {
+  auto *IdExpr = Expr->as_cptr<IdentifierAST>();
+  auto It = Constants.find(IdExpr->getName());
+  if (It == Constants.end())
+    return;
+
+  const VariableBinding &Binding = IdExpr->getBinding();
+  if (Binding.Kind == VariableBinding::LocalBinding ||
+      (Binding.Kind == VariableBinding::GlobalBinding && It->second.Global))
+    Expr = makeLiteral(It->second.Value, Expr->getLoc());
+}
+
+void CMMConstantPropagator::propagateUnaryOperator(
+    std::unique_ptr<ExpressionAST> &Expr) {
+  auto *UnaryOp = static_cast<UnaryOperatorAST *>(Expr.get());
+  std::unique_ptr<ExpressionAST> &Operand = UnaryOp->getOperand();
+  propagateExpression(Operand);
+  if (!Operand->isConstant())
+    return;
+
+  cvm::BasicValue Result;
+  if (foldUnaryOperator(UnaryOp->getOpKind(), getLiteralValue(Operand.get()),
+                        Result))
+    Expr = makeLiteral(Result, Expr->getLoc());
+}
+
+void CMMConstantPropagator::propagateBinaryOperator(
+    std::unique_ptr<ExpressionAST> &Expr) {
+  auto *BinOp = static_cast<BinaryOperatorAST *>(Expr.get());
+  std::unique_ptr<ExpressionAST> &LHS = BinOp->getLHS();
+  std::unique_ptr<ExpressionAST> &RHS = BinOp->getRHS();
+
+  // The variable assigned to or indexed is not read as a value.
+  auto OpKind = BinOp->getOpKind();
+  if (OpKind == BinaryOperatorAST::Assign ||
+      OpKind == BinaryOperatorAST::Index) {
+    if (!LHS->isIdentifierExpr())
+      propagateExpression(LHS);
+    propagateExpression(RHS);
+    return;
+  }
+
+  propagateExpression(LHS);
+  propagateExpression(RHS);
+  if (!LHS->isConstant() || !RHS->isConstant())
+    return;
+
+  cvm::BasicValue Result;
+  if (foldBinaryOperator(OpKind, getLiteralValue(LHS.get()),
+                         getLiteralValue(RHS.get()), Result))
+    Expr = makeLiteral(Result, Expr->getLoc());
+}
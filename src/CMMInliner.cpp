@@ -0,0 +1,588 @@
+#include "CMMInliner.h"
+#include <algorithm>
+#include <cassert>
+
+using namespace cmm;
+
+/// \brief Return the expression a body returns or ends with, if it's all the
+/// body does. \p Returned is set if it's returned.
+static const ExpressionAST *getBodyExpression(const StatementAST *Stmt,
+                                              bool &Returned) {
+  while (Stmt && Stmt->getKind() == StatementAST::BlockStatement) {
+    auto &StatementList = Stmt->as_cptr<BlockAST>()->getStatementList();
+    if (StatementList.size() != 1)
+      return nullptr;
+    Stmt = StatementList.front().get();
+  }
+
+  if (!Stmt)
+    return nullptr;
+  Returned = Stmt->getKind() == StatementAST::ReturnStatement;
+  if (Returned)
+    return Stmt->as_cptr<ReturnStatementAST>()->getReturnValue();
+  if (Stmt->getKind() == StatementAST::ExprStatement)
+    return Stmt->as_cptr<ExprStatementAST>()->getExpression();
+  return nullptr;
+}
+
+/// \brief Return the type of a literal.
+static cvm::BasicType getLiteralType(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  default:                                return cvm::VoidType;
+  case ExpressionAST::IntExpression:      return cvm::IntType;
+  case ExpressionAST::DoubleExpression:   return cvm::DoubleType;
+  case ExpressionAST::BoolExpression:     return cvm::BoolType;
+  case ExpressionAST::StringExpression:   return cvm::StringType;
+  }
+}
+
+static bool isNumeric(cvm::BasicType Type) {
+  return Type == cvm::IntType || Type == cvm::DoubleType;
+}
+
+/// \brief Return true if a unary operator on a scalar of type \p Operand
+/// never fails, and set \p Type to the type of its result.
+static bool isSafeUnaryOperator(UnaryOperatorAST::OperatorKind OpKind,
+                                cvm::BasicType Operand, cvm::BasicType &Type) {
+  switch (OpKind) {
+  default:
+    assert(false && "isSafeUnaryOperator: unknown unary operator kind");
+  case UnaryOperatorAST::Plus:
+  case UnaryOperatorAST::Minus:
+    Type = Operand;
+    return isNumeric(Operand);
+  case UnaryOperatorAST::LogicalNot:
+    Type = cvm::BoolType;
+    return Operand != cvm::VoidType;
+  case UnaryOperatorAST::BitwiseNot:
+    Type = cvm::IntType;
+    return Operand == cvm::IntType;
+  }
+  return false; // Make the compiler happy.
+}
+
+/// \brief Return true if a binary operator on scalars of types \p L and \p R
+/// never fails, and set \p Type to the type of its result. Int division
+/// only by a literal other than zero.
+static bool isSafeBinaryOperator(BinaryOperatorAST::OperatorKind OpKind,
+                                 cvm::BasicType L, cvm::BasicType R,
+                                 const ExpressionAST *RHS,
+                                 cvm::BasicType &Type) {
+  switch (OpKind) {
+  default:
+    return false;
+  case BinaryOperatorAST::Division:
+  case BinaryOperatorAST::Modulo:
+    if (L == cvm::IntType && R == cvm::IntType &&
+        (RHS->getKind() != ExpressionAST::IntExpression ||
+         RHS->as_cptr<IntAST>()->getValue() == 0))
+      return false;
+    // Fall through.
+  case BinaryOperatorAST::Add:
+  case BinaryOperatorAST::Minus:
+  case BinaryOperatorAST::Multiply:
+    Type = L == cvm::IntType && R == cvm::IntType ? cvm::IntType :
+                                                    cvm::DoubleType;
+    return isNumeric(L) && isNumeric(R);
+  case BinaryOperatorAST::Less:
+  case BinaryOperatorAST::LessEqual:
+  case BinaryOperatorAST::Equal:
+  case BinaryOperatorAST::NotEqual:
+  case BinaryOperatorAST::Greater:
+  case BinaryOperatorAST::GreaterEqual:
+    Type = cvm::BoolType;
+    return (L == R && L != cvm::VoidType) || (isNumeric(L) && isNumeric(R));
+  case BinaryOperatorAST::BitwiseAnd:
+  case BinaryOperatorAST::BitwiseOr:
+  case BinaryOperatorAST::BitwiseXor:
+  case BinaryOperatorAST::LeftShift:
+  case BinaryOperatorAST::RightShift:
+    Type = cvm::IntType;
+    return L == cvm::IntType && R == cvm::IntType;
+  }
+}
+
+/// \brief Return true if an expression evaluates to a value or fails.
+static bool isNonVoid(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  default:
+    return Expr->getStaticType().Known &&
+           Expr->getStaticType().Type != cvm::VoidType;
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+  case ExpressionAST::UnaryOperatorExpression:
+  case ExpressionAST::BinaryOperatorExpression:
+    return true;
+  }
+}
+
+void CMMInliner::inlineCalls() {
+  InlineStack.clear();
+  for (auto &Stmt : TopLevelBlock.getStatementList())
+    inlineStatement(Stmt);
+
+  // A function is never inlined into itself.
+  for (auto &F : UserFunctionMap) {
+    InlineStack.push_back(&F.second);
+    inlineStatement(F.second.getStatement());
+    InlineStack.pop_back();
+  }
+  for (auto &I : InfixOpMap) {
+    InlineStack.push_back(&I.second);
+    inlineStatement(I.second.getStatement());
+    InlineStack.pop_back();
+  }
+}
+
+const CMMInliner::Inlinee &
+CMMInliner::getInlinee(const FunctionDefinitionAST &Function) {
+  auto Res = Inlinees.emplace(&Function, Inlinee());
+  Inlinee &Callee = Res.first->second;
+  if (!Res.second)
+    return Callee;
+
+  for (const Parameter &P : Function.getParameterList())
+    Callee.ParamTypes.push_back(P.getType());
+  Callee.Params.resize(Callee.ParamTypes.size());
+
+  // A returned value is checked to be of the function type, the last
+  // statement is returned as it is.
+  bool Returned = false;
+  const ExpressionAST *Body = getBodyExpression(Function.getStatement(),
+                                                Returned);
+  if (!Body || (Returned && !Body->getStaticType().is(Function.getType())))
+    return Callee;
+
+  analyzeBody(Body, &Function, Callee);
+  return Callee;
+}
+
+const CMMInliner::Inlinee &
+CMMInliner::getInlinee(const InfixOpDefinitionAST &InfixOp) {
+  auto Res = Inlinees.emplace(&InfixOp, Inlinee());
+  Inlinee &Callee = Res.first->second;
+  if (!Res.second)
+    return Callee;
+
+  // Operands are of any type, the result must not be void.
+  Callee.ParamTypes.assign(2, cvm::VoidType);
+  Callee.Params.resize(2);
+
+  bool Returned = false;
+  const ExpressionAST *Body = getBodyExpression(InfixOp.getStatement(),
+                                                Returned);
+  if (!Body || !isNonVoid(Body))
+    return Callee;
+
+  analyzeBody(Body, &InfixOp, Callee);
+  return Callee;
+}
+
+void CMMInliner::analyzeBody(const ExpressionAST *Body,
+                             const void *Definition, Inlinee &Callee) {
+  BodyAnalysis Analysis(Definition, Callee);
+  cvm::BasicType Type;
+  if (analyzeExpression(Body, Analysis, Type))
+    Callee.Body = substitute(Body, nullptr);
+}
+
+/// \brief Record how a body uses its parameters in the order of evaluation.
+/// \p Type is set to the type of the value if it's a scalar of that type
+/// whenever the parameters are, VoidType otherwise. Return false if the body
+/// can't be inlined.
+bool CMMInliner::analyzeExpression(const ExpressionAST *Expr,
+                                   BodyAnalysis &Analysis,
+                                   cvm::BasicType &Type) {
+  Type = cvm::VoidType;
+  if (!Expr || ++Analysis.Size > InlineBudget)
+    return false;
+
+  Inlinee &Callee = Analysis.Callee;
+  switch (Expr->getKind()) {
+  default:
+    return false;
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+    Type = getLiteralType(Expr);
+    return true;
+
+  case ExpressionAST::IdentifierExpression: {
+    // Only parameters, which are in the first slots.
+    const VariableBinding &Binding =
+        Expr->as_cptr<IdentifierAST>()->getBinding();
+    if (Binding.Kind != VariableBinding::LocalBinding || Binding.Depth != 0 ||
+        Binding.Slot >= Callee.Params.size())
+      return false;
+
+    ParamUse &Param = Callee.Params[Binding.Slot];
+    if (Param.Count++ == 0)
+      Param.First = Analysis.Uses;
+    ++Analysis.Uses;
+    Param.Late |= Analysis.Effects;
+    Param.AfterOperator |= Analysis.Operators;
+    Type = Callee.ParamTypes[Binding.Slot];
+    return true;
+  }
+
+  case ExpressionAST::FunctionCallExpression: {
+    // A function called with dynamic binding sees the variables of the
+    // caller.
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    if (FuncCall->isDynamicBound() ||
+        FuncCall->getUserFunction() == Analysis.Definition)
+      return false;
+    for (auto &Arg : FuncCall->getArguments()) {
+      cvm::BasicType ArgType;
+      if (!analyzeExpression(Arg.get(), Analysis, ArgType))
+        return false;
+    }
+    if (FuncCall->getUserFunction())
+      Callee.CallsUserCode = true;
+    Analysis.Effects = true;
+    return true;
+  }
+
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixExpr = Expr->as_cptr<InfixOpExprAST>();
+    cvm::BasicType L, R;
+    if (InfixExpr->getInfixOp() == Analysis.Definition ||
+        !analyzeExpression(InfixExpr->getLHS(), Analysis, L) ||
+        !analyzeExpression(InfixExpr->getRHS(), Analysis, R))
+      return false;
+    Callee.CallsUserCode = true;
+    Analysis.Effects = true;
+    return true;
+  }
+
+  case ExpressionAST::UnaryOperatorExpression: {
+    auto *UnaryOp = Expr->as_cptr<UnaryOperatorAST>();
+    cvm::BasicType Operand;
+    if (!analyzeExpression(UnaryOp->getOperand(), Analysis, Operand))
+      return false;
+    Analysis.Operators = true;
+    if (!isSafeUnaryOperator(UnaryOp->getOpKind(), Operand, Type)) {
+      Type = cvm::VoidType;
+      Analysis.Effects = true;
+    }
+    return true;
+  }
+
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    const ExpressionAST *LHS = BinOp->getLHS();
+    cvm::BasicType L, R;
+    switch (BinOp->getOpKind()) {
+    default:
+      if (!analyzeExpression(LHS, Analysis, L) ||
+          !analyzeExpression(BinOp->getRHS(), Analysis, R))
+        return false;
+      Analysis.Operators = true;
+      if (!isSafeBinaryOperator(BinOp->getOpKind(), L, R, BinOp->getRHS(),
+                                Type)) {
+        Type = cvm::VoidType;
+        Analysis.Effects = true;
+      }
+      return true;
+
+    case BinaryOperatorAST::Assign:
+      return false;
+
+    // The base of an index expression is checked to be an array before
+    // evaluating the index, which takes variables only.
+    case BinaryOperatorAST::Index:
+      if (!analyzeExpression(LHS, Analysis, L))
+        return false;
+      if (LHS->isIdentifierExpr()) {
+        unsigned Slot = LHS->as_cptr<IdentifierAST>()->getBinding().Slot;
+        Callee.Params[Slot].Indexed = true;
+      }
+      Analysis.Operators = Analysis.Effects = true;
+      return analyzeExpression(BinOp->getRHS(), Analysis, R);
+
+    // The right operand may not be evaluated.
+    case BinaryOperatorAST::LogicalAnd:
+    case BinaryOperatorAST::LogicalOr:
+      if (!analyzeExpression(LHS, Analysis, L))
+        return false;
+      Analysis.Operators = Analysis.Effects = true;
+      if (!analyzeExpression(BinOp->getRHS(), Analysis, R))
+        return false;
+      Type = cvm::BoolType;
+      return true;
+    }
+  }
+  }
+}
+
+/// \brief Replace a call to \p Definition by its body if the arguments can
+/// be substituted for the parameters.
+void CMMInliner::tryInline(
+    std::unique_ptr<ExpressionAST> &Expr, const void *Definition,
+    const Inlinee &Callee,
+    const std::vector<std::unique_ptr<ExpressionAST> *> &Args) {
+  if (!Callee.Body || Args.size() != Callee.Params.size() ||
+      InlineStack.size() >= InlineDepth ||
+      std::count(InlineStack.begin(), InlineStack.end(), Definition))
+    return;
+
+  // Variables may be read at any time, unless the body may assign them, or
+  // other arguments have side effects.
+  bool Ordered = Callee.CallsUserCode;
+  for (auto *Arg : Args) {
+    if (!(*Arg)->isConstant() && !(*Arg)->isIdentifierExpr())
+      Ordered = true;
+  }
+
+  // Operators are assumed not to fail if the parameters are scalars, which
+  // matters if an argument is moved past them.
+  bool NeedScalars = false;
+  bool HasPrevious = false;
+  unsigned Previous = 0;
+  for (size_t I = 0, E = Args.size(); I != E; ++I) {
+    ExpressionAST *Arg = Args[I]->get();
+    const ParamUse &Param = Callee.Params[I];
+    cvm::BasicType Type = Callee.ParamTypes[I];
+    bool Literal = Arg->isConstant();
+
+    if (Type != cvm::VoidType) {
+      cvm::BasicType ArgType = Literal ? getLiteralType(Arg) :
+          Arg->getStaticType().Known ? Arg->getStaticType().Type :
+          cvm::VoidType;
+      if (ArgType != Type &&
+          !(Literal && ArgType == cvm::IntType && Type == cvm::DoubleType))
+        return;
+    }
+    if (Param.Indexed && !Arg->isIdentifierExpr())
+      return;
+    if (Literal)
+      continue;
+
+    // An argument is evaluated even if the parameter is never used.
+    if (Param.Count == 0)
+      return;
+    if (Ordered) {
+      if (Param.Count != 1 || Param.Late ||
+          (HasPrevious && Param.First < Previous))
+        return;
+      HasPrevious = true;
+      Previous = Param.First;
+      if (!Arg->isIdentifierExpr())
+        NeedScalars |= Param.AfterOperator;
+    }
+  }
+  if (NeedScalars) {
+    for (auto *Arg : Args) {
+      if (!(*Arg)->isConstant() && !(*Arg)->getStaticType().isScalar())
+        return;
+    }
+  }
+
+  std::vector<std::unique_ptr<ExpressionAST>> Values;
+  for (size_t I = 0, E = Args.size(); I != E; ++I) {
+    Values.push_back(std::move(*Args[I]));
+    if (Values.back()->isInt() && Callee.ParamTypes[I] == cvm::DoubleType) {
+      auto *Int = Values.back()->as_cptr<IntAST>();
+      Values.back().reset(new DoubleAST(static_cast<double>(Int->getValue())));
+    }
+  }
+  Expr = substitute(Callee.Body.get(), &Values);
+
+  InlineStack.push_back(Definition);
+  inlineExpression(Expr);
+  InlineStack.pop_back();
+}
+
+/// \brief Copy an expression with its annotations. If \p Args is given, the
+/// parameters are replaced by them: literals and variables are copied, other
+/// arguments are moved to their only use.
+std::unique_ptr<ExpressionAST>
+CMMInliner::substitute(const ExpressionAST *Expr,
+                       std::vector<std::unique_ptr<ExpressionAST>> *Args) {
+  if (!Expr)
+    return nullptr;
+
+  std::unique_ptr<ExpressionAST> Res;
+  switch (Expr->getKind()) {
+  default:
+    assert(false && "substitute: unknown expression kind");
+  case ExpressionAST::IntExpression:
+    Res.reset(new IntAST(Expr->as_cptr<IntAST>()->getValue()));
+    break;
+  case ExpressionAST::DoubleExpression:
+    Res.reset(new DoubleAST(Expr->as_cptr<DoubleAST>()->getValue()));
+    break;
+  case ExpressionAST::BoolExpression:
+    Res.reset(new BoolAST(Expr->as_cptr<BoolAST>()->getValue()));
+    break;
+  case ExpressionAST::StringExpression:
+    Res.reset(new StringAST(Expr->as_cptr<StringAST>()->getBasicValue()));
+    break;
+
+  case ExpressionAST::IdentifierExpression: {
+    auto *IdExpr = Expr->as_cptr<IdentifierAST>();
+    if (Args) {
+      std::unique_ptr<ExpressionAST> &Arg =
+          (*Args)[IdExpr->getBinding().Slot];
+      if (Arg->isConstant() || Arg->isIdentifierExpr())
+        return substitute(Arg.get(), nullptr);
+      return std::move(Arg);
+    }
+    auto *NewId = new IdentifierAST(IdExpr->getName());
+    NewId->setBinding(IdExpr->getBinding());
+    Res.reset(NewId);
+    break;
+  }
+
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    std::list<std::unique_ptr<ExpressionAST>> NewArgs;
+    for (auto &Arg : FuncCall->getArguments())
+      NewArgs.push_back(substitute(Arg.get(), Args));
+    auto *NewCall = new FunctionCallAST(FuncCall->getCallee(),
+                                        std::move(NewArgs),
+                                        FuncCall->isDynamicBound());
+    NewCall->link(FuncCall->getUserFunction(),
+                  FuncCall->getNativeFunction());
+    Res.reset(NewCall);
+    break;
+  }
+
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixExpr = Expr->as_cptr<InfixOpExprAST>();
+    auto *NewInfix = new InfixOpExprAST(InfixExpr->getSymbol(),
+                                        substitute(InfixExpr->getLHS(), Args),
+                                        substitute(InfixExpr->getRHS(), Args));
+    NewInfix->link(InfixExpr->getInfixOp());
+    Res.reset(NewInfix);
+    break;
+  }
+
+  case ExpressionAST::UnaryOperatorExpression: {
+    auto *UnaryOp = Expr->as_cptr<UnaryOperatorAST>();
+    Res.reset(new UnaryOperatorAST(UnaryOp->getOpKind(),
+                                   substitute(UnaryOp->getOperand(), Args)));
+    break;
+  }
+
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    auto *NewBinOp = new BinaryOperatorAST(BinOp->getOpKind(),
+                                           substitute(BinOp->getLHS(), Args),
+                                           substitute(BinOp->getRHS(), Args));
+    NewBinOp->quicken(BinOp->getQuickening());
+    Res.reset(NewBinOp);
+    break;
+  }
+  }
+
+  Res->setLoc(Expr->getLoc());
+  Res->setStaticType(Expr->getStaticType());
+  if (Expr->isTypeChecked())
+    Res->setTypeChecked();
+  return Res;
+}
+
+void CMMInliner::inlineStatement(std::unique_ptr<StatementAST> &Stmt) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  default:
+    assert(false && "inlineStatement: unknown statement kind");
+  case StatementAST::DeclarationStatement: {
+    auto *Decl = static_cast<DeclarationAST *>(Stmt.get());
+    for (auto &Count : Decl->getElementCountList())
+      inlineExpression(Count);
+    inlineExpression(Decl->getInitializer());
+    break;
+  }
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl :
+         static_cast<DeclarationListAST *>(Stmt.get())->getDeclarationList()) {
+      for (auto &Count : Decl->getElementCountList())
+        inlineExpression(Count);
+      inlineExpression(Decl->getInitializer());
+    }
+    break;
+  case StatementAST::ExprStatement:
+    inlineExpression(
+        static_cast<ExprStatementAST *>(Stmt.get())->getExpression());
+    break;
+  case StatementAST::BlockStatement:
+    for (auto &S : static_cast<BlockAST *>(Stmt.get())->getStatementList())
+      inlineStatement(S);
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = static_cast<IfStatementAST *>(Stmt.get());
+    inlineExpression(IfStmt->getCondition());
+    inlineStatement(IfStmt->getStatementThen());
+    inlineStatement(IfStmt->getStatementElse());
+    break;
+  }
+  case StatementAST::ReturnStatement:
+    inlineExpression(
+        static_cast<ReturnStatementAST *>(Stmt.get())->getReturnValue());
+    break;
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = static_cast<WhileStatementAST *>(Stmt.get());
+    inlineExpression(WhileStmt->getCondition());
+    inlineStatement(WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = static_cast<ForStatementAST *>(Stmt.get());
+    inlineExpression(ForStmt->getInit());
+    inlineExpression(ForStmt->getCondition());
+    inlineExpression(ForStmt->getPost());
+    inlineStatement(ForStmt->getStatement());
+    break;
+  }
+  case StatementAST::ContinueStatement:
+  case StatementAST::BreakStatement:
+    break;
+  }
+}
+
+void CMMInliner::inlineExpression(std::unique_ptr<ExpressionAST> &Expr) {
+  if (!Expr)
+    return;
+
+  switch (Expr->getKind()) {
+  default:
+    break;
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = static_cast<FunctionCallAST *>(Expr.get());
+    std::vector<std::unique_ptr<ExpressionAST> *> Args;
+    for (auto &Arg : FuncCall->getArguments()) {
+      inlineExpression(Arg);
+      Args.push_back(&Arg);
+    }
+    if (const FunctionDefinitionAST *Function = FuncCall->getUserFunction())
+      tryInline(Expr, Function, getInlinee(*Function), Args);
+    break;
+  }
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixExpr = static_cast<InfixOpExprAST *>(Expr.get());
+    inlineExpression(InfixExpr->getLHS());
+    inlineExpression(InfixExpr->getRHS());
+    if (const InfixOpDefinitionAST *InfixOp = InfixExpr->getInfixOp()) {
+      tryInline(Expr, InfixOp, getInlinee(*InfixOp),
+                {&InfixExpr->getLHS(), &InfixExpr->getRHS()});
+    }
+    break;
+  }
+  case ExpressionAST::UnaryOperatorExpression:
+    inlineExpression(static_cast<UnaryOperatorAST *>(Expr.get())->getOperand());
+    break;
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = static_cast<BinaryOperatorAST *>(Expr.get());
+    inlineExpression(BinOp->getLHS());
+    inlineExpression(BinOp->getRHS());
+    break;
+  }
+  }
+}
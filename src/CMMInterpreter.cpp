@@ -1,28 +1,49 @@
 #include "CMMInterpreter.h"
+#include "CMMJit.h"
+#include "CMMRuntime.h"
 #include "NativeFunctions.h"
+#include "OutputBuffer.h"
+#include <cassert>
 #include <cmath>
 
 using namespace cmm;
 
+CMMInterpreter::CMMInterpreter(SourceMgr &SrcMgr, const BlockAST &Block,
+                 const std::map<std::string, FunctionDefinitionAST> &F,
+                 const std::map<std::string, InfixOpDefinitionAST> &I,
+                 size_t MaxStack, bool EnableJit)
+    : SrcMgr(SrcMgr), TopLevelBlock(Block), UserFunctionMap(F)
+    , InfixOpMap(I), TopLevelEnv(Stack, nullptr, Block.getSlots())
+    , RT(MaxStack) {
+  if (EnableJit)
+    Jit.reset(new CMMJit(*this));
+}
+
+CMMInterpreter::~CMMInterpreter() {}
+
+/// \brief Run the program. Calls are evaluated recursively, so it runs on the
+/// stack CMMRuntime sets up for MaxStack nested calls.
 int CMMInterpreter::interpret(int Argc, char *Argv[]) {
+  return RT.run(Argc, Argv, [this](int Argc, char *Argv[]) {
+    return run(Argc, Argv);
+  });
+}
+
+int CMMInterpreter::run(int Argc, char *Argv[]) {
   // First run top level statements.
   for (auto &Stmt : TopLevelBlock.getStatementList()) {
     ExecutionResult Res = executeStatement(&TopLevelEnv, Stmt.get());
 
-    switch (Res.Kind) {
+    switch (Res) {
     default:
-      RuntimeError("bad execution result code: " + std::to_string(Res.Kind));
-    case ExecutionResult::BreakStatementResult:
+      RuntimeError("bad execution result code: " + std::to_string(Res));
+    case BreakStatementResult:
       RuntimeError("break statement should be in a loop");
-    case ExecutionResult::ContinueStatementResult:
+    case ContinueStatementResult:
       RuntimeError("continue statement should be in a loop");
-    case ExecutionResult::ReturnStatementResult:
-      if (Res.ReturnValue.isInt())
-        return Res.ReturnValue.IntVal;
-      RuntimeError("top level return statement should return integers, but " +
-          cvm::TypeToStr(Res.ReturnValue.Type) + Res.ReturnValue.toString() +
-          " is returned");
-    case ExecutionResult::NormalStatementResult:
+    case ReturnStatementResult:
+      return CMMRuntime::exitCode(ReturnValue);
+    case NormalStatementResult:
       break;
     }
   }
@@ -30,106 +51,67 @@ int CMMInterpreter::interpret(int Argc, char *Argv[]) {
   // Invoke main function is there is one
   auto MainIt = UserFunctionMap.find("main");
   if (MainIt != UserFunctionMap.end()) {
-    std::list<cvm::BasicValue> Args;
+    const FunctionDefinitionAST &Main = MainIt->second;
+    size_t ArgCount = Main.getParameterCount() == 0 ? 0 : 1;
+    VariableEnv MainEnv(Stack, &TopLevelEnv, Main.getSlots(), ArgCount);
 
-    if (MainIt->second.getParameterCount() == 0)
-      return callUserFunction(MainIt->second, Args).toInt();
-
-    auto ArgsPtr = std::make_shared<std::vector<cvm::BasicValue>>();
-    ArgsPtr->reserve(static_cast<size_t>(Argc));
-    for (int I = 0; I < Argc; ++I)
-      ArgsPtr->emplace_back(std::string(Argv[I]));
-    Args.emplace_back(cvm::StringType, ArgsPtr);
-    return callUserFunction(MainIt->second, Args).toInt();
+    if (ArgCount != 0)
+      MainEnv.Vars[0].Value = CMMRuntime::makeArguments(Argc, Argv);
+    return callUserFunction(Main, MainEnv, ArgCount).toInt();
   }
 
   return 0;
 }
 
-void CMMInterpreter::addNativeFunctions() {
-  NativeFunctionMap["typeof"] = cvm::Native::TypeOf;
-  NativeFunctionMap["len"] = cvm::Native::Length;
-  NativeFunctionMap["strlen"] = cvm::Native::StrLength;
-  NativeFunctionMap["print"] = cvm::Native::Print;
-  NativeFunctionMap["println"] = cvm::Native::PrintLn;
-  NativeFunctionMap["puts"] = cvm::Native::PrintLn;
-  NativeFunctionMap["system"] = cvm::Native::System;
-  NativeFunctionMap["random"] = cvm::Native::Random;
-  NativeFunctionMap["rand"] = cvm::Native::Random;
-  NativeFunctionMap["srand"] = cvm::Native::Srand;
-  NativeFunctionMap["time"] = cvm::Native::Time;
-  NativeFunctionMap["exit"] = cvm::Native::Exit;
-  NativeFunctionMap["toint"] = cvm::Native::ToInt;
-  NativeFunctionMap["todouble"] = cvm::Native::ToDouble;
-  NativeFunctionMap["tostring"] = cvm::Native::ToString;
-  NativeFunctionMap["str"] = cvm::Native::ToString;
-  NativeFunctionMap["tobool"] = cvm::Native::ToBool;
-  NativeFunctionMap["read"] = cvm::Native::Read;
-  NativeFunctionMap["readln"] = cvm::Native::ReadLn;
-  NativeFunctionMap["readint"] = cvm::Native::ReadInt;
-  NativeFunctionMap["sqrt"] = cvm::Native::Sqrt;
-  NativeFunctionMap["pow"] = cvm::Native::Pow;
-  NativeFunctionMap["exp"] = cvm::Native::Exp;
-  NativeFunctionMap["log"] = cvm::Native::Log;
-  NativeFunctionMap["log10"] = cvm::Native::Log10;
-
-#if defined(__APPLE__) || defined(__linux__)
-  NativeFunctionMap["UnixFork"] = cvm::Unix::Fork;
-
-  NativeFunctionMap["NcEndWin"] = cvm::Ncurses::EndWindow;
-  NativeFunctionMap["NcInitScr"] = cvm::Ncurses::InitScreen;
-  NativeFunctionMap["NcNoEcho"] = cvm::Ncurses::NoEcho;
-  NativeFunctionMap["NcCursSet"] = cvm::Ncurses::CursSet;
-  NativeFunctionMap["NcKeypad"] = cvm::Ncurses::Keypad;
-  NativeFunctionMap["NcTimeout"] = cvm::Ncurses::Timeout;
-  NativeFunctionMap["NcGetCh"] = cvm::Ncurses::GetChar;
-  NativeFunctionMap["NcMvAddCh"] = cvm::Ncurses::MoveAddChar;
-  NativeFunctionMap["NcMvAddStr"] = cvm::Ncurses::MoveAddString;
-  NativeFunctionMap["NcGetMaxY"] = cvm::Ncurses::GetMaxY;
-  NativeFunctionMap["NcGetMaxX"] = cvm::Ncurses::GetMaxX;
-  NativeFunctionMap["NcStartColor"] = cvm::Ncurses::StartColor;
-  NativeFunctionMap["NcInitPair"] = cvm::Ncurses::InitPair;
-  NativeFunctionMap["NcAttrOn"] = cvm::Ncurses::AttrOn;
-  NativeFunctionMap["NcAttrOff"] = cvm::Ncurses::AttrOff;
-  NativeFunctionMap["NcColorPair"] = cvm::Ncurses::ColorPair;
-
-#endif // defined(__APPLE__) || defined(__linux__)
-}
-
 void CMMInterpreter::RuntimeError(const std::string &Msg) {
-#if defined(__APPLE__) || defined(__linux__)
-  const char *StartColor = "\033[1;31m";
-  const char *EndColor = "\033[0m";
-  std::cerr << StartColor;
-#endif // defined(__APPLE__) || defined(__linux__)
-
-  std::cerr << "CMM Runtime Error: ";
+  CMMRuntime::error(Msg);
+}
 
-#if defined(__APPLE__) || defined(__linux__)
-  std::cerr << EndColor;
-#endif // defined(__APPLE__) || defined(__linux__)
-  std::cerr << Msg << std::endl;
-  std::exit(EXIT_FAILURE);
+void CMMInterpreter::stackOverflow(SourceMgr::LocTy Loc) {
+  RT.stackOverflow(SrcMgr.getLineColByLoc(Loc).first + 1);
 }
 
+/// \brief Execute a block. A hoisted block runs in the enclosing scope, and
+/// its variables are cleared however it's left.
 CMMInterpreter::ExecutionResult
-CMMInterpreter::executeBlock(VariableEnv *OuterEnv, const BlockAST *Block) {
+CMMInterpreter::executeBlock(VariableEnv *OuterEnv, const BlockAST *Block,
+                             bool Tail) {
+  if (Block->isHoisted()) {
+    struct HoistedScope {
+      VariableEnv *Env;
+      unsigned Begin, End;
+      ~HoistedScope() { Env->clear(Begin, End); }
+    } Scope{OuterEnv, Block->getHoistedBegin(), Block->getHoistedEnd()};
+    return executeStatementList(OuterEnv, Block->getStatementList(), Tail);
+  }
 
-  ExecutionResult Res;  // Stores last execution result.
-  VariableEnv CurrentEnv(OuterEnv);
+  VariableEnv CurrentEnv(Stack, OuterEnv, Block->getSlots());
+  return executeStatementList(&CurrentEnv, Block->getStatementList(), Tail);
+}
 
-  for (auto &Stmt : Block->getStatementList()) {
-    Res = executeStatement(&CurrentEnv, Stmt.get());
-    if (Res.Kind != ExecutionResult::NormalStatementResult)
+/// \brief Execute statements in order. If they're in \p Tail position, so is
+/// the last one.
+CMMInterpreter::ExecutionResult
+CMMInterpreter::executeStatementList(VariableEnv *Env,
+                        const std::list<std::unique_ptr<StatementAST>> &List,
+                        bool Tail) {
+  for (auto It = List.begin(), E = List.end(); It != E;) {
+    const StatementAST *Stmt = (It++)->get();
+    ExecutionResult Res = executeStatement(Env, Stmt, Tail && It == E);
+    if (Res != NormalStatementResult)
       return Res;
   }
-  return Res;
+  return NormalStatementResult;
 }
 
+/// \brief Execute a statement. A statement in \p Tail position is the last
+/// one a function runs if it completes normally, and leaves its value in
+/// ReturnValue as the default return value.
 CMMInterpreter::ExecutionResult
-CMMInterpreter::executeStatement(VariableEnv *Env, const StatementAST *Stmt) {
+CMMInterpreter::executeStatement(VariableEnv *Env, const StatementAST *Stmt,
+                                 bool Tail) {
   if (!Stmt)
-    return ExecutionResult();
+    return NormalStatementResult;
 
   switch (Stmt->getKind()) {
   default:
@@ -139,11 +121,11 @@ CMMInterpreter::executeStatement(VariableEnv *Env, const StatementAST *Stmt) {
   case StatementAST::DeclarationListStatement:
     return executeDeclarationList(Env, Stmt->as_cptr<DeclarationListAST>());
   case StatementAST::ExprStatement:
-    return executeExprStatement(Env, Stmt->as_cptr<ExprStatementAST>());
+    return executeExprStatement(Env, Stmt->as_cptr<ExprStatementAST>(), Tail);
   case StatementAST::BlockStatement:
-    return executeBlock(Env, Stmt->as_cptr<BlockAST>());
+    return executeBlock(Env, Stmt->as_cptr<BlockAST>(), Tail);
   case StatementAST::IfStatement:
-    return executeIfStatement(Env, Stmt->as_cptr<IfStatementAST>());
+    return executeIfStatement(Env, Stmt->as_cptr<IfStatementAST>(), Tail);
   case StatementAST::ReturnStatement:
     return executeReturnStatement(Env, Stmt->as_cptr<ReturnStatementAST>());
   case StatementAST::WhileStatement:
@@ -159,39 +141,70 @@ CMMInterpreter::executeStatement(VariableEnv *Env, const StatementAST *Stmt) {
 
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeIfStatement(VariableEnv *Env,
-                                   const IfStatementAST *Stmt) {
-  if (evaluateExpression(Env, Stmt->getCondition()).toBool()) {
-    return executeStatement(Env, Stmt->getStatementThen());
+                                   const IfStatementAST *Stmt, bool Tail) {
+  bool Taken = evaluateExpression(Env, Stmt->getCondition()).toBool();
+  if (Jit && Jit->isRecording())
+    Jit->recordBranch(*Stmt, Taken);
+
+  if (Taken) {
+    return executeStatement(Env, Stmt->getStatementThen(), Tail);
   }
   if (const StatementAST *StatementElse = Stmt->getStatementElse()) {
-    return executeStatement(Env, StatementElse);
+    return executeStatement(Env, StatementElse, Tail);
   }
-  return ExecutionResult();
+  return NormalStatementResult;
 }
 
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeForStatement(VariableEnv *Env,
                                     const ForStatementAST *ForStmt) {
+  if (const ExpressionAST *Init = ForStmt->getInit()) {
+    evaluateExpression(Env, Init);
+  }
+  return executeForLoop(Env, ForStmt);
+}
+
+/// \brief Run a for loop from its condition on. Once the loop is hot, its
+/// iterations are run by the trace CMMJit records for it, as long as it can.
+CMMInterpreter::ExecutionResult
+CMMInterpreter::executeForLoop(VariableEnv *Env,
+                               const ForStatementAST *ForStmt) {
   const ExpressionAST *Condition = ForStmt->getCondition();
   const ExpressionAST *Post = ForStmt->getPost();
   const StatementAST  *Statement = ForStmt->getStatement();
 
-  if (const ExpressionAST *Init = ForStmt->getInit()) {
-    evaluateExpression(Env, Init);
-  }
+  for (;;) {
+    if (Jit) {
+      switch (Jit->enterLoop(Env, *ForStmt)) {
+      case CMMJit::TraceNotEntered:
+        break;
+      case CMMJit::TraceDone:
+        return NormalStatementResult;
+      case CMMJit::TraceReturned:
+        return ReturnStatementResult;
+      case CMMJit::TraceTailCalled:
+        return TailCallResult;
+      case CMMJit::TraceNext:
+        if (Post)
+          evaluateExpression(Env, Post);
+        continue;
+      }
+    }
+
+    if (Condition && !evaluateExpression(Env, Condition).toBool())
+      break;
 
-  while (!Condition || evaluateExpression(Env, Condition).toBool()) {
     ExecutionResult Res = executeStatement(Env, Statement);
 
-    if (Res.Kind == Res.ReturnStatementResult)
+    if (Res == ReturnStatementResult || Res == TailCallResult)
       return Res;
-    if (Res.Kind == Res.BreakStatementResult)
+    if (Res == BreakStatementResult)
       break;
 
     if (Post)
       evaluateExpression(Env, Post);
   }
-  return ExecutionResult();
+  return NormalStatementResult;
 }
 
 CMMInterpreter::ExecutionResult
@@ -200,45 +213,158 @@ CMMInterpreter::executeWhileStatement(VariableEnv *Env,
   const ExpressionAST *Condition = WhileStmt->getCondition();
   const StatementAST *Statement = WhileStmt->getStatement();
 
-  while (!Condition || evaluateExpression(Env, Condition).toBool()) {
+  for (;;) {
+    if (Jit) {
+      switch (Jit->enterLoop(Env, *WhileStmt)) {
+      case CMMJit::TraceNotEntered:
+        break;
+      case CMMJit::TraceDone:
+        return NormalStatementResult;
+      case CMMJit::TraceReturned:
+        return ReturnStatementResult;
+      case CMMJit::TraceTailCalled:
+        return TailCallResult;
+      case CMMJit::TraceNext:
+        continue;
+      }
+    }
+
+    if (Condition && !evaluateExpression(Env, Condition).toBool())
+      break;
+
     ExecutionResult Res = executeStatement(Env, Statement);
 
-    if (Res.Kind == Res.ReturnStatementResult)
+    if (Res == ReturnStatementResult || Res == TailCallResult)
       return Res;
-    if (Res.Kind == Res.BreakStatementResult)
+    if (Res == BreakStatementResult)
       break;
   }
-  return ExecutionResult();
+  return NormalStatementResult;
 }
 
+/// \brief Finish an iteration of a loop its trace left at a side exit.
+/// \p Leaf is executed, then the rest of each statement on \p Path, which
+/// holds the statements enclosing it from the loop body down. A loop on the
+/// path is run on to its end.
+CMMInterpreter::ExecutionResult
+CMMInterpreter::resumeIteration(VariableEnv *Env,
+                                const std::vector<const StatementAST *> &Path,
+                                const StatementAST *Leaf, size_t Level) {
+  if (Level == Path.size())
+    return Leaf ? executeStatement(Env, Leaf) : NormalStatementResult;
+
+  const StatementAST *Stmt = Path[Level];
+  const StatementAST *Child = Level + 1 != Path.size() ? Path[Level + 1]
+                                                       : Leaf;
+  ExecutionResult Res = resumeIteration(Env, Path, Leaf, Level + 1);
+
+  switch (Stmt->getKind()) {
+  default:
+    assert(false && "resumeIteration: unknown statement kind on the path");
+  case StatementAST::IfStatement:
+    return Res;
+
+  case StatementAST::BlockStatement: {
+    // A block which isn't hoisted has a scope of its own, which is Env.
+    auto *Block = Stmt->as_cptr<BlockAST>();
+    auto &List = Block->getStatementList();
+    auto It = std::find_if(List.begin(), List.end(),
+        [Child](const std::unique_ptr<StatementAST> &S) {
+          return S.get() == Child;
+        });
+    assert(It != List.end() && "resumeIteration: bad path");
+    while (Res == NormalStatementResult && ++It != List.end())
+      Res = executeStatement(Env, It->get());
+    if (Block->isHoisted())
+      Env->clear(Block->getHoistedBegin(), Block->getHoistedEnd());
+    return Res;
+  }
+
+  case StatementAST::WhileStatement:
+    if (Res == ReturnStatementResult || Res == TailCallResult)
+      return Res;
+    if (Res == BreakStatementResult)
+      return NormalStatementResult;
+    return executeWhileStatement(Env, Stmt->as_cptr<WhileStatementAST>());
+
+  case StatementAST::ForStatement: {
+    if (Res == ReturnStatementResult || Res == TailCallResult)
+      return Res;
+    if (Res == BreakStatementResult)
+      return NormalStatementResult;
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    if (const ExpressionAST *Post = ForStmt->getPost())
+      evaluateExpression(Env, Post);
+    return executeForLoop(Env, ForStmt);
+  }
+  }
+  return NormalStatementResult; // Make the compiler happy.
+}
+
+/// \brief Execute an expression statement. Its value is only kept in
+/// \p Tail position, an assignment isn't even read back otherwise.
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeExprStatement(VariableEnv *Env,
-                                     const ExprStatementAST *Stmt) {
-  return ExecutionResult(ExecutionResult::NormalStatementResult,
-                         evaluateExpression(Env, Stmt->getExpression()));
+                                     const ExprStatementAST *Stmt,
+                                     bool Tail) {
+  const ExpressionAST *Expr = Stmt->getExpression();
+  if (Tail) {
+    if (Expr->isFunctionCallExpr() &&
+        Expr->as_cptr<FunctionCallAST>()->isTailCall())
+      return executeTailCall(Env, Expr->as_cptr<FunctionCallAST>(), false);
+    ReturnValue = evaluateExpression(Env, Expr);
+    return NormalStatementResult;
+  }
+
+  if (Expr->isBinaryOperatorExpression()) {
+    auto *BinOpExpr = Expr->as_cptr<BinaryOperatorAST>();
+    if (BinOpExpr->getOpKind() == BinaryOperatorAST::Assign) {
+      evaluateAssignment(Env, BinOpExpr->getLHS(), BinOpExpr->getRHS(),
+                         BinOpExpr->isTypeChecked());
+      return NormalStatementResult;
+    }
+  }
+  evaluateExpression(Env, Expr);
+  return NormalStatementResult;
 }
 
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeReturnStatement(VariableEnv *Env,
                                        const ReturnStatementAST *Stmt) {
-  ExecutionResult Res(ExecutionResult::ReturnStatementResult);
-
   // ReturnValueExpr can be null.
-  if (const ExpressionAST *ReturnValueExpr = Stmt->getReturnValue())
-    Res.ReturnValue = evaluateExpression(Env, ReturnValueExpr);
-  return Res;
+  if (const ExpressionAST *ReturnValueExpr = Stmt->getReturnValue()) {
+    if (ReturnValueExpr->isFunctionCallExpr() &&
+        ReturnValueExpr->as_cptr<FunctionCallAST>()->isTailCall())
+      return executeTailCall(Env, ReturnValueExpr->as_cptr<FunctionCallAST>(),
+                             true);
+    ReturnValue = evaluateExpression(Env, ReturnValueExpr);
+  }
+  return ReturnStatementResult;
+}
+
+/// \brief Evaluate the arguments of a tail call onto the argument stack and
+/// leave the body, whose frame the call reuses.
+CMMInterpreter::ExecutionResult
+CMMInterpreter::executeTailCall(VariableEnv *Env,
+                                const FunctionCallAST *FuncCall,
+                                bool Returned) {
+  for (auto &P : FuncCall->getArguments())
+    ArgumentStack.push_back(evaluateExpression(Env, P.get()));
+  TailCall = FuncCall;
+  TailCallReturned = Returned;
+  return TailCallResult;
 }
 
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeBreakStatement(VariableEnv *,
                                       const BreakStatementAST *) {
-  return ExecutionResult(ExecutionResult::BreakStatementResult);
+  return BreakStatementResult;
 }
 
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeContinueStatement(VariableEnv *Env,
                                          const ContinueStatementAST *ContStmt) {
-  return ExecutionResult(ExecutionResult::ContinueStatementResult);
+  return ContinueStatementResult;
 }
 
 CMMInterpreter::ExecutionResult
@@ -247,63 +373,43 @@ CMMInterpreter::executeDeclarationList(VariableEnv *Env,
   for (auto &Declaration : DeclList->getDeclarationList()) {
     executeDeclaration(Env, Declaration.get());
   }
-  return ExecutionResult();
+  return NormalStatementResult;
 }
 
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeDeclaration(VariableEnv *Env,
                                    const DeclarationAST *Decl) {
-  const std::string& Name = Decl->getName();
+  Atom Name = Decl->getName();
   cvm::BasicType Type = Decl->getType();
+  unsigned Slot = Decl->getSlot();
 
-  if (Env->contain(Name)) {
-    RuntimeError("variable `" + Decl->getName() +
-        "' is already defined in current scope");
-  }
+  if (Env->Vars[Slot].Declared)
+    CMMRuntime::redeclared(Name);
 
   if (Decl->isArray()) {
     std::list<int> DimensionList;
 
     for (auto &E : Decl->getElementCountList()) {
       cvm::BasicValue Dimension = evaluateExpression(Env, E.get());
-
-      if (!Dimension.isInt()) {
-        RuntimeError("expressions in array declaration `" + Name +
-            "' should be integral type");
-      }
-
-      if (Dimension.IntVal <= 0) {
-        RuntimeError("dimension of array `" + Name + "' declared to be " +
-            std::to_string(Dimension.IntVal) + "; positive number expected");
-      }
-
-      DimensionList.push_back(Dimension.IntVal);
+      DimensionList.push_back(CMMRuntime::dimension(Name, Dimension));
     }
 
-    Env->VarMap.emplace(std::make_pair(Name,
-                                       cvm::BasicValue(Type, DimensionList)));
+    Env->declare(Slot, cvm::BasicValue(Type, DimensionList));
   }
 
   // Now it's a normal variable.
   if (Decl->getInitializer()) {
-    cvm::BasicValue Val = evaluateExpression(Env, Decl->getInitializer());
-
-    if (Val.Type != Decl->getType()) {
-      if (Decl->getType() == cvm::DoubleType && Val.isInt()) {
-        Val.Type = cvm::DoubleType;
-        Val.DoubleVal = static_cast<double>(Val.IntVal);
-      } else {
-        RuntimeError("variable `" + Name + "' is declared to be " +
-            cvm::TypeToStr(Decl->getType()) + ", but is initialized to be " +
-            cvm::TypeToStr(Val.Type));
-      }
-    }
-    Env->VarMap.emplace(std::make_pair(Name, Val));
-  } else {
-    Env->VarMap.emplace(std::make_pair(Name, Decl->getType()));
+    cvm::BasicValue Val = CMMRuntime::initialize(Name, Type,
+        evaluateExpression(Env, Decl->getInitializer()),
+        Decl->isTypeChecked());
+    // An array keeps its value even if it has an initializer.
+    if (!Decl->isArray())
+      Env->declare(Slot, Val);
+  } else if (!Decl->isArray()) {
+    Env->declare(Slot, Decl->getType());
   }
 
-  return ExecutionResult();
+  return NormalStatementResult;
 }
 
 cvm::BasicValue
@@ -324,7 +430,7 @@ CMMInterpreter::evaluateExpression(VariableEnv *Env,
     return Expr->as_cptr<BoolAST>()->getValue();
 
   case ExpressionAST::StringExpression:
-    return Expr->as_cptr<StringAST>()->getValue();
+    return Expr->as_cptr<StringAST>()->getBasicValue();
 
   case ExpressionAST::IdentifierExpression:
     return evaluateIdentifierExpr(Env, Expr->as_cptr<IdentifierAST>());
@@ -346,20 +452,24 @@ CMMInterpreter::evaluateExpression(VariableEnv *Env,
 cvm::BasicValue
 CMMInterpreter::evaluateFunctionCallExpr(VariableEnv *Env,
                                          const FunctionCallAST *FuncCall) {
-  auto UserFuncIt = UserFunctionMap.find(FuncCall->getCallee());
-  if (UserFuncIt != UserFunctionMap.end()) {
-    auto Args(evaluateArgumentList(Env, FuncCall->getArguments()));
-    return callUserFunction(UserFuncIt->second, Args,
-                            FuncCall->isDynamicBound() ? Env : nullptr);
+  if (auto *UserFunction = FuncCall->getUserFunction()) {
+    enterCall(FuncCall->getLoc());
+    auto &Args = FuncCall->getArguments();
+    VariableEnv FuncEnv(Stack, FuncCall->isDynamicBound() ? Env : &TopLevelEnv,
+                        UserFunction->getSlots(), Args.size());
+    evaluateArgumentList(Env, Args, FuncEnv);
+    cvm::BasicValue Result = callUserFunction(*UserFunction, FuncEnv,
+                                              Args.size(),
+                                              FuncCall->isTypeChecked());
+    leaveCall();
+    return Result;
   }
 
-  auto NativeFuncIt = NativeFunctionMap.find(FuncCall->getCallee());
-  if (NativeFuncIt != NativeFunctionMap.end()) {
-    auto Args(evaluateArgumentList(Env, FuncCall->getArguments()));
-    return callNativeFunction(NativeFuncIt->second, Args);
+  if (auto Native = FuncCall->getNativeFunction()) {
+    return callNativeFunction(Env, Native, FuncCall->getArguments());
   }
 
-  RuntimeError("function `" + FuncCall->getCallee() + "' is undefined");
+  RuntimeError("function `" + FuncCall->getCallee().str() + "' is undefined");
   return evaluateFunctionCallExpr(nullptr, nullptr); // Make the compiler happy.
 }
 
@@ -368,7 +478,7 @@ CMMInterpreter::evaluateFunctionCallExpr(VariableEnv *Env,
 /// 1. IdentifierExpression
 /// 2. ArrayIdentifier [ IndexExpression ]
 /// 3. IdentifierExpression = Expression
-cvm::BasicValue &
+cvm::ValueRef
 CMMInterpreter::evaluateLvalueExpr(VariableEnv *Env,
                                    const ExpressionAST *Expr) {
   if (Expr->isIdentifierExpr())
@@ -381,7 +491,8 @@ CMMInterpreter::evaluateLvalueExpr(VariableEnv *Env,
     if (BinOpExpr->getOpKind() == BinaryOperatorAST::Index)
       return evaluateIndexExpr(Env, BinOpExpr->getLHS(), BinOpExpr->getRHS());
     if (BinOpExpr->getOpKind() == BinaryOperatorAST::Assign)
-      return evaluateAssignment(Env, BinOpExpr->getLHS(), BinOpExpr->getRHS());
+      return evaluateAssignment(Env, BinOpExpr->getLHS(), BinOpExpr->getRHS(),
+                                BinOpExpr->isTypeChecked());
 
     RuntimeError("try to evaluate a rvalue binOpExpr as lvalue");
   }
@@ -394,76 +505,14 @@ CMMInterpreter::evaluateLvalueExpr(VariableEnv *Env,
 cvm::BasicValue &
 CMMInterpreter::evaluateIdentifierExpr(VariableEnv *Env,
                                        const IdentifierAST *IdExpr) {
-  return searchVariable(Env, IdExpr->getName())->second;
+  return searchVariable(Env, IdExpr);
 }
 
 cvm::BasicValue
 CMMInterpreter::evaluateUnaryOpExpr(VariableEnv *Env,
                                     const UnaryOperatorAST *Expr) {
-
-  cvm::BasicValue Operand = evaluateExpression(Env, Expr->getOperand());
-
-  switch (auto OpKind = Expr->getOpKind()) {
-  default:
-    RuntimeError("unknown unary operator kind (code :" +
-        std::to_string(OpKind) + ")");
-
-  case UnaryOperatorAST::Plus:
-  case UnaryOperatorAST::Minus:
-    return evaluateUnaryArith(OpKind, Operand);
-
-  case UnaryOperatorAST::LogicalNot:
-    return evaluateUnaryLogical(OpKind, Operand);
-
-  case UnaryOperatorAST::BitwiseNot:
-    return evaluateUnaryBitwise(OpKind, Operand);
-  }
-}
-
-/// \brief Perform unary arithmetic operation (+,-) on value
-cvm::BasicValue
-CMMInterpreter::evaluateUnaryArith(UnaryOperatorAST::OperatorKind OpKind,
-                                   cvm::BasicValue Operand) {
-  if (!Operand.isNumeric()) {
-    RuntimeError("operands of unary arithmetic operations should be numeric");
-  }
-  if (OpKind == UnaryOperatorAST::Plus)
-    return Operand;
-  if (OpKind == UnaryOperatorAST::Minus) {
-    if (Operand.isInt())
-      return -Operand.IntVal;
-    else
-      return -Operand.DoubleVal;
-  }
-
-  RuntimeError(std::to_string(OpKind) +
-      " is not valid unary arithmetic operation kind");
-  return cvm::BasicValue(); // Make the compiler happy.
-}
-
-/// \brief Perform unary bitwise operation (!) on value
-cvm::BasicValue
-CMMInterpreter::evaluateUnaryLogical(UnaryOperatorAST::OperatorKind OpKind,
-                                     cvm::BasicValue Operand) {
-  if (OpKind != UnaryOperatorAST::LogicalNot) {
-    RuntimeError(std::to_string(OpKind) +
-        " is not valid unary logical operation kind");
-  }
-  return !Operand.toBool();
-}
-
-/// \brief Perform unary bitwise operation (~) on value
-cvm::BasicValue
-CMMInterpreter::evaluateUnaryBitwise(UnaryOperatorAST::OperatorKind OpKind,
-                                     cvm::BasicValue Operand) {
-  if (OpKind != UnaryOperatorAST::BitwiseNot) {
-    RuntimeError(std::to_string(OpKind) +
-        " is not valid unary bitwise operation kind");
-  }
-  if (!Operand.isInt()) {
-    RuntimeError("operand of unary bitwise operation should be int");
-  }
-  return ~Operand.IntVal;
+  return CMMRuntime::unaryOp(Expr->getOpKind(),
+                             evaluateExpression(Env, Expr->getOperand()));
 }
 
 cvm::BasicValue
@@ -473,12 +522,15 @@ CMMInterpreter::evaluateBinaryOpExpr(VariableEnv *Env,
   default: {
     cvm::BasicValue LHS = evaluateExpression(Env, Expr->getLHS());
     cvm::BasicValue RHS = evaluateExpression(Env, Expr->getRHS());
+    if (Expr->getQuickening() != BinaryOperatorAST::Deoptimized)
+      return evaluateQuickenedBinOp(Expr, LHS, RHS);
     return evaluateBinaryCalc(Expr->getOpKind(), LHS, RHS);
   }
   case BinaryOperatorAST::Assign:
-    return evaluateAssignment(Env, Expr->getLHS(), Expr->getRHS());
+    return evaluateAssignment(Env, Expr->getLHS(), Expr->getRHS(),
+                              Expr->isTypeChecked()).get();
   case BinaryOperatorAST::Index:
-    return evaluateIndexExpr(Env, Expr->getLHS(), Expr->getRHS());
+    return evaluateIndexExpr(Env, Expr->getLHS(), Expr->getRHS()).get();
   case BinaryOperatorAST::LogicalAnd:
     return evaluateLogicalAnd(Env, Expr->getLHS(), Expr->getRHS());
   case BinaryOperatorAST::LogicalOr:
@@ -486,118 +538,111 @@ CMMInterpreter::evaluateBinaryOpExpr(VariableEnv *Env,
   }
 }
 
-cvm::BasicValue &
+/// \brief Return the reference of an element or a sub-array. A sub-array is
+/// only created if the reference is evaluated as a value.
+cvm::ValueRef
 CMMInterpreter::evaluateIndexExpr(VariableEnv *Env,
                                   const ExpressionAST *BaseExpr,
                                   const ExpressionAST *IndexExpr) {
 
-  cvm::BasicValue &Base = evaluateLvalueExpr(Env, BaseExpr);
-  if (!Base.isArray())
-    RuntimeError("too many index or index expression didn't start with array");
+  cvm::ValueRef Base =
+      CMMRuntime::getArrayView(evaluateLvalueExpr(Env, BaseExpr));
+  return CMMRuntime::index(Base, evaluateExpression(Env, IndexExpr));
+}
 
-  cvm::BasicValue Index = evaluateExpression(Env, IndexExpr);
-  if (!Index.isInt())
-    RuntimeError("non-int index in index expression");
+/// \brief Evaluate a binary operator by the fast path it's quickened to, if
+/// the operands pass its guard. A node not quickened yet is quickened after
+/// its operands, and deoptimized to the generic path on a miss.
+cvm::BasicValue
+CMMInterpreter::evaluateQuickenedBinOp(const BinaryOperatorAST *Expr,
+                                       const cvm::BasicValue &LHS,
+                                       const cvm::BasicValue &RHS) {
+  BinaryOperatorAST::OperatorKind OpKind = Expr->getOpKind();
+
+  switch (Expr->getQuickening()) {
+  case BinaryOperatorAST::QuickenedInt:
+    if (LHS.isInt() && RHS.isInt())
+      return evaluateIntBinOp(OpKind, LHS.IntVal, RHS.IntVal);
+    break;
+
+  case BinaryOperatorAST::QuickenedDouble:
+    if (LHS.isDouble() && RHS.isDouble())
+      return evaluateDoubleBinOp(OpKind, LHS.DoubleVal, RHS.DoubleVal);
+    break;
+
+  case BinaryOperatorAST::NotQuickened:
+    if (LHS.isInt() && RHS.isInt()) {
+      Expr->quicken(BinaryOperatorAST::QuickenedInt);
+      return evaluateIntBinOp(OpKind, LHS.IntVal, RHS.IntVal);
+    }
+    // Bitwise operators on doubles are errors, left to the generic path.
+    if (LHS.isDouble() && RHS.isDouble() &&
+        (OpKind < BinaryOperatorAST::BitwiseAnd ||
+         OpKind > BinaryOperatorAST::RightShift)) {
+      Expr->quicken(BinaryOperatorAST::QuickenedDouble);
+      return evaluateDoubleBinOp(OpKind, LHS.DoubleVal, RHS.DoubleVal);
+    }
+    break;
 
-  size_t ArraySize = Base.ArrayPtr->size();
-  if (Index.IntVal < 0 || Index.IntVal >= static_cast<int>(ArraySize)) {
-    RuntimeError("index out of range: should within [0," +
-        std::to_string(ArraySize) + "); actually got index " +
-        std::to_string(Index .IntVal));
+  case BinaryOperatorAST::Deoptimized:
+    break;
   }
-  return Base.ArrayPtr->at(static_cast<size_t>(Index.IntVal));
+
+  Expr->quicken(BinaryOperatorAST::Deoptimized);
+  return evaluateBinaryCalc(OpKind, LHS, RHS);
 }
 
 cvm::BasicValue
-CMMInterpreter::evaluateBinaryCalc(BinaryOperatorAST::OperatorKind OpKind,
-                                   cvm::BasicValue LHS, cvm::BasicValue RHS) {
+CMMInterpreter::evaluateIntBinOp(BinaryOperatorAST::OperatorKind OpKind,
+                                 int LHS, int RHS) {
   switch (OpKind) {
   default:
-    RuntimeError("unknown binary operator kind (code :" +
-        std::to_string(OpKind) + ")");
-  case BinaryOperatorAST::Add:
-    if (LHS.isString() || RHS.isString())
-      return LHS.toString() + RHS.toString();
-    /* fall Through */
-  case BinaryOperatorAST::Minus:
-  case BinaryOperatorAST::Multiply:
-  case BinaryOperatorAST::Division:
-  case BinaryOperatorAST::Modulo:
-    return evaluateBinArith(OpKind, LHS, RHS);
-
-  case BinaryOperatorAST::Less:
-  case BinaryOperatorAST::LessEqual:
-  case BinaryOperatorAST::Equal:
-  case BinaryOperatorAST::NotEqual:
-  case BinaryOperatorAST::Greater:
-  case BinaryOperatorAST::GreaterEqual:
-    return evaluateBinRelation(OpKind, LHS, RHS);
-
-  case BinaryOperatorAST::BitwiseAnd:
-  case BinaryOperatorAST::BitwiseOr:
-  case BinaryOperatorAST::BitwiseXor:
+    return evaluateBinaryCalc(OpKind, LHS, RHS);
+  case BinaryOperatorAST::Add:      return CMMRuntime::add(LHS, RHS);
+  case BinaryOperatorAST::Minus:    return CMMRuntime::subtract(LHS, RHS);
+  case BinaryOperatorAST::Multiply: return CMMRuntime::multiply(LHS, RHS);
+  case BinaryOperatorAST::Division: return CMMRuntime::divide(LHS, RHS);
+  case BinaryOperatorAST::Modulo:   return CMMRuntime::modulo(LHS, RHS);
+  case BinaryOperatorAST::Less:         return LHS < RHS;
+  case BinaryOperatorAST::LessEqual:    return LHS <= RHS;
+  case BinaryOperatorAST::Equal:        return LHS == RHS;
+  case BinaryOperatorAST::NotEqual:     return LHS != RHS;
+  case BinaryOperatorAST::Greater:      return LHS > RHS;
+  case BinaryOperatorAST::GreaterEqual: return LHS >= RHS;
+  case BinaryOperatorAST::BitwiseAnd:   return LHS & RHS;
+  case BinaryOperatorAST::BitwiseOr:    return LHS | RHS;
+  case BinaryOperatorAST::BitwiseXor:   return LHS ^ RHS;
   case BinaryOperatorAST::LeftShift:
+    return CMMRuntime::shiftLeft(LHS, RHS);
   case BinaryOperatorAST::RightShift:
-    return evaluateBinBitwise(OpKind, LHS, RHS);
-
-  case BinaryOperatorAST::LogicalAnd:
-  case BinaryOperatorAST::LogicalOr:
-  case BinaryOperatorAST::Assign:
-  case BinaryOperatorAST::Index:
-    RuntimeError("assignment/index/logicalBinOp "
-                     "should be handled in evaluateBinaryOpExpr");
+    return CMMRuntime::shiftRight(LHS, RHS);
   }
-  return cvm::BasicValue(); // Make the compiler happy.
 }
 
-/// \brief Perform binary arithmetic operation (+,-,*,/) on values
 cvm::BasicValue
-CMMInterpreter::evaluateBinArith(BinaryOperatorAST::OperatorKind OpKind,
-                                 cvm::BasicValue LHS, cvm::BasicValue RHS) {
-  if (!LHS.isNumeric() || !RHS.isNumeric()) {
-    RuntimeError("operands of binary arithmetic operations should be numeric");
-  }
-
-  if (LHS.isInt() && RHS.isInt()) {
-    switch (OpKind) {
-    default:
-      RuntimeError(std::to_string(OpKind) +
-          " is not valid binary arithmetic operation kind");
-    case BinaryOperatorAST::Add:
-      return LHS.IntVal + RHS.IntVal;
-    case BinaryOperatorAST::Minus:
-      return LHS.IntVal - RHS.IntVal;
-    case BinaryOperatorAST::Multiply:
-      return LHS.IntVal * RHS.IntVal;
-    case BinaryOperatorAST::Modulo:
-      if (RHS.IntVal == 0)
-        RuntimeError("int modulo by zero");
-      return LHS.IntVal % RHS.IntVal;
-    case BinaryOperatorAST::Division:
-      if (RHS.IntVal == 0)
-        RuntimeError("int division by zero");
-      return LHS.IntVal / RHS.IntVal;
-    }
-  }
-
-  double L = LHS.toDouble(), R = RHS.toDouble();
+CMMInterpreter::evaluateDoubleBinOp(BinaryOperatorAST::OperatorKind OpKind,
+                                    double LHS, double RHS) {
   switch (OpKind) {
   default:
-    RuntimeError(std::to_string(OpKind) +
-        " is not a valid binary arithmetic operation kind");
-  case BinaryOperatorAST::Add:
-    return L + R;
-  case BinaryOperatorAST::Minus:
-    return L - R;
-  case BinaryOperatorAST::Multiply:
-    return L * R;
-  case BinaryOperatorAST::Division:
-    return L / R;
-  case BinaryOperatorAST::Modulo:
-    //RuntimeError("operands of modulo operator should be int");
-    return std::fmod(L, R);
-  }
-  return cvm::BasicValue(); // Make the compiler happy.
+    return evaluateBinaryCalc(OpKind, LHS, RHS);
+  case BinaryOperatorAST::Add:          return LHS + RHS;
+  case BinaryOperatorAST::Minus:        return LHS - RHS;
+  case BinaryOperatorAST::Multiply:     return LHS * RHS;
+  case BinaryOperatorAST::Division:     return LHS / RHS;
+  case BinaryOperatorAST::Modulo:       return std::fmod(LHS, RHS);
+  case BinaryOperatorAST::Less:         return LHS < RHS;
+  case BinaryOperatorAST::LessEqual:    return LHS <= RHS;
+  case BinaryOperatorAST::Equal:        return LHS == RHS;
+  case BinaryOperatorAST::NotEqual:     return LHS != RHS;
+  case BinaryOperatorAST::Greater:      return LHS > RHS;
+  case BinaryOperatorAST::GreaterEqual: return LHS >= RHS;
+  }
+}
+
+cvm::BasicValue
+CMMInterpreter::evaluateBinaryCalc(BinaryOperatorAST::OperatorKind OpKind,
+                                   cvm::BasicValue LHS, cvm::BasicValue RHS) {
+  return CMMRuntime::binaryOp(OpKind, LHS, RHS);
 }
 
 /// \brief Perform binary logical and (&&) on expressions
@@ -620,178 +665,172 @@ CMMInterpreter::evaluateLogicalOr(VariableEnv *Env,
       evaluateExpression(Env, RHS).toBool();
 }
 
-/// \brief Perform binary relational operation (<, <=, ==, !=, >, >=) on values
-cvm::BasicValue
-CMMInterpreter::evaluateBinRelation(BinaryOperatorAST::OperatorKind OpKind,
-                                    cvm::BasicValue LHS, cvm::BasicValue RHS) {
-  if (LHS.Type != RHS.Type) {
-    if (LHS.isNumeric() && RHS.isNumeric()) {
-      return evaluateBinRelation(OpKind, LHS.toDouble(), RHS.toDouble());
+/// \brief Return the variable an identifier refers to by its binding.
+/// Fall back to searching by name if the slot is not declared yet, or a top
+/// level variable is referred to in a function called with dynamic binding.
+cvm::BasicValue &
+CMMInterpreter::searchVariable(VariableEnv *Env, const IdentifierAST *Id) {
+  const VariableBinding &Binding = Id->getBinding();
+
+  if (Binding.Kind != VariableBinding::DynamicBinding) {
+    VariableEnv *E = Env;
+    for (unsigned Depth = Binding.Depth; Depth != 0; --Depth)
+      E = E->OuterEnv;
+
+    if (Binding.Kind == VariableBinding::LocalBinding || E == &TopLevelEnv) {
+      Variable &Var = E->Vars[Binding.Slot];
+      if (Var.Declared)
+        return Var.Value;
     }
-    RuntimeError("relational operator should apply to identical type");
-  }
-
-  switch (OpKind) {
-  default:
-    RuntimeError(std::to_string(OpKind) +
-        " is not a valid binary relational operation kind");
-  case cmm::BinaryOperatorAST::Less:
-    return LHS < RHS;
-  case cmm::BinaryOperatorAST::LessEqual:
-    return LHS <= RHS;
-  case cmm::BinaryOperatorAST::Equal:
-    return LHS == RHS;
-  case cmm::BinaryOperatorAST::NotEqual:
-    return LHS != RHS;
-  case cmm::BinaryOperatorAST::Greater:
-    return LHS > RHS;
-  case cmm::BinaryOperatorAST::GreaterEqual:
-    return LHS >= RHS;
-  }
-}
-
-/// \brief Perform binary bitwise operation (<<,>>,&,|) on values
-cvm::BasicValue
-CMMInterpreter::evaluateBinBitwise(BinaryOperatorAST::OperatorKind OpKind,
-                                   cvm::BasicValue LHS, cvm::BasicValue RHS) {
-  if (!LHS.isInt() || !RHS.isInt()) {
-    RuntimeError("operands of bitwise operations should be int");
-  }
-
-  switch (OpKind) {
-  default:
-    RuntimeError(std::to_string(OpKind) +
-        " is not a valid binary bitwise operation kind");
-  case cmm::BinaryOperatorAST::BitwiseAnd:
-    return LHS.IntVal & RHS.IntVal;
-  case cmm::BinaryOperatorAST::BitwiseOr:
-    return LHS.IntVal | RHS.IntVal;
-  case cmm::BinaryOperatorAST::BitwiseXor:
-    return LHS.IntVal ^ RHS.IntVal;
-  case cmm::BinaryOperatorAST::LeftShift:
-    return LHS.IntVal << RHS.IntVal;
-  case cmm::BinaryOperatorAST::RightShift:
-    return LHS.IntVal >> RHS.IntVal;
   }
+  return searchVariable(Env, Id->getName());
 }
 
+cvm::BasicValue &
+CMMInterpreter::searchVariable(VariableEnv *Env, Atom Name) {
 
-std::map<std::string, cvm::BasicValue>::iterator
-CMMInterpreter::searchVariable(VariableEnv *Env, const std::string &Name) {
-
+  // Variables of hoisted blocks come after those of the enclosing blocks in
+  // a scope, search backward for the innermost one.
   for (VariableEnv *E = Env; E != nullptr; E = E->OuterEnv) {
-    std::map<std::string, cvm::BasicValue>::iterator It = E->VarMap.find(Name);
-    if (It != E->VarMap.end())
-      return It;
+    for (size_t Slot = E->Names->size(); Slot-- != 0; ) {
+      if (E->Vars[Slot].Declared && (*E->Names)[Slot] == Name)
+        return E->Vars[Slot].Value;
+    }
   }
-  RuntimeError("variable `" + Name + "' is undefined");
-  return searchVariable(nullptr, nullptr); // Make the compiler happy.
+  CMMRuntime::undefinedVariable(Name);
 }
 
-std::list<cvm::BasicValue>
-CMMInterpreter::evaluateArgumentList(VariableEnv *Env, const std::list
-    <std::unique_ptr<ExpressionAST>> &Args) {
+/// \brief Evaluate arguments of a user function call into the first slots
+/// of the callee's frame, where its parameters live.
+void CMMInterpreter::evaluateArgumentList(VariableEnv *Env, const std::list
+    <std::unique_ptr<ExpressionAST>> &Args, VariableEnv &FuncEnv) {
 
-  std::list<cvm::BasicValue> Res;
+  Variable *Slot = FuncEnv.Vars;
   for (auto &P : Args) {
-    Res.emplace_back(evaluateExpression(Env, P.get()));
+    Slot->Value = evaluateExpression(Env, P.get());
+    ++Slot;
   }
-  return Res;
 }
 
-cvm::BasicValue
-CMMInterpreter::callNativeFunction(const NativeFunction &Function,
-                                   std::list<cvm::BasicValue> &Args) {
-  return Function(Args);
+/// \brief Evaluate arguments onto the argument stack, where the native
+/// function reads them in place.
+cvm::BasicValue CMMInterpreter::callNativeFunction(VariableEnv *Env,
+    cvm::NativeFunction Function,
+    const std::list<std::unique_ptr<ExpressionAST>> &Args) {
+
+  size_t Base = ArgumentStack.size();
+  for (auto &P : Args)
+    ArgumentStack.push_back(evaluateExpression(Env, P.get()));
+
+  cvm::BasicValue Res =
+      Function(cvm::ValueSpan(ArgumentStack.data() + Base, Args.size()));
+  ArgumentStack.resize(Base);
+  return Res;
 }
 
 cvm::BasicValue
 CMMInterpreter::evaluateInfixOpExpr(VariableEnv *Env,
                                     const InfixOpExprAST *Expr) {
-  auto InfixOpIt = InfixOpMap.find(Expr->getSymbol());
-
-  if (InfixOpIt == InfixOpMap.end()) {
-    RuntimeError("Infix operator " + Expr->getSymbol() + " is undefined");
+  const InfixOpDefinitionAST *InfixOp = Expr->getInfixOp();
+  if (!InfixOp) {
+    RuntimeError("Infix operator " + Expr->getSymbol().str() +
+                 " is undefined");
   }
 
-  const InfixOpDefinitionAST &InfixOpDef = InfixOpIt->second;
-  VariableEnv InfixOpEnv(&TopLevelEnv);
+  enterCall(Expr->getLoc());
+  const InfixOpDefinitionAST &InfixOpDef = *InfixOp;
+  VariableEnv InfixOpEnv(Stack, &TopLevelEnv, InfixOpDef.getSlots());
 
-  cvm::BasicValue LHSVal = evaluateExpression(Env, Expr->getLHS());
-  cvm::BasicValue RHSVal = evaluateExpression(Env, Expr->getRHS());
-  InfixOpEnv.VarMap.emplace(std::make_pair(InfixOpDef.getLHSName(), LHSVal));
-  InfixOpEnv.VarMap.emplace(std::make_pair(InfixOpDef.getRHSName(), RHSVal));
+  // Operands take the first two slots.
+  InfixOpEnv.declare(0, evaluateExpression(Env, Expr->getLHS()));
+  InfixOpEnv.declare(1, evaluateExpression(Env, Expr->getRHS()));
 
-  ExecutionResult Result = executeStatement(&InfixOpEnv,
-                                            InfixOpDef.getStatement());
+  executeStatement(&InfixOpEnv, InfixOpDef.getStatement(), true);
 
-  if (Result.ReturnValue.isVoid()) {
-    RuntimeError("infix operator didn't return any value");
-  }
-  return Result.ReturnValue;
+  cvm::BasicValue Result = std::move(ReturnValue);
+  ReturnValue = cvm::BasicValue();
+  if (Result.isVoid())
+    CMMRuntime::noInfixResult();
+  leaveCall();
+  return Result;
 }
 
+/// \brief Call a user function whose frame holds the arguments in its first
+/// slots. The types of the arguments aren't checked if they're \p Checked
+/// statically.
 cvm::BasicValue
 CMMInterpreter::callUserFunction(const FunctionDefinitionAST &Function,
-                                 std::list<cvm::BasicValue> &Args,
-                                 VariableEnv *Env) {
-  if (Args.size() != Function.getParameterCount()) {
-    RuntimeError("Function `" + Function.getName() + "' expects " +
-        std::to_string(Function.getParameterCount()) + " parameter(s), " +
-        std::to_string(Args.size()) + " argument(s) provided");
-  }
-
-  VariableEnv FuncEnv(Env ? Env : &TopLevelEnv);
-
-  auto It = Function.getParameterList().cbegin();
-  auto End = Function.getParameterList().cend();
-  for (cvm::BasicValue &Arg : Args) {
-    if (It->getType() != Arg.Type) {
-      if (Arg.isInt() && It->getType() == cvm::DoubleType) {
-        Arg.DoubleVal = Arg.IntVal;
-        Arg.Type = cvm::DoubleType;
-      } else {
-        RuntimeError("in function `" + Function.getName() + "', parameter `" +
-          It->getName() + "' has type " + cvm::TypeToStr(It->getType()) +
-          ", but argument is " + cvm::TypeToStr(Arg.Type));
+                                 VariableEnv &FuncEnv, size_t ArgCount,
+                                 bool Checked) {
+  if (ArgCount != Function.getParameterCount()) {
+    CMMRuntime::badArgumentCount(Function.getName(),
+                                 Function.getParameterCount(), ArgCount);
+  }
+
+  // A tail call runs the body again in the same frame, the value is checked
+  // if any of the calls returns it explicitly.
+  bool Returned = false;
+  ExecutionResult Res;
+  for (;;) {
+    // Parameters take the first slots in order, arguments become them in
+    // place.
+    Variable *Arg = FuncEnv.Vars;
+    for (auto &Param : Function.getParameterList()) {
+      if (!Checked) {
+        CMMRuntime::passArgument(Arg->Value, Param.getType(),
+                                 Function.getName(), Param.getName());
       }
+
+      if (Param.getName().empty()) // We allow empty parameter name.
+        Arg->Value = cvm::BasicValue();
+      else
+        Arg->Declared = true;
+      ++Arg;
     }
 
-    if (!It->getName().empty()) // We allow empty parameter name.
-      FuncEnv.VarMap.emplace(It->getName(), Arg);
-    ++It;
-  }
+    // Compiled code takes scalar arguments only.
+    if (Jit) {
+      if (auto Entry = Jit->getEntry(Function)) {
+        if (std::none_of(FuncEnv.Vars, FuncEnv.Vars + ArgCount,
+                         [](const Variable &V) { return V.Value.isArray(); }))
+          return CMMJit::makeValue(Function.getType(),
+                                   Entry(Jit.get(), FuncEnv.Vars));
+      }
+    }
 
-  ExecutionResult Result = executeStatement(&FuncEnv, Function.getStatement());
-  if (Result.Kind == ExecutionResult::ReturnStatementResult &&
-      Result.ReturnValue.Type != Function.getType()) {
-    RuntimeError("function `" + Function.getName() + "' ought to return " +
-        cvm::TypeToStr(Function.getType()) + ", but got " +
-        cvm::TypeToStr(Result.ReturnValue.Type));
-  }
-  return Result.ReturnValue;
-}
+    Res = executeStatement(&FuncEnv, Function.getStatement(), true);
+    if (Res != TailCallResult)
+      break;
 
-cvm::BasicValue &
+    // The callee sees top level variables even if the caller is dynamic
+    // bound, and none of the caller's.
+    Checked = TailCall->isTypeChecked();
+    Returned |= TailCallReturned;
+    FuncEnv.OuterEnv = &TopLevelEnv;
+    FuncEnv.clear(0, static_cast<unsigned>(FuncEnv.Size));
+    size_t Base = ArgumentStack.size() - ArgCount;
+    for (size_t I = 0; I != ArgCount; ++I)
+      FuncEnv.Vars[I].Value = std::move(ArgumentStack[Base + I]);
+    ArgumentStack.resize(Base);
+  }
+
+  cvm::BasicValue Result = std::move(ReturnValue);
+  ReturnValue = cvm::BasicValue();
+  if (Res == ReturnStatementResult || Returned)
+    CMMRuntime::checkReturnValue(Result, Function.getType(),
+                                 Function.getName());
+  return Result;
+}
+
+/// \brief Assign a value to a variable. The type of the value isn't checked
+/// if it's \p Checked statically to be the type of the variable.
+cvm::ValueRef
 CMMInterpreter::evaluateAssignment(VariableEnv *Env,
                                    const ExpressionAST *RefExpr,
-                                   const ExpressionAST *ValExpr) {
-  cvm::BasicValue &Variable = evaluateLvalueExpr(Env, RefExpr);
-  cvm::BasicValue Value = evaluateExpression(Env, ValExpr);
-
-  if (Variable.isArray()) {
-    RuntimeError("cannot assign value to array directly");
-  }
-
-  if (Variable.Type != Value.Type) {
-    if (Variable.isDouble() && Value.isInt()) {
-      Variable.DoubleVal = Value.IntVal;
-      return Variable;
-    } else {
-      RuntimeError("assignment to " + cvm::TypeToStr(Variable.Type) +
-          " variable with " + cvm::TypeToStr(Value.Type) + " expression");
-    }
-  }
-  return Variable = Value;
+                                   const ExpressionAST *ValExpr,
+                                   bool Checked) {
+  cvm::ValueRef Variable = evaluateLvalueExpr(Env, RefExpr);
+  CMMRuntime::assign(Variable, evaluateExpression(Env, ValExpr), Checked);
+  return Variable;
 }
 
@@ -0,0 +1,2405 @@
+#include "CMMJit.h"
+#include "CMMInterpreter.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#if defined(__x86_64__) && (defined(__APPLE__) || defined(__linux__))
+#define CMM_JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // defined(__x86_64__) && (defined(__APPLE__) || defined(__linux__))
+
+using namespace cmm;
+
+const unsigned CMMJit::CallThreshold;
+const unsigned CMMJit::TraceThreshold;
+const unsigned CMMJit::RecordIterations;
+const unsigned CMMJit::RecordBudget;
+const unsigned CMMJit::MaxTraceBases;
+
+static_assert(sizeof(cvm::BasicType) == 4, "types are stored as 32-bit words");
+
+static bool isScalarType(cvm::BasicType Type) {
+  return Type == cvm::IntType || Type == cvm::DoubleType ||
+         Type == cvm::BoolType;
+}
+
+static bool isNumericType(cvm::BasicType Type) {
+  return Type == cvm::IntType || Type == cvm::DoubleType;
+}
+
+/// \brief Translate a function or a traced loop to native code, node by node.
+///
+/// The frame of the function is addressed by r12, and rbx holds the CMMJit
+/// passed to the runtime. An expression leaves an int or a bool in eax, or
+/// a double in xmm0. An operand is pushed while the other is evaluated, then
+/// they're in eax and ecx, or xmm0 and xmm1. Arguments passed to the runtime
+/// are pushed in order, the last one on top.
+///
+/// A trace takes its context in r14. The scope the loop runs in is addressed
+/// by r12, the scope of its body by r13 if it has one, and the other scopes
+/// are loaded into rsi from the context where they are accessed.
+class CMMJit::CodeGenerator {
+private:  /* private data types */
+  enum Register : uint8_t {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R12 = 12, R13 = 13, R14 = 14, R15 = 15, NoRegister = 0xFF
+  };
+  enum XMMRegister : uint8_t { XMM0 = 0, XMM1 = 1 };
+
+  /// Condition codes, negated by flipping the lowest bit.
+  enum Condition : uint8_t {
+    CondB = 0x2, CondAE = 0x3, CondE = 0x4, CondNE = 0x5, CondBE = 0x6,
+    CondA = 0x7, CondP = 0xA, CondNP = 0xB, CondL = 0xC, CondGE = 0xD,
+    CondLE = 0xE, CondG = 0xF
+  };
+
+  /// A position in the code, jumps to it are patched once it's bound.
+  struct Label {
+    static const size_t Unbound = static_cast<size_t>(-1);
+    size_t Pos = Unbound;
+    std::vector<size_t> Uses;
+  };
+
+  struct Loop {
+    Label *Break;
+    Label *Continue;
+    /// Number of blocks entered out of the loop.
+    size_t Blocks;
+  };
+
+  /// A variable at \p Disp from the scope in \p Base. Rank is the number of
+  /// dimensions of an array, 0 for a scalar. A trace may keep it in the
+  /// register \p Value while it runs.
+  struct VariableRef {
+    Register Base;
+    unsigned Index;
+    int32_t Disp;
+    cvm::BasicType Type;
+    int Rank;
+    Register Value;
+  };
+
+  /// A variable of a trace \p Level scopes out from the loop, whose uses are
+  /// counted to choose those kept in registers.
+  struct VariableUse {
+    unsigned Level;
+    unsigned Slot;
+    bool Global;
+    unsigned Count;
+  };
+
+  /// The state of the code before a statement of a trace, restored if it
+  /// can't be compiled.
+  struct Checkpoint {
+    size_t CodeSize;
+    size_t Loops;
+    size_t Blocks;
+  };
+
+private:  /*  private member variables  */
+  CMMJit &Jit;
+  std::vector<uint8_t> Code;
+
+  /// The function compiled, null if it's a trace.
+  const FunctionDefinitionAST *Function = nullptr;
+  Candidate *Cand = nullptr;
+  std::vector<cvm::BasicType> ParamTypes;
+
+  /// The trace compiled, the scope it's compiled in, and the statements
+  /// enclosing the one being compiled from the body of the loop down.
+  Trace *T = nullptr;
+  CMMInterpreter::VariableEnv *Env = nullptr;
+  bool InScope = false;
+  std::vector<const StatementAST *> Path;
+  unsigned NativeStatements = 0;
+  /// Variables kept in registers, with their levels.
+  std::vector<std::pair<unsigned, VariableRef>> Promoted;
+
+  /// Slots of the innermost scope, and those declared to be arrays somewhere,
+  /// which are cleared by the runtime.
+  size_t FrameSize;
+  std::vector<bool> ArraySlots;
+
+  /// Words pushed since the prologue, which leaves the stack 16 byte aligned.
+  unsigned Depth = 0;
+  Label BodyStart;
+  Label Epilogue;
+  /// Where a trace writes back the variables in registers and returns, and
+  /// where it goes on with the next iteration.
+  Label Exit;
+  Label Next;
+  std::vector<Loop> Loops;
+  std::vector<const BlockAST *> Blocks;
+
+public:   /* public member functions */
+  CodeGenerator(CMMJit &Jit, const FunctionDefinitionAST &F, Candidate &C)
+      : Jit(Jit), Function(&F), Cand(&C)
+      , FrameSize(std::max(F.getSlots().size(), F.getParameterCount()))
+      , ArraySlots(FrameSize, false) {}
+  CodeGenerator(CMMJit &Jit, Trace &T, CMMInterpreter::VariableEnv *Env)
+      : Jit(Jit), T(&T), Env(Env), FrameSize(0) {}
+
+  /// \brief Compile the function, return false if it can't be.
+  bool compileFunction();
+  /// \brief Compile the trace, return false if it can't be.
+  bool compileTrace();
+
+  const std::vector<uint8_t> &getCode() const { return Code; }
+
+private:  /* private member functions */
+  // Instruction encoding.
+  void emit(uint8_t Byte) { Code.push_back(Byte); }
+  void emit(std::initializer_list<uint8_t> Bytes) {
+    Code.insert(Code.end(), Bytes.begin(), Bytes.end());
+  }
+  void emitImm32(uint32_t Imm);
+  void emitImm64(uint64_t Imm);
+  void emitRex(bool W, unsigned Reg, unsigned Base);
+  void emitModRM(unsigned Reg, unsigned RM);
+  void emitModRM(unsigned Reg, unsigned Base, int32_t Disp);
+
+  void emitOp(bool W, uint8_t Op, unsigned Reg, unsigned RM);
+  void emitOp(bool W, uint8_t Op, unsigned Reg, unsigned Base, int32_t Disp);
+  void emitSSE(uint8_t Prefix, uint8_t Op, unsigned Reg, unsigned RM,
+               bool W = false);
+  void emitSSE(uint8_t Prefix, uint8_t Op, unsigned Reg, unsigned Base,
+               int32_t Disp);
+  void emitStoreImm8(unsigned Base, int32_t Disp, uint8_t Imm);
+  void emitStoreImm32(unsigned Base, int32_t Disp, uint32_t Imm);
+  void emitMovImm(unsigned Reg, uint64_t Imm);
+  void emitSetCC(Condition CC, unsigned Reg);
+
+  void push(unsigned Reg);
+  void pop(unsigned Reg);
+  void adjustStack(int32_t Bytes);
+  void dropWords(size_t Count);
+  void callHelper(const void *Helper);
+  void callIndirect(const void *Entry);
+  void callContextHelper(const void *Helper);
+
+  void bind(Label &L);
+  void jump(Label &L);
+  void jumpIf(Condition CC, Label &L);
+  void useLabel(Label &L);
+  void patch(size_t At, size_t Target);
+
+  // Values.
+  int32_t slotOffset(unsigned Slot) const {
+    return static_cast<int32_t>(Slot) * Jit.Layout.VariableSize;
+  }
+  /// The scope declarations and blocks of the code are in.
+  Register scopeBase() const { return InScope ? R13 : R12; }
+  Register loadBase(const VariableRef &Var);
+  void loadVariable(const VariableRef &Var, bool Second);
+  void storeValue(unsigned Base, int32_t Disp, cvm::BasicType Type,
+                  bool Declare);
+  void pushValue(cvm::BasicType Type);
+  void popValue(cvm::BasicType Type);
+  void moveToSecond(cvm::BasicType Type);
+  void toDouble(cvm::BasicType Type, bool Second);
+  void toBool(cvm::BasicType Type);
+  bool convert(cvm::BasicType From, cvm::BasicType To);
+  void clearSlots(unsigned Begin, unsigned End);
+  void failWith(std::string Msg);
+
+  // Traces.
+  Checkpoint checkpoint() const {
+    return {Code.size(), Loops.size(), Blocks.size()};
+  }
+  void rollback(const Checkpoint &C);
+  void emitSideExit(const StatementAST *Leaf);
+  void emitTraceResult(int Result);
+  bool getTraceVariable(const IdentifierAST *Id, VariableRef &Var);
+  bool getTraceScope(const VariableBinding &Binding, unsigned &Level,
+                     CMMInterpreter::VariableEnv *&E) const;
+  void countUses(const StatementAST *Stmt, unsigned Weight,
+                 std::vector<VariableUse> &Uses);
+  void countUses(const ExpressionAST *Expr, unsigned Weight,
+                 std::vector<VariableUse> &Uses);
+  void promoteVariables(const ExpressionAST *Condition,
+                        const ExpressionAST *Post, const StatementAST *Body);
+  void emitWriteBack();
+  void emitReload();
+  unsigned getTraceBase(unsigned Level, bool Global);
+  void addGuard(const TraceGuard &Guard);
+  void mergeBranches(const JitTrace *Inner);
+
+  // Statements.
+  void collectArraySlots(const StatementAST *Stmt);
+  bool compileStatement(const StatementAST *Stmt, bool Tail);
+  bool compileStatementKind(const StatementAST *Stmt, bool Tail);
+  bool compileBlock(const BlockAST *Block, bool Tail);
+  bool compileDeclaration(const DeclarationAST *Decl);
+  bool compileIf(const IfStatementAST *IfStmt, bool Tail);
+  bool compileBranchArm(const StatementAST *Stmt, bool Recorded, bool Tail);
+  bool compileWhile(const WhileStatementAST *WhileStmt);
+  bool compileFor(const ForStatementAST *ForStmt);
+  bool compileJump(bool Break);
+  bool compileReturn(const ExpressionAST *Value);
+  bool compileTailCall(const FunctionCallAST *FuncCall);
+  bool compileDiscarded(const ExpressionAST *Expr);
+
+  // Expressions.
+  bool getVariable(const ExpressionAST *Expr, VariableRef &Var);
+  bool getScalar(const ExpressionAST *Expr, VariableRef &Var) {
+    return getVariable(Expr, Var) && Var.Rank == 0;
+  }
+  bool isLeaf(const ExpressionAST *Expr);
+  bool isSimple(const ExpressionAST *Expr);
+  bool compileLeaf(const ExpressionAST *Expr, cvm::BasicType &Type,
+                   bool Second);
+  bool compileExpression(const ExpressionAST *Expr, cvm::BasicType &Type);
+  bool compileOperands(const BinaryOperatorAST *Expr, cvm::BasicType &LHS,
+                       cvm::BasicType &RHS);
+  bool compileRelation(BinaryOperatorAST::OperatorKind OpKind,
+                       cvm::BasicType LHS, cvm::BasicType RHS,
+                       Condition &CC);
+  bool compileBranch(const ExpressionAST *Expr, bool JumpIf, Label &Target);
+  bool compileUnary(const UnaryOperatorAST *Expr, cvm::BasicType &Type);
+  bool compileBinary(const BinaryOperatorAST *Expr, cvm::BasicType &Type);
+  bool compileAssignment(const BinaryOperatorAST *Expr, cvm::BasicType &Type);
+  bool compileElement(const ExpressionAST *Expr, cvm::BasicType &Type);
+  bool compileCall(const FunctionCallAST *FuncCall, cvm::BasicType &Type,
+                   bool Discarded);
+  bool compileUserCall(const FunctionCallAST *FuncCall,
+                       const FunctionDefinitionAST &Callee,
+                       cvm::BasicType &Type);
+  bool compileNativeCall(const FunctionCallAST *FuncCall,
+                         cvm::NativeFunction Native, cvm::BasicType &Type,
+                         bool Discarded);
+};
+
+const size_t CMMJit::CodeGenerator::Label::Unbound;
+
+/// Returned by resumeTrace if the trace goes on with the next iteration.
+static const int TraceResumed = -1;
+
+bool CMMJit::CodeGenerator::compileFunction() {
+#if !defined(CMM_JIT_X86_64)
+  return false;
+#endif // !defined(CMM_JIT_X86_64)
+
+  if (!isScalarType(Function->getType()))
+    return false;
+  for (auto &Param : Function->getParameterList()) {
+    if (!isScalarType(Param.getType()))
+      return false;
+    ParamTypes.push_back(Param.getType());
+  }
+  collectArraySlots(Function->getStatement());
+
+  // push rbp; mov rbp, rsp; push rbx; push r12; mov rbx, rdi; mov r12, rsi
+  push(RBP);
+  emitOp(true, 0x89, RSP, RBP);
+  push(RBX);
+  push(R12);
+  Depth = 0;
+  emitOp(true, 0x89, RDI, RBX);
+  emitOp(true, 0x89, RSI, R12);
+
+  bind(BodyStart);
+  if (!compileStatement(Function->getStatement(), true))
+    return false;
+  emit({0x0F, 0x0B}); // ud2, every path has returned.
+
+  // lea rsp, [rbp - 16]; pop r12; pop rbx; pop rbp; ret
+  bind(Epilogue);
+  emitOp(true, 0x8D, RSP, RBP, -16);
+  pop(R12);
+  pop(RBX);
+  pop(RBP);
+  emit(0xC3);
+  return true;
+}
+
+/// \brief Compile an iteration of the loop from its head back to it. The
+/// trace returns a TraceResult once it leaves the loop.
+bool CMMJit::CodeGenerator::compileTrace() {
+#if !defined(CMM_JIT_X86_64)
+  return false;
+#endif // !defined(CMM_JIT_X86_64)
+
+  const ExpressionAST *Condition, *Post = nullptr;
+  const StatementAST *Body;
+  if (T->Loop->getKind() == StatementAST::WhileStatement) {
+    auto *WhileStmt = T->Loop->as_cptr<WhileStatementAST>();
+    Condition = WhileStmt->getCondition();
+    Body = WhileStmt->getStatement();
+  } else {
+    auto *ForStmt = T->Loop->as_cptr<ForStatementAST>();
+    Condition = ForStmt->getCondition();
+    Post = ForStmt->getPost();
+    Body = ForStmt->getStatement();
+  }
+
+  if (Body && Body->getKind() == StatementAST::BlockStatement &&
+      !Body->as_cptr<BlockAST>()->isHoisted())
+    T->Scope = Body->as_cptr<BlockAST>();
+  FrameSize = T->Scope ? T->Scope->getSlots().size() : Env->Size;
+  ArraySlots.assign(FrameSize, false);
+  collectArraySlots(Body);
+  T->Bases.push_back({0, false});
+  promoteVariables(Condition, Post, Body);
+
+  // push rbp; mov rbp, rsp; push rbx; push r12; push r13; push r14;
+  // push r15; sub rsp, 8; mov rbx, rdi; mov r14, rsi; mov r12, [r14 + Bases]
+  push(RBP);
+  emitOp(true, 0x89, RSP, RBP);
+  push(RBX);
+  push(R12);
+  push(R13);
+  push(R14);
+  push(R15);
+  adjustStack(-8);
+  Depth = 0;
+  emitOp(true, 0x89, RDI, RBX);
+  emitOp(true, 0x89, RSI, R14);
+  emitOp(true, 0x8B, R12, R14, offsetof(TraceContext, Bases));
+  emitReload();
+
+  Label Top, Continue, Break, Done;
+  bind(Top);
+  if (Condition && !compileBranch(Condition, false, Done))
+    return false;
+
+  Loops.push_back({&Break, &Continue, 0});
+  if (T->Scope) {
+    callContextHelper(reinterpret_cast<const void *>(&CMMJit::enterScope));
+    emitOp(true, 0x89, RAX, R13);
+    InScope = true;
+    Path.push_back(T->Scope);
+    for (auto &Stmt : T->Scope->getStatementList())
+      compileStatement(Stmt.get(), false);
+    Path.pop_back();
+  } else {
+    compileStatement(Body, false);
+  }
+  Loops.pop_back();
+  // Nothing is gained if every statement leaves the trace.
+  if (NativeStatements == 0)
+    return false;
+
+  bind(Continue);
+  if (InScope)
+    callContextHelper(reinterpret_cast<const void *>(&CMMJit::leaveScope));
+  InScope = false;
+  bind(Next);
+  if (Post) {
+    Checkpoint C = checkpoint();
+    if (!compileDiscarded(Post)) {
+      rollback(C);
+      emitTraceResult(TraceNext);
+    }
+  }
+  jump(Top);
+
+  bind(Break);
+  if (T->Scope)
+    callContextHelper(reinterpret_cast<const void *>(&CMMJit::leaveScope));
+  bind(Done);
+  emitMovImm(RAX, TraceDone);
+  bind(Exit);
+  emitWriteBack();
+
+  // lea rsp, [rbp - 40]; pop r15; pop r14; pop r13; pop r12; pop rbx;
+  // pop rbp; ret
+  bind(Epilogue);
+  emitOp(true, 0x8D, RSP, RBP, -40);
+  pop(R15);
+  pop(R14);
+  pop(R13);
+  pop(R12);
+  pop(RBX);
+  pop(RBP);
+  emit(0xC3);
+  return true;
+}
+
+void CMMJit::CodeGenerator::emitImm32(uint32_t Imm) {
+  for (int I = 0; I != 4; ++I)
+    emit(static_cast<uint8_t>(Imm >> (I * 8)));
+}
+
+void CMMJit::CodeGenerator::emitImm64(uint64_t Imm) {
+  for (int I = 0; I != 8; ++I)
+    emit(static_cast<uint8_t>(Imm >> (I * 8)));
+}
+
+void CMMJit::CodeGenerator::emitRex(bool W, unsigned Reg, unsigned Base) {
+  uint8_t Rex = 0x40 | (W << 3) | ((Reg >> 3) << 2) | (Base >> 3);
+  if (Rex != 0x40)
+    emit(Rex);
+}
+
+void CMMJit::CodeGenerator::emitModRM(unsigned Reg, unsigned RM) {
+  emit(0xC0 | (Reg & 7) << 3 | (RM & 7));
+}
+
+void CMMJit::CodeGenerator::emitModRM(unsigned Reg, unsigned Base,
+                                         int32_t Disp) {
+  // No displacement means rip relative with rbp and r13.
+  unsigned Mod = Disp == 0 && (Base & 7) != RBP ? 0 :
+                 Disp >= -128 && Disp <= 127 ? 1 : 2;
+  emit(Mod << 6 | (Reg & 7) << 3 | (Base & 7));
+  // rsp and r12 take a SIB byte.
+  if ((Base & 7) == RSP)
+    emit(0x24);
+  if (Mod == 1)
+    emit(static_cast<uint8_t>(Disp));
+  else if (Mod == 2)
+    emitImm32(static_cast<uint32_t>(Disp));
+}
+
+void CMMJit::CodeGenerator::emitOp(bool W, uint8_t Op, unsigned Reg,
+                                      unsigned RM) {
+  emitRex(W, Reg, RM);
+  emit(Op);
+  emitModRM(Reg, RM);
+}
+
+void CMMJit::CodeGenerator::emitOp(bool W, uint8_t Op, unsigned Reg,
+                                      unsigned Base, int32_t Disp) {
+  emitRex(W, Reg, Base);
+  emit(Op);
+  emitModRM(Reg, Base, Disp);
+}
+
+void CMMJit::CodeGenerator::emitSSE(uint8_t Prefix, uint8_t Op,
+                                       unsigned Reg, unsigned RM, bool W) {
+  emit(Prefix);
+  emitRex(W, Reg, RM);
+  emit({0x0F, Op});
+  emitModRM(Reg, RM);
+}
+
+void CMMJit::CodeGenerator::emitSSE(uint8_t Prefix, uint8_t Op,
+                                       unsigned Reg, unsigned Base,
+                                       int32_t Disp) {
+  emit(Prefix);
+  emitRex(false, Reg, Base);
+  emit({0x0F, Op});
+  emitModRM(Reg, Base, Disp);
+}
+
+void CMMJit::CodeGenerator::emitStoreImm8(unsigned Base, int32_t Disp,
+                                             uint8_t Imm) {
+  emitOp(false, 0xC6, 0, Base, Disp);
+  emit(Imm);
+}
+
+void CMMJit::CodeGenerator::emitStoreImm32(unsigned Base, int32_t Disp,
+                                              uint32_t Imm) {
+  emitOp(false, 0xC7, 0, Base, Disp);
+  emitImm32(Imm);
+}
+
+void CMMJit::CodeGenerator::emitMovImm(unsigned Reg, uint64_t Imm) {
+  emitRex(Imm > UINT32_MAX, 0, Reg);
+  emit(0xB8 | (Reg & 7));
+  if (Imm > UINT32_MAX)
+    emitImm64(Imm);
+  else
+    emitImm32(static_cast<uint32_t>(Imm));
+}
+
+/// \brief setcc of the low byte of eax or ecx.
+void CMMJit::CodeGenerator::emitSetCC(Condition CC, unsigned Reg) {
+  emit({0x0F, static_cast<uint8_t>(0x90 | CC)});
+  emitModRM(0, Reg);
+}
+
+void CMMJit::CodeGenerator::push(unsigned Reg) {
+  emitRex(false, 0, Reg);
+  emit(0x50 | (Reg & 7));
+  ++Depth;
+}
+
+void CMMJit::CodeGenerator::pop(unsigned Reg) {
+  emitRex(false, 0, Reg);
+  emit(0x58 | (Reg & 7));
+  --Depth;
+}
+
+/// \brief Add \p Bytes to rsp.
+void CMMJit::CodeGenerator::adjustStack(int32_t Bytes) {
+  if (Bytes >= -128 && Bytes <= 127) {
+    emitOp(true, 0x83, 0, RSP);
+    emit(static_cast<uint8_t>(Bytes));
+  } else {
+    emitOp(true, 0x81, 0, RSP);
+    emitImm32(static_cast<uint32_t>(Bytes));
+  }
+}
+
+void CMMJit::CodeGenerator::dropWords(size_t Count) {
+  if (Count == 0)
+    return;
+  adjustStack(static_cast<int32_t>(Count * 8));
+  Depth -= static_cast<unsigned>(Count);
+}
+
+/// \brief Call a function of the runtime, keeping the stack aligned.
+void CMMJit::CodeGenerator::callHelper(const void *Helper) {
+  if (Depth % 2)
+    adjustStack(-8);
+  emitMovImm(RAX, reinterpret_cast<uintptr_t>(Helper));
+  emit({0xFF, 0xD0}); // call rax
+  if (Depth % 2)
+    adjustStack(8);
+}
+
+/// \brief Call the native code whose entry is stored at \p Entry.
+void CMMJit::CodeGenerator::callIndirect(const void *Entry) {
+  if (Depth % 2)
+    adjustStack(-8);
+  emitMovImm(RAX, reinterpret_cast<uintptr_t>(Entry));
+  emit({0xFF, 0x10}); // call [rax]
+  if (Depth % 2)
+    adjustStack(8);
+}
+
+/// \brief Call a function of the runtime taking the context of the trace.
+void CMMJit::CodeGenerator::callContextHelper(const void *Helper) {
+  emitOp(true, 0x89, RBX, RDI);
+  emitOp(true, 0x89, R14, RSI);
+  callHelper(Helper);
+}
+
+void CMMJit::CodeGenerator::bind(Label &L) {
+  L.Pos = Code.size();
+  for (size_t At : L.Uses)
+    patch(At, L.Pos);
+  L.Uses.clear();
+}
+
+void CMMJit::CodeGenerator::jump(Label &L) {
+  emit(0xE9);
+  useLabel(L);
+}
+
+void CMMJit::CodeGenerator::jumpIf(Condition CC, Label &L) {
+  emit({0x0F, static_cast<uint8_t>(0x80 | CC)});
+  useLabel(L);
+}
+
+void CMMJit::CodeGenerator::useLabel(Label &L) {
+  size_t At = Code.size();
+  emitImm32(0);
+  if (L.Pos != Label::Unbound)
+    patch(At, L.Pos);
+  else
+    L.Uses.push_back(At);
+}
+
+void CMMJit::CodeGenerator::patch(size_t At, size_t Target) {
+  int32_t Rel = static_cast<int32_t>(Target) - static_cast<int32_t>(At + 4);
+  std::memcpy(&Code[At], &Rel, sizeof(Rel));
+}
+
+/// \brief Return the register addressing the scope of a variable, which is
+/// loaded from the context of the trace if it's none of those kept.
+CMMJit::CodeGenerator::Register
+CMMJit::CodeGenerator::loadBase(const VariableRef &Var) {
+  if (Var.Base == RSI) {
+    emitOp(true, 0x8B, RSI, R14,
+           static_cast<int32_t>(offsetof(TraceContext, Bases) +
+                                Var.Index * sizeof(void *)));
+  }
+  return Var.Base;
+}
+
+/// \brief Load a variable into eax or xmm0, or ecx or xmm1 if it's the
+/// \p Second operand.
+void CMMJit::CodeGenerator::loadVariable(const VariableRef &Var,
+                                         bool Second) {
+  if (Var.Value != NoRegister) {
+    emitOp(false, 0x89, Var.Value, Second ? RCX : RAX);
+    return;
+  }
+
+  Register Base = loadBase(Var);
+  int32_t Disp = Var.Disp + Jit.Layout.Payload;
+  unsigned Reg = Second ? RCX : RAX;
+  switch (Var.Type) {
+  default:
+    assert(false && "loadVariable: unknown scalar type");
+  case cvm::IntType:
+    emitOp(false, 0x8B, Reg, Base, Disp);
+    break;
+  case cvm::BoolType:
+    emitRex(false, Reg, Base);
+    emit({0x0F, 0xB6}); // movzx
+    emitModRM(Reg, Base, Disp);
+    break;
+  case cvm::DoubleType:
+    emitSSE(0xF2, 0x10, Second ? XMM1 : XMM0, Base, Disp);
+    break;
+  }
+}
+
+/// \brief Store the value into the variable at \p Disp from \p Base, which
+/// is declared to be of \p Type if \p Declare is set.
+void CMMJit::CodeGenerator::storeValue(unsigned Base, int32_t Disp,
+                                          cvm::BasicType Type, bool Declare) {
+  // Ints and bools are zero extended to the whole payload.
+  if (Type == cvm::DoubleType)
+    emitSSE(0xF2, 0x11, XMM0, Base, Disp + Jit.Layout.Payload);
+  else
+    emitOp(true, 0x89, RAX, Base, Disp + Jit.Layout.Payload);
+
+  if (Declare) {
+    emitStoreImm32(Base, Disp + Jit.Layout.Type, Type);
+    emitStoreImm8(Base, Disp + Jit.Layout.Declared, 1);
+  }
+}
+
+void CMMJit::CodeGenerator::pushValue(cvm::BasicType Type) {
+  if (Type == cvm::DoubleType)
+    emitSSE(0x66, 0x7E, XMM0, RAX, true); // movq rax, xmm0
+  push(RAX);
+}
+
+void CMMJit::CodeGenerator::popValue(cvm::BasicType Type) {
+  pop(RAX);
+  if (Type == cvm::DoubleType)
+    emitSSE(0x66, 0x6E, XMM0, RAX, true); // movq xmm0, rax
+}
+
+void CMMJit::CodeGenerator::moveToSecond(cvm::BasicType Type) {
+  if (Type == cvm::DoubleType)
+    emitSSE(0x66, 0x28, XMM1, XMM0); // movapd xmm1, xmm0
+  else
+    emitOp(false, 0x89, RAX, RCX);
+}
+
+void CMMJit::CodeGenerator::toDouble(cvm::BasicType Type, bool Second) {
+  if (Type == cvm::IntType) // cvtsi2sd
+    emitSSE(0xF2, 0x2A, Second ? XMM1 : XMM0, Second ? RCX : RAX);
+}
+
+/// \brief Convert the value in eax or xmm0 to a bool in eax, as
+/// BasicValue::toBool() does.
+void CMMJit::CodeGenerator::toBool(cvm::BasicType Type) {
+  switch (Type) {
+  default:
+    assert(false && "toBool: unknown scalar type");
+  case cvm::BoolType:
+    return;
+  case cvm::IntType:
+    emitOp(false, 0x85, RAX, RAX);
+    emitSetCC(CondNE, RAX);
+    break;
+  case cvm::DoubleType:
+    // NaN is true as well.
+    emitSSE(0x66, 0x57, XMM1, XMM1);
+    emitSSE(0x66, 0x2E, XMM0, XMM1);
+    emitSetCC(CondNE, RAX);
+    emitSetCC(CondP, RCX);
+    emit({0x08, 0xC8}); // or al, cl
+    break;
+  }
+  emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+}
+
+/// \brief Convert a value of type \p From to be assigned to \p To, return
+/// false if it's an error.
+bool CMMJit::CodeGenerator::convert(cvm::BasicType From,
+                                       cvm::BasicType To) {
+  if (From == To)
+    return true;
+  if (From != cvm::IntType || To != cvm::DoubleType)
+    return false;
+  toDouble(From, false);
+  return true;
+}
+
+/// \brief Clear the variables in slots [Begin, End).
+void CMMJit::CodeGenerator::clearSlots(unsigned Begin, unsigned End) {
+  if (std::none_of(ArraySlots.begin() + Begin, ArraySlots.begin() + End,
+                   [](bool IsArray) { return IsArray; })) {
+    // Scalars are simply undeclared.
+    for (unsigned Slot = Begin; Slot != End; ++Slot)
+      emitStoreImm8(scopeBase(), slotOffset(Slot) + Jit.Layout.Declared, 0);
+    return;
+  }
+
+  emitOp(true, 0x89, RBX, RDI);
+  emitOp(true, 0x8D, RSI, scopeBase(), slotOffset(Begin));
+  emitMovImm(RDX, End - Begin);
+  callHelper(reinterpret_cast<const void *>(&CMMJit::clearSlots));
+}
+
+/// \brief Report a runtime error.
+void CMMJit::CodeGenerator::failWith(std::string Msg) {
+  emitOp(true, 0x89, RBX, RDI);
+  emitMovImm(RSI, reinterpret_cast<uintptr_t>(
+      Jit.addMessage(std::move(Msg))));
+  callHelper(reinterpret_cast<const void *>(&CMMJit::fail));
+}
+
+/// \brief Drop the code of a statement which can't be compiled, and the
+/// jumps out of it.
+void CMMJit::CodeGenerator::rollback(const Checkpoint &C) {
+  size_t Size = C.CodeSize;
+  Code.resize(Size);
+  Depth = 0;
+  Loops.resize(C.Loops);
+  Blocks.resize(C.Blocks);
+
+  auto DropUses = [Size](Label &L) {
+    L.Uses.erase(std::remove_if(L.Uses.begin(), L.Uses.end(),
+                                [Size](size_t At) { return At >= Size; }),
+                 L.Uses.end());
+  };
+  DropUses(Epilogue);
+  DropUses(Exit);
+  DropUses(Next);
+  for (Loop &L : Loops) {
+    DropUses(*L.Break);
+    DropUses(*L.Continue);
+  }
+}
+
+/// \brief Leave the trace for the interpreter, which runs \p Leaf and the
+/// rest of the iteration. The trace goes on with the next iteration if the
+/// guards still hold, and returns otherwise.
+void CMMJit::CodeGenerator::emitSideExit(const StatementAST *Leaf) {
+  Jit.SideExits.push_back({Path, Leaf, InScope});
+  emitWriteBack();
+  emitMovImm(RDX, reinterpret_cast<uintptr_t>(&Jit.SideExits.back()));
+  callContextHelper(reinterpret_cast<const void *>(&CMMJit::resumeTrace));
+  emit({0x83, 0xF8, static_cast<uint8_t>(TraceResumed)}); // cmp eax, imm8
+  jumpIf(CondNE, Epilogue);
+  emitReload();
+  jump(Next);
+}
+
+void CMMJit::CodeGenerator::emitTraceResult(int Result) {
+  emitMovImm(RAX, static_cast<uint32_t>(Result));
+  jump(Exit);
+}
+
+/// \brief Resolve a variable of the trace to its slot, whose state is
+/// observed now and guarded when the trace is entered.
+bool CMMJit::CodeGenerator::getTraceVariable(const IdentifierAST *Id,
+                                             VariableRef &Var) {
+  const VariableBinding &Binding = Id->getBinding();
+  if (Binding.Kind == VariableBinding::DynamicBinding)
+    return false;
+
+  // Variables of the body are declared by the trace, of their static types.
+  const StaticType &ST = Id->getStaticType();
+  if (InScope && Binding.Depth == 0) {
+    if (!ST.Known || !isScalarType(ST.Type))
+      return false;
+    Var = {R13, 0, slotOffset(Binding.Slot), ST.Type,
+           std::max(ST.Dimensions, 0), NoRegister};
+    return true;
+  }
+
+  unsigned Level;
+  CMMInterpreter::VariableEnv *E;
+  if (!getTraceScope(Binding, Level, E))
+    return false;
+  for (auto &Pair : Promoted) {
+    if (Pair.first == Level &&
+        Pair.second.Disp == slotOffset(Binding.Slot)) {
+      Var = Pair.second;
+      return true;
+    }
+  }
+
+  unsigned Index = getTraceBase(Level,
+                                Binding.Kind == VariableBinding::GlobalBinding);
+  if (Index == MaxTraceBases)
+    return false;
+  Var = {Index == 0 ? R12 : RSI, Index, slotOffset(Binding.Slot),
+         cvm::VoidType, 0, NoRegister};
+
+  // A variable of the scope of the loop which isn't declared yet may be
+  // declared by the body, as a variable of a hoisted block.
+  const CMMInterpreter::Variable &Slot = E->Vars[Binding.Slot];
+  if (!Slot.Declared) {
+    if (Level != 0 || InScope || !ST.Known || !isScalarType(ST.Type))
+      return false;
+    Var.Type = ST.Type;
+    Var.Rank = std::max(ST.Dimensions, 0);
+    addGuard({Index, Binding.Slot, false, cvm::VoidType, 0});
+    return true;
+  }
+
+  const cvm::BasicValue &Value = Slot.Value;
+  if (!isScalarType(Value.Type))
+    return false;
+  Var.Type = Value.Type;
+  if (Value.isArray()) {
+    const cvm::ArrayObject &Array = Value.getArray();
+    if (Array.Storage->Kind == cvm::ArrayStorage::BoxedStorage)
+      return false;
+    Var.Rank = static_cast<int>(Array.Storage->Dims.size() - Array.Level);
+  }
+  addGuard({Index, Binding.Slot, true, Var.Type, Var.Rank});
+  return true;
+}
+
+/// \brief Find the scope of a variable out of the body of the loop, as the
+/// interpreter does.
+bool CMMJit::CodeGenerator::getTraceScope(const VariableBinding &Binding,
+                                          unsigned &Level,
+                                          CMMInterpreter::VariableEnv *&E)
+                                          const {
+  Level = Binding.Depth - (InScope ? 1 : 0);
+  E = Env;
+  for (unsigned I = 0; I != Level && E; ++I)
+    E = E->OuterEnv;
+  return E && Binding.Slot < E->Size &&
+         (Binding.Kind != VariableBinding::GlobalBinding ||
+          E == &Jit.Interp.TopLevelEnv);
+}
+
+/// \brief Count the uses of ints and bools declared out of the body, those
+/// in nested loops weigh more.
+void CMMJit::CodeGenerator::countUses(const StatementAST *Stmt,
+                                      unsigned Weight,
+                                      std::vector<VariableUse> &Uses) {
+  if (!Stmt)
+    return;
+
+  unsigned Inner = std::min(Weight * 8, 1u << 12);
+  switch (Stmt->getKind()) {
+  default:
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &D :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList()) {
+      const DeclarationAST *Decl = D.get();
+      for (auto &E : Decl->getElementCountList())
+        countUses(E.get(), Weight, Uses);
+      countUses(Decl->getInitializer(), Weight, Uses);
+    }
+    break;
+  case StatementAST::ExprStatement:
+    countUses(Stmt->as_cptr<ExprStatementAST>()->getExpression(), Weight,
+              Uses);
+    break;
+  case StatementAST::ReturnStatement:
+    countUses(Stmt->as_cptr<ReturnStatementAST>()->getReturnValue(), Weight,
+              Uses);
+    break;
+  case StatementAST::BlockStatement:
+    // A block with a scope of its own leaves the trace.
+    if (Stmt->as_cptr<BlockAST>()->isHoisted()) {
+      for (auto &S : Stmt->as_cptr<BlockAST>()->getStatementList())
+        countUses(S.get(), Weight, Uses);
+    }
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    countUses(IfStmt->getCondition(), Weight, Uses);
+    countUses(IfStmt->getStatementThen(), Weight, Uses);
+    countUses(IfStmt->getStatementElse(), Weight, Uses);
+    break;
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    countUses(WhileStmt->getCondition(), Inner, Uses);
+    countUses(WhileStmt->getStatement(), Inner, Uses);
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    countUses(ForStmt->getInit(), Weight, Uses);
+    countUses(ForStmt->getCondition(), Inner, Uses);
+    countUses(ForStmt->getPost(), Inner, Uses);
+    countUses(ForStmt->getStatement(), Inner, Uses);
+    break;
+  }
+  }
+}
+
+void CMMJit::CodeGenerator::countUses(const ExpressionAST *Expr,
+                                      unsigned Weight,
+                                      std::vector<VariableUse> &Uses) {
+  if (!Expr)
+    return;
+
+  switch (Expr->getKind()) {
+  default:
+    break;
+  case ExpressionAST::IdentifierExpression: {
+    const VariableBinding &Binding =
+        Expr->as_cptr<IdentifierAST>()->getBinding();
+    unsigned Level;
+    CMMInterpreter::VariableEnv *E;
+    if (Binding.Kind == VariableBinding::DynamicBinding ||
+        (InScope && Binding.Depth == 0) ||
+        !getTraceScope(Binding, Level, E))
+      break;
+
+    const CMMInterpreter::Variable &Var = E->Vars[Binding.Slot];
+    if (!Var.Declared || Var.Value.isArray() ||
+        (Var.Value.Type != cvm::IntType && Var.Value.Type != cvm::BoolType))
+      break;
+    auto It = std::find_if(Uses.begin(), Uses.end(),
+        [&](const VariableUse &U) {
+          return U.Level == Level && U.Slot == Binding.Slot;
+        });
+    if (It == Uses.end()) {
+      Uses.push_back({Level, Binding.Slot,
+                      Binding.Kind == VariableBinding::GlobalBinding, 0});
+      It = Uses.end() - 1;
+    }
+    It->Count += Weight;
+    break;
+  }
+  case ExpressionAST::FunctionCallExpression:
+    for (auto &Arg : Expr->as_cptr<FunctionCallAST>()->getArguments())
+      countUses(Arg.get(), Weight, Uses);
+    break;
+  case ExpressionAST::InfixOpExpression:
+    countUses(Expr->as_cptr<InfixOpExprAST>()->getLHS(), Weight, Uses);
+    countUses(Expr->as_cptr<InfixOpExprAST>()->getRHS(), Weight, Uses);
+    break;
+  case ExpressionAST::UnaryOperatorExpression:
+    countUses(Expr->as_cptr<UnaryOperatorAST>()->getOperand(), Weight, Uses);
+    break;
+  case ExpressionAST::BinaryOperatorExpression:
+    countUses(Expr->as_cptr<BinaryOperatorAST>()->getLHS(), Weight, Uses);
+    countUses(Expr->as_cptr<BinaryOperatorAST>()->getRHS(), Weight, Uses);
+    break;
+  }
+}
+
+/// \brief Choose the ints and bools used the most by the trace to be kept in
+/// the registers free, r15, and r13 if the body has no scope. They're loaded
+/// when the trace is entered, and written back whenever the interpreter
+/// runs, or may read them.
+void CMMJit::CodeGenerator::promoteVariables(const ExpressionAST *Condition,
+                                             const ExpressionAST *Post,
+                                             const StatementAST *Body) {
+  std::vector<VariableUse> Uses;
+  countUses(Condition, 1, Uses);
+  countUses(Post, 1, Uses);
+  if (T->Scope) {
+    InScope = true;
+    for (auto &Stmt : T->Scope->getStatementList())
+      countUses(Stmt.get(), 1, Uses);
+    InScope = false;
+  } else {
+    countUses(Body, 1, Uses);
+  }
+  std::stable_sort(Uses.begin(), Uses.end(),
+      [](const VariableUse &A, const VariableUse &B) {
+        return A.Count > B.Count;
+      });
+
+  std::vector<Register> Free{R15};
+  if (!T->Scope)
+    Free.push_back(R13);
+  for (const VariableUse &U : Uses) {
+    if (Promoted.size() == Free.size())
+      break;
+    unsigned Index = getTraceBase(U.Level, U.Global);
+    if (Index == MaxTraceBases)
+      continue;
+
+    CMMInterpreter::VariableEnv *E = Env;
+    for (unsigned I = 0; I != U.Level; ++I)
+      E = E->OuterEnv;
+    cvm::BasicType Type = E->Vars[U.Slot].Value.Type;
+    Promoted.push_back({U.Level, {Index == 0 ? R12 : RSI, Index,
+                                  slotOffset(U.Slot), Type, 0,
+                                  Free[Promoted.size()]}});
+    addGuard({Index, U.Slot, true, Type, 0});
+  }
+}
+
+/// \brief Store the variables kept in registers to their slots.
+void CMMJit::CodeGenerator::emitWriteBack() {
+  for (auto &Pair : Promoted) {
+    const VariableRef &Var = Pair.second;
+    emitOp(true, 0x89, Var.Value, loadBase(Var),
+           Var.Disp + Jit.Layout.Payload);
+  }
+}
+
+/// \brief Load the variables kept in registers from their slots.
+void CMMJit::CodeGenerator::emitReload() {
+  for (auto &Pair : Promoted) {
+    const VariableRef &Var = Pair.second;
+    Register Base = loadBase(Var);
+    int32_t Disp = Var.Disp + Jit.Layout.Payload;
+    if (Var.Type == cvm::IntType) {
+      emitOp(false, 0x8B, Var.Value, Base, Disp);
+    } else {
+      emitRex(false, Var.Value, Base);
+      emit({0x0F, 0xB6}); // movzx
+      emitModRM(Var.Value, Base, Disp);
+    }
+  }
+}
+
+/// \brief Return the index of the scope \p Level levels out from the loop
+/// among the bases of the trace, MaxTraceBases if there are too many.
+unsigned CMMJit::CodeGenerator::getTraceBase(unsigned Level, bool Global) {
+  auto &Bases = T->Bases;
+  for (unsigned I = 0; I != Bases.size(); ++I) {
+    if (Bases[I].Depth == Level && (I == 0 || Bases[I].Global == Global))
+      return I;
+  }
+  if (Bases.size() == MaxTraceBases)
+    return MaxTraceBases;
+  Bases.push_back({Level, Global});
+  return static_cast<unsigned>(Bases.size() - 1);
+}
+
+void CMMJit::CodeGenerator::addGuard(const TraceGuard &Guard) {
+  for (const TraceGuard &G : T->Guards) {
+    if (G.Base == Guard.Base && G.Slot == Guard.Slot)
+      return;
+  }
+  T->Guards.push_back(Guard);
+}
+
+/// \brief Take the branches recorded for a loop traced before, whose
+/// iterations have been run by its trace since.
+void CMMJit::CodeGenerator::mergeBranches(const JitTrace *Inner) {
+  if (!T || !Inner)
+    return;
+  for (auto &Pair : static_cast<const Trace *>(Inner)->Branches)
+    T->Branches[Pair.first] |= Pair.second;
+}
+
+void CMMJit::CodeGenerator::collectArraySlots(const StatementAST *Stmt) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  default:
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList()) {
+      if (Decl->isArray() && Decl->getSlot() < FrameSize)
+        ArraySlots[Decl->getSlot()] = true;
+    }
+    break;
+  case StatementAST::BlockStatement:
+    for (auto &S : Stmt->as_cptr<BlockAST>()->getStatementList())
+      collectArraySlots(S.get());
+    break;
+  case StatementAST::IfStatement:
+    collectArraySlots(Stmt->as_cptr<IfStatementAST>()->getStatementThen());
+    collectArraySlots(Stmt->as_cptr<IfStatementAST>()->getStatementElse());
+    break;
+  case StatementAST::WhileStatement:
+    collectArraySlots(Stmt->as_cptr<WhileStatementAST>()->getStatement());
+    break;
+  case StatementAST::ForStatement:
+    collectArraySlots(Stmt->as_cptr<ForStatementAST>()->getStatement());
+    break;
+  }
+}
+
+/// \brief Compile a statement. A statement in \p Tail position must return
+/// a value of the function type however it completes. A statement of a
+/// trace which can't be compiled leaves the trace instead.
+bool CMMJit::CodeGenerator::compileStatement(const StatementAST *Stmt,
+                                             bool Tail) {
+  assert(Depth == 0 && "compileStatement: operands left on the stack");
+  if (!Stmt)
+    return !Tail;
+  if (!T)
+    return compileStatementKind(Stmt, Tail);
+
+  Checkpoint C = checkpoint();
+  Path.push_back(Stmt);
+  bool Compiled = compileStatementKind(Stmt, false);
+  Path.pop_back();
+  if (!Compiled) {
+    rollback(C);
+    emitSideExit(Stmt);
+  } else if (Stmt->getKind() != StatementAST::BlockStatement) {
+    ++NativeStatements;
+  }
+  return true;
+}
+
+bool CMMJit::CodeGenerator::compileStatementKind(const StatementAST *Stmt,
+                                                 bool Tail) {
+  switch (Stmt->getKind()) {
+  default:
+    assert(false && "compileStatementKind: unknown statement kind");
+  case StatementAST::DeclarationStatement:
+    return false;
+
+  case StatementAST::DeclarationListStatement:
+    if (Tail)
+      return false;
+    for (auto &Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList()) {
+      if (!compileDeclaration(Decl.get()))
+        return false;
+    }
+    return true;
+
+  case StatementAST::ExprStatement: {
+    const ExpressionAST *Expr =
+        Stmt->as_cptr<ExprStatementAST>()->getExpression();
+    return Tail ? compileReturn(Expr) : compileDiscarded(Expr);
+  }
+
+  case StatementAST::BlockStatement:
+    return compileBlock(Stmt->as_cptr<BlockAST>(), Tail);
+  case StatementAST::IfStatement:
+    return compileIf(Stmt->as_cptr<IfStatementAST>(), Tail);
+  case StatementAST::WhileStatement:
+    return !Tail && compileWhile(Stmt->as_cptr<WhileStatementAST>());
+  case StatementAST::ForStatement:
+    return !Tail && compileFor(Stmt->as_cptr<ForStatementAST>());
+  case StatementAST::ReturnStatement:
+    return compileReturn(
+        Stmt->as_cptr<ReturnStatementAST>()->getReturnValue());
+  case StatementAST::BreakStatement:
+    return compileJump(true);
+  case StatementAST::ContinueStatement:
+    return compileJump(false);
+  }
+  return false; // Make the compiler happy.
+}
+
+/// \brief Compile a block, whose variables are cleared when it completes.
+bool CMMJit::CodeGenerator::compileBlock(const BlockAST *Block, bool Tail) {
+  auto &List = Block->getStatementList();
+  if (!Block->isHoisted() || (Tail && List.empty()))
+    return false;
+
+  Blocks.push_back(Block);
+  for (auto It = List.begin(), E = List.end(); It != E;) {
+    const StatementAST *Stmt = (It++)->get();
+    if (!compileStatement(Stmt, Tail && It == E))
+      return false;
+  }
+  Blocks.pop_back();
+
+  // A block in tail position never completes.
+  if (!Tail)
+    clearSlots(Block->getHoistedBegin(), Block->getHoistedEnd());
+  return true;
+}
+
+bool CMMJit::CodeGenerator::compileDeclaration(const DeclarationAST *Decl) {
+  cvm::BasicType Type = Decl->getType();
+  if (!isScalarType(Type))
+    return false;
+
+  // cmp byte [Base + Declared], 0
+  Register Base = scopeBase();
+  int32_t Disp = slotOffset(Decl->getSlot());
+  emitOp(false, 0x80, 7, Base, Disp + Jit.Layout.Declared);
+  emit(0);
+  Label Fresh;
+  jumpIf(CondE, Fresh);
+  failWith("variable `" + Decl->getName().str() +
+           "' is already defined in current scope");
+  bind(Fresh);
+
+  if (Decl->isArray()) {
+    // An array with an initializer keeps its value, but the initializer is
+    // still checked.
+    if (Decl->getInitializer())
+      return false;
+
+    // Dimensions are checked once they are all evaluated, so those after
+    // the first must not have side effects.
+    auto &Dims = Decl->getElementCountList();
+    for (auto &E : Dims) {
+      cvm::BasicType DimType;
+      if ((&E != &Dims.front() && !isSimple(E.get())) ||
+          !compileExpression(E.get(), DimType) || DimType != cvm::IntType)
+        return false;
+      push(RAX);
+    }
+
+    Jit.ArrayDeclarations.push_back({Decl->getName().str(), Type,
+                                     Dims.size()});
+    emitOp(true, 0x89, RBX, RDI);
+    emitOp(true, 0x8D, RSI, Base, Disp);
+    emitMovImm(RDX, reinterpret_cast<uintptr_t>(
+        &Jit.ArrayDeclarations.back()));
+    emitOp(true, 0x89, RSP, RCX);
+    callHelper(reinterpret_cast<const void *>(&CMMJit::declareArray));
+    dropWords(Dims.size());
+    return true;
+  }
+
+  if (const ExpressionAST *Init = Decl->getInitializer()) {
+    cvm::BasicType InitType;
+    if (!compileExpression(Init, InitType) || !convert(InitType, Type))
+      return false;
+  } else {
+    // Zero is all bits clear for every type.
+    emitOp(false, 0x31, RAX, RAX);
+    if (Type == cvm::DoubleType)
+      emitSSE(0x66, 0x6E, XMM0, RAX, true);
+  }
+  storeValue(Base, Disp, Type, true);
+  return true;
+}
+
+bool CMMJit::CodeGenerator::compileIf(const IfStatementAST *IfStmt,
+                                         bool Tail) {
+  const StatementAST *Else = IfStmt->getStatementElse();
+  if (Tail && !Else)
+    return false;
+
+  // A trace only compiles the branches recorded, and leaves the trace on
+  // the others. An if statement never reached isn't compiled at all.
+  unsigned Taken = 3;
+  if (T) {
+    auto It = T->Branches.find(IfStmt);
+    Taken = It != T->Branches.end() ? It->second : 0;
+    if (Taken == 0)
+      return false;
+  }
+
+  Label ElseLabel, End;
+  if (!compileBranch(IfStmt->getCondition(), false, ElseLabel) ||
+      !compileBranchArm(IfStmt->getStatementThen(), Taken & 1, Tail))
+    return false;
+  if (Else && !Tail)
+    jump(End);
+  bind(ElseLabel);
+  if (Else && !compileBranchArm(Else, Taken & 2, Tail))
+    return false;
+  bind(End);
+  return true;
+}
+
+bool CMMJit::CodeGenerator::compileBranchArm(const StatementAST *Stmt,
+                                             bool Recorded, bool Tail) {
+  if (Recorded)
+    return compileStatement(Stmt, Tail);
+  emitSideExit(Stmt);
+  return true;
+}
+
+bool CMMJit::CodeGenerator::compileWhile(
+    const WhileStatementAST *WhileStmt) {
+  mergeBranches(WhileStmt->getJitTrace());
+
+  Label Top, Break;
+  bind(Top);
+  if (const ExpressionAST *Condition = WhileStmt->getCondition()) {
+    if (!compileBranch(Condition, false, Break))
+      return false;
+  }
+
+  Loops.push_back({&Break, &Top, Blocks.size()});
+  if (!compileStatement(WhileStmt->getStatement(), false))
+    return false;
+  Loops.pop_back();
+
+  jump(Top);
+  bind(Break);
+  return true;
+}
+
+bool CMMJit::CodeGenerator::compileFor(const ForStatementAST *ForStmt) {
+  mergeBranches(ForStmt->getJitTrace());
+  if (const ExpressionAST *Init = ForStmt->getInit()) {
+    if (!compileDiscarded(Init))
+      return false;
+  }
+
+  Label Top, Continue, Break;
+  bind(Top);
+  if (const ExpressionAST *Condition = ForStmt->getCondition()) {
+    if (!compileBranch(Condition, false, Break))
+      return false;
+  }
+
+  Loops.push_back({&Break, &Continue, Blocks.size()});
+  if (!compileStatement(ForStmt->getStatement(), false))
+    return false;
+  Loops.pop_back();
+
+  bind(Continue);
+  if (const ExpressionAST *Post = ForStmt->getPost()) {
+    if (!compileDiscarded(Post))
+      return false;
+  }
+  jump(Top);
+  bind(Break);
+  return true;
+}
+
+/// \brief Compile a break or continue statement, which leaves the blocks
+/// entered in the loop.
+bool CMMJit::CodeGenerator::compileJump(bool Break) {
+  if (Loops.empty())
+    return false;
+
+  const Loop &L = Loops.back();
+  for (size_t I = Blocks.size(); I-- != L.Blocks;)
+    clearSlots(Blocks[I]->getHoistedBegin(), Blocks[I]->getHoistedEnd());
+  jump(Break ? *L.Break : *L.Continue);
+  return true;
+}
+
+/// \brief Compile a returned value, which must be of the function type.
+bool CMMJit::CodeGenerator::compileReturn(const ExpressionAST *Value) {
+  // A trace leaves the function to the interpreter.
+  if (!Value || !Function)
+    return false;
+
+  if (Value->isFunctionCallExpr() &&
+      Value->as_cptr<FunctionCallAST>()->isTailCall())
+    return compileTailCall(Value->as_cptr<FunctionCallAST>());
+
+  cvm::BasicType Type;
+  if (!compileExpression(Value, Type) || Type != Function->getType())
+    return false;
+  if (Type == cvm::DoubleType)
+    emitSSE(0x66, 0x7E, XMM0, RAX, true);
+  jump(Epilogue);
+  return true;
+}
+
+/// \brief Compile a call of the function to itself from tail position, which
+/// rebinds the parameters and starts over.
+bool CMMJit::CodeGenerator::compileTailCall(const FunctionCallAST *Call) {
+  if (Call->getUserFunction() != Function ||
+      Call->getArguments().size() != ParamTypes.size())
+    return false;
+
+  size_t Index = 0;
+  for (auto &Arg : Call->getArguments()) {
+    cvm::BasicType Type;
+    if (!compileExpression(Arg.get(), Type) ||
+        !convert(Type, ParamTypes[Index]))
+      return false;
+    pushValue(ParamTypes[Index++]);
+  }
+
+  // Arguments are popped into the parameters in reverse, payloads as they
+  // are.
+  clearSlots(0, static_cast<unsigned>(FrameSize));
+  auto Param = Function->getParameterList().rbegin();
+  for (size_t Slot = ParamTypes.size(); Slot-- != 0; ++Param) {
+    pop(RAX);
+    if (!Param->getName().empty()) {
+      int32_t Disp = slotOffset(static_cast<unsigned>(Slot));
+      emitOp(true, 0x89, RAX, R12, Disp + Jit.Layout.Payload);
+      emitStoreImm32(R12, Disp + Jit.Layout.Type, ParamTypes[Slot]);
+      emitStoreImm8(R12, Disp + Jit.Layout.Declared, 1);
+    }
+  }
+  jump(BodyStart);
+  return true;
+}
+
+/// \brief Compile an expression whose value isn't used. A call may return
+/// no value then.
+bool CMMJit::CodeGenerator::compileDiscarded(const ExpressionAST *Expr) {
+  cvm::BasicType Type;
+  if (Expr->isFunctionCallExpr())
+    return compileCall(Expr->as_cptr<FunctionCallAST>(), Type, true);
+  return compileExpression(Expr, Type);
+}
+
+/// \brief Return where a variable of the function or of the trace is, and
+/// its type.
+bool CMMJit::CodeGenerator::getVariable(const ExpressionAST *Expr,
+                                        VariableRef &Var) {
+  if (!Expr->isIdentifierExpr())
+    return false;
+  if (T)
+    return getTraceVariable(Expr->as_cptr<IdentifierAST>(), Var);
+
+  const VariableBinding &Binding =
+      Expr->as_cptr<IdentifierAST>()->getBinding();
+  if (Binding.Kind != VariableBinding::LocalBinding || Binding.Depth != 0)
+    return false;
+
+  // Parameters are proven scalars by the interpreter when it's called.
+  Var = {R12, 0, slotOffset(Binding.Slot), cvm::VoidType, 0, NoRegister};
+  if (Binding.Slot < ParamTypes.size()) {
+    Var.Type = ParamTypes[Binding.Slot];
+    return true;
+  }
+
+  // A scalar variable may only be made an alias of an array by assigning it
+  // one, which compiled code never does. Arrays are declared in the function
+  // then, which are unboxed.
+  const StaticType &ST = Expr->getStaticType();
+  if (!ST.Known || !isScalarType(ST.Type))
+    return false;
+  Var.Type = ST.Type;
+  Var.Rank = std::max(ST.Dimensions, 0);
+  return true;
+}
+
+/// \brief Return true if the expression is a literal or a variable, which
+/// can be loaded straight into the second operand.
+bool CMMJit::CodeGenerator::isLeaf(const ExpressionAST *Expr) {
+  VariableRef Var;
+  switch (Expr->getKind()) {
+  default:
+    return getScalar(Expr, Var);
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+    return true;
+  }
+}
+
+/// \brief Return true if the expression can neither fail nor have side
+/// effects, so that it may be evaluated before an earlier check.
+bool CMMJit::CodeGenerator::isSimple(const ExpressionAST *Expr) {
+  if (isLeaf(Expr))
+    return true;
+
+  if (Expr->getKind() == ExpressionAST::UnaryOperatorExpression)
+    return isSimple(Expr->as_cptr<UnaryOperatorAST>()->getOperand());
+
+  if (!Expr->isBinaryOperatorExpression())
+    return false;
+
+  auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+  switch (BinOp->getOpKind()) {
+  default:
+    return isSimple(BinOp->getLHS()) && isSimple(BinOp->getRHS());
+  case BinaryOperatorAST::Division:
+  case BinaryOperatorAST::Modulo:
+  case BinaryOperatorAST::Assign:
+  case BinaryOperatorAST::Index:
+    return false;
+  }
+}
+
+/// \brief Load a literal or a variable into the first or \p Second operand.
+bool CMMJit::CodeGenerator::compileLeaf(const ExpressionAST *Expr,
+                                           cvm::BasicType &Type,
+                                           bool Second) {
+  unsigned Reg = Second ? RCX : RAX;
+  switch (Expr->getKind()) {
+  default: {
+    VariableRef Var;
+    if (!getScalar(Expr, Var))
+      return false;
+    loadVariable(Var, Second);
+    Type = Var.Type;
+    return true;
+  }
+  case ExpressionAST::IntExpression:
+    Type = cvm::IntType;
+    emitMovImm(Reg, static_cast<uint32_t>(Expr->as_cptr<IntAST>()->getValue()));
+    return true;
+  case ExpressionAST::BoolExpression:
+    Type = cvm::BoolType;
+    emitMovImm(Reg, Expr->as_cptr<BoolAST>()->getValue());
+    return true;
+  case ExpressionAST::DoubleExpression: {
+    Type = cvm::DoubleType;
+    double Value = Expr->as_cptr<DoubleAST>()->getValue();
+    uint64_t Bits;
+    std::memcpy(&Bits, &Value, sizeof(Bits));
+    emitMovImm(Reg, Bits);
+    emitSSE(0x66, 0x6E, Second ? XMM1 : XMM0, Reg, true); // movq
+    return true;
+  }
+  }
+}
+
+bool CMMJit::CodeGenerator::compileExpression(const ExpressionAST *Expr,
+                                                 cvm::BasicType &Type) {
+  switch (Expr->getKind()) {
+  default:
+    assert(false && "compileExpression: unknown expression kind");
+  case ExpressionAST::StringExpression:
+  case ExpressionAST::InfixOpExpression:
+    return false;
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::IdentifierExpression:
+    return compileLeaf(Expr, Type, false);
+  case ExpressionAST::FunctionCallExpression:
+    return compileCall(Expr->as_cptr<FunctionCallAST>(), Type, false);
+  case ExpressionAST::UnaryOperatorExpression:
+    return compileUnary(Expr->as_cptr<UnaryOperatorAST>(), Type);
+  case ExpressionAST::BinaryOperatorExpression:
+    return compileBinary(Expr->as_cptr<BinaryOperatorAST>(), Type);
+  }
+  return false; // Make the compiler happy.
+}
+
+/// \brief Evaluate both operands, the first into eax or xmm0, the second
+/// into ecx or xmm1.
+bool CMMJit::CodeGenerator::compileOperands(const BinaryOperatorAST *Expr,
+                                               cvm::BasicType &LHS,
+                                               cvm::BasicType &RHS) {
+  if (!compileExpression(Expr->getLHS(), LHS))
+    return false;
+  if (isLeaf(Expr->getRHS()))
+    return compileLeaf(Expr->getRHS(), RHS, true);
+
+  pushValue(LHS);
+  if (!compileExpression(Expr->getRHS(), RHS))
+    return false;
+  moveToSecond(RHS);
+  popValue(LHS);
+  return true;
+}
+
+/// \brief Compare the operands, \p CC holds then if the relation does.
+bool CMMJit::CodeGenerator::compileRelation(
+    BinaryOperatorAST::OperatorKind OpKind, cvm::BasicType LHS,
+    cvm::BasicType RHS, Condition &CC) {
+  if (LHS == RHS && LHS != cvm::DoubleType) {
+    emitOp(false, 0x39, RCX, RAX); // cmp eax, ecx
+    switch (OpKind) {
+    default:
+      assert(false && "compileRelation: unknown relational operator kind");
+    case BinaryOperatorAST::Less:         CC = CondL;   break;
+    case BinaryOperatorAST::LessEqual:    CC = CondLE;  break;
+    case BinaryOperatorAST::Equal:        CC = CondE;   break;
+    case BinaryOperatorAST::NotEqual:     CC = CondNE;  break;
+    case BinaryOperatorAST::Greater:      CC = CondG;   break;
+    case BinaryOperatorAST::GreaterEqual: CC = CondGE;  break;
+    }
+    return true;
+  }
+
+  if (!isNumericType(LHS) || !isNumericType(RHS))
+    return false;
+  toDouble(LHS, false);
+  toDouble(RHS, true);
+
+  // Comparisons with NaN are false, as "above" is.
+  switch (OpKind) {
+  default:
+    assert(false && "compileRelation: unknown relational operator kind");
+  case BinaryOperatorAST::Less:
+  case BinaryOperatorAST::LessEqual:
+    emitSSE(0x66, 0x2E, XMM1, XMM0);
+    CC = OpKind == BinaryOperatorAST::Less ? CondA : CondAE;
+    break;
+  case BinaryOperatorAST::Greater:
+  case BinaryOperatorAST::GreaterEqual:
+    emitSSE(0x66, 0x2E, XMM0, XMM1);
+    CC = OpKind == BinaryOperatorAST::Greater ? CondA : CondAE;
+    break;
+  case BinaryOperatorAST::Equal:
+    emitSSE(0x66, 0x2E, XMM0, XMM1);
+    emitSetCC(CondE, RAX);
+    emitSetCC(CondNP, RCX);
+    emit({0x20, 0xC8, 0x84, 0xC0}); // and al, cl; test al, al
+    CC = CondNE;
+    break;
+  case BinaryOperatorAST::NotEqual:
+    emitSSE(0x66, 0x2E, XMM0, XMM1);
+    emitSetCC(CondNE, RAX);
+    emitSetCC(CondP, RCX);
+    emit({0x08, 0xC8, 0x84, 0xC0}); // or al, cl; test al, al
+    CC = CondNE;
+    break;
+  }
+  return true;
+}
+
+static bool isRelational(BinaryOperatorAST::OperatorKind OpKind) {
+  return OpKind >= BinaryOperatorAST::Less &&
+         OpKind <= BinaryOperatorAST::GreaterEqual;
+}
+
+/// \brief Jump to \p Target if the condition converted to bool is \p JumpIf.
+bool CMMJit::CodeGenerator::compileBranch(const ExpressionAST *Expr,
+                                             bool JumpIf, Label &Target) {
+  if (Expr->getKind() == ExpressionAST::UnaryOperatorExpression) {
+    auto *UnOp = Expr->as_cptr<UnaryOperatorAST>();
+    if (UnOp->getOpKind() == UnaryOperatorAST::LogicalNot)
+      return compileBranch(UnOp->getOperand(), !JumpIf, Target);
+  }
+
+  if (Expr->isBinaryOperatorExpression()) {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    BinaryOperatorAST::OperatorKind OpKind = BinOp->getOpKind();
+
+    if (OpKind == BinaryOperatorAST::LogicalAnd ||
+        OpKind == BinaryOperatorAST::LogicalOr) {
+      // The right operand decides unless the left one does.
+      bool Decisive = OpKind == BinaryOperatorAST::LogicalOr;
+      if (JumpIf == Decisive) {
+        return compileBranch(BinOp->getLHS(), JumpIf, Target) &&
+               compileBranch(BinOp->getRHS(), JumpIf, Target);
+      }
+      Label Skip;
+      if (!compileBranch(BinOp->getLHS(), Decisive, Skip) ||
+          !compileBranch(BinOp->getRHS(), JumpIf, Target))
+        return false;
+      bind(Skip);
+      return true;
+    }
+
+    if (isRelational(OpKind)) {
+      cvm::BasicType LHS, RHS;
+      Condition CC;
+      if (!compileOperands(BinOp, LHS, RHS) ||
+          !compileRelation(OpKind, LHS, RHS, CC))
+        return false;
+      jumpIf(JumpIf ? CC : static_cast<Condition>(CC ^ 1), Target);
+      return true;
+    }
+  }
+
+  cvm::BasicType Type;
+  if (!compileExpression(Expr, Type))
+    return false;
+  toBool(Type);
+  emitOp(false, 0x85, RAX, RAX);
+  jumpIf(JumpIf ? CondNE : CondE, Target);
+  return true;
+}
+
+bool CMMJit::CodeGenerator::compileUnary(const UnaryOperatorAST *Expr,
+                                            cvm::BasicType &Type) {
+  if (!compileExpression(Expr->getOperand(), Type))
+    return false;
+
+  switch (Expr->getOpKind()) {
+  default:
+    assert(false && "compileUnary: unknown unary operator kind");
+  case UnaryOperatorAST::Plus:
+    return isNumericType(Type);
+  case UnaryOperatorAST::Minus:
+    if (Type == cvm::IntType) {
+      emit({0xF7, 0xD8}); // neg eax
+      return true;
+    }
+    if (Type == cvm::DoubleType) {
+      // Flip the sign bit.
+      emitSSE(0x66, 0x7E, XMM0, RAX, true);
+      emit({0x48, 0x0F, 0xBA, 0xF8, 0x3F}); // btc rax, 63
+      emitSSE(0x66, 0x6E, XMM0, RAX, true);
+      return true;
+    }
+    return false;
+  case UnaryOperatorAST::LogicalNot:
+    toBool(Type);
+    emit({0x83, 0xF0, 0x01}); // xor eax, 1
+    Type = cvm::BoolType;
+    return true;
+  case UnaryOperatorAST::BitwiseNot:
+    emit({0xF7, 0xD0}); // not eax
+    return Type == cvm::IntType;
+  }
+  return false; // Make the compiler happy.
+}
+
+bool CMMJit::CodeGenerator::compileBinary(const BinaryOperatorAST *Expr,
+                                             cvm::BasicType &Type) {
+  BinaryOperatorAST::OperatorKind OpKind = Expr->getOpKind();
+  switch (OpKind) {
+  default:
+    break;
+  case BinaryOperatorAST::Assign:
+    return compileAssignment(Expr, Type);
+  case BinaryOperatorAST::Index:
+    if (!compileElement(Expr, Type))
+      return false;
+    // The element is at rax.
+    if (Type == cvm::DoubleType) {
+      emitSSE(0xF2, 0x10, XMM0, RAX, 0);
+    } else if (Type == cvm::IntType) {
+      emitOp(false, 0x8B, RAX, RAX, 0);
+    } else {
+      emit({0x0F, 0xB6}); // movzx
+      emitModRM(RAX, RAX, 0);
+    }
+    return true;
+  case BinaryOperatorAST::LogicalAnd:
+  case BinaryOperatorAST::LogicalOr: {
+    Label False, End;
+    if (!compileBranch(Expr, false, False))
+      return false;
+    emitMovImm(RAX, 1);
+    jump(End);
+    bind(False);
+    emitOp(false, 0x31, RAX, RAX);
+    bind(End);
+    Type = cvm::BoolType;
+    return true;
+  }
+  }
+
+  cvm::BasicType LHS, RHS;
+  if (!compileOperands(Expr, LHS, RHS))
+    return false;
+
+  if (isRelational(OpKind)) {
+    Condition CC;
+    if (!compileRelation(OpKind, LHS, RHS, CC))
+      return false;
+    emitSetCC(CC, RAX);
+    emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+    Type = cvm::BoolType;
+    return true;
+  }
+
+  switch (OpKind) {
+  default:
+    assert(false && "compileBinary: unknown binary operator kind");
+  case BinaryOperatorAST::Add:
+  case BinaryOperatorAST::Minus:
+  case BinaryOperatorAST::Multiply:
+  case BinaryOperatorAST::Division:
+  case BinaryOperatorAST::Modulo:
+    if (!isNumericType(LHS) || !isNumericType(RHS))
+      return false;
+    break;
+  case BinaryOperatorAST::BitwiseAnd:
+  case BinaryOperatorAST::BitwiseOr:
+  case BinaryOperatorAST::BitwiseXor:
+  case BinaryOperatorAST::LeftShift:
+  case BinaryOperatorAST::RightShift:
+    if (LHS != cvm::IntType || RHS != cvm::IntType)
+      return false;
+    break;
+  }
+
+  if (LHS == cvm::IntType && RHS == cvm::IntType) {
+    Type = cvm::IntType;
+    switch (OpKind) {
+    default:
+      assert(false && "compileBinary: unknown binary operator kind");
+    case BinaryOperatorAST::Add:        emit({0x01, 0xC8}); break;
+    case BinaryOperatorAST::Minus:      emit({0x29, 0xC8}); break;
+    case BinaryOperatorAST::Multiply:   emit({0x0F, 0xAF, 0xC1}); break;
+    case BinaryOperatorAST::BitwiseAnd: emit({0x21, 0xC8}); break;
+    case BinaryOperatorAST::BitwiseOr:  emit({0x09, 0xC8}); break;
+    case BinaryOperatorAST::BitwiseXor: emit({0x31, 0xC8}); break;
+    case BinaryOperatorAST::LeftShift:  emit({0xD3, 0xE0}); break;
+    case BinaryOperatorAST::RightShift: emit({0xD3, 0xF8}); break;
+    case BinaryOperatorAST::Division:
+    case BinaryOperatorAST::Modulo: {
+      bool Division = OpKind == BinaryOperatorAST::Division;
+      Label NonZero;
+      emitOp(false, 0x85, RCX, RCX);
+      jumpIf(CondNE, NonZero);
+      failWith(Division ? "int division by zero" : "int modulo by zero");
+      bind(NonZero);
+      emit({0x99, 0xF7, 0xF9}); // cdq; idiv ecx
+      if (!Division)
+        emitOp(false, 0x89, RDX, RAX);
+      break;
+    }
+    }
+    return true;
+  }
+
+  Type = cvm::DoubleType;
+  toDouble(LHS, false);
+  toDouble(RHS, true);
+  switch (OpKind) {
+  default:
+    assert(false && "compileBinary: unknown arithmetic operator kind");
+  case BinaryOperatorAST::Add:      emitSSE(0xF2, 0x58, XMM0, XMM1); break;
+  case BinaryOperatorAST::Minus:    emitSSE(0xF2, 0x5C, XMM0, XMM1); break;
+  case BinaryOperatorAST::Multiply: emitSSE(0xF2, 0x59, XMM0, XMM1); break;
+  case BinaryOperatorAST::Division: emitSSE(0xF2, 0x5E, XMM0, XMM1); break;
+  case BinaryOperatorAST::Modulo:
+    callHelper(reinterpret_cast<const void *>(&CMMJit::modulo));
+    break;
+  }
+  return true;
+}
+
+/// \brief Compile an assignment to a variable or an element of an array,
+/// whose reference is evaluated before the value.
+bool CMMJit::CodeGenerator::compileAssignment(const BinaryOperatorAST *Expr,
+                                                 cvm::BasicType &Type) {
+  const ExpressionAST *LHS = Expr->getLHS();
+  cvm::BasicType ValueType;
+  VariableRef Var;
+
+  if (getScalar(LHS, Var)) {
+    Type = Var.Type;
+    if (!compileExpression(Expr->getRHS(), ValueType) ||
+        !convert(ValueType, Type))
+      return false;
+    if (Var.Value != NoRegister)
+      emitOp(false, 0x89, RAX, Var.Value);
+    else
+      storeValue(loadBase(Var), Var.Disp, Type, false);
+    return true;
+  }
+
+  if (!LHS->isBinaryOperatorExpression() ||
+      LHS->as_cptr<BinaryOperatorAST>()->getOpKind() !=
+          BinaryOperatorAST::Index)
+    return false;
+
+  if (!compileElement(LHS, Type))
+    return false;
+  push(RAX);
+  if (!compileExpression(Expr->getRHS(), ValueType) ||
+      !convert(ValueType, Type))
+    return false;
+  pop(RCX);
+
+  // The element is at rcx.
+  if (Type == cvm::DoubleType)
+    emitSSE(0xF2, 0x11, XMM0, RCX, 0);
+  else if (Type == cvm::IntType)
+    emitOp(false, 0x89, RAX, RCX, 0);
+  else
+    emitOp(false, 0x88, RAX, RCX, 0);
+  return true;
+}
+
+/// \brief Evaluate the address of an element of an array variable into rax.
+/// Indices are checked once they are all evaluated, so those after the
+/// first must not have side effects.
+bool CMMJit::CodeGenerator::compileElement(const ExpressionAST *Expr,
+                                              cvm::BasicType &Type) {
+  std::vector<const ExpressionAST *> Indices;
+  while (Expr->isBinaryOperatorExpression() &&
+         Expr->as_cptr<BinaryOperatorAST>()->getOpKind() ==
+             BinaryOperatorAST::Index) {
+    Indices.push_back(Expr->as_cptr<BinaryOperatorAST>()->getRHS());
+    Expr = Expr->as_cptr<BinaryOperatorAST>()->getLHS();
+  }
+  std::reverse(Indices.begin(), Indices.end());
+
+  // Only elements of unboxed arrays.
+  VariableRef Var;
+  if (!getVariable(Expr, Var) || Var.Rank != static_cast<int>(Indices.size()))
+    return false;
+
+  for (size_t I = 0; I != Indices.size(); ++I) {
+    cvm::BasicType IndexType;
+    if ((I != 0 && !isSimple(Indices[I])) ||
+        !compileExpression(Indices[I], IndexType) ||
+        IndexType != cvm::IntType)
+      return false;
+    push(RAX);
+  }
+
+  emitOp(true, 0x89, RBX, RDI);
+  emitOp(true, 0x8D, RSI, loadBase(Var), Var.Disp);
+  emitOp(true, 0x89, RSP, RDX);
+  emitMovImm(RCX, Indices.size());
+  callHelper(reinterpret_cast<const void *>(&CMMJit::indexArray));
+  dropWords(Indices.size());
+  Type = Var.Type;
+  return true;
+}
+
+/// \brief Compile a call. A native returning no value may only be called if
+/// the value is \p Discarded.
+bool CMMJit::CodeGenerator::compileCall(const FunctionCallAST *FuncCall,
+                                           cvm::BasicType &Type,
+                                           bool Discarded) {
+  if (FuncCall->isDynamicBound())
+    return false;
+  if (auto *Callee = FuncCall->getUserFunction())
+    return compileUserCall(FuncCall, *Callee, Type);
+  if (auto Native = FuncCall->getNativeFunction())
+    return compileNativeCall(FuncCall, Native, Type, Discarded);
+  return false;
+}
+
+/// \brief Compile a call to a function compiled along. Its frame is taken
+/// from the interpreter, and the arguments are evaluated into it.
+bool CMMJit::CodeGenerator::compileUserCall(
+    const FunctionCallAST *FuncCall, const FunctionDefinitionAST &Callee,
+    cvm::BasicType &Type) {
+  auto &Args = FuncCall->getArguments();
+  if (Args.size() != Callee.getParameterCount() ||
+      !isScalarType(Callee.getType()))
+    return false;
+  // A trace calls functions compiled already.
+  const JitFunction *Target;
+  if (Cand) {
+    if (!(Target = Jit.getCallee(Callee)))
+      return false;
+    Cand->Callees.push_back(&Callee);
+  } else {
+    if (!(Target = Callee.getJitFunction()))
+      Target = &Jit.compile(Callee);
+    if (!Target->Entry)
+      return false;
+  }
+
+  size_t Size = std::max(Callee.getSlots().size(), Args.size());
+
+  // The mark of the slot stack, and the frame on top of it.
+  adjustStack(-16);
+  Depth += 2;
+  emitOp(true, 0x89, RBX, RDI);
+  emitMovImm(RSI, Size);
+  emitMovImm(RDX, FuncCall->getLoc());
+  emitOp(true, 0x89, RSP, RCX);
+  callHelper(reinterpret_cast<const void *>(&CMMJit::enterFrame));
+  push(RAX);
+  unsigned FrameDepth = Depth;
+
+  unsigned Slot = 0;
+  auto Arg = Args.begin();
+  for (auto &Param : Callee.getParameterList()) {
+    cvm::BasicType ArgType;
+    if (!compileExpression((Arg++)->get(), ArgType) ||
+        !convert(ArgType, Param.getType()))
+      return false;
+    if (!Param.getName().empty()) {
+      emitOp(true, 0x8B, RCX, RSP, (Depth - FrameDepth) * 8);
+      storeValue(RCX, slotOffset(Slot), Param.getType(), true);
+    }
+    ++Slot;
+  }
+
+  emitOp(true, 0x89, RBX, RDI);
+  emitOp(true, 0x8B, RSI, RSP, 0);
+  callIndirect(&Target->Entry);
+
+  emitOp(true, 0x89, RAX, R8);
+  emitOp(true, 0x89, RBX, RDI);
+  emitOp(true, 0x8B, RSI, RSP, 0);
+  emitMovImm(RDX, Size);
+  emitOp(true, 0x8D, RCX, RSP, 8);
+  callHelper(reinterpret_cast<const void *>(&CMMJit::leaveFrame));
+  dropWords(3);
+
+  Type = Callee.getType();
+  if (Type == cvm::DoubleType)
+    emitSSE(0x66, 0x6E, XMM0, RAX, true);
+  return true;
+}
+
+bool CMMJit::CodeGenerator::compileNativeCall(
+    const FunctionCallAST *FuncCall, cvm::NativeFunction Native,
+    cvm::BasicType &Type, bool Discarded) {
+  auto It = Jit.NativeFunctions.find(Native);
+  if (It == Jit.NativeFunctions.end())
+    return false;
+
+  NativeCall Call;
+  Call.Function = Native;
+  for (auto &Arg : FuncCall->getArguments()) {
+    // A string literal takes a word as well, which is ignored.
+    if (Arg->getKind() == ExpressionAST::StringExpression) {
+      Call.ArgTypes.push_back(cvm::StringType);
+      Call.Strings.push_back(Arg->as_cptr<StringAST>()->getBasicValue());
+      push(RAX);
+      continue;
+    }
+
+    cvm::BasicType ArgType;
+    if (!compileExpression(Arg.get(), ArgType))
+      return false;
+    Call.ArgTypes.push_back(ArgType);
+    Call.Strings.emplace_back();
+    pushValue(ArgType);
+  }
+  Jit.NativeCalls.push_back(std::move(Call));
+
+  emitOp(true, 0x89, RBX, RDI);
+  emitMovImm(RSI, reinterpret_cast<uintptr_t>(&Jit.NativeCalls.back()));
+  emitOp(true, 0x89, RSP, RDX);
+  callHelper(reinterpret_cast<const void *>(&CMMJit::callNative));
+  dropWords(FuncCall->getArguments().size());
+
+  Type = It->second.ReturnType;
+  if (!isScalarType(Type))
+    return Discarded;
+  // Only the bytes of the type are set in the payload.
+  if (Type == cvm::DoubleType)
+    emitSSE(0x66, 0x6E, XMM0, RAX, true);
+  else if (Type == cvm::IntType)
+    emitOp(false, 0x89, RAX, RAX);
+  else
+    emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+  return true;
+}
+
+CMMJit::CMMJit(CMMInterpreter &Interp) : Interp(Interp) {
+  static_assert(sizeof(CMMInterpreter::SlotStack::Mark) <= 16,
+                "marks of the slot stack take two words on the stack");
+
+  CMMInterpreter::Variable Var;
+  const char *Base = reinterpret_cast<const char *>(&Var);
+  Layout.VariableSize = static_cast<int32_t>(sizeof(Var));
+  Layout.Type = static_cast<int32_t>(
+      reinterpret_cast<const char *>(&Var.Value.Type) - Base);
+  Layout.Payload = static_cast<int32_t>(
+      reinterpret_cast<const char *>(&Var.Value.Payload) - Base);
+  Layout.Declared = static_cast<int32_t>(
+      reinterpret_cast<const char *>(&Var.Declared) - Base);
+
+  std::map<std::string, cvm::NativeFunctionInfo> NativeFunctionMap;
+  cvm::addNativeFunctions(NativeFunctionMap);
+  for (auto &Pair : NativeFunctionMap)
+    NativeFunctions[Pair.second.Function] = Pair.second;
+}
+
+CMMJit::~CMMJit() {
+#if defined(CMM_JIT_X86_64)
+  for (auto &Block : CodeBlocks)
+    ::munmap(Block.first, Block.second);
+#endif // defined(CMM_JIT_X86_64)
+}
+
+cvm::BasicValue CMMJit::makeValue(cvm::BasicType Type, uint64_t Payload) {
+  switch (Type) {
+  default:
+    assert(false && "makeValue: unknown scalar type");
+  case cvm::IntType:
+    return static_cast<int>(static_cast<uint32_t>(Payload));
+  case cvm::BoolType:
+    return (Payload & 0xFF) != 0;
+  case cvm::DoubleType: {
+    double Value;
+    std::memcpy(&Value, &Payload, sizeof(Value));
+    return Value;
+  }
+  }
+  return cvm::BasicValue(); // Make the compiler happy.
+}
+
+/// \brief Compile a function along with the functions it calls. A function
+/// is only compiled if all functions it calls are, so the result is settled
+/// once they are all tried.
+const JitFunction &CMMJit::compile(const FunctionDefinitionAST &Function) {
+  const JitFunction *Root = getCallee(Function);
+  assert(Root && "compile: function compiled already");
+
+  while (!Worklist.empty()) {
+    const FunctionDefinitionAST *F = Worklist.back();
+    Worklist.pop_back();
+    Candidate &C = Candidates[F];
+    CodeGenerator Gen(*this, *F, C);
+    C.Compiled = Gen.compileFunction();
+    C.Code = Gen.getCode();
+  }
+
+  for (bool Changed = true; Changed;) {
+    Changed = false;
+    for (auto &Pair : Candidates) {
+      Candidate &C = Pair.second;
+      if (!C.Compiled)
+        continue;
+      for (const FunctionDefinitionAST *Callee : C.Callees) {
+        auto It = Candidates.find(Callee);
+        if (It != Candidates.end() ? !It->second.Compiled :
+                                     !Callee->getJitFunction()->Entry) {
+          C.Compiled = false;
+          Changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  install();
+  for (auto &Pair : Candidates)
+    Pair.first->setJitFunction(Pair.second.Function);
+  Candidates.clear();
+  return *Root;
+}
+
+/// \brief Return the native code of a function called, which is compiled
+/// along if it's not tried yet. Null if it can't be compiled.
+const JitFunction *
+CMMJit::getCallee(const FunctionDefinitionAST &Function) {
+  if (const JitFunction *J = Function.getJitFunction())
+    return J->Entry ? J : nullptr;
+
+  auto It = Candidates.find(&Function);
+  if (It == Candidates.end()) {
+    Functions.emplace_back();
+    It = Candidates.emplace(&Function, Candidate()).first;
+    It->second.Function = &Functions.back();
+    Worklist.push_back(&Function);
+  }
+  return It->second.Function;
+}
+
+/// \brief Copy the code compiled to executable memory, and set the entries
+/// of the functions.
+bool CMMJit::install() {
+  const size_t Alignment = 16;
+  std::vector<uint8_t> Code;
+  std::vector<std::pair<JitFunction *, size_t>> Entries;
+  for (auto &Pair : Candidates) {
+    Candidate &C = Pair.second;
+    if (!C.Compiled)
+      continue;
+    Code.resize((Code.size() + Alignment - 1) & ~(Alignment - 1), 0xCC);
+    Entries.emplace_back(const_cast<JitFunction *>(C.Function), Code.size());
+    Code.insert(Code.end(), C.Code.begin(), C.Code.end());
+  }
+  if (Entries.empty())
+    return true;
+
+  const uint8_t *Memory = mapCode(Code);
+  if (!Memory)
+    return false;
+  for (auto &Entry : Entries) {
+    Entry.first->Entry =
+        reinterpret_cast<JitFunction::EntryTy>(Memory + Entry.second);
+  }
+  return true;
+}
+
+/// \brief Copy code to memory mapped executable, return null if it can't be.
+const uint8_t *CMMJit::mapCode(const std::vector<uint8_t> &Code) {
+#if defined(CMM_JIT_X86_64)
+  size_t PageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  size_t Size = (Code.size() + PageSize - 1) & ~(PageSize - 1);
+  void *Memory = ::mmap(nullptr, Size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Memory == MAP_FAILED)
+    return nullptr;
+
+  std::memcpy(Memory, Code.data(), Code.size());
+  if (::mprotect(Memory, Size, PROT_READ | PROT_EXEC) != 0) {
+    ::munmap(Memory, Size);
+    return nullptr;
+  }
+  CodeBlocks.emplace_back(Memory, Size);
+  return static_cast<const uint8_t *>(Memory);
+#else
+  return nullptr;
+#endif // defined(CMM_JIT_X86_64)
+}
+
+/// \brief Record the branches of a loop reached at its head, and return its
+/// trace once enough iterations are recorded, null until then. Only one
+/// loop is recorded at a time, heads of others are counted meanwhile.
+const JitTrace *CMMJit::recordLoop(CMMInterpreter::VariableEnv *Env,
+                                   const StatementAST &Loop) {
+  if (RecordingLoop != &Loop) {
+    if (RecordingLoop && ++OtherHeads < RecordBudget)
+      return nullptr;
+    RecordingLoop = &Loop;
+    RecordedIterations = 0;
+    OtherHeads = 0;
+    Branches.clear();
+    return nullptr;
+  }
+  if (++RecordedIterations < RecordIterations)
+    return nullptr;
+
+  RecordingLoop = nullptr;
+  return &compileTrace(Env, Loop);
+}
+
+/// \brief Compile the trace of a loop along the branches recorded, with the
+/// variables as they are in \p Env.
+const CMMJit::Trace &
+CMMJit::compileTrace(CMMInterpreter::VariableEnv *Env,
+                     const StatementAST &Loop) {
+  Traces.emplace_back();
+  Trace &T = Traces.back();
+  T.Loop = &Loop;
+  T.Branches = std::move(Branches);
+  Branches.clear();
+
+  CodeGenerator Gen(*this, T, Env);
+  if (Gen.compileTrace()) {
+    if (const uint8_t *Memory = mapCode(Gen.getCode()))
+      T.Entry = reinterpret_cast<JitTrace::EntryTy>(Memory);
+  }
+  return T;
+}
+
+/// \brief Run the trace of a loop in \p Env from its head, unless the
+/// variables aren't as it relies on.
+CMMJit::TraceResult CMMJit::runTrace(CMMInterpreter::VariableEnv *Env,
+                                     const JitTrace &JT) {
+  TraceContext Ctx;
+  Ctx.Env = Env;
+  Ctx.T = static_cast<const Trace *>(&JT);
+  Ctx.Scope = nullptr;
+
+  unsigned Index = 0;
+  for (const TraceBase &Base : Ctx.T->Bases) {
+    CMMInterpreter::VariableEnv *E = Env;
+    for (unsigned I = 0; I != Base.Depth && E; ++I)
+      E = E->OuterEnv;
+    if (!E || (Base.Global && E != &Interp.TopLevelEnv))
+      return TraceNotEntered;
+    Ctx.Bases[Index++] = E->Vars;
+  }
+  if (!checkGuards(Ctx))
+    return TraceNotEntered;
+  return static_cast<TraceResult>(JT.Entry(this, &Ctx));
+}
+
+bool CMMJit::checkGuards(const TraceContext &Ctx) const {
+  for (const TraceGuard &G : Ctx.T->Guards) {
+    const CMMInterpreter::Variable &Var = Ctx.Bases[G.Base][G.Slot];
+    if (Var.Declared != G.Declared)
+      return false;
+    if (!G.Declared)
+      continue;
+
+    const cvm::BasicValue &Value = Var.Value;
+    if (Value.Type != G.Type || Value.isArray() != (G.Rank != 0))
+      return false;
+    if (G.Rank != 0) {
+      const cvm::ArrayObject &Array = Value.getArray();
+      if (Array.Storage->Kind == cvm::ArrayStorage::BoxedStorage ||
+          Array.Storage->Dims.size() - Array.Level !=
+              static_cast<size_t>(G.Rank))
+        return false;
+    }
+  }
+  return true;
+}
+
+const std::string *CMMJit::addMessage(std::string Msg) {
+  Messages.push_back(std::move(Msg));
+  return &Messages.back();
+}
+
+/// \brief Enter a call and take the frame of the callee, the mark of the slot
+/// stack is kept at \p Mark on the native stack.
+void *CMMJit::enterFrame(CMMJit *Jit, size_t Size, SourceMgr::LocTy Loc,
+                         void *Mark) {
+  CMMInterpreter &Interp = Jit->Interp;
+  Interp.enterCall(Loc);
+  return Interp.Stack.allocate(
+      Size, *static_cast<CMMInterpreter::SlotStack::Mark *>(Mark));
+}
+
+uint64_t CMMJit::leaveFrame(CMMJit *Jit, void *Slots, size_t Size,
+                            const void *Mark, uint64_t Result) {
+  CMMInterpreter &Interp = Jit->Interp;
+  Interp.Stack.release(
+      static_cast<CMMInterpreter::Variable *>(Slots), Size,
+      *static_cast<const CMMInterpreter::SlotStack::Mark *>(Mark));
+  Interp.leaveCall();
+  return Result;
+}
+
+void CMMJit::clearSlots(CMMJit *, void *Slots, size_t Count) {
+  auto *Vars = static_cast<CMMInterpreter::Variable *>(Slots);
+  for (size_t I = 0; I != Count; ++I) {
+    Vars[I].Value = cvm::BasicValue();
+    Vars[I].Declared = false;
+  }
+}
+
+void CMMJit::declareArray(CMMJit *Jit, void *Slot,
+                          const ArrayDeclaration *Decl,
+                          const uint64_t *Dims) {
+  std::list<int> DimensionList;
+  for (size_t I = 0; I != Decl->Rank; ++I) {
+    int Dimension = static_cast<int>(Dims[Decl->Rank - 1 - I]);
+    if (Dimension <= 0)
+      CMMRuntime::badDimension(Decl->Name, Dimension);
+    DimensionList.push_back(Dimension);
+  }
+
+  auto *Var = static_cast<CMMInterpreter::Variable *>(Slot);
+  Var->Value = cvm::BasicValue(Decl->Type, DimensionList);
+  Var->Declared = true;
+}
+
+/// \brief Check the indices of an element of an array, return its address.
+void *CMMJit::indexArray(CMMJit *Jit, void *Slot, const uint64_t *Indices,
+                         size_t Count) {
+  auto *Var = static_cast<CMMInterpreter::Variable *>(Slot);
+  const cvm::ArrayObject &Array = Var->Value.getArray();
+  cvm::ArrayStorage *Storage = Array.Storage;
+  size_t Offset = Array.Offset;
+  unsigned Level = Array.Level;
+
+  for (size_t I = 0; I != Count; ++I, ++Level) {
+    int Index = static_cast<int>(Indices[Count - 1 - I]);
+    size_t ArraySize = Storage->Dims[Level];
+    if (Index < 0 || Index >= static_cast<int>(ArraySize))
+      CMMRuntime::indexOutOfRange(ArraySize, Index);
+    Offset += static_cast<size_t>(Index) * Storage->Strides[Level];
+  }
+
+  switch (Storage->Kind) {
+  default:
+    assert(false && "indexArray: scalar array boxed");
+  case cvm::ArrayStorage::IntStorage:     return &Storage->Ints[Offset];
+  case cvm::ArrayStorage::DoubleStorage:  return &Storage->Doubles[Offset];
+  case cvm::ArrayStorage::BoolStorage:    return &Storage->Bools[Offset];
+  }
+  return nullptr; // Make the compiler happy.
+}
+
+/// \brief Call a native function with the arguments on the argument stack of
+/// the interpreter, return the payload of its value.
+uint64_t CMMJit::callNative(CMMJit *Jit, const NativeCall *Call,
+                            const uint64_t *Args) {
+  std::vector<cvm::BasicValue> &Stack = Jit->Interp.ArgumentStack;
+  size_t Base = Stack.size();
+  size_t Count = Call->ArgTypes.size();
+
+  for (size_t I = 0; I != Count; ++I) {
+    uint64_t Payload = Args[Count - 1 - I];
+    if (Call->ArgTypes[I] == cvm::StringType)
+      Stack.push_back(Call->Strings[I]);
+    else
+      Stack.push_back(makeValue(Call->ArgTypes[I], Payload));
+  }
+
+  cvm::BasicValue Res =
+      Call->Function(cvm::ValueSpan(Stack.data() + Base, Count));
+  Stack.resize(Base);
+  return Res.Payload;
+}
+
+double CMMJit::modulo(double LHS, double RHS) {
+  return std::fmod(LHS, RHS);
+}
+
+void CMMJit::fail(CMMJit *Jit, const std::string *Msg) {
+  Jit->Interp.RuntimeError(*Msg);
+}
+
+/// \brief Enter the scope of the body of a traced loop, return its slots.
+CMMInterpreter::Variable *CMMJit::enterScope(CMMJit *Jit, TraceContext *Ctx) {
+  Ctx->Scope = new (Ctx->ScopeStorage) CMMInterpreter::VariableEnv(
+      Jit->Interp.Stack, Ctx->Env, Ctx->T->Scope->getSlots());
+  return Ctx->Scope->Vars;
+}
+
+void CMMJit::leaveScope(CMMJit *, TraceContext *Ctx) {
+  Ctx->Scope->~VariableEnv();
+  Ctx->Scope = nullptr;
+}
+
+/// \brief Run the rest of an iteration left at a side exit, return how the
+/// trace goes on.
+int CMMJit::resumeTrace(CMMJit *Jit, TraceContext *Ctx,
+                        const SideExit *Exit) {
+  CMMInterpreter::ExecutionResult Res = Jit->Interp.resumeIteration(
+      Exit->InScope ? Ctx->Scope : Ctx->Env, Exit->Path, Exit->Leaf, 0);
+  if (Exit->InScope)
+    leaveScope(Jit, Ctx);
+
+  switch (Res) {
+  default:
+    return Jit->checkGuards(*Ctx) ? TraceResumed : TraceNext;
+  case CMMInterpreter::BreakStatementResult:
+    return TraceDone;
+  case CMMInterpreter::ReturnStatementResult:
+    return TraceReturned;
+  case CMMInterpreter::TailCallResult:
+    return TraceTailCalled;
+  }
+}
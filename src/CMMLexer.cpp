@@ -1,9 +1,16 @@
 #include "CMMLexer.h"
 #include <iostream>
 #include <cctype>
+#include <algorithm>
 
 using namespace cmm;
 
+CMMLexer::CMMLexer(SourceMgr &SrcMgr)
+    : SrcMgr(SrcMgr), Buffer(SrcMgr.getBuffer()),
+      BufferSize(SrcMgr.getBufferSize()) {
+  tokenize();
+}
+
 bool CMMLexer::Error(LocTy ErrorLoc, const std::string &Msg) {
   SrcMgr.Error(ErrorLoc, Msg);
   return true;
@@ -13,6 +20,64 @@ void CMMLexer::Warning(LocTy ErrorLoc, const std::string &Msg) {
   SrcMgr.Warning(ErrorLoc, Msg);
 }
 
+bool CMMLexer::lexError(LocTy ErrorLoc, const std::string &Msg) {
+  Diagnostics.push_back({Tokens.size(), ErrorLoc, true, Msg});
+  return true;
+}
+
+void CMMLexer::lexWarning(LocTy ErrorLoc, const std::string &Msg) {
+  Diagnostics.push_back({Tokens.size(), ErrorLoc, false, Msg});
+}
+
+/// \brief Report diagnostics found while lexing the current token.
+void CMMLexer::reportDiagnostics() const {
+  auto It = std::lower_bound(
+      Diagnostics.begin(), Diagnostics.end(), TokIndex,
+      [](const Diagnostic &D, size_t Index) { return D.TokenIndex < Index; });
+  for (; It != Diagnostics.end() && It->TokenIndex == TokIndex; ++It) {
+    if (It->IsError)
+      SrcMgr.Error(It->Loc, It->Msg);
+    else
+      SrcMgr.Warning(It->Loc, It->Msg);
+  }
+}
+
+void CMMLexer::tokenize() {
+  // A rough guess, to avoid most of the reallocations.
+  Tokens.reserve(BufferSize / 4 + 1);
+
+  for (;;) {
+    Token Tok = LexToken();
+    LexedToken Lexed;
+    Lexed.Loc = TokStartLoc;
+    Lexed.Kind = Tok.getKind();
+    switch (Lexed.Kind) {
+    default:
+      Lexed.IntVal = 0;
+      break;
+    case Token::Identifier:
+    case Token::String:
+    case Token::InfixOp:
+      Lexed.StrVal = Atom(StrVal);
+      Lexed.IntVal = 0;
+      break;
+    case Token::Integer:
+      Lexed.IntVal = IntVal;
+      break;
+    case Token::Double:
+      Lexed.DoubleVal = DoubleVal;
+      break;
+    case Token::Boolean:
+      Lexed.BoolVal = BoolVal;
+      break;
+    }
+    Tokens.push_back(Lexed);
+
+    if (Tok.is(Token::Eof))
+      break;
+  }
+}
+
 static int hexDigitValue(int C) {
   if ('a' <= C && C <= 'f')
     return 10 + C - 'a';
@@ -70,38 +135,44 @@ static void UnEscapeLexed(std::string &Str) {
  */
 
 Token CMMLexer::LexToken() {
-  TokStartLoc = SrcMgr.getLoc();
-  int CurChar = getNextChar();
-
-  switch (CurChar) {
-  default:
-    if (std::isalpha(static_cast<unsigned char>(CurChar)) || CurChar == '_') {
-      ungetChar();
-      return LexIdentifier();
-    }
-    Error("unknown character " + std::string(1, static_cast<char>(CurChar)));
-    return Token::Error;
-
-  case std::char_traits<char>::eof():
-    return Token::Eof;
+  int CurChar;
+  for (;;) {
+    TokStartLoc = CurLoc;
+    CurChar = getNextChar();
 
-  case '\0': case ' ': case '\t': case '\n': case '\r':
-    return LexToken();
+    // Skip whitespaces and comments.
+    if (CurChar == '\0' || CurChar == ' ' || CurChar == '\t' ||
+        CurChar == '\n' || CurChar == '\r')
+      continue;
+    if (CurChar != '/')
+      break;
 
-  case '/': {
     int NextChar = getNextChar();
     if (NextChar == '/') {
       skipLineComment();
-      return LexToken();
+      continue;
     }
     if (NextChar == '*') {
       skipBlockComment();
-      return LexToken();
+      continue;
     }
     ungetChar();
     return Token::Slash;
   }
 
+  switch (CurChar) {
+  default:
+    if (std::isalpha(static_cast<unsigned char>(CurChar)) || CurChar == '_') {
+      ungetChar();
+      return LexIdentifier();
+    }
+    lexError("unknown character " +
+             std::string(1, static_cast<char>(CurChar)));
+    return Token::Error;
+
+  case std::char_traits<char>::eof():
+    return Token::Eof;
+
   case '\'':  return LexChar();
   case '"':   return LexString();
   case '(':   return Token::LParen;
@@ -215,7 +286,7 @@ Token CMMLexer::LexIdentifier() {
   if (StrVal == "false") { BoolVal = false; return Token::Boolean; }
 
   if (StrVal.back() == '_')
-    Warning(SrcMgr.getLoc(), "identifier end with _");
+    lexWarning(CurLoc, "identifier end with _");
 
   return Token::Identifier;
 }
@@ -225,21 +296,21 @@ Token CMMLexer::LexChar() {
   int CurChar = getNextChar();
 
   if (CurChar == std::char_traits<char>::eof()) {
-    Error("end of file in char constant");
+    lexError("end of file in char constant");
     return Token::Error;
   }
 
   if (CurChar == '\\') {
-    LocTy CharLoc = SrcMgr.getLoc();
+    LocTy CharLoc = CurLoc;
     CurChar = getNextChar();
 
     if (CurChar == std::char_traits<char>::eof()) {
-      Error("end of file in char constant");
+      lexError("end of file in char constant");
       return Token::Error;
     }
 
     if (UnEscapeChar(CurChar)) {
-      Warning(CharLoc, "\\" + std::string(1, static_cast<char>(CurChar)) +
+      lexWarning(CharLoc, "\\" + std::string(1, static_cast<char>(CurChar)) +
           " is an invalid escaping character");
     }
   }
@@ -247,14 +318,20 @@ Token CMMLexer::LexChar() {
   IntVal = CurChar;
 
   if (CurChar == '\'') {
-    Warning("no character in single quote, treat as '\\0'");
+    lexWarning("no character in single quote, treat as '\\0'");
     IntVal = '\0';
     return Token::Integer;
   }
 
   LocTy QuoteLoc;
-  while (QuoteLoc = SrcMgr.getLoc(), getNextChar() != '\'')
-    Warning(QuoteLoc, "extra character in single quote");
+  int NextChar;
+  while (QuoteLoc = CurLoc, (NextChar = getNextChar()) != '\'') {
+    if (NextChar == std::char_traits<char>::eof()) {
+      lexError("end of file in char constant");
+      return Token::Error;
+    }
+    lexWarning(QuoteLoc, "extra character in single quote");
+  }
 
   return Token::Integer;
 }
@@ -271,22 +348,22 @@ Token CMMLexer::LexString() {
     }
 
     if (CurChar == std::char_traits<char>::eof()) {
-      Error("end of file in string constant");
+      lexError("end of file in string constant");
       return Token::Error;
     }
 
     if (CurChar == '\\') {
-      LocTy Loc = SrcMgr.getLoc();
+      LocTy Loc = CurLoc;
 
       CurChar = getNextChar();
 
       if (CurChar == std::char_traits<char>::eof()) {
-        Error("end of file in string constant after \\");
+        lexError("end of file in string constant after \\");
         return Token::Error;
       }
 
       if (UnEscapeChar(CurChar)) {
-        Warning(Loc, "\\" + std::string(1, static_cast<char>(CurChar)) +
+        lexWarning(Loc, "\\" + std::string(1, static_cast<char>(CurChar)) +
             " is an invalid escaping sequence in string literal");
         StrVal.push_back('\\');
       }
@@ -299,7 +376,7 @@ Token CMMLexer::LexDigit() {
   int HeadChar = getNextChar();
   IntVal = 0;
 
-  LocTy DigitStartLoc = getLoc();
+  LocTy DigitStartLoc = TokStartLoc;
 
   if (HeadChar == '0' && (peekNextChar() == 'x' || peekNextChar() == 'X')) {
     getNextChar();
@@ -307,7 +384,7 @@ Token CMMLexer::LexDigit() {
       int NewIntVal = 16 * IntVal + hexDigitValue(getNextChar());
 
       if (NewIntVal < 0) {
-        Warning(DigitStartLoc, "hexadecimal integer literal is too large");
+        lexWarning(DigitStartLoc, "hexadecimal integer literal is too large");
 
         while (std::isxdigit(getNextChar())) ;
         ungetChar();
@@ -326,7 +403,7 @@ Token CMMLexer::LexDigit() {
     int NewIntVal = 10 * IntVal + (getNextChar() - '0');
 
     if (NewIntVal < 0) {
-      Warning(DigitStartLoc, "decimal integer literal is too large");
+      lexWarning(DigitStartLoc, "decimal integer literal is too large");
 
       while (std::isdigit(getNextChar()));
       ungetChar();
@@ -349,7 +426,7 @@ Token CMMLexer::LexDigit() {
 
   while (std::isdigit(DigitChar = getNextChar())) {
     if (Scale > 100000) {
-      Warning(DigitStartLoc, "long floating number may lost precision");
+      lexWarning(DigitStartLoc, "long floating number may lost precision");
       while (std::isdigit(getNextChar()));
       break;
     }
@@ -385,13 +462,13 @@ Token CMMLexer::LexInfixOp(int HeadChar) {
 bool CMMLexer::skipBlockComment() {
   int CurChar;
   do {
-    auto CurLoc = SrcMgr.getLoc();
+    auto CharLoc = CurLoc;
     CurChar = getNextChar();
     if (CurChar == std::char_traits<char>::eof())
-      return Error("unterminated /* comment");
+      return lexError("unterminated /* comment");
 
     if (CurChar == '/' && peekNextChar() == '*') {
-      Warning(CurLoc, "block comments can't be nested");
+      lexWarning(CharLoc, "block comments can't be nested");
       getNextChar();
       skipBlockComment();
     }
@@ -405,15 +482,3 @@ bool CMMLexer::skipBlockComment() {
     return skipBlockComment();
   }
 }
-
-int CMMLexer::peekNextChar() {
-  return SrcMgr.peek();
-}
-
-int CMMLexer::getNextChar() {
-  return SrcMgr.get();
-}
-
-void CMMLexer::ungetChar() {
-  SrcMgr.unget();
-}
@@ -3,6 +3,15 @@
 
 using namespace cmm;
 
+/// \brief Return the value of a string literal. Equal literals share the
+/// same string object.
+const cvm::BasicValue &CMMParser::getStringLiteral(Atom Literal) {
+  auto It = StringLiterals.find(Literal);
+  if (It == StringLiterals.end())
+    It = StringLiterals.emplace(Literal, Literal.str()).first;
+  return It->second;
+}
+
 bool CMMParser::parse() {
   Lex();
   while (!Lexer.isOneOf(Token::Eof, Token::Error))
@@ -72,18 +81,18 @@ bool CMMParser::parseTopLevel() {
     if (parseTypeSpecifier(Type))
       return true;
 
-    LocTy Loc = Lexer.getLoc();
+    size_t NameIndex = Lexer.getTokenIndex();
 
     if (Lexer.isNot(Token::Identifier))
       return Error("expect identifier after type");
-    std::string Name = Lexer.getStrVal();
+    Atom Name = Lexer.getAtomVal();
     Lex();  // Eat the identifier.
 
     if (Lexer.is(Token::LParen))
       return parseFunctionDefinition(Type, Name); // It's function definition.
 
     // It's a variable declaration.
-    Lexer.seekLoc(Loc);
+    Lexer.seekToken(NameIndex);
     Lex();
     std::unique_ptr<StatementAST> DeclStatement;
     if (parseDeclarationStatement(Type, DeclStatement))
@@ -114,17 +123,17 @@ bool CMMParser::parseInfixOpDefinition() {
 
   if (Lexer.isNot(Token::Identifier))
     return Error("left hand operand name for infix operator expected");
-  std::string LHS = Lexer.getStrVal();
+  Atom LHS = Lexer.getAtomVal();
   Lex();  // eat the LHS operand identifier.
 
   if (Lexer.isNot(Token::InfixOp))
     return Error("symbol of infix operator expected");
-  std::string Symbol = Lexer.getStrVal();
+  Atom Symbol = Lexer.getAtomVal();
   Lex();  // eat the infix operator.
 
   if (Lexer.isNot(Token::Identifier))
     return Error("right hand operand name for infix operator expected");
-  std::string RHS = Lexer.getStrVal();
+  Atom RHS = Lexer.getAtomVal();
   Lex();  // eat the RHS operand identifier.
 
   std::unique_ptr<StatementAST> Statement;
@@ -140,10 +149,11 @@ bool CMMParser::parseInfixOpDefinition() {
 
   if (!BinOpPrecedence.emplace(Symbol,
                                static_cast<int8_t>(Precedence)).second) {
-    Warning(Loc, "infix operator " + Symbol + " overrides another");
+    Warning(Loc, "infix operator " + Symbol.str() + " overrides another");
   }
-  InfixOpDefinition.emplace(Symbol, InfixOpDefinitionAST(Symbol, LHS, RHS,
-                                                         std::move(Statement)));
+  InfixOpDefinition.emplace(Symbol.str(),
+                            InfixOpDefinitionAST(Symbol, LHS, RHS,
+                                                 std::move(Statement)));
   return false;
 }
 
@@ -158,7 +168,7 @@ bool CMMParser::parseFunctionDefinition() {
   if (Lexer.isNot(Token::Identifier))
     return Error("expect identifier in function definition");
 
-  std::string Identifier = Lexer.getStrVal();
+  Atom Identifier = Lexer.getAtomVal();
   Lex();  // eat the identifier of function.
 
   return parseFunctionDefinition(RetType, Identifier);
@@ -167,8 +177,7 @@ bool CMMParser::parseFunctionDefinition() {
 /// \brief Parse a function definition body.
 /// _functionDefinition ::= "(" ")" Statement
 /// _functionDefinition ::= "(" parameterList ")" Statement
-bool CMMParser::parseFunctionDefinition(cvm::BasicType RetType,
-                                        const std::string &Name) {
+bool CMMParser::parseFunctionDefinition(cvm::BasicType RetType, Atom Name) {
   assert(Lexer.is(Token::LParen) && "parseFunctionDefinition: unknown token");
   LocTy Loc = Lexer.getLoc();
   Lex();  // Eat LParen '('.
@@ -186,8 +195,8 @@ bool CMMParser::parseFunctionDefinition(cvm::BasicType RetType,
 
   FunctionDefinitionAST FuncDef(Name, RetType, std::move(ParameterList),
                                 std::move(Statement));
-  if (!FunctionDefinition.emplace(Name, std::move(FuncDef)).second) {
-    Warning(Loc, "function `" + Name + "' overrides another one");
+  if (!FunctionDefinition.emplace(Name.str(), std::move(FuncDef)).second) {
+    Warning(Loc, "function `" + Name.str() + "' overrides another one");
   }
   return false;
 }
@@ -201,7 +210,7 @@ bool CMMParser::parseParameterList(std::list<Parameter> &ParameterList) {
     return false;
   }
   for (;;) {
-    std::string Identifier;
+    Atom Identifier;
     cvm::BasicType Type;
     LocTy Loc;
 
@@ -210,7 +219,7 @@ bool CMMParser::parseParameterList(std::list<Parameter> &ParameterList) {
 
     Loc = Lexer.getLoc();
     if (Lexer.is(Token::Identifier)) {
-      Identifier = Lexer.getStrVal();
+      Identifier = Lexer.getAtomVal();
       Lex();  // Eat the identifier.
     } else {
       Warning("missing identifier after type");
@@ -370,7 +379,7 @@ int8_t CMMParser::getBinOpPrecedence() {
   case Token::Percent:
     return 11;
   case Token::InfixOp: {
-    auto It = BinOpPrecedence.find(Lexer.getStrVal());
+    auto It = BinOpPrecedence.find(Lexer.getAtomVal());
     if (It != BinOpPrecedence.end())
       return It->second;
     break;
@@ -412,6 +421,7 @@ bool CMMParser::parsePrimaryExpression(std::unique_ptr<ExpressionAST> &Res) {
     if (parseIdentifierExpression(Res))
       return true;
     while (Lexer.is(Token::LBrac)) {
+      LocTy BracLoc = Lexer.getLoc();
       Lex(); // Eat the ']'.
 
       std::unique_ptr<ExpressionAST> IndexExpr, TmpRHS;
@@ -425,6 +435,7 @@ bool CMMParser::parsePrimaryExpression(std::unique_ptr<ExpressionAST> &Res) {
       std::swap(Res, TmpRHS);
       Res.reset(new BinaryOperatorAST(
           BinaryOperatorAST::Index, std::move(TmpRHS), std::move(IndexExpr)));
+      Res->setLoc(BracLoc);
     }
     return false;
 
@@ -440,10 +451,12 @@ bool CMMParser::parsePrimaryExpression(std::unique_ptr<ExpressionAST> &Res) {
   case Token::Exclaim:  UnaryOpKind = UnaryOperatorAST::LogicalNot; break;
   }
 
+  LocTy OpLoc = Lexer.getLoc();
   Lex(); // Eat the operator: +,-,~,!
   if (parsePrimaryExpression(Operand))
     return true;
   Res = UnaryOperatorAST::tryFoldUnaryOp(UnaryOpKind, std::move(Operand));
+  Res->setLoc(OpLoc);
   return false;
 }
 
@@ -455,11 +468,13 @@ bool CMMParser::parseBinOpRHS(int8_t ExprPrec,
 
   // Handle assignment expression first.
   if (Lexer.getTok().is(Token::Equal)) {
+    LocTy OpLoc = Lexer.getLoc();
     Lex();
     if (parseExpression(RHS))
       return true;
     Res = BinaryOperatorAST::create(Token::Equal,
                                     std::move(Res), std::move(RHS));
+    Res->setLoc(OpLoc);
     return false;
   }
   for (;;) {
@@ -473,7 +488,8 @@ bool CMMParser::parseBinOpRHS(int8_t ExprPrec,
       return false;
 
     // Save the potential symbol before lex.
-    std::string Symbol = Lexer.getStrVal();
+    Atom Symbol = Lexer.getAtomVal();
+    LocTy OpLoc = Lexer.getLoc();
     // Eat the binary operator.
     Lex();
     // Eat the next primary expression.
@@ -492,6 +508,7 @@ bool CMMParser::parseBinOpRHS(int8_t ExprPrec,
     else
       Res = BinaryOperatorAST::tryFoldBinOp(TokenKind, std::move(Res),
                                              std::move(RHS));
+    Res->setLoc(OpLoc);
   }
 }
 
@@ -504,7 +521,8 @@ bool CMMParser::parseIdentifierExpression(std::unique_ptr<ExpressionAST> &Res) {
   assert(Lexer.is(Token::Identifier) &&
       "parseIdentifierExpression: unknown token");
 
-  std::string Identifier = Lexer.getStrVal();
+  Atom Identifier = Lexer.getAtomVal();
+  LocTy IdentifierLoc = Lexer.getLoc();
   Lex();  // eat the identifier
 
   LocTy ExclaimLoc;
@@ -524,7 +542,8 @@ bool CMMParser::parseIdentifierExpression(std::unique_ptr<ExpressionAST> &Res) {
     if (Lexer.isNot(Token::RParen))
       return Error("expect ')' in function call");
     Lex(); // eat the ')'
-    Res.reset(new FunctionCallAST(Identifier, std::move(Args), Dynamic));
+    Res.reset(new FunctionCallAST(Identifier, std::move(Args), Dynamic,
+                                  IdentifierLoc));
   } else {
     if (Dynamic)
       Warning(ExclaimLoc, "trailing `!' is ignored in identifier");
@@ -545,7 +564,9 @@ bool CMMParser::parseConstantExpression(std::unique_ptr<ExpressionAST> &Res) {
   case Token::Integer:  Res.reset(new IntAST(Lexer.getIntVal())); break;
   case Token::Double:   Res.reset(new DoubleAST(Lexer.getDoubleVal())); break;
   case Token::Boolean:  Res.reset(new BoolAST(Lexer.getBoolVal())); break;
-  case Token::String:   Res.reset(new StringAST(Lexer.getStrVal())); break;
+  case Token::String:
+    Res.reset(new StringAST(getStringLiteral(Lexer.getAtomVal())));
+    break;
   }
   Lex(); // eat the string,bool,int,double.
   return false;
@@ -673,6 +694,7 @@ bool CMMParser::parseReturnStatement(std::unique_ptr<StatementAST> &Res) {
   std::unique_ptr<ExpressionAST> ReturnValue;
 
   assert(Lexer.is(Token::Kw_return) && "parseIfStatement: unknown token");
+  LocTy ReturnLoc = Lexer.getLoc();
   Lex();  // eat the 'return'.
 
   if (Lexer.isNot(Token::Semicolon) && parseExpression(ReturnValue))
@@ -680,7 +702,7 @@ bool CMMParser::parseReturnStatement(std::unique_ptr<StatementAST> &Res) {
   if (Lexer.isNot(Token::Semicolon))
     return Error("unexpected token after return value");
   Lex();  // eat the semicolon.
-  Res.reset(new ReturnStatementAST(std::move(ReturnValue)));
+  Res.reset(new ReturnStatementAST(std::move(ReturnValue), ReturnLoc));
   return false;
 }
 
@@ -727,7 +749,8 @@ bool CMMParser::parseDeclarationStatement(cvm::BasicType Type,
   for (;;) {
     if (Lexer.isNot(Token::Identifier))
       return Error("identifier expected");
-    std::string Name = Lexer.getStrVal();
+    Atom Name = Lexer.getAtomVal();
+    LocTy NameLoc = Lexer.getLoc();
     Lex(); // eat the identifier
 
     std::unique_ptr<ExpressionAST> InitExpr;
@@ -749,8 +772,8 @@ bool CMMParser::parseDeclarationStatement(cvm::BasicType Type,
     }
 
     // Emit
-    DeclList->addDeclaration(Name,
-                             std::move(InitExpr), std::move(CountExprList));
+    DeclList->addDeclaration(Name, std::move(InitExpr),
+                             std::move(CountExprList), NameLoc);
 
     if (Lexer.isNot(Token::Comma))
       break;
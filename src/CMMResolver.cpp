@@ -0,0 +1,359 @@
+#include "CMMResolver.h"
+#include <algorithm>
+#include <cassert>
+
+using namespace cmm;
+
+/// \brief Return true if executing the statement may declare variables in
+/// the current scope, that is, it's a declaration not nested in a block.
+static bool declaresInScope(const StatementAST *Stmt) {
+  if (!Stmt)
+    return false;
+
+  switch (Stmt->getKind()) {
+  default:
+    return false;
+  case StatementAST::DeclarationStatement:
+  case StatementAST::DeclarationListStatement:
+    return true;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    return declaresInScope(IfStmt->getStatementThen()) ||
+        declaresInScope(IfStmt->getStatementElse());
+  }
+  case StatementAST::WhileStatement:
+    return declaresInScope(Stmt->as_cptr<WhileStatementAST>()->getStatement());
+  case StatementAST::ForStatement:
+    return declaresInScope(Stmt->as_cptr<ForStatementAST>()->getStatement());
+  }
+}
+
+bool CMMResolver::resolve() {
+  // Top level statements are resolved first, so that all top level variables
+  // are known when resolving functions, which may run at any time.
+  ScopeStack.clear();
+  ScopeStack.emplace_back(TopLevelBlock.getSlots(), 0);
+  FunctionScope = 0;
+  for (auto &Stmt : TopLevelBlock.getStatementList())
+    resolveStatement(Stmt.get());
+
+  FunctionScope = 1;
+  for (const auto &F : UserFunctionMap)
+    resolveFunction(F.second);
+  for (const auto &I : InfixOpMap)
+    resolveInfixOp(I.second);
+  return HadError;
+}
+
+void CMMResolver::addNativeFunctions() {
+  cvm::addNativeFunctions(NativeFunctionMap);
+}
+
+/// \brief Link a call to the function called. A user-defined function hides
+/// a native one of the same name.
+void CMMResolver::linkFunctionCall(const FunctionCallAST *FuncCall) {
+  const std::string &Callee = FuncCall->getCallee().str();
+
+  auto UserFuncIt = UserFunctionMap.find(Callee);
+  if (UserFuncIt != UserFunctionMap.end()) {
+    FuncCall->link(&UserFuncIt->second, nullptr);
+    return;
+  }
+
+  auto NativeFuncIt = NativeFunctionMap.find(Callee);
+  if (NativeFuncIt == NativeFunctionMap.end())
+    return;
+
+  const cvm::NativeFunctionInfo &Native = NativeFuncIt->second;
+  size_t ArgCount = FuncCall->getArguments().size();
+  if (Native.Arity >= 0 && ArgCount != static_cast<size_t>(Native.Arity)) {
+    SrcMgr.Error(FuncCall->getLoc(), "function `" + Callee + "' expects " +
+        std::to_string(Native.Arity) + " parameter(s), " +
+        std::to_string(ArgCount) + " argument(s) provided");
+    HadError = true;
+  }
+  FuncCall->link(nullptr, Native.Function);
+}
+
+void CMMResolver::linkInfixOp(const InfixOpExprAST *Expr) const {
+  auto It = InfixOpMap.find(Expr->getSymbol().str());
+  if (It != InfixOpMap.end())
+    Expr->link(&It->second);
+}
+
+/// \brief Allocate a slot for a variable declared in the current scope.
+/// Declaring a name twice in a scope is an error at runtime, so they share
+/// the same slot.
+unsigned CMMResolver::declareSlot(Atom Name) {
+  Scope &Current = ScopeStack.back();
+  auto Res = Current.SlotMap.emplace(Name, Current.Slots->size());
+  if (Res.second)
+    Current.Slots->push_back(Name);
+  return Res.first->second;
+}
+
+VariableBinding CMMResolver::lookup(Atom Name) const {
+  if (DynamicLevel)
+    return VariableBinding();
+
+  // Hoisted blocks have no scope at runtime, so they're not counted.
+  unsigned Depth = 0;
+  for (size_t I = ScopeStack.size(); I-- > FunctionScope; ) {
+    const Scope &S = ScopeStack[I];
+    auto It = S.SlotMap.find(Name);
+    if (It != S.SlotMap.end())
+      return VariableBinding(VariableBinding::LocalBinding, Depth, It->second);
+    if (S.Frame == I)
+      ++Depth;
+  }
+
+  // Functions and infix operators see top level variables.
+  if (FunctionScope > 0) {
+    auto It = ScopeStack.front().SlotMap.find(Name);
+    if (It != ScopeStack.front().SlotMap.end()) {
+      return VariableBinding(VariableBinding::GlobalBinding, Depth,
+                             It->second);
+    }
+  }
+  return VariableBinding();
+}
+
+void CMMResolver::resolveFunction(const FunctionDefinitionAST &Function) {
+  ScopeStack.emplace_back(Function.getSlots(), ScopeStack.size());
+
+  // Parameters take the first slots in order. If two of them have the same
+  // name, the first one wins, the others can't be found by name.
+  Scope &FuncScope = ScopeStack.back();
+  for (const Parameter &P : Function.getParameterList()) {
+    bool First = !P.getName().empty() &&
+        FuncScope.SlotMap.emplace(P.getName(), FuncScope.Slots->size()).second;
+    FuncScope.Slots->push_back(First ? P.getName() : Atom());
+  }
+
+  resolveStatement(Function.getStatement());
+  ScopeStack.pop_back();
+  markTailCalls(Function, Function.getStatement(), true);
+}
+
+/// \brief Mark calls of a function to itself whose value is returned, either
+/// by a return statement or as the value of the last statement if \p Tail.
+/// Calls with dynamic binding or a wrong number of arguments aren't marked.
+void CMMResolver::markTailCalls(const FunctionDefinitionAST &Function,
+                                const StatementAST *Stmt, bool Tail) const {
+  if (!Stmt)
+    return;
+
+  const ExpressionAST *Value = nullptr;
+  switch (Stmt->getKind()) {
+  default:
+    return;
+  case StatementAST::BlockStatement: {
+    auto &StatementList = Stmt->as_cptr<BlockAST>()->getStatementList();
+    for (auto It = StatementList.begin(), E = StatementList.end(); It != E;) {
+      const StatementAST *S = (It++)->get();
+      markTailCalls(Function, S, Tail && It == E);
+    }
+    return;
+  }
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    markTailCalls(Function, IfStmt->getStatementThen(), Tail);
+    markTailCalls(Function, IfStmt->getStatementElse(), Tail);
+    return;
+  }
+  case StatementAST::WhileStatement:
+    markTailCalls(Function, Stmt->as_cptr<WhileStatementAST>()->getStatement(),
+                  false);
+    return;
+  case StatementAST::ForStatement:
+    markTailCalls(Function, Stmt->as_cptr<ForStatementAST>()->getStatement(),
+                  false);
+    return;
+  case StatementAST::ReturnStatement:
+    Value = Stmt->as_cptr<ReturnStatementAST>()->getReturnValue();
+    break;
+  case StatementAST::ExprStatement:
+    if (!Tail)
+      return;
+    Value = Stmt->as_cptr<ExprStatementAST>()->getExpression();
+    break;
+  }
+
+  if (!Value || !Value->isFunctionCallExpr())
+    return;
+  auto *FuncCall = Value->as_cptr<FunctionCallAST>();
+  if (FuncCall->getUserFunction() == &Function && !FuncCall->isDynamicBound() &&
+      FuncCall->getArguments().size() == Function.getParameterCount())
+    FuncCall->setTailCall();
+}
+
+void CMMResolver::resolveInfixOp(const InfixOpDefinitionAST &InfixOp) {
+  ScopeStack.emplace_back(InfixOp.getSlots(), ScopeStack.size());
+
+  Scope &InfixOpScope = ScopeStack.back();
+  InfixOpScope.SlotMap.emplace(InfixOp.getLHSName(), 0);
+  InfixOpScope.SlotMap.emplace(InfixOp.getRHSName(), 1);
+  InfixOpScope.Slots->push_back(InfixOp.getLHSName());
+  InfixOpScope.Slots->push_back(InfixOp.getRHSName());
+
+  resolveStatement(InfixOp.getStatement());
+  ScopeStack.pop_back();
+}
+
+void CMMResolver::resolveStatement(const StatementAST *Stmt) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  default:
+    assert(false && "resolveStatement: unknown statement kind");
+  case StatementAST::DeclarationStatement:
+    resolveDeclaration(Stmt->as_cptr<DeclarationAST>());
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      resolveDeclaration(Decl.get());
+    break;
+  case StatementAST::ExprStatement:
+    resolveExpression(Stmt->as_cptr<ExprStatementAST>()->getExpression());
+    break;
+  case StatementAST::BlockStatement:
+    resolveBlock(Stmt->as_cptr<BlockAST>());
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    resolveExpression(IfStmt->getCondition());
+    resolveStatement(IfStmt->getStatementThen());
+    resolveStatement(IfStmt->getStatementElse());
+    break;
+  }
+  case StatementAST::ReturnStatement:
+    resolveExpression(Stmt->as_cptr<ReturnStatementAST>()->getReturnValue());
+    break;
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    resolveLoop(nullptr, WhileStmt->getCondition(), nullptr,
+                WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    resolveLoop(ForStmt->getInit(), ForStmt->getCondition(),
+                ForStmt->getPost(), ForStmt->getStatement());
+    break;
+  }
+  case StatementAST::ContinueStatement:
+  case StatementAST::BreakStatement:
+    break;
+  }
+}
+
+/// \brief Resolve a block, which is hoisted unless it declares variables in
+/// top level code.
+void CMMResolver::resolveBlock(const BlockAST *Block) {
+  auto &StatementList = Block->getStatementList();
+  bool Hoisted = ScopeStack.back().Frame != 0 ||
+      std::none_of(StatementList.begin(), StatementList.end(),
+                   [](const std::unique_ptr<StatementAST> &Stmt) {
+                     return declaresInScope(Stmt.get());
+                   });
+
+  if (Hoisted) {
+    size_t Frame = ScopeStack.back().Frame;
+    ScopeStack.emplace_back(*ScopeStack.back().Slots, Frame, true);
+  } else {
+    ScopeStack.emplace_back(Block->getSlots(), ScopeStack.size());
+  }
+  size_t Begin = ScopeStack.back().Slots->size();
+
+  for (auto &Stmt : StatementList)
+    resolveStatement(Stmt.get());
+
+  if (Hoisted) {
+    Block->hoist(static_cast<unsigned>(Begin),
+                 static_cast<unsigned>(ScopeStack.back().Slots->size()));
+  }
+  ScopeStack.pop_back();
+}
+
+/// \brief Resolve a loop. If the loop body declares variables in the current
+/// scope, like `while (C) int X = 0;', they are visible to the condition from
+/// the second iteration on, so a static binding isn't reliable.
+void CMMResolver::resolveLoop(const ExpressionAST *Init,
+                              const ExpressionAST *Condition,
+                              const ExpressionAST *Post,
+                              const StatementAST *Body) {
+  bool Declares = declaresInScope(Body);
+  if (Declares)
+    ++DynamicLevel;
+
+  resolveExpression(Init);
+  resolveExpression(Condition);
+  resolveStatement(Body);
+  resolveExpression(Post);
+
+  if (Declares)
+    --DynamicLevel;
+}
+
+void CMMResolver::resolveDeclaration(const DeclarationAST *Decl) {
+  // The name is declared after evaluating the dimensions of an array, but
+  // before evaluating the initializer of it.
+  if (Decl->isArray()) {
+    for (auto &E : Decl->getElementCountList())
+      resolveExpression(E.get());
+    Decl->setSlot(declareSlot(Decl->getName()));
+    resolveExpression(Decl->getInitializer());
+    return;
+  }
+
+  resolveExpression(Decl->getInitializer());
+  Decl->setSlot(declareSlot(Decl->getName()));
+}
+
+void CMMResolver::resolveExpression(const ExpressionAST *Expr) {
+  if (!Expr)
+    return;
+
+  switch (Expr->getKind()) {
+  default:
+    assert(false && "resolveExpression: unknown expression kind");
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+    break;
+
+  case ExpressionAST::IdentifierExpression: {
+    auto *IdExpr = Expr->as_cptr<IdentifierAST>();
+    IdExpr->setBinding(lookup(IdExpr->getName()));
+    break;
+  }
+
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    linkFunctionCall(FuncCall);
+    for (auto &Arg : FuncCall->getArguments())
+      resolveExpression(Arg.get());
+    break;
+  }
+
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixOpExpr = Expr->as_cptr<InfixOpExprAST>();
+    linkInfixOp(InfixOpExpr);
+    resolveExpression(InfixOpExpr->getLHS());
+    resolveExpression(InfixOpExpr->getRHS());
+    break;
+  }
+
+  case ExpressionAST::BinaryOperatorExpression:
+    resolveExpression(Expr->as_cptr<BinaryOperatorAST>()->getLHS());
+    resolveExpression(Expr->as_cptr<BinaryOperatorAST>()->getRHS());
+    break;
+
+  case ExpressionAST::UnaryOperatorExpression:
+    resolveExpression(Expr->as_cptr<UnaryOperatorAST>()->getOperand());
+    break;
+  }
+}
@@ -0,0 +1,383 @@
+#include "CMMRuntime.h"
+#include "OutputBuffer.h"
+#include <cmath>
+#include <iostream>
+
+#if defined(__APPLE__) || defined(__linux__)
+#include <pthread.h>
+#include <sys/resource.h>
+#endif // defined(__APPLE__) || defined(__linux__)
+
+using namespace cmm;
+
+const size_t CMMRuntime::NativeFrameSize;
+const size_t CMMRuntime::NativeStackReserve;
+
+CMMRuntime::CMMRuntime(size_t MaxStack) : MaxStack(MaxStack) {
+  cvm::addNativeFunctions(NativeFunctions);
+}
+
+size_t CMMRuntime::getMainStackSize() {
+  size_t Size = 1024 * 1024; // The default on Windows.
+#if defined(__APPLE__) || defined(__linux__)
+  struct rlimit Limit;
+  if (::getrlimit(RLIMIT_STACK, &Limit) == 0) {
+    // An unlimited stack may still run into other mappings.
+    Size = Limit.rlim_cur == RLIM_INFINITY ? 8 * 1024 * 1024 :
+                                             static_cast<size_t>(Limit.rlim_cur);
+  }
+#endif // defined(__APPLE__) || defined(__linux__)
+  return Size;
+}
+
+/// \brief Run the program on a thread of its own, whose stack is reserved
+/// rather than committed, so it takes memory only as deep as calls go.
+int CMMRuntime::run(int Argc, char *Argv[], ProgramTy Program) {
+  struct Task {
+    CMMRuntime *RT;
+    int Argc;
+    char **Argv;
+    const ProgramTy &Program;
+    size_t StackSize;
+    int Res;
+
+    void start() {
+      char Base;
+      RT->StackBase = reinterpret_cast<uintptr_t>(&Base);
+      RT->NativeStackLimit = StackSize > NativeStackReserve ?
+                             StackSize - NativeStackReserve : 0;
+      Res = Program(Argc, Argv);
+    }
+  } T{this, Argc, Argv, Program, MaxStack * NativeFrameSize +
+                                 NativeStackReserve, 0};
+
+#if defined(__APPLE__) || defined(__linux__)
+  pthread_attr_t Attr;
+  pthread_t Thread;
+  if (T.StackSize / NativeFrameSize > MaxStack &&
+      ::pthread_attr_init(&Attr) == 0) {
+    bool Started = ::pthread_attr_setstacksize(&Attr, T.StackSize) == 0 &&
+        ::pthread_create(&Thread, &Attr, [](void *P) -> void * {
+          static_cast<Task *>(P)->start();
+          return nullptr;
+        }, &T) == 0;
+    ::pthread_attr_destroy(&Attr);
+    if (Started) {
+      ::pthread_join(Thread, nullptr);
+      return T.Res;
+    }
+  }
+#endif // defined(__APPLE__) || defined(__linux__)
+
+  // Fall back on the stack of the main thread.
+  T.StackSize = getMainStackSize();
+  T.start();
+  return T.Res;
+}
+
+cvm::NativeFunction CMMRuntime::getNative(const std::string &Name) const {
+  auto It = NativeFunctions.find(Name);
+  return It == NativeFunctions.end() ? nullptr : It->second.Function;
+}
+
+cvm::BasicValue &CMMRuntime::search(Env *E, Atom Name) {
+  // Variables of hoisted blocks come after those of the enclosing blocks in
+  // a scope, search backward for the innermost one.
+  for (; E != nullptr; E = E->OuterEnv) {
+    for (size_t Slot = E->Names->size(); Slot-- != 0; ) {
+      if (E->Vars[Slot].Declared && (*E->Names)[Slot] == Name)
+        return E->Vars[Slot].Value;
+    }
+  }
+  undefinedVariable(Name);
+}
+
+void CMMRuntime::error(const std::string &Msg) {
+  // Keep the error after what the program printed.
+  cvm::flushOutput();
+
+#if defined(__APPLE__) || defined(__linux__)
+  const char *StartColor = "\033[1;31m";
+  const char *EndColor = "\033[0m";
+  std::cerr << StartColor;
+#endif // defined(__APPLE__) || defined(__linux__)
+
+  std::cerr << "CMM Runtime Error: ";
+
+#if defined(__APPLE__) || defined(__linux__)
+  std::cerr << EndColor;
+#endif // defined(__APPLE__) || defined(__linux__)
+  std::cerr << Msg << std::endl;
+  std::exit(EXIT_FAILURE);
+}
+
+void CMMRuntime::stackOverflow(unsigned Line) {
+  error("stack overflow at line " + std::to_string(Line));
+}
+
+void CMMRuntime::undefinedVariable(Atom Name) {
+  error("variable `" + Name.str() + "' is undefined");
+}
+
+void CMMRuntime::noInfixResult() {
+  error("infix operator didn't return any value");
+}
+
+/// \brief Perform binary arithmetic operation (+,-,*,/) on values
+static cvm::BasicValue binaryArith(BinaryOperatorAST::OperatorKind OpKind,
+                                   const cvm::BasicValue &LHS,
+                                   const cvm::BasicValue &RHS) {
+  if (!LHS.isNumeric() || !RHS.isNumeric()) {
+    CMMRuntime::error(
+        "operands of binary arithmetic operations should be numeric");
+  }
+
+  if (LHS.isInt() && RHS.isInt()) {
+    switch (OpKind) {
+    default:
+      CMMRuntime::error(std::to_string(OpKind) +
+          " is not valid binary arithmetic operation kind");
+    case BinaryOperatorAST::Add:
+      return CMMRuntime::add(LHS.IntVal, RHS.IntVal);
+    case BinaryOperatorAST::Minus:
+      return CMMRuntime::subtract(LHS.IntVal, RHS.IntVal);
+    case BinaryOperatorAST::Multiply:
+      return CMMRuntime::multiply(LHS.IntVal, RHS.IntVal);
+    case BinaryOperatorAST::Modulo:
+      return CMMRuntime::modulo(LHS.IntVal, RHS.IntVal);
+    case BinaryOperatorAST::Division:
+      return CMMRuntime::divide(LHS.IntVal, RHS.IntVal);
+    }
+  }
+
+  double L = LHS.toDouble(), R = RHS.toDouble();
+  switch (OpKind) {
+  default:
+    CMMRuntime::error(std::to_string(OpKind) +
+        " is not a valid binary arithmetic operation kind");
+  case BinaryOperatorAST::Add:
+    return L + R;
+  case BinaryOperatorAST::Minus:
+    return L - R;
+  case BinaryOperatorAST::Multiply:
+    return L * R;
+  case BinaryOperatorAST::Division:
+    return L / R;
+  case BinaryOperatorAST::Modulo:
+    return std::fmod(L, R);
+  }
+}
+
+/// \brief Perform binary relational operation (<, <=, ==, !=, >, >=) on values
+static cvm::BasicValue binaryRelation(BinaryOperatorAST::OperatorKind OpKind,
+                                      const cvm::BasicValue &LHS,
+                                      const cvm::BasicValue &RHS) {
+  if (LHS.Type != RHS.Type) {
+    if (LHS.isNumeric() && RHS.isNumeric()) {
+      return binaryRelation(OpKind, LHS.toDouble(), RHS.toDouble());
+    }
+    CMMRuntime::error("relational operator should apply to identical type");
+  }
+
+  switch (OpKind) {
+  default:
+    CMMRuntime::error(std::to_string(OpKind) +
+        " is not a valid binary relational operation kind");
+  case BinaryOperatorAST::Less:
+    return LHS < RHS;
+  case BinaryOperatorAST::LessEqual:
+    return LHS <= RHS;
+  case BinaryOperatorAST::Equal:
+    return LHS == RHS;
+  case BinaryOperatorAST::NotEqual:
+    return LHS != RHS;
+  case BinaryOperatorAST::Greater:
+    return LHS > RHS;
+  case BinaryOperatorAST::GreaterEqual:
+    return LHS >= RHS;
+  }
+}
+
+/// \brief Perform binary bitwise operation (<<,>>,&,|) on values
+static cvm::BasicValue binaryBitwise(BinaryOperatorAST::OperatorKind OpKind,
+                                     const cvm::BasicValue &LHS,
+                                     const cvm::BasicValue &RHS) {
+  if (!LHS.isInt() || !RHS.isInt()) {
+    CMMRuntime::error("operands of bitwise operations should be int");
+  }
+
+  switch (OpKind) {
+  default:
+    CMMRuntime::error(std::to_string(OpKind) +
+        " is not a valid binary bitwise operation kind");
+  case BinaryOperatorAST::BitwiseAnd:
+    return LHS.IntVal & RHS.IntVal;
+  case BinaryOperatorAST::BitwiseOr:
+    return LHS.IntVal | RHS.IntVal;
+  case BinaryOperatorAST::BitwiseXor:
+    return LHS.IntVal ^ RHS.IntVal;
+  case BinaryOperatorAST::LeftShift:
+    return CMMRuntime::shiftLeft(LHS.IntVal, RHS.IntVal);
+  case BinaryOperatorAST::RightShift:
+    return CMMRuntime::shiftRight(LHS.IntVal, RHS.IntVal);
+  }
+}
+
+/// \brief Perform a binary operator other than logical ones, assignment and
+/// indexing, which are evaluated along with their operands.
+cvm::BasicValue
+CMMRuntime::binaryOp(BinaryOperatorAST::OperatorKind OpKind,
+                     const cvm::BasicValue &LHS, const cvm::BasicValue &RHS) {
+  switch (OpKind) {
+  default:
+    error("unknown binary operator kind (code :" +
+        std::to_string(OpKind) + ")");
+  case BinaryOperatorAST::Add:
+    if (LHS.isString() || RHS.isString())
+      return LHS.toString() + RHS.toString();
+    /* fall Through */
+  case BinaryOperatorAST::Minus:
+  case BinaryOperatorAST::Multiply:
+  case BinaryOperatorAST::Division:
+  case BinaryOperatorAST::Modulo:
+    return binaryArith(OpKind, LHS, RHS);
+
+  case BinaryOperatorAST::Less:
+  case BinaryOperatorAST::LessEqual:
+  case BinaryOperatorAST::Equal:
+  case BinaryOperatorAST::NotEqual:
+  case BinaryOperatorAST::Greater:
+  case BinaryOperatorAST::GreaterEqual:
+    return binaryRelation(OpKind, LHS, RHS);
+
+  case BinaryOperatorAST::BitwiseAnd:
+  case BinaryOperatorAST::BitwiseOr:
+  case BinaryOperatorAST::BitwiseXor:
+  case BinaryOperatorAST::LeftShift:
+  case BinaryOperatorAST::RightShift:
+    return binaryBitwise(OpKind, LHS, RHS);
+
+  case BinaryOperatorAST::LogicalAnd:
+  case BinaryOperatorAST::LogicalOr:
+  case BinaryOperatorAST::Assign:
+  case BinaryOperatorAST::Index:
+    error("assignment/index/logicalBinOp "
+          "should be handled in evaluateBinaryOpExpr");
+  }
+}
+
+cvm::BasicValue
+CMMRuntime::unaryOp(UnaryOperatorAST::OperatorKind OpKind,
+                    const cvm::BasicValue &Operand) {
+  switch (OpKind) {
+  default:
+    error("unknown unary operator kind (code :" +
+        std::to_string(OpKind) + ")");
+
+  case UnaryOperatorAST::Plus:
+  case UnaryOperatorAST::Minus:
+    if (!Operand.isNumeric()) {
+      error("operands of unary arithmetic operations should be numeric");
+    }
+    if (OpKind == UnaryOperatorAST::Plus)
+      return Operand;
+    if (Operand.isInt())
+      return negate(Operand.IntVal);
+    return -Operand.DoubleVal;
+
+  case UnaryOperatorAST::LogicalNot:
+    return !Operand.toBool();
+
+  case UnaryOperatorAST::BitwiseNot:
+    if (!Operand.isInt()) {
+      error("operand of unary bitwise operation should be int");
+    }
+    return ~Operand.IntVal;
+  }
+}
+
+void CMMRuntime::assign(cvm::ValueRef Var, cvm::BasicValue Value,
+                        bool Checked) {
+  if (Var.isArray()) {
+    error("cannot assign value to array directly");
+  }
+
+  if (Checked) {
+    Var.set(Value);
+    return;
+  }
+
+  cvm::BasicType Type = Var.getType();
+  if (Type != Value.Type) {
+    if (Type == cvm::DoubleType && Value.isInt()) {
+      Var.set(static_cast<double>(Value.IntVal));
+      return;
+    }
+    error("assignment to " + cvm::TypeToStr(Type) +
+        " variable with " + cvm::TypeToStr(Value.Type) + " expression");
+  }
+  Var.set(Value);
+}
+
+void CMMRuntime::indexOutOfRange(size_t ArraySize, int Index) {
+  error("index out of range: should within [0," +
+      std::to_string(ArraySize) + "); actually got index " +
+      std::to_string(Index));
+}
+
+void CMMRuntime::redeclared(Atom Name) {
+  error("variable `" + Name.str() + "' is already defined in current scope");
+}
+
+void CMMRuntime::badDimension(Atom Name, const cvm::BasicValue &Dim) {
+  if (!Dim.isInt()) {
+    error("expressions in array declaration `" + Name.str() +
+        "' should be integral type");
+  }
+  error("dimension of array `" + Name.str() + "' declared to be " +
+      std::to_string(Dim.IntVal) + "; positive number expected");
+}
+
+void CMMRuntime::badInitializer(Atom Name, cvm::BasicType Type,
+                                const cvm::BasicValue &Init) {
+  error("variable `" + Name.str() + "' is declared to be " +
+      cvm::TypeToStr(Type) + ", but is initialized to be " +
+      cvm::TypeToStr(Init.Type));
+}
+
+void CMMRuntime::badArgument(const cvm::BasicValue &Arg,
+                             cvm::BasicType ParamType, Atom Function,
+                             Atom Param) {
+  error("in function `" + Function.str() + "', parameter `" + Param.str() +
+      "' has type " + cvm::TypeToStr(ParamType) + ", but argument is " +
+      cvm::TypeToStr(Arg.Type));
+}
+
+void CMMRuntime::badArgumentCount(Atom Function, size_t Params,
+                                  size_t Args) {
+  error("Function `" + Function.str() + "' expects " +
+      std::to_string(Params) + " parameter(s), " +
+      std::to_string(Args) + " argument(s) provided");
+}
+
+void CMMRuntime::badReturnValue(const cvm::BasicValue &Value,
+                                cvm::BasicType Type, Atom Function) {
+  error("function `" + Function.str() + "' ought to return " +
+      cvm::TypeToStr(Type) + ", but got " + cvm::TypeToStr(Value.Type));
+}
+
+cvm::BasicValue CMMRuntime::makeArguments(int Argc, char *Argv[]) {
+  cvm::BasicValue Args(cvm::StringType, std::list<int>(1, Argc));
+  auto &ArgStrings = Args.getArray().Storage->Values;
+  for (int I = 0; I < Argc; ++I)
+    ArgStrings[I] = std::string(Argv[I]);
+  return Args;
+}
+
+int CMMRuntime::exitCode(const cvm::BasicValue &Value) {
+  if (!Value.isInt()) {
+    error("top level return statement should return integers, but " +
+        cvm::TypeToStr(Value.Type) + Value.toString() + " is returned");
+  }
+  return Value.IntVal;
+}
@@ -0,0 +1,1184 @@
+#include "CMMTranspiler.h"
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+using namespace cmm;
+
+/// \brief Return \p S as a C++ string literal. Characters other than
+/// printable ASCII are escaped in octal, and so is `?', to stay clear of
+/// trigraphs.
+static std::string quote(const std::string &S) {
+  std::string Res = "\"";
+  for (unsigned char C : S) {
+    if (C == '"' || C == '\\') {
+      Res += '\\';
+      Res += static_cast<char>(C);
+    } else if (C < ' ' || C > '~' || C == '?') {
+      char Buf[8];
+      std::snprintf(Buf, sizeof(Buf), "\\%03o", C);
+      Res += Buf;
+    } else {
+      Res += static_cast<char>(C);
+    }
+  }
+  return Res + "\"";
+}
+
+static std::string getIntLiteral(int Value) {
+  // -2147483648 is the negation of a literal too large for an int.
+  if (Value == std::numeric_limits<int>::min())
+    return "(-2147483647 - 1)";
+  if (Value < 0)
+    return "(" + std::to_string(Value) + ")";
+  return std::to_string(Value);
+}
+
+static std::string getDoubleLiteral(double Value) {
+  std::string Res;
+  if (std::isnan(Value)) {
+    Res = "std::numeric_limits<double>::quiet_NaN()";
+  } else if (std::isinf(Value)) {
+    Res = "std::numeric_limits<double>::infinity()";
+  } else {
+    char Buf[32];
+    std::snprintf(Buf, sizeof(Buf), "%.17g", std::fabs(Value));
+    Res = Buf;
+    if (Res.find_first_of(".e") == std::string::npos)
+      Res += ".0";
+  }
+  return std::signbit(Value) ? "(-" + Res + ")" : Res;
+}
+
+static const char *getTypeName(cvm::BasicType Type) {
+  switch (Type) {
+  default:
+    assert(false && "getTypeName: unknown basic type");
+  case cvm::BoolType:   return "cvm::BoolType";
+  case cvm::IntType:    return "cvm::IntType";
+  case cvm::DoubleType: return "cvm::DoubleType";
+  case cvm::StringType: return "cvm::StringType";
+  case cvm::VoidType:   return "cvm::VoidType";
+  }
+  return nullptr; // Make the compiler happy.
+}
+
+static const char *getOpName(BinaryOperatorAST::OperatorKind OpKind) {
+  switch (OpKind) {
+  default:
+    assert(false && "getOpName: unknown operator kind");
+  case BinaryOperatorAST::Add:          return "BinaryOperatorAST::Add";
+  case BinaryOperatorAST::Minus:        return "BinaryOperatorAST::Minus";
+  case BinaryOperatorAST::Multiply:     return "BinaryOperatorAST::Multiply";
+  case BinaryOperatorAST::Division:     return "BinaryOperatorAST::Division";
+  case BinaryOperatorAST::Modulo:       return "BinaryOperatorAST::Modulo";
+  case BinaryOperatorAST::Less:         return "BinaryOperatorAST::Less";
+  case BinaryOperatorAST::LessEqual:    return "BinaryOperatorAST::LessEqual";
+  case BinaryOperatorAST::Equal:        return "BinaryOperatorAST::Equal";
+  case BinaryOperatorAST::NotEqual:     return "BinaryOperatorAST::NotEqual";
+  case BinaryOperatorAST::Greater:      return "BinaryOperatorAST::Greater";
+  case BinaryOperatorAST::GreaterEqual:
+    return "BinaryOperatorAST::GreaterEqual";
+  case BinaryOperatorAST::BitwiseAnd:   return "BinaryOperatorAST::BitwiseAnd";
+  case BinaryOperatorAST::BitwiseOr:    return "BinaryOperatorAST::BitwiseOr";
+  case BinaryOperatorAST::BitwiseXor:   return "BinaryOperatorAST::BitwiseXor";
+  case BinaryOperatorAST::LeftShift:    return "BinaryOperatorAST::LeftShift";
+  case BinaryOperatorAST::RightShift:   return "BinaryOperatorAST::RightShift";
+  }
+  return nullptr; // Make the compiler happy.
+}
+
+static const char *getOpName(UnaryOperatorAST::OperatorKind OpKind) {
+  switch (OpKind) {
+  default:
+    assert(false && "getOpName: unknown operator kind");
+  case UnaryOperatorAST::Plus:       return "UnaryOperatorAST::Plus";
+  case UnaryOperatorAST::Minus:      return "UnaryOperatorAST::Minus";
+  case UnaryOperatorAST::LogicalNot: return "UnaryOperatorAST::LogicalNot";
+  case UnaryOperatorAST::BitwiseNot: return "UnaryOperatorAST::BitwiseNot";
+  }
+  return nullptr; // Make the compiler happy.
+}
+
+/// \brief Return the C++ expression of an operator on ints \p L and \p R,
+/// empty if it's not one.
+static std::string getIntOp(BinaryOperatorAST::OperatorKind OpKind,
+                            const std::string &L, const std::string &R) {
+  const char *Op = nullptr;
+  const char *Function = nullptr;
+  switch (OpKind) {
+  default:                              return "";
+  case BinaryOperatorAST::Add:          Function = "add"; break;
+  case BinaryOperatorAST::Minus:        Function = "subtract"; break;
+  case BinaryOperatorAST::Multiply:     Function = "multiply"; break;
+  case BinaryOperatorAST::Division:     Function = "divide"; break;
+  case BinaryOperatorAST::Modulo:       Function = "modulo"; break;
+  case BinaryOperatorAST::LeftShift:    Function = "shiftLeft"; break;
+  case BinaryOperatorAST::RightShift:   Function = "shiftRight"; break;
+  case BinaryOperatorAST::Less:         Op = " < "; break;
+  case BinaryOperatorAST::LessEqual:    Op = " <= "; break;
+  case BinaryOperatorAST::Equal:        Op = " == "; break;
+  case BinaryOperatorAST::NotEqual:     Op = " != "; break;
+  case BinaryOperatorAST::Greater:      Op = " > "; break;
+  case BinaryOperatorAST::GreaterEqual: Op = " >= "; break;
+  case BinaryOperatorAST::BitwiseAnd:   Op = " & "; break;
+  case BinaryOperatorAST::BitwiseOr:    Op = " | "; break;
+  case BinaryOperatorAST::BitwiseXor:   Op = " ^ "; break;
+  }
+  if (Function)
+    return std::string("CMMRuntime::") + Function + "(" + L + ", " + R + ")";
+  return "(" + L + Op + R + ")";
+}
+
+static bool isRelational(BinaryOperatorAST::OperatorKind OpKind) {
+  return OpKind >= BinaryOperatorAST::Less &&
+         OpKind <= BinaryOperatorAST::GreaterEqual;
+}
+
+void CMMTranspiler::transpile(std::ostream &OS,
+                              const std::string &SourcePath) {
+  for (const auto &F : UserFunctionMap)
+    FunctionIndex.emplace(&F.second, FunctionIndex.size());
+  for (const auto &I : InfixOpMap)
+    InfixOpIndex.emplace(&I.second, InfixOpIndex.size());
+
+  std::vector<std::string> Bodies;
+  for (const auto &F : UserFunctionMap)
+    Bodies.push_back(translateFunction(F.second));
+  for (const auto &I : InfixOpMap)
+    Bodies.push_back(translateInfixOp(I.second));
+  Bodies.push_back(translateTopLevel());
+
+  OS << "// Translated from " << SourcePath << " by `cmm --emit-cpp'.\n"
+        "#include \"CMMRuntime.h\"\n"
+        "#include <cmath>\n\n"
+        "using namespace cmm;\n\n"
+        "static CMMRuntime RT(" << MaxStack << ");\n";
+  if (!Atoms.empty())
+    OS << "static Atom A[" << Atoms.size() << "];\n";
+  OS << "static SlotNameList SN[" << Scopes.size() << "];\n";
+  if (!Strings.empty())
+    OS << "static cvm::BasicValue Str[" << Strings.size() << "];\n";
+  if (!Natives.empty())
+    OS << "static cvm::NativeFunction N[" << Natives.size() << "];\n";
+  OS << "\n";
+
+  for (const auto &F : UserFunctionMap) {
+    OS << "static cvm::BasicValue F" << FunctionIndex[&F.second]
+       << "(CMMRuntime::Env *Outer, cvm::BasicValue *Args);\n";
+  }
+  for (const auto &I : InfixOpMap) {
+    OS << "static cvm::BasicValue I" << InfixOpIndex[&I.second]
+       << "(cvm::BasicValue LHS, cvm::BasicValue RHS);\n";
+  }
+  if (!UserFunctionMap.empty() || !InfixOpMap.empty())
+    OS << "\n";
+
+  for (const std::string &Body : Bodies)
+    OS << Body << "\n";
+
+  OS << "int main(int argc, char *argv[]) {\n";
+  for (size_t I = 0; I != Atoms.size(); ++I)
+    OS << "  A[" << I << "] = Atom(" << quote(Atoms[I].str()) << ");\n";
+  for (size_t I = 0; I != Scopes.size(); ++I) {
+    OS << "  SN[" << I << "] = {";
+    for (size_t Slot = 0; Slot != Scopes[I]->size(); ++Slot) {
+      OS << (Slot ? ", " : "") << addAtom((*Scopes[I])[Slot]);
+      if (Slot % 8 == 7 && Slot + 1 != Scopes[I]->size())
+        OS << "\n     ";
+    }
+    OS << "};\n";
+  }
+  for (size_t I = 0; I != Strings.size(); ++I) {
+    OS << "  Str[" << I << "] = cvm::BasicValue(std::string("
+       << quote(Strings[I]) << ", " << Strings[I].size() << "));\n";
+  }
+  for (size_t I = 0; I != Natives.size(); ++I)
+    OS << "  N[" << I << "] = RT.getNative(" << quote(Natives[I]) << ");\n";
+  OS << "  return RT.run(argc - 1, argv + 1, Program);\n"
+        "}\n";
+}
+
+void CMMTranspiler::line(const std::string &Code) {
+  Out.append(Indent, ' ');
+  Out += Code;
+  Out += '\n';
+}
+
+void CMMTranspiler::label(const std::string &Name) {
+  Out.append(Indent - 2, ' ');
+  Out += Name + ":;\n";
+}
+
+void CMMTranspiler::open(const std::string &Code) {
+  line(Code);
+  Indent += 2;
+}
+
+void CMMTranspiler::close(const std::string &Code) {
+  Indent -= 2;
+  line(Code);
+}
+
+std::string CMMTranspiler::newTemp() {
+  return "t" + std::to_string(Temps++);
+}
+
+unsigned CMMTranspiler::getLine(SourceMgr::LocTy Loc) const {
+  return static_cast<unsigned>(SrcMgr.getLineColByLoc(Loc).first + 1);
+}
+
+std::string CMMTranspiler::addAtom(Atom Name) {
+  if (Name.empty())
+    return "Atom()";
+  auto It = AtomIndex.emplace(Name, Atoms.size());
+  if (It.second)
+    Atoms.push_back(Name);
+  return "A[" + std::to_string(It.first->second) + "]";
+}
+
+std::string CMMTranspiler::addScope(const SlotNameList &Slots) {
+  auto It = ScopeIndex.emplace(&Slots, Scopes.size());
+  if (It.second) {
+    Scopes.push_back(&Slots);
+    // Names are written to the program along with the scope.
+    for (Atom Name : Slots)
+      addAtom(Name);
+  }
+  return "SN[" + std::to_string(It.first->second) + "]";
+}
+
+std::string CMMTranspiler::addString(const std::string &S) {
+  auto It = StringIndex.emplace(S, Strings.size());
+  if (It.second)
+    Strings.push_back(S);
+  return "Str[" + std::to_string(It.first->second) + "]";
+}
+
+std::string CMMTranspiler::addNative(const std::string &Name) {
+  auto It = NativeIndex.emplace(Name, Natives.size());
+  if (It.second)
+    Natives.push_back(Name);
+  return "N[" + std::to_string(It.first->second) + "]";
+}
+
+void CMMTranspiler::beginBody(BodyKind Kind) {
+  Out.clear();
+  Indent = 2;
+  Temps = 0;
+  Labels = 0;
+  Body = Kind;
+  EnvStack.assign(1, "E0");
+  LoopStack.clear();
+  UsesEntry = UsesDone = UsesReturn = UsesReturned = false;
+}
+
+/// \brief Translate a function, which takes the arguments of its parameters,
+/// checked, in \p Args, and the scope it's called in if it's dynamic bound.
+///
+/// A tail call to itself runs the body again in the same frame from Entry.
+/// Falling off the end leaves the default return value, which is checked
+/// if a tail call returned it.
+std::string
+CMMTranspiler::translateFunction(const FunctionDefinitionAST &Function) {
+  beginBody(FunctionBody);
+  Indent = 4;
+  this->Function = &Function;
+  translateStatement(Function.getStatement(), true);
+  std::string Body = std::move(Out);
+  Out.clear();
+
+  std::string Signature = cvm::TypeToStr(Function.getType()) + " " +
+      Function.getName().str() + "(";
+  for (const Parameter &Param : Function.getParameterList()) {
+    if (&Param != &Function.getParameterList().front())
+      Signature += ", ";
+    Signature += Param.toString();
+  }
+  Signature += ")";
+
+  std::string Name = addAtom(Function.getName());
+  std::string Type = getTypeName(Function.getType());
+  std::string Res = "// " + Signature + "\n"
+      "static cvm::BasicValue F" + std::to_string(FunctionIndex[&Function]) +
+      "(CMMRuntime::Env *Outer, cvm::BasicValue *Args) {\n"
+      "  CMMRuntime::Frame<" + std::to_string(Function.getSlots().size()) +
+      "> E0(Outer, " + addScope(Function.getSlots()) + ");\n"
+      "  cvm::BasicValue Ret;\n";
+  if (UsesReturned)
+    Res += "  bool Returned = false;\n";
+
+  size_t ParamCount = Function.getParameterCount();
+  for (size_t I = 0; I != ParamCount; ++I) {
+    Res += "  E0.Slots[" + std::to_string(I) +
+        "].Value = std::move(Args[" + std::to_string(I) + "]);\n";
+  }
+  if (UsesEntry)
+    Res += "Entry:\n";
+  size_t Slot = 0;
+  for (const Parameter &Param : Function.getParameterList()) {
+    // We allow empty parameter name.
+    Res += "  E0.Slots[" + std::to_string(Slot++) + "]." +
+        (Param.getName().empty() ? "Value = cvm::BasicValue();\n"
+                                 : "Declared = true;\n");
+  }
+
+  Res += "  {\n" + Body + "  }\n";
+  if (UsesDone)
+    Res += "Done:\n";
+  if (UsesReturned) {
+    Res += "  if (Returned)\n"
+           "    CMMRuntime::checkReturnValue(Ret, " + Type + ", " + Name +
+           ");\n";
+  }
+  Res += "  return Ret;\n";
+  if (UsesReturn) {
+    Res += "Return:\n"
+           "  CMMRuntime::checkReturnValue(Ret, " + Type + ", " + Name +
+           ");\n"
+           "  return Ret;\n";
+  }
+  Res += "}\n";
+  this->Function = nullptr;
+  return Res;
+}
+
+/// \brief Translate an infix operator, whose operands are declared in the
+/// first two slots. It must leave a value, of any type.
+std::string
+CMMTranspiler::translateInfixOp(const InfixOpDefinitionAST &InfixOp) {
+  beginBody(InfixOpBody);
+  Indent = 4;
+  translateStatement(InfixOp.getStatement(), true);
+  std::string Body = std::move(Out);
+  Out.clear();
+
+  std::string Res = "// infix " + InfixOp.getLHSName().str() + " " +
+      InfixOp.getSymbol().str() + " " + InfixOp.getRHSName().str() + "\n"
+      "static cvm::BasicValue I" + std::to_string(InfixOpIndex[&InfixOp]) +
+      "(cvm::BasicValue LHS, cvm::BasicValue RHS) {\n"
+      "  CMMRuntime::Frame<" + std::to_string(InfixOp.getSlots().size()) +
+      "> E0(RT.getTopLevelEnv(), " + addScope(InfixOp.getSlots()) + ");\n"
+      "  cvm::BasicValue Ret;\n"
+      "  E0.declare(0, LHS);\n"
+      "  E0.declare(1, RHS);\n"
+      "  {\n" + Body + "  }\n";
+  if (UsesDone)
+    Res += "Done:\n";
+  Res += "  if (Ret.isVoid())\n"
+         "    CMMRuntime::noInfixResult();\n"
+         "  return Ret;\n"
+         "}\n";
+  return Res;
+}
+
+/// \brief Translate the top level statements, followed by the call to main()
+/// if there is one.
+std::string CMMTranspiler::translateTopLevel() {
+  beginBody(TopLevelBody);
+  line("CMMRuntime::Frame<" + std::to_string(TopLevelBlock.getSlots().size()) +
+       "> E0(nullptr, " + addScope(TopLevelBlock.getSlots()) + ");");
+  line("RT.setTopLevelEnv(&E0);");
+  for (auto &Stmt : TopLevelBlock.getStatementList())
+    translateStatement(Stmt.get());
+
+  auto MainIt = UserFunctionMap.find("main");
+  if (MainIt != UserFunctionMap.end()) {
+    const FunctionDefinitionAST &Main = MainIt->second;
+    std::string Name = addAtom(Main.getName());
+    std::string Call = "F" + std::to_string(FunctionIndex[&Main]) + "(&E0, ";
+    // main() takes the arguments as an array of strings, if anything.
+    if (Main.getParameterCount() == 0) {
+      Call += "nullptr)";
+    } else {
+      line("cvm::BasicValue Args[1] = "
+           "{CMMRuntime::makeArguments(Argc, Argv)};");
+      if (Main.getParameterCount() != 1) {
+        line("CMMRuntime::badArgumentCount(" + Name + ", " +
+             std::to_string(Main.getParameterCount()) + ", 1);");
+      } else {
+        const Parameter &Param = Main.getParameterList().front();
+        line("CMMRuntime::passArgument(Args[0], " +
+             std::string(getTypeName(Param.getType())) + ", " + Name + ", " +
+             addAtom(Param.getName()) + ");");
+      }
+      Call += "Args)";
+    }
+    line("return " + Call + ".toInt();");
+  } else {
+    line("return 0;");
+  }
+
+  std::string Res = "static int Program(int Argc, char *Argv[]) {\n" + Out +
+      "}\n";
+  Out.clear();
+  return Res;
+}
+
+/// \brief Translate a statement. Each one is a C++ block of its own, so that
+/// a jump never crosses the temporaries of another.
+void CMMTranspiler::translateStatement(const StatementAST *Stmt, bool Tail) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  default:
+    assert(false && "translateStatement: unknown statement kind");
+  case StatementAST::DeclarationStatement:
+    line("CMMRuntime::error(\"single declaration should not be used by "
+         "user\");");
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList()) {
+      open();
+      translateDeclaration(Decl.get());
+      close();
+    }
+    break;
+  case StatementAST::ExprStatement:
+    open();
+    translateExprStatement(Stmt->as_cptr<ExprStatementAST>(), Tail);
+    close();
+    break;
+  case StatementAST::BlockStatement:
+    translateBlock(Stmt->as_cptr<BlockAST>(), Tail);
+    break;
+  case StatementAST::IfStatement:
+    translateIfStatement(Stmt->as_cptr<IfStatementAST>(), Tail);
+    break;
+  case StatementAST::ReturnStatement:
+    open();
+    translateReturnStatement(Stmt->as_cptr<ReturnStatementAST>());
+    close();
+    break;
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    translateLoop(nullptr, WhileStmt->getCondition(), nullptr,
+                  WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    translateLoop(ForStmt->getInit(), ForStmt->getCondition(),
+                  ForStmt->getPost(), ForStmt->getStatement());
+    break;
+  }
+  case StatementAST::ContinueStatement:
+    translateLoopExit(false);
+    break;
+  case StatementAST::BreakStatement:
+    translateLoopExit(true);
+    break;
+  }
+}
+
+/// \brief Translate a block. A hoisted block clears its slots of the
+/// enclosing scope however it's left, any other has a frame of its own.
+void CMMTranspiler::translateBlock(const BlockAST *Block, bool Tail) {
+  open();
+  bool Scoped = !Block->isHoisted();
+  if (Scoped) {
+    std::string Name = "E" + std::to_string(EnvStack.size());
+    line("CMMRuntime::Frame<" + std::to_string(Block->getSlots().size()) +
+         "> " + Name + "(&" + env() + ", " + addScope(Block->getSlots()) +
+         ");");
+    EnvStack.push_back(Name);
+  } else if (Block->getHoistedBegin() != Block->getHoistedEnd()) {
+    line("CMMRuntime::HoistedScope H" + std::to_string(newLabel()) + "{" +
+         env() + ", " + std::to_string(Block->getHoistedBegin()) + ", " +
+         std::to_string(Block->getHoistedEnd()) + "};");
+  }
+
+  auto &List = Block->getStatementList();
+  for (auto It = List.begin(), E = List.end(); It != E;) {
+    const StatementAST *Stmt = (It++)->get();
+    translateStatement(Stmt, Tail && It == E);
+  }
+
+  if (Scoped)
+    EnvStack.pop_back();
+  close();
+}
+
+void CMMTranspiler::translateIfStatement(const IfStatementAST *IfStmt,
+                                         bool Tail) {
+  open();
+  std::string Cond = translateCondition(IfStmt->getCondition());
+  open("if (" + Cond + ") {");
+  translateStatement(IfStmt->getStatementThen(), Tail);
+  if (const StatementAST *StatementElse = IfStmt->getStatementElse()) {
+    close("} else {");
+    Indent += 2;
+    translateStatement(StatementElse, Tail);
+  }
+  close();
+  close();
+}
+
+/// \brief Translate a while loop, or a for loop with \p Init and \p Post.
+/// break and continue jump to the labels after the loop and the body.
+void CMMTranspiler::translateLoop(const ExpressionAST *Init,
+                                  const ExpressionAST *Condition,
+                                  const ExpressionAST *Post,
+                                  const StatementAST *Body) {
+  open();
+  if (Init)
+    translateDiscarded(Init);
+
+  LoopStack.push_back(LoopContext{newLabel(), false, false});
+  open("for (;;) {");
+  if (Condition) {
+    std::string Cond = translateCondition(Condition);
+    open("if (!" + Cond + ")");
+    line("break;");
+    Indent -= 2;
+  }
+  translateStatement(Body);
+
+  LoopContext Loop = LoopStack.back();
+  LoopStack.pop_back();
+  if (Loop.Continued)
+    label("C" + std::to_string(Loop.Label));
+  if (Post) {
+    open();
+    translateDiscarded(Post);
+    close();
+  }
+  close();
+  if (Loop.Broken)
+    label("B" + std::to_string(Loop.Label));
+  close();
+}
+
+/// \brief Translate break or continue. Out of loops, it ends a function, and
+/// is an error in top level code.
+void CMMTranspiler::translateLoopExit(bool IsBreak) {
+  if (!LoopStack.empty()) {
+    LoopContext &Loop = LoopStack.back();
+    (IsBreak ? Loop.Broken : Loop.Continued) = true;
+    line(std::string("goto ") + (IsBreak ? "B" : "C") +
+         std::to_string(Loop.Label) + ";");
+    return;
+  }
+
+  if (Body == TopLevelBody) {
+    line(std::string("CMMRuntime::error(\"") +
+         (IsBreak ? "break" : "continue") +
+         " statement should be in a loop\");");
+    return;
+  }
+  UsesDone = true;
+  line("goto Done;");
+}
+
+/// \brief Translate an expression statement. Its value is only kept in
+/// \p Tail position, an assignment isn't even read back otherwise.
+void CMMTranspiler::translateExprStatement(const ExprStatementAST *ExprStmt,
+                                           bool Tail) {
+  const ExpressionAST *Expr = ExprStmt->getExpression();
+  if (Tail) {
+    if (Expr->isFunctionCallExpr() &&
+        Expr->as_cptr<FunctionCallAST>()->isTailCall()) {
+      translateTailCall(Expr->as_cptr<FunctionCallAST>(), false);
+      return;
+    }
+    line("Ret = " + as(translateExpression(Expr), ValueRep) + ";");
+    return;
+  }
+  translateDiscarded(Expr);
+}
+
+/// \brief Translate an expression evaluated for its effects only.
+void CMMTranspiler::translateDiscarded(const ExpressionAST *Expr) {
+  if (Expr->isBinaryOperatorExpression()) {
+    auto *BinOpExpr = Expr->as_cptr<BinaryOperatorAST>();
+    if (BinOpExpr->getOpKind() == BinaryOperatorAST::Assign) {
+      translateAssignment(BinOpExpr, false, true);
+      return;
+    }
+  }
+  translateExpression(Expr);
+}
+
+void CMMTranspiler::translateReturnStatement(
+    const ReturnStatementAST *RetStmt) {
+  const ExpressionAST *ReturnValue = RetStmt->getReturnValue();
+  if (Body == TopLevelBody) {
+    std::string Value = ReturnValue ?
+        as(translateExpression(ReturnValue), ValueRep) : "cvm::BasicValue()";
+    line("return CMMRuntime::exitCode(" + Value + ");");
+    return;
+  }
+
+  if (ReturnValue) {
+    if (ReturnValue->isFunctionCallExpr() &&
+        ReturnValue->as_cptr<FunctionCallAST>()->isTailCall()) {
+      translateTailCall(ReturnValue->as_cptr<FunctionCallAST>(), true);
+      return;
+    }
+    line("Ret = " + as(translateExpression(ReturnValue), ValueRep) + ";");
+  }
+
+  // An infix operator may return any value.
+  if (Body == InfixOpBody) {
+    UsesDone = true;
+    line("goto Done;");
+  } else {
+    UsesReturn = true;
+    line("goto Return;");
+  }
+}
+
+/// \brief Translate a call of the function to itself from tail position. The
+/// arguments replace the variables of the frame, which sees top level
+/// variables only from then on, and the body is run again.
+void CMMTranspiler::translateTailCall(const FunctionCallAST *FuncCall,
+                                      bool Returned) {
+  std::string Args = translateArguments(FuncCall);
+  if (!FuncCall->isTypeChecked())
+    checkArguments(*Function, Args);
+
+  line("E0.OuterEnv = RT.getTopLevelEnv();");
+  line("E0.clear(0, " + std::to_string(Function->getSlots().size()) + ");");
+  for (size_t I = 0, E = FuncCall->getArguments().size(); I != E; ++I) {
+    line("E0.Slots[" + std::to_string(I) + "].Value = std::move(" + Args +
+         "[" + std::to_string(I) + "]);");
+  }
+  if (Returned) {
+    UsesReturned = true;
+    line("Returned = true;");
+  }
+  UsesEntry = true;
+  line("goto Entry;");
+}
+
+/// \brief Translate a declaration. It mustn't be declared yet, an array is
+/// declared before its initializer is evaluated, a scalar after.
+void CMMTranspiler::translateDeclaration(const DeclarationAST *Decl) {
+  std::string Name = addAtom(Decl->getName());
+  std::string Slot = std::to_string(Decl->getSlot());
+  cvm::BasicType Type = Decl->getType();
+  line("CMMRuntime::checkUndeclared(" + env() + ", " + Slot + ", " + Name +
+       ");");
+
+  if (Decl->isArray()) {
+    std::string Dims;
+    for (auto &E : Decl->getElementCountList()) {
+      Operand Dim = translateExpression(E.get(), true);
+      Dims += Dims.empty() ? "" : ", ";
+      Dims += "CMMRuntime::dimension(" + Name + ", " +
+          (Dim.Rep == IntRep ? Dim.Code : as(Dim, ValueRep)) + ")";
+    }
+    std::string Array = newTemp();
+    line("int " + Array + "[] = {" + Dims + "};");
+    line("CMMRuntime::declareArray(" + env() + ", " + Slot + ", " +
+         getTypeName(Type) + ", " + Array + ", " +
+         std::to_string(Decl->getElementCountList().size()) + ");");
+  }
+
+  if (const ExpressionAST *Init = Decl->getInitializer()) {
+    Operand Value = translateExpression(Init);
+    bool Typed = getRep(Type) == Value.Rep ||
+        (Type == cvm::DoubleType && Value.Rep == IntRep);
+    std::string Code = Typed ? "cvm::BasicValue(" + as(Value, getRep(Type)) +
+                               ")" : as(Value, ValueRep);
+    if (!Typed && !Decl->isTypeChecked()) {
+      Code = "CMMRuntime::initialize(" + Name + ", " + getTypeName(Type) +
+          ", " + Code + ", false)";
+    }
+    // An array keeps its value even if it has an initializer, which is
+    // checked all the same.
+    if (!Decl->isArray())
+      line(env() + ".declare(" + Slot + ", " + Code + ");");
+    else if (!Typed && !Decl->isTypeChecked())
+      line(Code + ";");
+  } else if (!Decl->isArray()) {
+    line(env() + ".declare(" + Slot + ", cvm::BasicValue(" +
+         getTypeName(Type) + "));");
+  }
+}
+
+std::string CMMTranspiler::translateCondition(const ExpressionAST *Cond) {
+  return asBool(translateExpression(Cond, true));
+}
+
+/// \brief Return the type of the value of an expression, if it's proven to
+/// be int, double or bool, VoidType otherwise. The types of calls and infix
+/// operators aren't trusted, natives may return anything.
+cvm::BasicType CMMTranspiler::getScalarType(const ExpressionAST *Expr) {
+  const StaticType &Type = Expr->getStaticType();
+  if (!Type.Known || Expr->isFunctionCallExpr() ||
+      Expr->getKind() == ExpressionAST::InfixOpExpression)
+    return cvm::VoidType;
+  if (Type.Type == cvm::IntType || Type.Type == cvm::DoubleType ||
+      Type.Type == cvm::BoolType)
+    return Type.Type;
+  return cvm::VoidType;
+}
+
+/// \brief Translate an expression, whose operands are evaluated into
+/// temporaries in order. If it's \p Scalar, only the type and the payload
+/// of the value are read, as operators do, so a variable of a proven type
+/// is read as such even if it may be an alias of an array.
+CMMTranspiler::Operand
+CMMTranspiler::translateExpression(const ExpressionAST *Expr, bool Scalar) {
+  switch (Expr->getKind()) {
+  default:
+    assert(false && "translateExpression: unknown expression kind");
+  case ExpressionAST::IntExpression:
+    return Operand{IntRep, getIntLiteral(Expr->as_cptr<IntAST>()->getValue())};
+  case ExpressionAST::DoubleExpression:
+    return Operand{DoubleRep,
+                   getDoubleLiteral(Expr->as_cptr<DoubleAST>()->getValue())};
+  case ExpressionAST::BoolExpression:
+    return Operand{BoolRep,
+                   Expr->as_cptr<BoolAST>()->getValue() ? "true" : "false"};
+  case ExpressionAST::StringExpression:
+    return Operand{ValueRep,
+                   addString(Expr->as_cptr<StringAST>()->getValue())};
+
+  case ExpressionAST::IdentifierExpression: {
+    std::string Var = translateIdentifier(Expr->as_cptr<IdentifierAST>());
+    cvm::BasicType Type = getScalarType(Expr);
+    if (Scalar && Type != cvm::VoidType)
+      return makeTemp(getRep(Type), Var + getPayload(Type));
+    return makeTemp(ValueRep, Var);
+  }
+
+  case ExpressionAST::FunctionCallExpression:
+    return translateFunctionCall(Expr->as_cptr<FunctionCallAST>());
+  case ExpressionAST::InfixOpExpression:
+    return translateInfixOp(Expr->as_cptr<InfixOpExprAST>());
+
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOpExpr = Expr->as_cptr<BinaryOperatorAST>();
+    switch (BinOpExpr->getOpKind()) {
+    default:
+      return translateBinaryOp(BinOpExpr);
+    case BinaryOperatorAST::Assign:
+      return translateAssignment(BinOpExpr, Scalar);
+    case BinaryOperatorAST::Index: {
+      Operand Value = makeTemp(ValueRep,
+                               translateIndex(BinOpExpr).Code + ".get()");
+      return narrow(Value, Expr, Scalar);
+    }
+    case BinaryOperatorAST::LogicalAnd:
+    case BinaryOperatorAST::LogicalOr:
+      return translateLogicalOp(BinOpExpr);
+    }
+  }
+
+  case ExpressionAST::UnaryOperatorExpression:
+    return translateUnaryOp(Expr->as_cptr<UnaryOperatorAST>(), Scalar);
+  }
+  return Operand{ValueRep, ""}; // Make the compiler happy.
+}
+
+/// \brief Translate an lvalue expression to a reference to the variable, or
+/// the element or sub-array of an array, it refers to.
+CMMTranspiler::Lvalue
+CMMTranspiler::translateLvalue(const ExpressionAST *Expr) {
+  if (Expr->isIdentifierExpr()) {
+    auto *IdExpr = Expr->as_cptr<IdentifierAST>();
+    std::string Var = translateIdentifier(IdExpr);
+    // A slot is referred to in place, anything else is searched now.
+    if (IdExpr->getBinding().Kind == VariableBinding::LocalBinding &&
+        IdExpr->getStaticType().Known)
+      return Lvalue{Var, true};
+    std::string Ref = newTemp();
+    line("cvm::BasicValue &" + Ref + " = " + Var + ";");
+    return Lvalue{Ref, true};
+  }
+
+  if (Expr->isBinaryOperatorExpression()) {
+    auto *BinOpExpr = Expr->as_cptr<BinaryOperatorAST>();
+    if (BinOpExpr->getOpKind() == BinaryOperatorAST::Index)
+      return translateIndex(BinOpExpr);
+    if (BinOpExpr->getOpKind() == BinaryOperatorAST::Assign) {
+      Operand Stored;
+      return translateStore(BinOpExpr, Stored);
+    }
+    line("CMMRuntime::error(\"try to evaluate a rvalue binOpExpr as "
+         "lvalue\");");
+    return Lvalue{"cvm::ValueRef()", false};
+  }
+
+  line("CMMRuntime::error(\"try to evaluate a rvalue expression as "
+       "lvalue\");");
+  return Lvalue{"cvm::ValueRef()", false};
+}
+
+/// \brief Return the C++ expression of the variable an identifier refers to
+/// by its binding, as CMMInterpreter::searchVariable() finds it. A variable
+/// of a proven type is declared in its slot.
+std::string CMMTranspiler::translateIdentifier(const IdentifierAST *IdExpr) {
+  const VariableBinding &Binding = IdExpr->getBinding();
+  std::string Name = addAtom(IdExpr->getName());
+  std::string Slot = std::to_string(Binding.Slot);
+
+  switch (Binding.Kind) {
+  default:
+    assert(false && "translateIdentifier: unknown binding kind");
+  case VariableBinding::LocalBinding: {
+    assert(Binding.Depth < EnvStack.size() &&
+           "translateIdentifier: bad depth");
+    const std::string &Scope = EnvStack[EnvStack.size() - 1 - Binding.Depth];
+    if (IdExpr->getStaticType().Known)
+      return Scope + ".Slots[" + Slot + "].Value";
+    return "RT.local(" + Scope + ", " + Slot + ", &" + env() + ", " + Name +
+        ")";
+  }
+  case VariableBinding::GlobalBinding:
+    return "RT.global(&" + env() + ", " + std::to_string(Binding.Depth) +
+        ", " + Slot + ", " + Name + ")";
+  case VariableBinding::DynamicBinding:
+    return "RT.search(&" + env() + ", " + Name + ")";
+  }
+  return ""; // Make the compiler happy.
+}
+
+/// \brief Translate a binary operator other than logical ones, assignment
+/// and indexing. Operands of proven numeric types are operated on as ints
+/// and doubles, an int operation is tried first on values of other types.
+CMMTranspiler::Operand
+CMMTranspiler::translateBinaryOp(const BinaryOperatorAST *Expr) {
+  BinaryOperatorAST::OperatorKind OpKind = Expr->getOpKind();
+
+  // A string is concatenated with the whole of the other operand, which
+  // may be an array.
+  cvm::BasicType LType = getScalarType(Expr->getLHS());
+  cvm::BasicType RType = getScalarType(Expr->getRHS());
+  bool Scalar = OpKind != BinaryOperatorAST::Add ||
+      ((LType == cvm::IntType || LType == cvm::DoubleType) &&
+       (RType == cvm::IntType || RType == cvm::DoubleType));
+  Operand L = translateExpression(Expr->getLHS(), Scalar);
+  Operand R = translateExpression(Expr->getRHS(), Scalar);
+  std::string Generic = std::string("CMMRuntime::binaryOp(") +
+      getOpName(OpKind) + ", " + as(L, ValueRep) + ", " + as(R, ValueRep) +
+      ")";
+
+  if (L.Rep == IntRep && R.Rep == IntRep) {
+    std::string Code = getIntOp(OpKind, L.Code, R.Code);
+    if (!Code.empty())
+      return makeTemp(isRelational(OpKind) ? BoolRep : IntRep, Code);
+  }
+
+  bool LNumeric = L.Rep == IntRep || L.Rep == DoubleRep;
+  bool RNumeric = R.Rep == IntRep || R.Rep == DoubleRep;
+  if (LNumeric && RNumeric) {
+    std::string LHS = as(L, DoubleRep), RHS = as(R, DoubleRep);
+    switch (OpKind) {
+    default:
+      break;
+    case BinaryOperatorAST::Add:
+      return makeTemp(DoubleRep, "(" + LHS + " + " + RHS + ")");
+    case BinaryOperatorAST::Minus:
+      return makeTemp(DoubleRep, "(" + LHS + " - " + RHS + ")");
+    case BinaryOperatorAST::Multiply:
+      return makeTemp(DoubleRep, "(" + LHS + " * " + RHS + ")");
+    case BinaryOperatorAST::Division:
+      return makeTemp(DoubleRep, "(" + LHS + " / " + RHS + ")");
+    case BinaryOperatorAST::Modulo:
+      return makeTemp(DoubleRep, "std::fmod(" + LHS + ", " + RHS + ")");
+    case BinaryOperatorAST::GreaterEqual:
+      // Values of different types are compared as `!(L < R)'.
+      if (L.Rep != R.Rep)
+        return makeTemp(BoolRep, "!(" + LHS + " < " + RHS + ")");
+      /* fall Through */
+    case BinaryOperatorAST::Less:
+    case BinaryOperatorAST::LessEqual:
+    case BinaryOperatorAST::Equal:
+    case BinaryOperatorAST::NotEqual:
+    case BinaryOperatorAST::Greater:
+      return makeTemp(BoolRep, getIntOp(OpKind, LHS, RHS));
+    }
+    return makeTemp(ValueRep, Generic);
+  }
+
+  // Values of unknown types are most likely ints.
+  if ((L.Rep == IntRep || L.Rep == ValueRep) &&
+      (R.Rep == IntRep || R.Rep == ValueRep)) {
+    std::string Guard, LHS = L.Code, RHS = R.Code;
+    if (L.Rep == ValueRep) {
+      Guard = L.Code + ".isInt()";
+      LHS += ".IntVal";
+    }
+    if (R.Rep == ValueRep) {
+      Guard += (Guard.empty() ? "" : " && ") + R.Code + ".isInt()";
+      RHS += ".IntVal";
+    }
+    std::string Code = getIntOp(OpKind, LHS, RHS);
+    if (!Code.empty()) {
+      return makeTemp(ValueRep, Guard + " ?\n" + std::string(Indent + 4, ' ') +
+                      "cvm::BasicValue(" + Code + ") : " + Generic);
+    }
+  }
+  return makeTemp(ValueRep, Generic);
+}
+
+CMMTranspiler::Operand
+CMMTranspiler::translateUnaryOp(const UnaryOperatorAST *Expr, bool Scalar) {
+  UnaryOperatorAST::OperatorKind OpKind = Expr->getOpKind();
+  switch (OpKind) {
+  default:
+    assert(false && "translateUnaryOp: unknown operator kind");
+  case UnaryOperatorAST::Plus: {
+    // The operand is the value, which may be an array.
+    Operand Op = translateExpression(Expr->getOperand(), Scalar);
+    if (Op.Rep == IntRep || Op.Rep == DoubleRep)
+      return Op;
+    break;
+  }
+  case UnaryOperatorAST::Minus: {
+    Operand Op = translateExpression(Expr->getOperand(), true);
+    if (Op.Rep == IntRep)
+      return makeTemp(IntRep, "CMMRuntime::negate(" + Op.Code + ")");
+    if (Op.Rep == DoubleRep)
+      return makeTemp(DoubleRep, "-" + Op.Code);
+    return makeTemp(ValueRep, std::string("CMMRuntime::unaryOp(") +
+                    getOpName(OpKind) + ", " + as(Op, ValueRep) + ")");
+  }
+  case UnaryOperatorAST::LogicalNot: {
+    Operand Op = translateExpression(Expr->getOperand(), true);
+    return makeTemp(BoolRep, "!" + asBool(Op));
+  }
+  case UnaryOperatorAST::BitwiseNot: {
+    Operand Op = translateExpression(Expr->getOperand(), true);
+    if (Op.Rep == IntRep)
+      return makeTemp(IntRep, "~" + Op.Code);
+    return makeTemp(ValueRep, std::string("CMMRuntime::unaryOp(") +
+                    getOpName(OpKind) + ", " + as(Op, ValueRep) + ")");
+  }
+  }
+
+  Operand Op = translateExpression(Expr->getOperand());
+  return makeTemp(ValueRep, std::string("CMMRuntime::unaryOp(") +
+                  getOpName(OpKind) + ", " + as(Op, ValueRep) + ")");
+}
+
+/// \brief Translate && and ||, whose right operand is only evaluated if the
+/// left one doesn't decide the value.
+CMMTranspiler::Operand
+CMMTranspiler::translateLogicalOp(const BinaryOperatorAST *Expr) {
+  bool IsAnd = Expr->getOpKind() == BinaryOperatorAST::LogicalAnd;
+  std::string Res = newTemp();
+  line("bool " + Res + " = " + translateCondition(Expr->getLHS()) + ";");
+  open("if (" + std::string(IsAnd ? "" : "!") + Res + ") {");
+  line(Res + " = " + translateCondition(Expr->getRHS()) + ";");
+  close();
+  return Operand{BoolRep, Res};
+}
+
+/// \brief Translate an assignment, whose value is read back from the
+/// variable unless it's \p Discarded.
+CMMTranspiler::Operand
+CMMTranspiler::translateAssignment(const BinaryOperatorAST *Expr,
+                                   bool Scalar, bool Discarded) {
+  Operand Stored;
+  Lvalue Var = translateStore(Expr, Stored);
+  if (Discarded || !Stored.Code.empty())
+    return Stored;
+  Operand Value = makeTemp(ValueRep, Var.Variable ? Var.Code
+                                                  : Var.Code + ".get()");
+  return narrow(Value, Expr, Scalar);
+}
+
+/// \brief Assign the value to the variable, which is evaluated first, and
+/// return the variable. A scalar of the type the variable is proven to have
+/// is stored as such, and left in \p Stored.
+CMMTranspiler::Lvalue
+CMMTranspiler::translateStore(const BinaryOperatorAST *Expr,
+                              Operand &Stored) {
+  Lvalue Var = translateLvalue(Expr->getLHS());
+  Operand Value = translateExpression(Expr->getRHS());
+  cvm::BasicType Type = getScalarType(Expr->getLHS());
+
+  Stored = Operand{ValueRep, ""};
+  if (Var.Variable && Type != cvm::VoidType &&
+      (Value.Rep == getRep(Type) ||
+       (Type == cvm::DoubleType && Value.Rep == IntRep))) {
+    Stored = Operand{getRep(Type), as(Value, getRep(Type))};
+    line("CMMRuntime::store(" + Var.Code + ", " + Stored.Code + ");");
+    return Var;
+  }
+
+  line("CMMRuntime::assign(" + Var.Code + ", " + as(Value, ValueRep) + ", " +
+       (Expr->isTypeChecked() ? "true" : "false") + ");");
+  return Var;
+}
+
+/// \brief Translate an index expression to a reference to the element. The
+/// array is evaluated before the index.
+CMMTranspiler::Lvalue
+CMMTranspiler::translateIndex(const BinaryOperatorAST *Expr) {
+  Lvalue Base = translateLvalue(Expr->getLHS());
+  std::string View = newTemp();
+  line("cvm::ValueRef " + View + " = CMMRuntime::getArrayView(" + Base.Code +
+       ");");
+  Operand Index = translateExpression(Expr->getRHS(), true);
+  std::string Ref = newTemp();
+  line("cvm::ValueRef " + Ref + " = CMMRuntime::index(" + View + ", " +
+       (Index.Rep == IntRep ? Index.Code : as(Index, ValueRep)) + ");");
+  return Lvalue{Ref, false};
+}
+
+/// \brief Translate a call to a user function or a native one. A user
+/// function is called with the arguments checked against its parameters,
+/// in the scope of the caller if it's dynamic bound.
+CMMTranspiler::Operand
+CMMTranspiler::translateFunctionCall(const FunctionCallAST *FuncCall) {
+  if (auto *Callee = FuncCall->getUserFunction()) {
+    line("RT.enterCall(" + std::to_string(getLine(FuncCall->getLoc())) +
+         ");");
+    std::string Args = translateArguments(FuncCall);
+    size_t ArgCount = FuncCall->getArguments().size();
+    if (ArgCount != Callee->getParameterCount()) {
+      line("CMMRuntime::badArgumentCount(" + addAtom(Callee->getName()) +
+           ", " + std::to_string(Callee->getParameterCount()) + ", " +
+           std::to_string(ArgCount) + ");");
+      return Operand{ValueRep, "cvm::BasicValue()"};
+    }
+    if (!FuncCall->isTypeChecked())
+      checkArguments(*Callee, Args);
+
+    Operand Res = makeTemp(ValueRep, "F" +
+        std::to_string(FunctionIndex[Callee]) + "(" +
+        (FuncCall->isDynamicBound() ? "&" + env() : "RT.getTopLevelEnv()") +
+        ", " + Args + ")");
+    line("RT.leaveCall();");
+    return Res;
+  }
+
+  if (FuncCall->getNativeFunction()) {
+    std::string Args = translateArguments(FuncCall);
+    return makeTemp(ValueRep, addNative(FuncCall->getCallee().str()) +
+                    "(cvm::ValueSpan(" + Args + ", " +
+                    std::to_string(FuncCall->getArguments().size()) + "))");
+  }
+
+  line("CMMRuntime::error(" + quote("function `" +
+       FuncCall->getCallee().str() + "' is undefined") + ");");
+  return Operand{ValueRep, "cvm::BasicValue()"};
+}
+
+/// \brief Evaluate the arguments of a call in order into an array, and
+/// return its name, null if there are none.
+std::string CMMTranspiler::translateArguments(const FunctionCallAST *FuncCall) {
+  auto &Arguments = FuncCall->getArguments();
+  if (Arguments.empty())
+    return "nullptr";
+
+  std::vector<std::string> Values;
+  for (auto &Arg : Arguments)
+    Values.push_back(as(translateExpression(Arg.get()), ValueRep));
+
+  std::string Args = newTemp();
+  std::string Code = "cvm::BasicValue " + Args + "[] = {";
+  for (size_t I = 0; I != Values.size(); ++I)
+    Code += (I ? ", " : "") + Values[I];
+  line(Code + "};");
+  return Args;
+}
+
+/// \brief Check the arguments in \p Args against the parameters of
+/// \p Callee, which haven't been checked statically.
+void CMMTranspiler::checkArguments(const FunctionDefinitionAST &Callee,
+                                   const std::string &Args) {
+  size_t I = 0;
+  for (const Parameter &Param : Callee.getParameterList()) {
+    line("CMMRuntime::passArgument(" + Args + "[" + std::to_string(I++) +
+         "], " + getTypeName(Param.getType()) + ", " +
+         addAtom(Callee.getName()) + ", " + addAtom(Param.getName()) + ");");
+  }
+}
+
+CMMTranspiler::Operand
+CMMTranspiler::translateInfixOp(const InfixOpExprAST *Expr) {
+  const InfixOpDefinitionAST *InfixOp = Expr->getInfixOp();
+  if (!InfixOp) {
+    line("CMMRuntime::error(" + quote("Infix operator " +
+         Expr->getSymbol().str() + " is undefined") + ");");
+    return Operand{ValueRep, "cvm::BasicValue()"};
+  }
+
+  line("RT.enterCall(" + std::to_string(getLine(Expr->getLoc())) + ");");
+  Operand L = translateExpression(Expr->getLHS());
+  Operand R = translateExpression(Expr->getRHS());
+  Operand Res = makeTemp(ValueRep, "I" +
+      std::to_string(InfixOpIndex[InfixOp]) + "(" + as(L, ValueRep) + ", " +
+      as(R, ValueRep) + ")");
+  line("RT.leaveCall();");
+  return Res;
+}
+
+CMMTranspiler::Operand CMMTranspiler::makeTemp(RepKind Rep,
+                                               const std::string &Code) {
+  std::string Temp = newTemp();
+  line(std::string(getRepType(Rep)) + " " + Temp + " = " + Code + ";");
+  return Operand{Rep, Temp};
+}
+
+/// \brief Read a value of a proven type as such if it's \p Scalar.
+CMMTranspiler::Operand CMMTranspiler::narrow(const Operand &Value,
+                                             const ExpressionAST *Expr,
+                                             bool Scalar) {
+  cvm::BasicType Type = getScalarType(Expr);
+  if (!Scalar || Value.Rep != ValueRep || Type == cvm::VoidType)
+    return Value;
+  return Operand{getRep(Type), Value.Code + getPayload(Type)};
+}
+
+std::string CMMTranspiler::as(const Operand &Op, RepKind Rep) {
+  if (Op.Rep == Rep)
+    return Op.Code;
+  if (Rep == ValueRep)
+    return "cvm::BasicValue(" + Op.Code + ")";
+  assert(Op.Rep == IntRep && Rep == DoubleRep && "as: bad conversion");
+  return "static_cast<double>(" + Op.Code + ")";
+}
+
+std::string CMMTranspiler::asBool(const Operand &Op) {
+  switch (Op.Rep) {
+  default:
+    assert(false && "asBool: unknown representation");
+  case IntRep:    return "(" + Op.Code + " != 0)";
+  case DoubleRep: return "(" + Op.Code + " != 0.0)";
+  case BoolRep:   return Op.Code;
+  case ValueRep:  return Op.Code + ".toBool()";
+  }
+  return ""; // Make the compiler happy.
+}
+
+const char *CMMTranspiler::getRepType(RepKind Rep) {
+  switch (Rep) {
+  default:
+    assert(false && "getRepType: unknown representation");
+  case IntRep:    return "int";
+  case DoubleRep: return "double";
+  case BoolRep:   return "bool";
+  case ValueRep:  return "cvm::BasicValue";
+  }
+  return nullptr; // Make the compiler happy.
+}
+
+CMMTranspiler::RepKind CMMTranspiler::getRep(cvm::BasicType Type) {
+  switch (Type) {
+  default:             return ValueRep;
+  case cvm::IntType:    return IntRep;
+  case cvm::DoubleType: return DoubleRep;
+  case cvm::BoolType:   return BoolRep;
+  }
+}
+
+const char *CMMTranspiler::getPayload(cvm::BasicType Type) {
+  switch (Type) {
+  default:
+    assert(false && "getPayload: not a scalar type");
+  case cvm::IntType:    return ".IntVal";
+  case cvm::DoubleType: return ".DoubleVal";
+  case cvm::BoolType:   return ".BoolVal";
+  }
+  return nullptr; // Make the compiler happy.
+}
@@ -0,0 +1,422 @@
+#include "CMMTypeChecker.h"
+#include <algorithm>
+#include <cassert>
+
+using namespace cmm;
+
+bool CMMTypeChecker::check() {
+  ScopeStack.clear();
+  ScopeStack.emplace_back(TopLevelBlock.getSlots().size());
+  CurrentFunction = nullptr;
+  for (auto &Stmt : TopLevelBlock.getStatementList())
+    checkStatement(Stmt.get(), true);
+
+  for (const auto &F : UserFunctionMap)
+    checkFunction(F.second);
+  for (const auto &I : InfixOpMap)
+    checkInfixOp(I.second);
+
+  std::stable_sort(Errors.begin(), Errors.end(),
+      [](const std::pair<SourceMgr::LocTy, std::string> &L,
+         const std::pair<SourceMgr::LocTy, std::string> &R) {
+        return L.first < R.first;
+      });
+  for (const auto &E : Errors)
+    SrcMgr.Error(E.first, E.second);
+  return !Errors.empty();
+}
+
+void CMMTypeChecker::error(SourceMgr::LocTy Loc, const std::string &Msg) {
+  Errors.emplace_back(Loc, Msg);
+}
+
+void CMMTypeChecker::checkFunction(const FunctionDefinitionAST &Function) {
+  // Parameters take the first slots in order. Arrays can be passed to them.
+  ScopeStack.emplace_back(Function.getSlots().size());
+  unsigned Slot = 0;
+  for (const Parameter &P : Function.getParameterList()) {
+    if (!P.getName().empty())
+      ScopeStack.back()[Slot] = StaticType(P.getType(), -1);
+    ++Slot;
+  }
+
+  CurrentFunction = &Function;
+  checkStatement(Function.getStatement(), true);
+  CurrentFunction = nullptr;
+  ScopeStack.pop_back();
+}
+
+void CMMTypeChecker::checkInfixOp(const InfixOpDefinitionAST &InfixOp) {
+  // Operands of infix operators can be of any type.
+  ScopeStack.emplace_back(InfixOp.getSlots().size());
+  checkStatement(InfixOp.getStatement(), true);
+  ScopeStack.pop_back();
+}
+
+/// \brief Check a statement. It's unconditional if it's run whenever the
+/// statements after it in the same scope are.
+void CMMTypeChecker::checkStatement(const StatementAST *Stmt,
+                                    bool Unconditional) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  default:
+    assert(false && "checkStatement: unknown statement kind");
+  case StatementAST::DeclarationStatement:
+    checkDeclaration(Stmt->as_cptr<DeclarationAST>(), Unconditional);
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      checkDeclaration(Decl.get(), Unconditional);
+    break;
+  case StatementAST::ExprStatement:
+    checkExpression(Stmt->as_cptr<ExprStatementAST>()->getExpression());
+    break;
+  case StatementAST::BlockStatement:
+    checkBlock(Stmt->as_cptr<BlockAST>());
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    checkExpression(IfStmt->getCondition());
+    checkStatement(IfStmt->getStatementThen(), false);
+    checkStatement(IfStmt->getStatementElse(), false);
+    break;
+  }
+  case StatementAST::ReturnStatement:
+    checkReturn(Stmt->as_cptr<ReturnStatementAST>());
+    break;
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    checkExpression(WhileStmt->getCondition());
+    checkStatement(WhileStmt->getStatement(), false);
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    checkExpression(ForStmt->getInit());
+    checkExpression(ForStmt->getCondition());
+    checkStatement(ForStmt->getStatement(), false);
+    checkExpression(ForStmt->getPost());
+    break;
+  }
+  case StatementAST::ContinueStatement:
+  case StatementAST::BreakStatement:
+    break;
+  }
+}
+
+void CMMTypeChecker::checkBlock(const BlockAST *Block) {
+  // A hoisted block declares in the slots of the enclosing scope, which are
+  // referred to by this block only.
+  if (Block->isHoisted()) {
+    for (auto &Stmt : Block->getStatementList())
+      checkStatement(Stmt.get(), true);
+    return;
+  }
+
+  ScopeStack.emplace_back(Block->getSlots().size());
+  for (auto &Stmt : Block->getStatementList())
+    checkStatement(Stmt.get(), true);
+  ScopeStack.pop_back();
+}
+
+/// \brief A function must return exactly its type, int isn't converted to
+/// double here.
+void CMMTypeChecker::checkReturn(const ReturnStatementAST *RetStmt) {
+  StaticType Type(cvm::VoidType);
+  if (const ExpressionAST *ReturnValue = RetStmt->getReturnValue())
+    Type = checkExpression(ReturnValue);
+
+  if (CurrentFunction && Type.Known &&
+      Type.Type != CurrentFunction->getType()) {
+    error(RetStmt->getLoc(), "function `" +
+        CurrentFunction->getName().str() + "' ought to return " +
+        cvm::TypeToStr(CurrentFunction->getType()) + ", but got " +
+        cvm::TypeToStr(Type.Type));
+  }
+}
+
+/// \brief Check a declaration. The type of the variable is known from now on
+/// if it's declared unconditionally. If it's declared conditionally first,
+/// an identifier may find another variable of the name when it's not.
+void CMMTypeChecker::checkDeclaration(const DeclarationAST *Decl,
+                                      bool Unconditional) {
+  const std::string &Name = Decl->getName().str();
+  cvm::BasicType Type = Decl->getType();
+
+  for (auto &E : Decl->getElementCountList()) {
+    StaticType DimensionType = checkExpression(E.get());
+    if (DimensionType.Known && !DimensionType.is(cvm::IntType)) {
+      error(Decl->getLoc(), "expressions in array declaration `" + Name +
+          "' should be integral type");
+    }
+  }
+
+  // The name is declared before the initializer of an array. A scalar
+  // variable may be assigned an array later, which makes an alias of it.
+  auto Declare = [&]() {
+    StaticType &SlotType = ScopeStack.back()[Decl->getSlot()];
+    if (Unconditional && !SlotType.Known) {
+      SlotType = StaticType(Type, Decl->isArray() ? static_cast<int>(
+          Decl->getElementCountList().size()) : -1);
+    }
+  };
+  if (Decl->isArray())
+    Declare();
+
+  if (const ExpressionAST *Init = Decl->getInitializer()) {
+    StaticType InitType = checkExpression(Init);
+    if (InitType.is(Type)) {
+      Decl->setTypeChecked();
+    } else if (InitType.Known &&
+               !(Type == cvm::DoubleType && InitType.is(cvm::IntType))) {
+      error(Decl->getLoc(), "variable `" + Name + "' is declared to be " +
+          cvm::TypeToStr(Type) + ", but is initialized to be " +
+          cvm::TypeToStr(InitType.Type));
+    }
+  }
+
+  if (!Decl->isArray())
+    Declare();
+}
+
+StaticType CMMTypeChecker::checkExpression(const ExpressionAST *Expr) {
+  if (!Expr)
+    return StaticType();
+
+  StaticType Type;
+  switch (Expr->getKind()) {
+  default:
+    assert(false && "checkExpression: unknown expression kind");
+  case ExpressionAST::IntExpression:
+    Type = StaticType(cvm::IntType);
+    break;
+  case ExpressionAST::DoubleExpression:
+    Type = StaticType(cvm::DoubleType);
+    break;
+  case ExpressionAST::BoolExpression:
+    Type = StaticType(cvm::BoolType);
+    break;
+  case ExpressionAST::StringExpression:
+    Type = StaticType(cvm::StringType);
+    break;
+  case ExpressionAST::IdentifierExpression:
+    Type = checkIdentifier(Expr->as_cptr<IdentifierAST>());
+    break;
+  case ExpressionAST::FunctionCallExpression:
+    Type = checkFunctionCall(Expr->as_cptr<FunctionCallAST>());
+    break;
+  case ExpressionAST::InfixOpExpression:
+    checkExpression(Expr->as_cptr<InfixOpExprAST>()->getLHS());
+    checkExpression(Expr->as_cptr<InfixOpExprAST>()->getRHS());
+    break;
+  case ExpressionAST::BinaryOperatorExpression:
+    Type = checkBinaryOperator(Expr->as_cptr<BinaryOperatorAST>());
+    break;
+  case ExpressionAST::UnaryOperatorExpression:
+    Type = checkUnaryOperator(Expr->as_cptr<UnaryOperatorAST>());
+    break;
+  }
+
+  Expr->setStaticType(Type);
+  return Type;
+}
+
+StaticType CMMTypeChecker::checkIdentifier(const IdentifierAST *IdExpr) {
+  const VariableBinding &Binding = IdExpr->getBinding();
+  if (Binding.Kind != VariableBinding::LocalBinding)
+    return StaticType();
+
+  assert(Binding.Depth < ScopeStack.size() && "checkIdentifier: bad depth");
+  return ScopeStack[ScopeStack.size() - 1 - Binding.Depth][Binding.Slot];
+}
+
+StaticType CMMTypeChecker::checkFunctionCall(const FunctionCallAST *FuncCall) {
+  std::vector<StaticType> ArgTypes;
+  for (auto &Arg : FuncCall->getArguments())
+    ArgTypes.push_back(checkExpression(Arg.get()));
+
+  if (const FunctionDefinitionAST *Function = FuncCall->getUserFunction()) {
+    // A wrong number of arguments is reported at runtime.
+    if (ArgTypes.size() != Function->getParameterCount())
+      return StaticType();
+
+    bool Checked = true;
+    auto ArgType = ArgTypes.cbegin();
+    for (const Parameter &Param : Function->getParameterList()) {
+      if (!ArgType->is(Param.getType())) {
+        Checked = false;
+        if (ArgType->Known && !(Param.getType() == cvm::DoubleType &&
+                                ArgType->is(cvm::IntType))) {
+          error(FuncCall->getLoc(), "in function `" +
+              Function->getName().str() + "', parameter `" +
+              Param.getName().str() + "' has type " +
+              cvm::TypeToStr(Param.getType()) + ", but argument is " +
+              cvm::TypeToStr(ArgType->Type));
+        }
+      }
+      ++ArgType;
+    }
+    if (Checked)
+      FuncCall->setTypeChecked();
+
+    // A function returns its last statement by default.
+    return StaticType();
+  }
+
+  if (FuncCall->getNativeFunction()) {
+    auto It = NativeFunctionMap.find(FuncCall->getCallee().str());
+    if (It != NativeFunctionMap.end())
+      return StaticType(It->second.ReturnType);
+  }
+  return StaticType();
+}
+
+StaticType CMMTypeChecker::checkUnaryOperator(const UnaryOperatorAST *Expr) {
+  StaticType Operand = checkExpression(Expr->getOperand());
+
+  switch (Expr->getOpKind()) {
+  default:
+    assert(false && "checkUnaryOperator: unknown operator kind");
+  case UnaryOperatorAST::Plus:
+  case UnaryOperatorAST::Minus:
+    if (!Operand.Known)
+      return StaticType();
+    if (!Operand.is(cvm::IntType) && !Operand.is(cvm::DoubleType)) {
+      error(Expr->getLoc(),
+            "operands of unary arithmetic operations should be numeric");
+      return StaticType();
+    }
+    if (Expr->getOpKind() == UnaryOperatorAST::Plus)
+      return Operand;
+    return StaticType(Operand.Type);
+
+  case UnaryOperatorAST::LogicalNot:
+    return StaticType(cvm::BoolType);
+
+  case UnaryOperatorAST::BitwiseNot:
+    if (Operand.Known && !Operand.is(cvm::IntType))
+      error(Expr->getLoc(), "operand of unary bitwise operation should be int");
+    return StaticType(cvm::IntType);
+  }
+}
+
+StaticType CMMTypeChecker::checkBinaryOperator(const BinaryOperatorAST *Expr) {
+  switch (Expr->getOpKind()) {
+  default:
+    break;
+  case BinaryOperatorAST::Assign:
+    return checkAssignment(Expr);
+  case BinaryOperatorAST::Index:
+    return checkIndex(Expr);
+  case BinaryOperatorAST::LogicalAnd:
+  case BinaryOperatorAST::LogicalOr:
+    checkExpression(Expr->getLHS());
+    checkExpression(Expr->getRHS());
+    return StaticType(cvm::BoolType);
+  }
+
+  StaticType LHS = checkExpression(Expr->getLHS());
+  StaticType RHS = checkExpression(Expr->getRHS());
+  bool BothKnown = LHS.Known && RHS.Known;
+  bool Numeric = (LHS.is(cvm::IntType) || LHS.is(cvm::DoubleType)) &&
+                 (RHS.is(cvm::IntType) || RHS.is(cvm::DoubleType));
+
+  switch (Expr->getOpKind()) {
+  default:
+    assert(false && "checkBinaryOperator: unknown operator kind");
+  case BinaryOperatorAST::Add:
+    if (LHS.is(cvm::StringType) || RHS.is(cvm::StringType))
+      return StaticType(cvm::StringType);
+    /* fall Through */
+  case BinaryOperatorAST::Minus:
+  case BinaryOperatorAST::Multiply:
+  case BinaryOperatorAST::Division:
+  case BinaryOperatorAST::Modulo:
+    if (!BothKnown)
+      return StaticType();
+    if (!Numeric) {
+      error(Expr->getLoc(),
+            "operands of binary arithmetic operations should be numeric");
+      return StaticType();
+    }
+    if (LHS.is(cvm::IntType) && RHS.is(cvm::IntType)) {
+      Expr->quicken(BinaryOperatorAST::QuickenedInt);
+      return StaticType(cvm::IntType);
+    }
+    if (LHS.is(cvm::DoubleType) && RHS.is(cvm::DoubleType))
+      Expr->quicken(BinaryOperatorAST::QuickenedDouble);
+    return StaticType(cvm::DoubleType);
+
+  case BinaryOperatorAST::Less:
+  case BinaryOperatorAST::LessEqual:
+  case BinaryOperatorAST::Equal:
+  case BinaryOperatorAST::NotEqual:
+  case BinaryOperatorAST::Greater:
+  case BinaryOperatorAST::GreaterEqual:
+    if (BothKnown && LHS.Type != RHS.Type && !Numeric) {
+      error(Expr->getLoc(),
+            "relational operator should apply to identical type");
+    } else if (LHS.is(cvm::IntType) && RHS.is(cvm::IntType)) {
+      Expr->quicken(BinaryOperatorAST::QuickenedInt);
+    } else if (LHS.is(cvm::DoubleType) && RHS.is(cvm::DoubleType)) {
+      Expr->quicken(BinaryOperatorAST::QuickenedDouble);
+    }
+    return StaticType(cvm::BoolType);
+
+  case BinaryOperatorAST::BitwiseAnd:
+  case BinaryOperatorAST::BitwiseOr:
+  case BinaryOperatorAST::BitwiseXor:
+  case BinaryOperatorAST::LeftShift:
+  case BinaryOperatorAST::RightShift:
+    if (BothKnown && !(LHS.is(cvm::IntType) && RHS.is(cvm::IntType))) {
+      error(Expr->getLoc(), "operands of bitwise operations should be int");
+    } else if (BothKnown) {
+      Expr->quicken(BinaryOperatorAST::QuickenedInt);
+    }
+    return StaticType(cvm::IntType);
+  }
+}
+
+StaticType CMMTypeChecker::checkAssignment(const BinaryOperatorAST *Expr) {
+  StaticType Variable = checkExpression(Expr->getLHS());
+  StaticType Value = checkExpression(Expr->getRHS());
+
+  if (!Variable.Known)
+    return StaticType();
+
+  if (Variable.Dimensions > 0) {
+    error(Expr->getLoc(), "cannot assign value to array directly");
+    return StaticType();
+  }
+
+  if (Value.is(Variable.Type)) {
+    Expr->setTypeChecked();
+  } else if (Value.Known && !(Variable.is(cvm::DoubleType) &&
+                              Value.is(cvm::IntType))) {
+    error(Expr->getLoc(), "assignment to " + cvm::TypeToStr(Variable.Type) +
+        " variable with " + cvm::TypeToStr(Value.Type) + " expression");
+  }
+  return StaticType(Variable.Type, -1);
+}
+
+StaticType CMMTypeChecker::checkIndex(const BinaryOperatorAST *Expr) {
+  StaticType Base = checkExpression(Expr->getLHS());
+  StaticType Index = checkExpression(Expr->getRHS());
+
+  if (Base.isScalar()) {
+    error(Expr->getLoc(),
+          "too many index or index expression didn't start with array");
+    return StaticType();
+  }
+  if (Index.Known && !Index.is(cvm::IntType))
+    error(Expr->getLoc(), "non-int index in index expression");
+
+  // An element may be an array assigned to it.
+  if (!Base.Known)
+    return StaticType();
+  return StaticType(Base.Type, Base.Dimensions > 1 ? Base.Dimensions - 1
+                                                   : -1);
+}
@@ -0,0 +1,147 @@
+#include "Code.h"
+#include <iomanip>
+#include <iostream>
+
+namespace cvm {
+
+static const char *OpCodeToStr(OpCode Op) {
+  switch (Op) {
+  default:            return "???";
+  case Nop:           return "Nop";
+  case PushConst:     return "PushConst";
+  case Pop:           return "Pop";
+  case PopResult:     return "PopResult";
+  case ClearResult:   return "ClearResult";
+  case LoadLocal:     return "LoadLocal";
+  case AddrLocal:     return "AddrLocal";
+  case LoadGlobal:    return "LoadGlobal";
+  case AddrGlobal:    return "AddrGlobal";
+  case LoadVar:       return "LoadVar";
+  case AddrVar:       return "AddrVar";
+  case AddrIndex:     return "AddrIndex";
+  case LoadRef:       return "LoadRef";
+  case StoreRef:      return "StoreRef";
+  case DeclareVar:    return "DeclareVar";
+  case DeclareArray:  return "DeclareArray";
+  case EnterScope:    return "EnterScope";
+  case LeaveScope:    return "LeaveScope";
+  case ClearSlots:    return "ClearSlots";
+  case Jump:          return "Jump";
+  case JumpIfFalse:   return "JumpIfFalse";
+  case JumpIfTrue:    return "JumpIfTrue";
+  case ToBool:        return "ToBool";
+  case Add:           return "Add";
+  case Sub:           return "Sub";
+  case Mul:           return "Mul";
+  case Div:           return "Div";
+  case Mod:           return "Mod";
+  case Less:          return "Less";
+  case LessEqual:     return "LessEqual";
+  case Equal:         return "Equal";
+  case NotEqual:      return "NotEqual";
+  case Greater:       return "Greater";
+  case GreaterEqual:  return "GreaterEqual";
+  case BitAnd:        return "BitAnd";
+  case BitOr:         return "BitOr";
+  case BitXor:        return "BitXor";
+  case Shl:           return "Shl";
+  case Shr:           return "Shr";
+  case Pos:           return "Pos";
+  case Neg:           return "Neg";
+  case Not:           return "Not";
+  case BitNot:        return "BitNot";
+  case Call:          return "Call";
+  case CallDynamic:   return "CallDynamic";
+  case CallNative:    return "CallNative";
+  case CallInfix:     return "CallInfix";
+  case TailCall:      return "TailCall";
+  case Return:        return "Return";
+  case ReturnDefault: return "ReturnDefault";
+  case Error:         return "Error";
+  }
+}
+
+void Program::dump() const {
+  for (const CodeObject &Code : Functions) {
+    dump(Code);
+    std::cout << "\n";
+  }
+}
+
+void Program::dump(const CodeObject &Code) const {
+  std::cout << TypeToStr(Code.ReturnType) << " " << Code.Name << "(";
+  for (const auto &P : Code.Parameters) {
+    std::cout << (&P == &Code.Parameters.front() ? "" : ", ")
+              << TypeToStr(P.second) << " "
+              << (P.first < 0 ? "" : Names[P.first]);
+  }
+  std::cout << "):\n";
+
+  // Slot names of the outermost scope are shown for reference.
+  const std::vector<int32_t> &Slots = Scopes[Code.Scope];
+  std::cout << "  slots:";
+  for (int32_t Name : Slots)
+    std::cout << " " << (Name < 0 ? "_" : Names[Name]);
+  std::cout << "\n";
+
+  for (size_t PC = 0; PC < Code.getCodeSize(); ++PC) {
+    const Instruction &I = Code.getCode()[PC];
+    std::cout << "  " << std::setw(4) << PC << "  " << std::left
+              << std::setw(14) << OpCodeToStr(I.Op) << std::right;
+
+    switch (I.Op) {
+    default:
+      break;
+    case PushConst:
+    case Error:
+      std::cout << Constants[I.A].toString();
+      break;
+    case LoadVar:
+    case AddrVar:
+      std::cout << Names[I.A];
+      break;
+    case LoadLocal:
+    case AddrLocal:
+    case LoadGlobal:
+    case AddrGlobal:
+      std::cout << I.Aux << ", " << I.A;
+      break;
+    case DeclareVar:
+    case DeclareArray:
+      std::cout << TypeToStr(static_cast<BasicType>(I.Aux & DeclTypeMask))
+                << " " << I.A;
+      break;
+    case EnterScope:
+      for (int32_t Name : Scopes[I.A])
+        std::cout << Names[Name] << " ";
+      break;
+    case StoreRef:
+    case LeaveScope:
+      std::cout << I.Aux;
+      break;
+    case ClearSlots:
+      std::cout << I.A << ", " << I.Aux;
+      break;
+    case Jump:
+    case JumpIfFalse:
+    case JumpIfTrue:
+      std::cout << "-> " << I.A;
+      break;
+    case Call:
+    case CallDynamic:
+    case CallInfix:
+      std::cout << Functions[I.A].Name << ", " << I.Aux;
+      break;
+    case TailCall:
+      std::cout << Functions[I.A].Name << ", " << (I.Aux & TailArgCountMask)
+                << (I.Aux & TailReturned ? " returned" : "");
+      break;
+    case CallNative:
+      std::cout << NativeNames[I.A] << ", " << I.Aux;
+      break;
+    }
+    std::cout << "\n";
+  }
+}
+
+}
@@ -0,0 +1,128 @@
+#include "GarbageCollector.h"
+#include <algorithm>
+#include <chrono>
+
+namespace cvm {
+
+const size_t GarbageCollector::InitialThreshold;
+
+GarbageCollector &GarbageCollector::get() {
+  // Never destroyed, arrays may outlive static objects.
+  static GarbageCollector *GC = new GarbageCollector;
+  return *GC;
+}
+
+ArrayObject *GarbageCollector::newArray(ArrayStorage *Storage, size_t Offset,
+                                        unsigned Level) {
+  if (TrackedCount >= Threshold && !Collecting)
+    collect();
+
+  ArrayObject *Array = new ArrayObject(Storage, Offset, Level);
+  Array->Prev = &Tracked;
+  Array->Next = Tracked.Next;
+  Tracked.Next->Prev = Array;
+  Tracked.Next = Array;
+  ++TrackedCount;
+  ++Stats.Allocated;
+  return Array;
+}
+
+void GarbageCollector::freeArray(ArrayObject *Array) {
+  Array->Prev->Next = Array->Next;
+  Array->Next->Prev = Array->Prev;
+  --TrackedCount;
+  delete Array;
+}
+
+void freeArray(ArrayObject *Array) {
+  GarbageCollector::get().freeArray(Array);
+}
+
+size_t GarbageCollector::collect() {
+  auto Start = std::chrono::steady_clock::now();
+  Collecting = true;
+
+  for (ArrayObject *A = Tracked.Next; A != &Tracked; A = A->Next) {
+    A->GCRefs = static_cast<long>(A->RefCount);
+    A->Storage->GCVisited = false;
+  }
+
+  // Subtract references from storages from the reference counts of arrays.
+  // Only boxed storages hold references.
+  for (ArrayObject *A = Tracked.Next; A != &Tracked; A = A->Next) {
+    ArrayStorage *Storage = A->Storage;
+    if (Storage->GCVisited)
+      continue;
+    Storage->GCVisited = true;
+    for (const BasicValue &Element : Storage->Values) {
+      if (Element.isArray())
+        --Element.getArrayObject()->GCRefs;
+    }
+  }
+
+  // Arrays still referenced are alive, so is everything reachable from them.
+  // GCVisited marks the storages alive from now on.
+  std::vector<ArrayObject *> WorkList;
+  for (ArrayObject *A = Tracked.Next; A != &Tracked; A = A->Next) {
+    A->Storage->GCVisited = false;
+    if (A->GCRefs > 0)
+      WorkList.push_back(A);
+  }
+  while (!WorkList.empty()) {
+    ArrayStorage *Storage = WorkList.back()->Storage;
+    WorkList.pop_back();
+    if (Storage->GCVisited)
+      continue;
+    Storage->GCVisited = true;
+    for (const BasicValue &Element : Storage->Values) {
+      if (!Element.isArray())
+        continue;
+      ArrayObject *Child = Element.getArrayObject();
+      if (Child->GCRefs <= 0) {
+        Child->GCRefs = 1;
+        WorkList.push_back(Child);
+      }
+    }
+  }
+
+  // Hold the garbage while breaking the cycles, so that none of them is
+  // freed (and untracked) before we're done.
+  std::vector<ArrayObject *> Garbage;
+  for (ArrayObject *A = Tracked.Next; A != &Tracked; A = A->Next) {
+    if (A->GCRefs <= 0) {
+      ++A->RefCount;
+      Garbage.push_back(A);
+    }
+  }
+  for (ArrayObject *A : Garbage) {
+    if (!A->Storage->GCVisited) {
+      for (BasicValue &Element : A->Storage->Values)
+        Element = BasicValue();
+    }
+  }
+
+  size_t Count = Garbage.size();
+  for (ArrayObject *A : Garbage) {
+    if (--A->RefCount == 0)
+      freeArray(A);
+  }
+
+  Threshold = std::max(InitialThreshold, TrackedCount * 2);
+  Collecting = false;
+  ++Stats.Collections;
+  Stats.Reclaimed += Count;
+  Stats.Seconds += std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - Start).count();
+  return Count;
+}
+
+void GarbageCollector::dumpStatistics(std::ostream &OS) const {
+  OS << "GC statistics:\n"
+     << "  arrays allocated:   " << Stats.Allocated << "\n"
+     << "  arrays alive:       " << TrackedCount << "\n"
+     << "  collections:        " << Stats.Collections << "\n"
+     << "  arrays in cycles:   " << Stats.Reclaimed << " reclaimed\n"
+     << "  time in collector:  " << Stats.Seconds * 1000 << " ms\n";
+}
+
+}
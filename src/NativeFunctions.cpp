@@ -1,6 +1,8 @@
 #include "NativeFunctions.h"
 
 #include "CMMParser.h"
+#include "GarbageCollector.h"
+#include "OutputBuffer.h"
 
 #include <ctime>
 #include <cstdlib>
@@ -13,100 +15,160 @@
 
 namespace cvm {
 
-BasicValue
-Native::TypeOf(std::list<BasicValue, std::allocator<BasicValue>> &Args) {
+void addNativeFunctions(
+    std::map<std::string, NativeFunctionInfo> &FunctionMap) {
+  FunctionMap["typeof"] = variadicNative(Native::TypeOf, StringType);
+  FunctionMap["len"] = variadicNative(Native::Length, IntType);
+  FunctionMap["strlen"] = BIND_NATIVE(Native::StrLength);
+  FunctionMap["print"] = variadicNative(Native::Print, VoidType);
+  FunctionMap["println"] = variadicNative(Native::PrintLn, VoidType);
+  FunctionMap["puts"] = variadicNative(Native::PrintLn, VoidType);
+  FunctionMap["flush"] = BIND_NATIVE(Native::Flush);
+  FunctionMap["system"] = variadicNative(Native::System, VoidType);
+  FunctionMap["random"] = variadicNative(Native::Random, IntType);
+  FunctionMap["rand"] = variadicNative(Native::Random, IntType);
+  FunctionMap["srand"] = variadicNative(Native::Srand, VoidType);
+  FunctionMap["time"] = variadicNative(Native::Time, IntType);
+  FunctionMap["exit"] = variadicNative(Native::Exit, VoidType);
+  FunctionMap["gc"] = BIND_NATIVE(Native::GC);
+  FunctionMap["toint"] = BIND_NATIVE(Native::ToInt);
+  FunctionMap["todouble"] = BIND_NATIVE(Native::ToDouble);
+  FunctionMap["tostring"] = BIND_NATIVE(Native::ToString);
+  FunctionMap["str"] = BIND_NATIVE(Native::ToString);
+  FunctionMap["tobool"] = BIND_NATIVE(Native::ToBool);
+  FunctionMap["read"] = BIND_NATIVE(Native::Read);
+  FunctionMap["readln"] = BIND_NATIVE(Native::ReadLn);
+  FunctionMap["readint"] = BIND_NATIVE(Native::ReadInt);
+  FunctionMap["sqrt"] = BIND_NATIVE(Native::Sqrt);
+  FunctionMap["pow"] = BIND_NATIVE(Native::Pow);
+  FunctionMap["exp"] = BIND_NATIVE(Native::Exp);
+  FunctionMap["log"] = BIND_NATIVE(Native::Log);
+  FunctionMap["log10"] = BIND_NATIVE(Native::Log10);
+
+#if defined(__APPLE__) || defined(__linux__)
+  FunctionMap["UnixFork"] = BIND_NATIVE(Unix::Fork);
+
+  FunctionMap["NcEndWin"] = BIND_NATIVE(Ncurses::EndWindow);
+  FunctionMap["NcInitScr"] = BIND_NATIVE(Ncurses::InitScreen);
+  FunctionMap["NcNoEcho"] = BIND_NATIVE(Ncurses::NoEcho);
+  FunctionMap["NcCursSet"] = BIND_NATIVE(Ncurses::CursSet);
+  FunctionMap["NcKeypad"] = BIND_NATIVE(Ncurses::Keypad);
+  FunctionMap["NcTimeout"] = BIND_NATIVE(Ncurses::Timeout);
+  FunctionMap["NcGetCh"] = BIND_NATIVE(Ncurses::GetChar);
+  FunctionMap["NcMvAddCh"] = BIND_NATIVE(Ncurses::MoveAddChar);
+  FunctionMap["NcMvAddStr"] = BIND_NATIVE(Ncurses::MoveAddString);
+  FunctionMap["NcGetMaxY"] = BIND_NATIVE(Ncurses::GetMaxY);
+  FunctionMap["NcGetMaxX"] = BIND_NATIVE(Ncurses::GetMaxX);
+  FunctionMap["NcStartColor"] = BIND_NATIVE(Ncurses::StartColor);
+  FunctionMap["NcInitPair"] = BIND_NATIVE(Ncurses::InitPair);
+  FunctionMap["NcAttrOn"] = BIND_NATIVE(Ncurses::AttrOn);
+  FunctionMap["NcAttrOff"] = BIND_NATIVE(Ncurses::AttrOff);
+  FunctionMap["NcColorPair"] = BIND_NATIVE(Ncurses::ColorPair);
+
+#endif // defined(__APPLE__) || defined(__linux__)
+}
+
+BasicValue Native::TypeOf(ValueSpan Args) {
   if (Args.empty())
     return std::string("Nil");
   return TypeToStr(Args.front().Type);
 }
 
-BasicValue
-Native::Length(std::list<BasicValue, std::allocator<BasicValue>> &Args) {
+BasicValue Native::Length(ValueSpan Args) {
   if (Args.empty())
     return 0;
   const BasicValue &Arg = Args.front();
   if (Arg.isArray())
-    return static_cast<int>(Arg.ArrayPtr->size());
+    return static_cast<int>(Arg.getArray().size());
   if (Arg.isString())
-    return static_cast<int>(Arg.StrVal.size());
+    return static_cast<int>(Arg.getString().size());
   return 0;
 }
 
-BasicValue Native::StrLength(std::list<BasicValue> &Args) {
-  if (Args.empty())
+int Native::StrLength(const BasicValue &S) {
+  if (!S.isString())
     return 0;
-  return static_cast<int>(Args.front().StrVal.size());
+  return static_cast<int>(S.getString().size());
 }
 
-BasicValue Native::ReadInt(std::list<BasicValue> &/*Args*/) {
+int Native::ReadInt() {
+  flushOutput();
   int Res;
   std::cin >> Res;
   return Res;
 }
 
-BasicValue Native::ReadLn(std::list<BasicValue> &/*Args*/) {
+std::string Native::ReadLn() {
+  flushOutput();
   std::string Res;
   std::getline(std::cin, Res);
   return Res;
 }
 
-BasicValue Native::Read(std::list<BasicValue> &/*Args*/) {
+std::string Native::Read() {
+  flushOutput();
   std::string Res;
   std::cin >> Res;
   return Res;
 }
 
-BasicValue Native::ToInt(std::list<BasicValue> &Args) {
-  if (Args.size() != 1)
-    return 0;
-  return Args.front().toInt();
+int Native::ToInt(const BasicValue &V) {
+  return V.toInt();
 }
 
-BasicValue Native::ToBool(std::list<BasicValue> &Args) {
-  if (Args.size() != 1)
-    return false;
-  return Args.front().toBool();
+bool Native::ToBool(const BasicValue &V) {
+  return V.toBool();
 }
 
-BasicValue Native::ToString(std::list<BasicValue> &Args) {
-  if (Args.size() != 1)
-    return std::string();
-  return Args.front().toString();
+std::string Native::ToString(const BasicValue &V) {
+  return V.toString();
 }
 
-BasicValue Native::ToDouble(std::list<BasicValue> &Args) {
-  if (Args.size() != 1)
-    return 0.0;
-  return Args.front().toDouble();
+double Native::ToDouble(const BasicValue &V) {
+  return V.toDouble();
 }
 
-BasicValue Native::Exit(std::list<BasicValue> &Args) {
+BasicValue Native::Exit(ValueSpan Args) {
+  flushOutput();
   if (Args.empty())
     std::exit(EXIT_SUCCESS);
   std::exit(Args.front().toInt());
 }
 
-BasicValue Native::Print(std::list<BasicValue> &Args) {
+/// \brief Collect reference cycles now. Return the number of arrays freed.
+int Native::GC() {
+  return static_cast<int>(GarbageCollector::get().collect());
+}
+
+BasicValue Native::Print(ValueSpan Args) {
+  OutputBuffer &Output = OutputBuffer::get();
   for (auto &Arg : Args) {
-    std::cout << Arg.toString() << " ";
+    Output.write(Arg);
+    Output.write(' ');
   }
   return BasicValue();
 }
 
-BasicValue Native::PrintLn(std::list<BasicValue> &Args) {
+BasicValue Native::PrintLn(ValueSpan Args) {
   Native::Print(Args);
-  std::cout << "\n";
+  OutputBuffer::get().writeLine();
   return BasicValue();
 }
 
-BasicValue Native::System(std::list<BasicValue> &Args) {
+/// \brief Write out what's printed so far.
+void Native::Flush() {
+  flushOutput();
+}
+
+BasicValue Native::System(ValueSpan Args) {
+  flushOutput();
   for (auto &Arg : Args) {
     std::system(Arg.toString().c_str());
   }
   return BasicValue();
 }
 
-BasicValue Native::Random(std::list<BasicValue> &Args) {
+BasicValue Native::Random(ValueSpan Args) {
   if (Args.empty())
     return std::rand();
 
@@ -117,152 +179,111 @@ BasicValue Native::Random(std::list<BasicValue> &Args) {
   return std::rand() % (High - Low) + Low;
 }
 
-BasicValue Native::Srand(std::list<BasicValue> &Args) {
+BasicValue Native::Srand(ValueSpan Args) {
   int Seed = (Args.empty() || !Args.front().isInt()) ? 0 : Args.front().IntVal;
   std::srand(static_cast<unsigned int>(Seed));
   return BasicValue();
 }
 
-BasicValue Native::Time(std::list<BasicValue> &/*Args*/) {
+/// Arguments are ignored, as in `time(0)'.
+BasicValue Native::Time(ValueSpan /*Args*/) {
   return static_cast<int>(std::time(nullptr));
 }
 
-BasicValue Native::Sqrt(std::list<BasicValue> &Args) {
-  if (Args.empty())
-    return 0.0;
-  return std::sqrt(Args.front().toDouble());
+double Native::Sqrt(double X) {
+  return std::sqrt(X);
 }
 
-BasicValue Native::Pow(std::list<BasicValue> &Args) {
-  if (Args.size() != 2)
-    return 0.0;
-  return std::pow(Args.front().toDouble(), Args.back().toDouble());
+double Native::Pow(double X, double Y) {
+  return std::pow(X, Y);
 }
 
-BasicValue Native::Exp(std::list<BasicValue> &Args) {
-  if (Args.empty())
-    return 0.0;
-  return std::exp(Args.front().toDouble());
+double Native::Exp(double X) {
+  return std::exp(X);
 }
 
-BasicValue Native::Log(std::list<BasicValue> &Args) {
-  if (Args.empty())
-    return 0.0;
-  return std::log(Args.front().toDouble());
+double Native::Log(double X) {
+  return std::log(X);
 }
 
-BasicValue Native::Log10(std::list<BasicValue> &Args) {
-  if (Args.empty())
-    return 0.0;
-  return std::log10(Args.front().toDouble());
+double Native::Log10(double X) {
+  return std::log10(X);
 }
 
 #if defined(__APPLE__) || defined(__linux__)
 
-BasicValue Unix::Fork(std::list<BasicValue> &/*Args*/) {
+int Unix::Fork() {
+  // Or the child would write what's buffered again.
+  flushOutput();
   return ::fork();
 }
 
-BasicValue Ncurses::GetMaxY(std::list<BasicValue> &/*Args*/) {
+int Ncurses::GetMaxY() {
   return getmaxy(stdscr);
 }
 
-BasicValue Ncurses::GetMaxX(std::list<BasicValue> &/*Args*/) {
+int Ncurses::GetMaxX() {
   return getmaxx(stdscr);
 }
 
-BasicValue Ncurses::InitScreen(std::list<BasicValue> &/*Args*/) {
+void Ncurses::InitScreen() {
+  flushOutput();
   ::initscr();
-  return BasicValue();
 }
 
-BasicValue Ncurses::NoEcho(std::list<BasicValue> &/*Args*/) {
+int Ncurses::NoEcho() {
   return ::noecho();
 }
 
-BasicValue Ncurses::CursSet(std::list<BasicValue> &Args) {
-  return ::curs_set(Args.empty() ? false : Args.front().toBool());
+int Ncurses::CursSet(bool Visible) {
+  return ::curs_set(Visible);
 }
 
-BasicValue Ncurses::Keypad(std::list<BasicValue> &Args) {
-  return ::keypad(::stdscr, Args.empty() ? false : Args.front().toBool());
+int Ncurses::Keypad(bool Enable) {
+  return ::keypad(::stdscr, Enable);
 }
 
-BasicValue Ncurses::Timeout(std::list<BasicValue> &Args) {
-  ::timeout(Args.empty() ? -1 : Args.front().toInt());
-  return BasicValue();
+void Ncurses::Timeout(int Delay) {
+  ::timeout(Delay);
 }
 
-BasicValue Ncurses::GetChar(std::list<BasicValue> &/*Args*/) {
+int Ncurses::GetChar() {
+  flushOutput();
   return ::wgetch(stdscr);
 }
 
-BasicValue Ncurses::MoveAddChar(std::list<BasicValue> &Args) {
-  if (Args.size() != 3)
-    return BasicValue();
-
-  auto Iterator = Args.cbegin();
-
-  int Y = Iterator->toInt();
-  ++Iterator;
-  int X = Iterator->toInt();
-
-  char C = static_cast<char>(Args.back().IntVal);
-  return mvaddch(Y, X, C);
+int Ncurses::MoveAddChar(int Y, int X, int C) {
+  return mvaddch(Y, X, static_cast<char>(C));
 }
 
-BasicValue Ncurses::MoveAddString(std::list<BasicValue> &Args) {
-  if (Args.size() != 3)
-    return BasicValue();
-
-  auto Iterator = Args.cbegin();
-
-  int Y = Iterator->toInt();
-  ++Iterator;
-  int X = Iterator->toInt();
-
-  const char *S = Args.back().StrVal.c_str();
-  return mvaddstr(Y, X, S);
+int Ncurses::MoveAddString(int Y, int X, const std::string &S) {
+  return mvaddstr(Y, X, S.c_str());
 }
 
-BasicValue Ncurses::EndWindow(std::list<BasicValue> &/*Args*/) {
+int Ncurses::EndWindow() {
+  flushOutput();
   return ::endwin();
 }
 
-BasicValue Ncurses::InitPair(std::list<BasicValue> &Args) {
-  if (Args.size() != 3)
-    return ERR;
-
-  auto Iterator = Args.cbegin();
-
-  short PairNo = static_cast<short>(Iterator->toInt());
-  ++Iterator;
-  short FgColor = static_cast<short>(Iterator->toInt());
-  short BgColor = static_cast<short>(Args.back().toInt());
-
-  return ::init_pair(PairNo, FgColor, BgColor);
+int Ncurses::InitPair(int PairNo, int FgColor, int BgColor) {
+  return ::init_pair(static_cast<short>(PairNo), static_cast<short>(FgColor),
+                     static_cast<short>(BgColor));
 }
 
-BasicValue Ncurses::StartColor(std::list<BasicValue> &/*Args*/) {
+int Ncurses::StartColor() {
   return ::start_color();
 }
 
-BasicValue Ncurses::AttrOn(std::list<BasicValue> &Args) {
-  if (Args.empty())
-    return ERR;
-  return attron(Args.front().toInt());
+int Ncurses::AttrOn(int Attrs) {
+  return attron(Attrs);
 }
 
-BasicValue Ncurses::AttrOff(std::list<BasicValue> &Args) {
-  if (Args.empty())
-    return ERR;
-  return attroff(Args.front().toInt());
+int Ncurses::AttrOff(int Attrs) {
+  return attroff(Attrs);
 }
 
-BasicValue Ncurses::ColorPair(std::list<BasicValue> &Args) {
-  if (Args.empty())
-    return 0;
-  return static_cast<int>(COLOR_PAIR(Args.front().toInt()));
+int Ncurses::ColorPair(int PairNo) {
+  return static_cast<int>(COLOR_PAIR(PairNo));
 }
 
 #endif // defined(__APPLE__) || defined(__linux__)
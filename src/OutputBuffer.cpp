@@ -0,0 +1,105 @@
+#include "OutputBuffer.h"
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__APPLE__) || defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace cvm {
+
+const size_t OutputBuffer::Capacity;
+
+OutputBuffer &OutputBuffer::get() {
+  // Never destroyed, it's flushed by atexit() after static objects may be.
+  static OutputBuffer *Output = new OutputBuffer;
+  return *Output;
+}
+
+OutputBuffer::OutputBuffer() {
+#if defined(__APPLE__) || defined(__linux__)
+  LineBuffered = ::isatty(STDOUT_FILENO);
+#endif // defined(__APPLE__) || defined(__linux__)
+  std::atexit(flushOutput);
+}
+
+void OutputBuffer::flush() {
+  if (Size == 0)
+    return;
+  std::fwrite(Buffer, 1, Size, stdout);
+  std::fflush(stdout);
+  Size = 0;
+}
+
+void OutputBuffer::writeSlow(const char *Data, size_t Length) {
+  flush();
+  if (Length < Capacity) {
+    std::memcpy(Buffer, Data, Length);
+    Size = Length;
+    return;
+  }
+  std::fwrite(Data, 1, Length, stdout);
+  std::fflush(stdout);
+}
+
+void OutputBuffer::write(int I) {
+  // Digits are generated backwards, from the least significant one.
+  char Digits[16];
+  char *End = Digits + sizeof(Digits), *P = End;
+  unsigned U = I < 0 ? 0u - static_cast<unsigned>(I)
+                     : static_cast<unsigned>(I);
+  do {
+    *--P = static_cast<char>('0' + U % 10);
+    U /= 10;
+  } while (U);
+  if (I < 0)
+    *--P = '-';
+  write(P, static_cast<size_t>(End - P));
+}
+
+void OutputBuffer::write(double D) {
+  // The same format as std::to_string(), which is at most 317 characters
+  // with the terminating null for the largest doubles.
+  const size_t MaxLength = 320;
+  if (Capacity - Size < MaxLength)
+    flush();
+  int Length = std::snprintf(Buffer + Size, MaxLength, "%f", D);
+  if (Length > 0)
+    Size += static_cast<size_t>(Length);
+}
+
+void OutputBuffer::write(const BasicValue &V, const ArrayObject *Outermost) {
+  if (V.isArray()) {
+    if (Outermost == V.getArrayObject()) {
+      write("[...]", 5);
+      return;
+    }
+    if (Outermost == nullptr)
+      Outermost = V.getArrayObject();
+
+    const ArrayObject &Array = V.getArray();
+    write('[');
+    for (size_t I = 0; I < Array.size(); ++I) {
+      if (I > 0)
+        write(", ", 2);
+      write(Array.get(I), Outermost);
+    }
+    write(']');
+    return;
+  }
+
+  switch (V.Type) {
+  default:                                      break;
+  case IntType:     write(V.IntVal);            break;
+  case DoubleType:  write(V.DoubleVal);         break;
+  case BoolType:
+    if (V.BoolVal)
+      write("true", 4);
+    else
+      write("false", 5);
+    break;
+  case StringType:  write(V.getString());       break;
+  }
+}
+
+}
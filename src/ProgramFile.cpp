@@ -0,0 +1,635 @@
+#include "ProgramFile.h"
+#include "NativeFunctions.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <type_traits>
+
+#if defined(__APPLE__) || defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace cvm;
+
+namespace {
+/// Bumped whenever the layout of the file, the instruction set or the code
+/// CMMCompiler generates changes, which invalidates programs cached.
+const uint32_t FormatVersion = 1;
+const char Magic[8] = { 'C', 'M', 'M', 'C', '\r', '\n', '\032', '\n' };
+const uint32_t ByteOrderMark = 0x01020304;
+
+/// A table of Count records at Offset.
+struct Section {
+  uint64_t Offset;
+  uint64_t Count;
+};
+
+struct FileHeader {
+  char Magic[8];
+  /// Hash of everything after it, to the end of the file.
+  uint64_t Checksum;
+  uint32_t Version;
+  uint32_t ByteOrder;
+  uint64_t BuildId;
+  uint64_t SourceHash;
+  uint64_t SourceSize;
+  uint64_t FileSize;
+  int32_t MainIndex;
+  uint32_t Reserved;
+  Section Constants;    // ConstantRecord
+  Section Names;        // Section of char
+  Section Scopes;       // Section of int32_t
+  Section Functions;    // FunctionRecord
+  Section NativeNames;  // Section of char
+};
+
+struct ConstantRecord {
+  uint32_t Type;
+  /// The int, or the bool as 0 or 1.
+  int32_t IntVal;
+  double DoubleVal;
+  Section Str;
+};
+
+struct ParameterRecord {
+  int32_t Name;
+  uint32_t Type;
+};
+
+struct FunctionRecord {
+  uint32_t Kind;
+  uint32_t ReturnType;
+  Section Name;
+  int32_t Scope;
+  uint32_t Reserved;
+  Section Parameters;   // ParameterRecord
+  /// Instructions, stored as Instruction is laid out in memory.
+  Section Code;
+  /// Offset of the line of each instruction, uint32_t.
+  uint64_t Lines;
+};
+
+// Instructions are run from the file as they are.
+static_assert(std::is_trivially_copyable<Instruction>::value &&
+              sizeof(Instruction) == 8 && offsetof(Instruction, Op) == 0 &&
+              offsetof(Instruction, Aux) == 2 &&
+              offsetof(Instruction, A) == 4,
+              "Instruction should be laid out as in .cmmc files");
+
+/// \brief Build the image of a file, with each record aligned to 8 bytes.
+class ImageWriter {
+private:  /*  private member variables  */
+  std::string Image;
+
+public:   /* public member functions */
+  ImageWriter() : Image(sizeof(FileHeader), '\0') {}
+
+  uint64_t append(const void *Data, size_t Size) {
+    Image.resize((Image.size() + 7) & ~static_cast<size_t>(7), '\0');
+    uint64_t Offset = Image.size();
+    Image.append(static_cast<const char *>(Data), Size);
+    return Offset;
+  }
+  Section appendString(const std::string &S) {
+    return { append(S.data(), S.size()), S.size() };
+  }
+  template <typename T>
+  Section appendTable(const std::vector<T> &Table) {
+    return { append(Table.data(), Table.size() * sizeof(T)), Table.size() };
+  }
+
+  void overwrite(uint64_t Offset, const void *Data, size_t Size) {
+    std::memcpy(&Image[Offset], Data, Size);
+  }
+
+  std::string &getImage() { return Image; }
+};
+
+/// \brief Checks the tables read from an image stay within it.
+class ImageReader {
+private:  /*  private member variables  */
+  const char *Data;
+  size_t Size;
+
+public:   /* public member functions */
+  ImageReader(const char *Data, size_t Size) : Data(Data), Size(Size) {}
+
+  template <typename T>
+  const T *get(uint64_t Offset, uint64_t Count) const {
+    if (Offset > Size || Count > (Size - Offset) / sizeof(T) ||
+        reinterpret_cast<uintptr_t>(Data + Offset) % alignof(T) != 0)
+      return nullptr;
+    return reinterpret_cast<const T *>(Data + Offset);
+  }
+  template <typename T>
+  const T *get(const Section &S) const { return get<T>(S.Offset, S.Count); }
+
+  bool getString(const Section &S, std::string &Str) const {
+    const char *P = get<char>(S);
+    if (!P)
+      return false;
+    Str.assign(P, S.Count);
+    return true;
+  }
+};
+
+/// \brief Identify what a program compiled by this build of cmm relies on:
+/// the format, the instruction set and the signatures of native functions.
+/// It's derived from the sources only, so that every build of the same cmm
+/// runs the same .cmmc files, wherever the executable is copied.
+uint64_t getBuildId() {
+  static const uint64_t BuildId = [] {
+    std::string Id = std::to_string(FormatVersion) + ' ' +
+                     std::to_string(Error + 1) + ' ' +
+                     std::to_string(sizeof(Instruction));
+
+    std::map<std::string, NativeFunctionInfo> NativeFunctionMap;
+    addNativeFunctions(NativeFunctionMap);
+    for (const auto &Native : NativeFunctionMap) {
+      const NativeFunctionInfo &Info = Native.second;
+      Id += ' ' + Native.first + '(';
+      for (int I = 0; I < Info.Arity; ++I)
+        Id += std::to_string(Info.ParamTypes[I]) + ',';
+      Id += std::to_string(Info.Arity) + ')' +
+            std::to_string(Info.ReturnType);
+    }
+    return ProgramFile::hashSource(Id.data(), Id.size());
+  }();
+  return BuildId;
+}
+
+/// \brief Hash what the checksum of a file covers.
+uint64_t computeChecksum(const char *Data, size_t Size) {
+  const size_t Start = offsetof(FileHeader, Checksum) + sizeof(uint64_t);
+  return ProgramFile::hashSource(Data + Start, Size - Start);
+}
+
+bool isValidType(uint32_t Type) {
+  return Type <= VoidType;
+}
+
+bool isValidName(int32_t Name, const FileHeader &Header) {
+  return Name >= -1 && Name < static_cast<int64_t>(Header.Names.Count);
+}
+
+/// \brief Return true if every operand of the code of Functions[Index]
+/// refers to something in \p Prog, and the code can't run past its end.
+/// Slots are only checked against the largest scope.
+bool isValidCode(const Program &Prog, size_t Index, size_t MaxSlots) {
+  const CodeObject &Code = Prog.Functions[Index];
+  const Instruction *Insts = Code.getCode();
+  const size_t Size = Code.getCodeSize();
+  auto InRange = [](int32_t A, size_t Count) {
+    return A >= 0 && static_cast<size_t>(A) < Count;
+  };
+
+  if (Insts[Size - 1].Op != ReturnDefault)
+    return false;
+  for (size_t PC = 0; PC != Size; ++PC) {
+    const Instruction &I = Insts[PC];
+    switch (I.Op) {
+    default:
+      if (I.Op > Error)
+        return false;
+      break;
+    case PushConst:
+      if (!InRange(I.A, Prog.Constants.size()))
+        return false;
+      break;
+    case Error:
+      if (!InRange(I.A, Prog.Constants.size()) ||
+          !Prog.Constants[I.A].isString())
+        return false;
+      break;
+    case LoadVar: case AddrVar:
+      if (!InRange(I.A, Prog.Names.size()))
+        return false;
+      break;
+    case LoadLocal: case AddrLocal: case LoadGlobal: case AddrGlobal:
+    case DeclareVar: case DeclareArray:
+      if (!InRange(I.A, MaxSlots))
+        return false;
+      break;
+    case ClearSlots:
+      if (!InRange(I.A, MaxSlots) || I.Aux > MaxSlots - I.A)
+        return false;
+      break;
+    case EnterScope:
+      if (!InRange(I.A, Prog.Scopes.size()))
+        return false;
+      break;
+    case Jump: case JumpIfFalse: case JumpIfTrue:
+      if (!InRange(I.A, Size))
+        return false;
+      break;
+    case Call: case CallDynamic:
+      if (!InRange(I.A, Prog.Functions.size()) ||
+          Prog.Functions[I.A].Kind != CodeObject::FunctionCode)
+        return false;
+      break;
+    case CallInfix:
+      if (!InRange(I.A, Prog.Functions.size()) ||
+          !Prog.Functions[I.A].isInfixOp())
+        return false;
+      break;
+    case TailCall:
+      if (static_cast<size_t>(I.A) != Index)
+        return false;
+      break;
+    case CallNative:
+      if (!InRange(I.A, Prog.Natives.size()))
+        return false;
+      break;
+    }
+  }
+  return true;
+}
+
+/// \brief A file mapped into memory read-only, or read into a buffer.
+class FileContent {
+private:  /*  private member variables  */
+  const char *Data = nullptr;
+  size_t Size = 0;
+  bool Mapped = false;
+  std::string Buffer;
+
+public:   /* public member functions */
+  explicit FileContent(const std::string &Path) {
+#if defined(__APPLE__) || defined(__linux__)
+    int FD = ::open(Path.c_str(), O_RDONLY);
+    if (FD < 0)
+      return;
+
+    struct stat Stat;
+    if (::fstat(FD, &Stat) == 0 && S_ISREG(Stat.st_mode) &&
+        Stat.st_size > 0) {
+      void *Addr = ::mmap(nullptr, static_cast<size_t>(Stat.st_size),
+                          PROT_READ, MAP_PRIVATE, FD, 0);
+      if (Addr != MAP_FAILED) {
+        Data = static_cast<const char *>(Addr);
+        Size = static_cast<size_t>(Stat.st_size);
+        Mapped = true;
+      }
+    }
+    ::close(FD);
+#else
+    std::ifstream Stream(Path, std::ios::binary);
+    Buffer.assign(std::istreambuf_iterator<char>(Stream),
+                  std::istreambuf_iterator<char>());
+    Data = Buffer.data();
+    Size = Buffer.size();
+#endif // defined(__APPLE__) || defined(__linux__)
+  }
+  ~FileContent() {
+#if defined(__APPLE__) || defined(__linux__)
+    if (Mapped)
+      ::munmap(const_cast<char *>(Data), Size);
+#endif // defined(__APPLE__) || defined(__linux__)
+  }
+  FileContent(const FileContent &) = delete;
+  FileContent &operator=(const FileContent &) = delete;
+
+  const char *data() const { return Data; }
+  size_t size() const { return Size; }
+};
+}
+
+uint64_t ProgramFile::hashSource(const char *Data, size_t Size) {
+  // Four lanes are mixed independently, so that their multiplications
+  // overlap, and hashing a large script takes a fraction of a millisecond.
+  const uint64_t K1 = 0x9E3779B97F4A7C15ULL, K2 = 0xC2B2AE3D27D4EB4FULL;
+  auto Mix = [=](uint64_t H, uint64_t W) {
+    H ^= W * K1;
+    return (H << 31 | H >> 33) * K2;
+  };
+
+  uint64_t H[4] = { K1, K2, ~K1, ~K2 };
+  const char *P = Data, *End = Data + Size;
+  for (; End - P >= 32; P += 32) {
+    uint64_t W[4];
+    std::memcpy(W, P, sizeof(W));
+    for (int I = 0; I != 4; ++I)
+      H[I] = Mix(H[I], W[I]);
+  }
+  for (int I = 0; P != End; I = (I + 1) % 4) {
+    uint64_t W = 0;
+    size_t N = std::min<size_t>(End - P, sizeof(W));
+    std::memcpy(&W, P, N);
+    H[I] = Mix(H[I], W);
+    P += N;
+  }
+
+  uint64_t Res = Size;
+  for (uint64_t Lane : H)
+    Res = Mix(Res, Lane);
+  Res ^= Res >> 33;
+  Res *= K2;
+  return Res ^ Res >> 29;
+}
+
+bool ProgramFile::isProgramFile(const char *Data, size_t Size) {
+  return Size >= sizeof(Magic) && !std::memcmp(Data, Magic, sizeof(Magic));
+}
+
+bool ProgramFile::write(const Program &Prog, uint64_t SourceHash,
+                        uint64_t SourceSize, const std::string &Path) {
+  ImageWriter Writer;
+  FileHeader Header;
+  std::memset(&Header, 0, sizeof(Header));
+  std::memcpy(Header.Magic, Magic, sizeof(Magic));
+  Header.Version = FormatVersion;
+  Header.ByteOrder = ByteOrderMark;
+  Header.BuildId = getBuildId();
+  Header.SourceHash = SourceHash;
+  Header.SourceSize = SourceSize;
+  Header.MainIndex = Prog.MainIndex;
+
+  std::vector<ConstantRecord> Constants;
+  for (const BasicValue &Value : Prog.Constants) {
+    ConstantRecord Record;
+    std::memset(&Record, 0, sizeof(Record));
+    Record.Type = Value.Type;
+    switch (Value.Type) {
+    default:          break;
+    case IntType:     Record.IntVal = Value.IntVal; break;
+    case BoolType:    Record.IntVal = Value.BoolVal; break;
+    case DoubleType:  Record.DoubleVal = Value.DoubleVal; break;
+    case StringType:  Record.Str = Writer.appendString(Value.getString());
+                      break;
+    }
+    Constants.push_back(Record);
+  }
+  Header.Constants = Writer.appendTable(Constants);
+
+  std::vector<Section> Strings;
+  for (const std::string &Name : Prog.Names)
+    Strings.push_back(Writer.appendString(Name));
+  Header.Names = Writer.appendTable(Strings);
+
+  Strings.clear();
+  for (const std::string &Name : Prog.NativeNames)
+    Strings.push_back(Writer.appendString(Name));
+  Header.NativeNames = Writer.appendTable(Strings);
+
+  std::vector<Section> Scopes;
+  for (const std::vector<int32_t> &Scope : Prog.Scopes)
+    Scopes.push_back(Writer.appendTable(Scope));
+  Header.Scopes = Writer.appendTable(Scopes);
+
+  std::vector<FunctionRecord> Functions;
+  for (const CodeObject &Code : Prog.Functions) {
+    FunctionRecord Record;
+    std::memset(&Record, 0, sizeof(Record));
+    Record.Kind = Code.Kind;
+    Record.ReturnType = Code.ReturnType;
+    Record.Name = Writer.appendString(Code.Name);
+    Record.Scope = Code.Scope;
+
+    std::vector<ParameterRecord> Parameters;
+    for (const auto &Param : Code.Parameters)
+      Parameters.push_back({ Param.first, Param.second });
+    Record.Parameters = Writer.appendTable(Parameters);
+    Functions.push_back(Record);
+  }
+  Header.Functions = Writer.appendTable(Functions);
+
+  // Code comes last, away from what's read when the file is loaded, so that
+  // only the code run is ever paged in.
+  for (size_t F = 0; F != Prog.Functions.size(); ++F) {
+    const CodeObject &Code = Prog.Functions[F];
+    FunctionRecord &Record = Functions[F];
+
+    // Write instructions field by field, leaving the padding zero.
+    size_t CodeSize = Code.getCodeSize();
+    std::vector<char> Instructions(CodeSize * sizeof(Instruction));
+    std::vector<uint32_t> Lines(CodeSize);
+    for (size_t I = 0; I != CodeSize; ++I) {
+      char *P = Instructions.data() + I * sizeof(Instruction);
+      const Instruction &Inst = Code.getCode()[I];
+      Lines[I] = Code.getLine(I);
+      std::memcpy(P + offsetof(Instruction, Op), &Inst.Op, sizeof(Inst.Op));
+      std::memcpy(P + offsetof(Instruction, Aux), &Inst.Aux,
+                  sizeof(Inst.Aux));
+      std::memcpy(P + offsetof(Instruction, A), &Inst.A, sizeof(Inst.A));
+    }
+    Record.Code = { Writer.append(Instructions.data(), Instructions.size()),
+                    CodeSize };
+    Record.Lines = Writer.appendTable(Lines).Offset;
+  }
+  Writer.overwrite(Header.Functions.Offset, Functions.data(),
+                   Functions.size() * sizeof(FunctionRecord));
+
+  std::string &Image = Writer.getImage();
+  Header.FileSize = Image.size();
+  std::memcpy(&Image[0], &Header, sizeof(Header));
+  Header.Checksum = computeChecksum(Image.data(), Image.size());
+  std::memcpy(&Image[0], &Header, sizeof(Header));
+
+  // Runs of the same script may write its cache at once, each their own.
+  std::string TmpPath = Path + ".tmp";
+#if defined(__APPLE__) || defined(__linux__)
+  TmpPath += std::to_string(::getpid());
+#endif // defined(__APPLE__) || defined(__linux__)
+  {
+    std::ofstream Stream(TmpPath, std::ios::binary | std::ios::trunc);
+    if (!Stream.write(Image.data(), Image.size()) || !Stream.flush()) {
+      std::remove(TmpPath.c_str());
+      return false;
+    }
+  }
+  if (std::rename(TmpPath.c_str(), Path.c_str()) != 0) {
+    std::remove(TmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<Program> ProgramFile::read(const char *Data, size_t Size,
+                                           uint64_t &SourceHash,
+                                           uint64_t &SourceSize) {
+  ImageReader Reader(Data, Size);
+  const FileHeader *Header = Reader.get<FileHeader>(0, 1);
+  if (!Header || !isProgramFile(Data, Size) ||
+      Header->Version != FormatVersion ||
+      Header->ByteOrder != ByteOrderMark || Header->FileSize != Size ||
+      Header->BuildId != getBuildId() ||
+      Header->Checksum != computeChecksum(Data, Size))
+    return nullptr;
+  SourceHash = Header->SourceHash;
+  SourceSize = Header->SourceSize;
+
+  std::unique_ptr<Program> Prog(new Program);
+  Prog->MainIndex = Header->MainIndex;
+
+  const ConstantRecord *Constants =
+      Reader.get<ConstantRecord>(Header->Constants);
+  if (!Constants)
+    return nullptr;
+  Prog->Constants.reserve(Header->Constants.Count);
+  for (uint64_t I = 0; I != Header->Constants.Count; ++I) {
+    const ConstantRecord &Record = Constants[I];
+    std::string Str;
+    switch (Record.Type) {
+    default:          return nullptr;
+    case VoidType:    Prog->Constants.emplace_back(); break;
+    case IntType:     Prog->Constants.emplace_back(Record.IntVal); break;
+    case BoolType:    Prog->Constants.emplace_back(Record.IntVal != 0); break;
+    case DoubleType:  Prog->Constants.emplace_back(Record.DoubleVal); break;
+    case StringType:
+      if (!Reader.getString(Record.Str, Str))
+        return nullptr;
+      Prog->Constants.emplace_back(std::move(Str));
+      break;
+    }
+  }
+
+  const Section *Names = Reader.get<Section>(Header->Names);
+  if (!Names)
+    return nullptr;
+  Prog->Names.resize(Header->Names.Count);
+  for (uint64_t I = 0; I != Header->Names.Count; ++I)
+    if (!Reader.getString(Names[I], Prog->Names[I]))
+      return nullptr;
+
+  const Section *Scopes = Reader.get<Section>(Header->Scopes);
+  if (!Scopes)
+    return nullptr;
+  Prog->Scopes.resize(Header->Scopes.Count);
+  for (uint64_t I = 0; I != Header->Scopes.Count; ++I) {
+    const int32_t *Slots = Reader.get<int32_t>(Scopes[I]);
+    if (!Slots)
+      return nullptr;
+    for (uint64_t J = 0; J != Scopes[I].Count; ++J)
+      if (!isValidName(Slots[J], *Header))
+        return nullptr;
+    Prog->Scopes[I].assign(Slots, Slots + Scopes[I].Count);
+  }
+
+  // Native functions are linked again, by name.
+  std::map<std::string, NativeFunctionInfo> NativeFunctionMap;
+  addNativeFunctions(NativeFunctionMap);
+  const Section *NativeNames = Reader.get<Section>(Header->NativeNames);
+  if (!NativeNames)
+    return nullptr;
+  for (uint64_t I = 0; I != Header->NativeNames.Count; ++I) {
+    std::string Name;
+    if (!Reader.getString(NativeNames[I], Name))
+      return nullptr;
+    auto It = NativeFunctionMap.find(Name);
+    if (It == NativeFunctionMap.end())
+      return nullptr;
+    Prog->Natives.push_back(It->second.Function);
+    Prog->NativeNames.push_back(std::move(Name));
+  }
+
+  const FunctionRecord *Functions =
+      Reader.get<FunctionRecord>(Header->Functions);
+  if (!Functions || Header->Functions.Count == 0)
+    return nullptr;
+  Prog->Functions.reserve(Header->Functions.Count);
+  for (uint64_t I = 0; I != Header->Functions.Count; ++I) {
+    const FunctionRecord &Record = Functions[I];
+    std::string Name;
+    if (Record.Kind > CodeObject::InfixOpCode ||
+        !isValidType(Record.ReturnType) || !Reader.getString(Record.Name, Name))
+      return nullptr;
+    if (Record.Scope < 0 ||
+        static_cast<uint64_t>(Record.Scope) >= Header->Scopes.Count)
+      return nullptr;
+
+    Prog->Functions.emplace_back(
+        static_cast<CodeObject::CodeKind>(Record.Kind), Name,
+        static_cast<BasicType>(Record.ReturnType));
+    CodeObject &Code = Prog->Functions.back();
+    Code.Scope = Record.Scope;
+
+    const ParameterRecord *Parameters =
+        Reader.get<ParameterRecord>(Record.Parameters);
+    if (!Parameters)
+      return nullptr;
+    for (uint64_t J = 0; J != Record.Parameters.Count; ++J) {
+      if (!isValidName(Parameters[J].Name, *Header) ||
+          !isValidType(Parameters[J].Type))
+        return nullptr;
+      Code.Parameters.emplace_back(
+          Parameters[J].Name, static_cast<BasicType>(Parameters[J].Type));
+    }
+
+    const Instruction *Instructions = Reader.get<Instruction>(Record.Code);
+    const uint32_t *Lines = Reader.get<uint32_t>(Record.Lines,
+                                                 Record.Code.Count);
+    if (!Instructions || !Lines || Record.Code.Count == 0)
+      return nullptr;
+    Code.MappedCode = Instructions;
+    Code.MappedLines = Lines;
+    Code.MappedSize = Record.Code.Count;
+  }
+
+  if (!Prog->Functions.front().isTopLevel() ||
+      (Prog->MainIndex != -1 &&
+       (Prog->MainIndex <= 0 ||
+        static_cast<uint64_t>(Prog->MainIndex) >= Header->Functions.Count)))
+    return nullptr;
+
+  size_t MaxSlots = 0;
+  for (const std::vector<int32_t> &Scope : Prog->Scopes)
+    MaxSlots = std::max(MaxSlots, Scope.size());
+  for (size_t I = 0; I != Prog->Functions.size(); ++I)
+    if (!isValidCode(*Prog, I, MaxSlots))
+      return nullptr;
+  return Prog;
+}
+
+std::string ProgramFile::getCachePath(uint64_t SourceHash) {
+#if defined(__APPLE__) || defined(__linux__)
+  std::string Dir;
+  const char *Env;
+  if ((Env = std::getenv("CMM_CACHE_DIR")))
+    Dir = Env;
+  else if ((Env = std::getenv("XDG_CACHE_HOME")) && *Env)
+    Dir = std::string(Env) + "/cmm";
+  else if ((Env = std::getenv("HOME")) && *Env)
+    Dir = std::string(Env) + "/.cache/cmm";
+  if (Dir.empty())
+    return std::string();
+
+  // Create the directory and those leading to it.
+  for (size_t Pos = Dir.find('/', 1); ; Pos = Dir.find('/', Pos + 1)) {
+    std::string Prefix = Dir.substr(0, Pos);
+    if (::mkdir(Prefix.c_str(), 0777) != 0 && errno != EEXIST)
+      return std::string();
+    if (Pos == std::string::npos)
+      break;
+  }
+
+  char Name[32];
+  std::snprintf(Name, sizeof(Name), "/%016llx.cmmc",
+                static_cast<unsigned long long>(SourceHash));
+  return Dir + Name;
+#else
+  (void)SourceHash;
+  return std::string();
+#endif // defined(__APPLE__) || defined(__linux__)
+}
+
+std::unique_ptr<Program> ProgramFile::load(const std::string &Path,
+                                           uint64_t SourceHash,
+                                           uint64_t SourceSize) {
+  std::shared_ptr<FileContent> Content = std::make_shared<FileContent>(Path);
+  uint64_t Hash, Size;
+  std::unique_ptr<Program> Prog =
+      read(Content->data(), Content->size(), Hash, Size);
+  if (!Prog || Hash != SourceHash || Size != SourceSize)
+    return nullptr;
+  Prog->Image = Content;
+  return Prog;
+}
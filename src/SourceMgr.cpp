@@ -1,7 +1,16 @@
 #include "SourceMgr.h"
 #include <iostream>
+#include <fstream>
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+
+#if defined(__APPLE__) || defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace cmm;
 
@@ -28,43 +37,106 @@ void SourceMgr::dumpError(LocTy L, ErrorKind K,
 }
 
 SourceMgr::SourceMgr(const std::string &SourcePath, bool DumpInstantly)
-  : SourceStream(SourcePath), CurrentLoc(0), DumpInstantly(DumpInstantly) {
+  : CurrentLoc(0), DumpInstantly(DumpInstantly) {
 
-  if (SourceStream.fail()) {
+  if (!mapFile(SourcePath) && !readFile(SourcePath)) {
     std::cerr << "Fatal Error: Cannot open file '" << SourcePath
               << "', exited." << std::endl;
     std::exit(EXIT_FAILURE);
   }
+}
 
-  SourceStream.seekg(0, SourceStream.end);
-  SourceContent.reserve(SourceStream.tellg());
-  SourceStream.seekg(0, SourceStream.beg);
-  LineNoOffsets.reserve(ReservedLineNo);
-  LineNoOffsets.emplace_back(std::streampos(0));
+SourceMgr::~SourceMgr() {
+#if defined(__APPLE__) || defined(__linux__)
+  if (Mapped)
+    ::munmap(const_cast<char *>(Content), ContentSize);
+#endif // defined(__APPLE__) || defined(__linux__)
+}
 
-  int CurChar;
-  size_t Index;
-  for (size_t Offset = 0; (CurChar = SourceStream.get()) !=
-       std::char_traits<char>::eof(); ++Offset) {
-    SourceContent.push_back(static_cast<char>(CurChar));
+/// \brief Map a regular file into memory read-only. Return false if it's not
+/// a regular file or can't be mapped.
+bool SourceMgr::mapFile(const std::string &SourcePath) {
+#if defined(__APPLE__) || defined(__linux__)
+  int FD = ::open(SourcePath.c_str(), O_RDONLY);
+  if (FD < 0)
+    return false;
+
+  struct stat Stat;
+  if (::fstat(FD, &Stat) != 0 || !S_ISREG(Stat.st_mode)) {
+    ::close(FD);
+    return false;
+  }
 
-    if (CurChar == '\n')
-      LineNoOffsets.push_back(Offset);
+  // An empty file can't be mapped, and needs no content anyway.
+  if (Stat.st_size == 0) {
+    ::close(FD);
+    return true;
   }
 
-  SourceStream.close();
+  size_t Size = static_cast<size_t>(Stat.st_size);
+  void *Addr = ::mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, FD, 0);
+  ::close(FD);
+  if (Addr == MAP_FAILED)
+    return false;
+
+  Content = static_cast<const char *>(Addr);
+  ContentSize = Size;
+  Mapped = true;
+  return true;
+#else
+  (void)SourcePath;
+  return false;
+#endif // defined(__APPLE__) || defined(__linux__)
+}
+
+/// \brief Read the whole file into Buffer, for pipes and the like. Return
+/// false if it's a directory or can't be read to the end.
+bool SourceMgr::readFile(const std::string &SourcePath) {
+#if defined(__APPLE__) || defined(__linux__)
+  // A directory opens as a stream that just reads nothing.
+  struct stat Stat;
+  if (::stat(SourcePath.c_str(), &Stat) != 0 || S_ISDIR(Stat.st_mode))
+    return false;
+#endif // defined(__APPLE__) || defined(__linux__)
+
+  std::ifstream SourceStream(SourcePath, std::ios::binary);
+  if (SourceStream.fail())
+    return false;
+
+  char Chunk[64 * 1024];
+  while (SourceStream.read(Chunk, sizeof(Chunk)) || SourceStream.gcount())
+    Buffer.append(Chunk, static_cast<size_t>(SourceStream.gcount()));
+  if (SourceStream.bad() || !SourceStream.eof())
+    return false;
+
+  Content = Buffer.data();
+  ContentSize = Buffer.size();
+  return true;
+}
+
+/// \brief Record where the lines are. memchr() is vectorized by the C
+/// library, so this is much faster than looking at each character.
+void SourceMgr::computeLineNoOffsets() const {
+  LineNoOffsets.push_back(0);
+  const char *End = Content + ContentSize;
+  for (const char *P = Content; P != End; ++P) {
+    P = static_cast<const char *>(std::memchr(P, '\n', End - P));
+    if (!P)
+      break;
+    LineNoOffsets.push_back(static_cast<LocTy>(P - Content));
+  }
 }
 
 int SourceMgr::get() {
-  if (CurrentLoc == SourceContent.size())
+  if (CurrentLoc == ContentSize)
     return std::char_traits<char>::eof();
-  return SourceContent[CurrentLoc++];
+  return Content[CurrentLoc++];
 }
 
 int SourceMgr::peek() {
-  if (CurrentLoc == SourceContent.size())
+  if (CurrentLoc == ContentSize)
     return std::char_traits<char>::eof();
-  return SourceContent[CurrentLoc];
+  return Content[CurrentLoc];
 }
 
 void SourceMgr::unget() {
@@ -73,6 +145,7 @@ void SourceMgr::unget() {
 }
 
 void SourceMgr::Error(LocTy L, const std::string &Msg) {
+  ++DiagnosticCount;
   if (DumpInstantly)
     dumpError(L, ErrorKind::Error, Msg);
   else
@@ -84,6 +157,7 @@ void SourceMgr::Error(const std::string &Msg) {
 }
 
 void SourceMgr::Warning(LocTy L, const std::string &Msg) {
+  ++DiagnosticCount;
   if (DumpInstantly)
     dumpError(L, ErrorKind::Warning, Msg);
   else
@@ -95,7 +169,9 @@ void SourceMgr::Warning(const std::string &Msg) {
 }
 
 std::pair<size_t, size_t> SourceMgr::getLineColByLoc(LocTy L) const {
-  //std::cout << L << std::endl;
+  if (LineNoOffsets.empty())
+    computeLineNoOffsets();
+
   auto It = std::upper_bound(LineNoOffsets.cbegin(), LineNoOffsets.cend(), L);
   assert(It > LineNoOffsets.begin() && It <= LineNoOffsets.end() && 
          "getLineColByLoc: iterator out of bound");
@@ -0,0 +1,488 @@
+#include "VirtualMachine.h"
+#include "CMMRuntime.h"
+
+using namespace cvm;
+using cmm::Atom;
+using cmm::CMMRuntime;
+
+/// \brief Return the operator an instruction of a binary operator does.
+static cmm::BinaryOperatorAST::OperatorKind getBinaryOperator(OpCode Op) {
+  using cmm::BinaryOperatorAST;
+  switch (Op) {
+  default:
+    CMMRuntime::error("unknown binary operator (code: " +
+        std::to_string(Op) + ")");
+  case Add:           return BinaryOperatorAST::Add;
+  case Sub:           return BinaryOperatorAST::Minus;
+  case Mul:           return BinaryOperatorAST::Multiply;
+  case Div:           return BinaryOperatorAST::Division;
+  case Mod:           return BinaryOperatorAST::Modulo;
+  case Less:          return BinaryOperatorAST::Less;
+  case LessEqual:     return BinaryOperatorAST::LessEqual;
+  case Equal:         return BinaryOperatorAST::Equal;
+  case NotEqual:      return BinaryOperatorAST::NotEqual;
+  case Greater:       return BinaryOperatorAST::Greater;
+  case GreaterEqual:  return BinaryOperatorAST::GreaterEqual;
+  case BitAnd:        return BinaryOperatorAST::BitwiseAnd;
+  case BitOr:         return BinaryOperatorAST::BitwiseOr;
+  case BitXor:        return BinaryOperatorAST::BitwiseXor;
+  case Shl:           return BinaryOperatorAST::LeftShift;
+  case Shr:           return BinaryOperatorAST::RightShift;
+  }
+}
+
+/// \brief Return the operator an instruction of a unary operator does.
+static cmm::UnaryOperatorAST::OperatorKind getUnaryOperator(OpCode Op) {
+  using cmm::UnaryOperatorAST;
+  switch (Op) {
+  default:
+    CMMRuntime::error("unknown unary operator (code: " +
+        std::to_string(Op) + ")");
+  case Pos:     return UnaryOperatorAST::Plus;
+  case Neg:     return UnaryOperatorAST::Minus;
+  case Not:     return UnaryOperatorAST::LogicalNot;
+  case BitNot:  return UnaryOperatorAST::BitwiseNot;
+  }
+}
+
+
+VirtualMachine::VirtualMachine(const Program &Prog, size_t MaxStack)
+    : Prog(Prog), MaxStack(MaxStack) {
+  const std::vector<int32_t> &Names = Prog.Scopes[Prog.Functions.front().Scope];
+  TopLevelEnv.Names = &Names;
+  TopLevelEnv.Size = Names.size();
+  TopLevelEnv.Vars = Slots.allocate(TopLevelEnv.Size, TopLevelEnv.Mark);
+}
+
+int VirtualMachine::run(int Argc, char *Argv[]) {
+  // First run top level statements.
+  FrameStack.emplace_back(&Prog.Functions.front(), &TopLevelEnv,
+                          ScopeDepth);
+  execute();
+
+  BasicValue Res = std::move(Stack.back());
+  Stack.pop_back();
+  if (ExplicitReturn)
+    return CMMRuntime::exitCode(Res);
+
+  // Invoke main function is there is one
+  if (Prog.MainIndex < 0)
+    return 0;
+
+  const CodeObject &Main = Prog.Functions[Prog.MainIndex];
+  size_t ArgCount = 0;
+  if (!Main.Parameters.empty()) {
+    Stack.push_back(CMMRuntime::makeArguments(Argc, Argv));
+    ArgCount = 1;
+  }
+
+  enterFunction(Main, ArgCount, &TopLevelEnv);
+  execute();
+  return Stack.back().toInt();
+}
+
+/// \brief Run the frame on top of the frame stack until it returns. Its
+/// return value is left on the operand stack.
+void VirtualMachine::execute() {
+  const size_t EntryDepth = FrameStack.size();
+  Frame *F = &FrameStack.back();
+  const Instruction *Code = F->Code->getCode();
+  const Instruction *PC = F->PC;
+
+  for (;;) {
+    const Instruction &I = *PC++;
+
+    switch (I.Op) {
+    default:
+      CMMRuntime::error("bad instruction (code: " + std::to_string(I.Op) +
+          ")");
+
+    case Nop:
+      break;
+
+    case PushConst:
+      Stack.push_back(Prog.Constants[I.A]);
+      break;
+
+    case Pop:
+      Stack.pop_back();
+      break;
+
+    case PopResult:
+      F->Result = std::move(Stack.back());
+      Stack.pop_back();
+      break;
+
+    case ClearResult:
+      F->Result = BasicValue();
+      break;
+
+    case LoadLocal:
+      Stack.push_back(localVariable(F->Env, I.Aux, I.A));
+      break;
+
+    case AddrLocal:
+      RefStack.emplace_back(localVariable(F->Env, I.Aux, I.A));
+      break;
+
+    case LoadGlobal:
+      Stack.push_back(globalVariable(F->Env, I.Aux, I.A));
+      break;
+
+    case AddrGlobal:
+      RefStack.emplace_back(globalVariable(F->Env, I.Aux, I.A));
+      break;
+
+    case LoadVar:
+      Stack.push_back(searchVariable(F->Env, I.A));
+      break;
+
+    case AddrVar:
+      RefStack.emplace_back(searchVariable(F->Env, I.A));
+      break;
+
+    case AddrIndex:
+      RefStack.back() = indexArray(RefStack.back(), Stack.back());
+      Stack.pop_back();
+      break;
+
+    case LoadRef:
+      Stack.push_back(RefStack.back().get());
+      RefStack.pop_back();
+      break;
+
+    case StoreRef: {
+      ValueRef Ref = RefStack.back();
+      assign(Ref, Stack.back());
+      if (I.Aux) {
+        Stack.pop_back();
+      } else {
+        RefStack.pop_back();
+        Stack.back() = Ref.get();
+      }
+      break;
+    }
+
+    case DeclareVar:
+      declareVariable(F->Env, I.A, I.Aux);
+      break;
+
+    case DeclareArray:
+      declareArray(F->Env, I.A, I.Aux);
+      break;
+
+    case EnterScope:
+      F->Env = enterScope(F->Env, I.A);
+      break;
+
+    case LeaveScope:
+      for (uint16_t N = 0; N < I.Aux; ++N)
+        F->Env = F->Env->OuterEnv;
+      leaveScope(I.Aux);
+      break;
+
+    case ClearSlots:
+      for (uint16_t N = 0; N < I.Aux; ++N)
+        F->Env->Vars[I.A + N] = Variable();
+      break;
+
+    case Jump:
+      PC = Code + I.A;
+      break;
+
+    case JumpIfFalse:
+      if (!Stack.back().toBool())
+        PC = Code + I.A;
+      Stack.pop_back();
+      break;
+
+    case JumpIfTrue:
+      if (Stack.back().toBool())
+        PC = Code + I.A;
+      Stack.pop_back();
+      break;
+
+    case ToBool:
+      Stack.back() = Stack.back().toBool();
+      break;
+
+    case Add: case Sub: case Mul: case Div: case Mod:
+    case Less: case LessEqual: case Equal: case NotEqual:
+    case Greater: case GreaterEqual:
+    case BitAnd: case BitOr: case BitXor: case Shl: case Shr: {
+      BasicValue &LHS = Stack[Stack.size() - 2];
+      const BasicValue &RHS = Stack.back();
+
+      // Fast path for the most common case: int op int.
+      if (LHS.Type == IntType && RHS.Type == IntType &&
+          !LHS.isArray() && !RHS.isArray()) {
+        int L = LHS.IntVal, R = RHS.IntVal;
+        bool Handled = true;
+        switch (I.Op) {
+        default:            Handled = false; break;
+        case Add:           LHS.IntVal = CMMRuntime::add(L, R); break;
+        case Sub:           LHS.IntVal = CMMRuntime::subtract(L, R); break;
+        case Mul:           LHS.IntVal = CMMRuntime::multiply(L, R); break;
+        case Less:          LHS = L < R; break;
+        case LessEqual:     LHS = L <= R; break;
+        case Equal:         LHS = L == R; break;
+        case NotEqual:      LHS = L != R; break;
+        case Greater:       LHS = L > R; break;
+        case GreaterEqual:  LHS = L >= R; break;
+        }
+        if (Handled) {
+          Stack.pop_back();
+          break;
+        }
+      }
+
+      LHS = CMMRuntime::binaryOp(getBinaryOperator(I.Op), LHS, RHS);
+      Stack.pop_back();
+      break;
+    }
+
+    case Pos: case Neg: case Not: case BitNot:
+      Stack.back() = CMMRuntime::unaryOp(getUnaryOperator(I.Op),
+                                         Stack.back());
+      break;
+
+    case Call:
+    case CallDynamic:
+    case CallInfix:
+      F->PC = PC;
+      enterFunction(Prog.Functions[I.A], I.Aux,
+                    I.Op == CallDynamic ? F->Env : &TopLevelEnv);
+      F = &FrameStack.back();
+      Code = F->Code->getCode();
+      PC = F->PC;
+      break;
+
+    case TailCall:
+      tailCall(I.Aux & TailArgCountMask, I.Aux & TailReturned);
+      PC = Code;
+      break;
+
+    case CallNative: {
+      // Arguments are passed in place on the stack.
+      size_t Base = Stack.size() - I.Aux;
+      BasicValue Res = Prog.Natives[I.A](ValueSpan(Stack.data() + Base, I.Aux));
+      Stack.resize(Base);
+      Stack.push_back(std::move(Res));
+      break;
+    }
+
+    case Return:
+    case ReturnDefault:
+      leaveFunction(I.Op == Return);
+      if (FrameStack.size() < EntryDepth)
+        return;
+      F = &FrameStack.back();
+      Code = F->Code->getCode();
+      PC = F->PC;
+      break;
+
+    case Error:
+      CMMRuntime::error(Prog.Constants[I.A].getString());
+    }
+  }
+}
+
+/// \brief Push a frame calling a function. The frame on top, if any, has
+/// its PC past the call.
+void VirtualMachine::enterFunction(const CodeObject &Function,
+                                   size_t ArgCount, VariableEnv *OuterEnv) {
+  // Frames of top level code or main don't count.
+  if (FrameStack.size() > MaxStack) {
+    const Frame &Caller = FrameStack.back();
+    size_t At = Caller.PC - Caller.Code->getCode() - 1;
+    CMMRuntime::stackOverflow(Caller.Code->getLine(At));
+  }
+
+  size_t ScopeBase = ScopeDepth;
+  VariableEnv *FuncEnv = enterScope(OuterEnv, Function.Scope);
+  bindArguments(Function, ArgCount, FuncEnv);
+  FrameStack.emplace_back(&Function, FuncEnv, ScopeBase);
+}
+
+/// \brief Pop the arguments of a call into the parameters of the function.
+void VirtualMachine::bindArguments(const CodeObject &Function,
+                                   size_t ArgCount, VariableEnv *FuncEnv) {
+  if (ArgCount != Function.Parameters.size())
+    CMMRuntime::badArgumentCount(Function.Name, Function.Parameters.size(),
+                                 ArgCount);
+
+  // Parameters take the first slots in order.
+  auto Arg = Stack.end() - ArgCount;
+  Variable *Param = FuncEnv->Vars;
+  for (const auto &P : Function.Parameters) {
+    BasicType Type = P.second;
+    // Operands of infix operators are untyped.
+    if (!Function.isInfixOp() && Arg->Type != Type) {
+      if (Arg->isInt() && Type == DoubleType) {
+        Arg->promoteToDouble();
+      } else {
+        CMMRuntime::badArgument(*Arg, Type, Function.Name,
+            P.first < 0 ? Atom() : Atom(Prog.Names[P.first]));
+      }
+    }
+
+    if (P.first >= 0) { // We allow empty parameter name.
+      Param->Value = std::move(*Arg);
+      Param->Declared = true;
+    }
+    ++Arg;
+    ++Param;
+  }
+  Stack.resize(Stack.size() - ArgCount);
+}
+
+/// \brief Call the function of the frame on top again in the same frame,
+/// whose scope is cleared. The callee sees top level variables even if the
+/// caller is dynamic bound.
+void VirtualMachine::tailCall(size_t ArgCount, bool Returned) {
+  Frame &F = FrameStack.back();
+  leaveScope(ScopeDepth - F.ScopeBase - 1);
+  F.Env->OuterEnv = &TopLevelEnv;
+  for (size_t Slot = 0; Slot < F.Env->Size; ++Slot)
+    F.Env->Vars[Slot] = Variable();
+  bindArguments(*F.Code, ArgCount, F.Env);
+  F.Result = BasicValue();
+  F.Returned |= Returned;
+}
+
+void VirtualMachine::leaveFunction(bool Explicit) {
+  Frame &F = FrameStack.back();
+  const CodeObject &Function = *F.Code;
+
+  if (Function.isInfixOp()) {
+    if (F.Result.isVoid())
+      CMMRuntime::noInfixResult();
+  } else if (!Function.isTopLevel() && (Explicit || F.Returned)) {
+    CMMRuntime::checkReturnValue(F.Result, Function.ReturnType,
+                                 Function.Name);
+  }
+
+  leaveScope(ScopeDepth - F.ScopeBase);
+  Stack.push_back(std::move(F.Result));
+  ExplicitReturn = Explicit;
+  FrameStack.pop_back();
+}
+
+VirtualMachine::VariableEnv *VirtualMachine::enterScope(VariableEnv *OuterEnv,
+                                                       int32_t Scope) {
+  if (ScopeDepth == ScopeStack.size())
+    ScopeStack.emplace_back();
+  VariableEnv &Env = ScopeStack[ScopeDepth++];
+  Env.OuterEnv = OuterEnv;
+  Env.Names = &Prog.Scopes[Scope];
+  Env.Size = Env.Names->size();
+  Env.Vars = Slots.allocate(Env.Size, Env.Mark);
+  return &Env;
+}
+
+void VirtualMachine::leaveScope(size_t Count) {
+  for (size_t N = 0; N < Count; ++N) {
+    VariableEnv &Env = ScopeStack[--ScopeDepth];
+    Slots.release(Env.Vars, Env.Size, Env.Mark);
+  }
+}
+
+/// \brief Return the variable in a slot of the scope Depth levels out.
+/// Search by name if it is not declared yet.
+BasicValue &VirtualMachine::localVariable(VariableEnv *Env, uint16_t Depth,
+                                          int32_t Slot) {
+  VariableEnv *E = Env;
+  for (uint16_t N = Depth; N != 0; --N)
+    E = E->OuterEnv;
+
+  Variable &Var = E->Vars[Slot];
+  if (Var.Declared)
+    return Var.Value;
+  return searchVariable(Env, (*E->Names)[Slot]);
+}
+
+/// \brief Return a top level variable referred to in a function. Search by
+/// name if the function is dynamic bound or it is not declared yet.
+BasicValue &VirtualMachine::globalVariable(VariableEnv *Env, uint16_t Depth,
+                                           int32_t Slot) {
+  VariableEnv *E = Env;
+  for (uint16_t N = Depth; N != 0; --N)
+    E = E->OuterEnv;
+
+  if (E == &TopLevelEnv && E->Vars[Slot].Declared)
+    return E->Vars[Slot].Value;
+  return searchVariable(Env, (*TopLevelEnv.Names)[Slot]);
+}
+
+BasicValue &VirtualMachine::searchVariable(VariableEnv *Env, int32_t Name) {
+  // Search backward for the innermost variable, as in CMMInterpreter.
+  for (VariableEnv *E = Env; E != nullptr; E = E->OuterEnv) {
+    for (size_t Slot = E->Size; Slot-- != 0; ) {
+      if (E->Vars[Slot].Declared && (*E->Names)[Slot] == Name)
+        return E->Vars[Slot].Value;
+    }
+  }
+  CMMRuntime::undefinedVariable(Prog.Names[Name]);
+}
+
+void VirtualMachine::declareVariable(VariableEnv *Env, int32_t Slot,
+                                     uint16_t Flags) {
+  const std::string &Id = Prog.Names[(*Env->Names)[Slot]];
+  BasicType Type = static_cast<BasicType>(Flags & DeclTypeMask);
+  Variable &Var = Env->Vars[Slot];
+
+  if (!(Flags & DeclNoCheck) && Var.Declared)
+    CMMRuntime::redeclared(Id);
+
+  if (!(Flags & DeclHasInit)) {
+    Var.Value = BasicValue(Type);
+    Var.Declared = true;
+    return;
+  }
+
+  BasicValue &Val = Stack.back();
+  if (Val.Type != Type) {
+    if (Type == DoubleType && Val.isInt()) {
+      Val.promoteToDouble();
+    } else {
+      CMMRuntime::badInitializer(Id, Type, Val);
+    }
+  }
+  // An array keeps its value even if it has an initializer.
+  if (!Var.Declared) {
+    Var.Value = std::move(Val);
+    Var.Declared = true;
+  }
+  Stack.pop_back();
+}
+
+void VirtualMachine::declareArray(VariableEnv *Env, int32_t Slot,
+                                  uint16_t Flags) {
+  const std::string &Id = Prog.Names[(*Env->Names)[Slot]];
+  BasicType Type = static_cast<BasicType>(Flags & DeclTypeMask);
+  size_t DimensionCount = Flags >> 8;
+  Variable &Var = Env->Vars[Slot];
+
+  if (Var.Declared)
+    CMMRuntime::redeclared(Id);
+
+  std::list<int> DimensionList;
+  for (auto It = Stack.end() - DimensionCount; It != Stack.end(); ++It) {
+    if (!It->isInt() || It->IntVal <= 0)
+      CMMRuntime::badDimension(Id, *It);
+    DimensionList.push_back(It->IntVal);
+  }
+  Stack.resize(Stack.size() - DimensionCount);
+
+  Var.Value = BasicValue(Type, DimensionList);
+  Var.Declared = true;
+}
+
+ValueRef VirtualMachine::indexArray(const ValueRef &Base,
+                                   const BasicValue &Index) {
+  return CMMRuntime::index(CMMRuntime::getArrayView(Base), Index);
+}
+
+void VirtualMachine::assign(const ValueRef &Variable, const BasicValue &Value) {
+  CMMRuntime::assign(Variable, Value, false);
+}
@@ -11,7 +11,22 @@
 #include <cstring>
 #include "CMMLexer.h"
 #include "CMMParser.h"
+#include "CMMResolver.h"
+#include "CMMConstantPropagator.h"
+#include "CMMTypeChecker.h"
+#include "CMMInliner.h"
 #include "CMMInterpreter.h"
+#include "CMMCompiler.h"
+#include "CMMTranspiler.h"
+#include "VirtualMachine.h"
+#include "ProgramFile.h"
+#include "GarbageCollector.h"
+#include "OutputBuffer.h"
+
+enum EngineKind { ASTEngine, VMEngine };
+
+/// Maximum depth of nested calls by default.
+static const size_t DefaultMaxStack = 100000;
 
 static void Error(const char *Name, const char *Msg);
 
@@ -19,8 +34,19 @@ static void Usage(const char *Name);
 static int DumpFile(cmm::SourceMgr &SrcMgr);
 static int AsLexInput(cmm::SourceMgr &SrcMgr);
 static int Interpret(cmm::SourceMgr &SrcMgr, int Argc, char **Argv,
-                     bool Verbose = false);
+                     EngineKind Engine, size_t MaxStack, bool Jit,
+                     bool UseCache, bool Verbose = false);
+static int RunProgram(const cvm::Program &Prog, int Argc, char **Argv,
+                      size_t MaxStack, bool Verbose);
 static int DumpAST(cmm::SourceMgr &SrcMgr);
+static int EmitCpp(cmm::SourceMgr &SrcMgr, const char *Input,
+                   size_t MaxStack);
+static int Analyze(cmm::SourceMgr &SrcMgr, cmm::CMMParser &Parser);
+static std::unique_ptr<cvm::Program> Compile(cmm::SourceMgr &SrcMgr,
+                                             bool Verbose, int &Err);
+static int CompileFile(cmm::SourceMgr &SrcMgr, const char *Input,
+                       const char *Output);
+static void DumpGCStatistics();
 
 static bool EqualOneOf(const char *S, const char *S1) {
   return !std::strcmp(S, S1);
@@ -33,10 +59,16 @@ static bool EqualOneOf(const char *S, const char *S1, Tn... Sn) {
 int main(int argc, char *argv[])
 {
   enum ActionKind {
-    DefaultAct, LexAct, ParseAct, DebugAct, DumpFileAct
+    DefaultAct, LexAct, ParseAct, DebugAct, DumpFileAct, EmitCppAct,
+    CompileAct
   } Action = DefaultAct;
+  EngineKind Engine = ASTEngine;
+  size_t MaxStack = DefaultMaxStack;
+  bool Jit = false;
+  bool UseCache = true;
   const char *ProgName = argv[0];
   const char *Input = nullptr;
+  const char *Output = nullptr;
   int Index;
   int Res;
 
@@ -45,6 +77,48 @@ int main(int argc, char *argv[])
 
   for (Index = 1; Index < argc; ++Index) {
     if (argv[Index][0] == '-') {
+      if (!std::strncmp(argv[Index], "--engine=", 9)) {
+        const char *Name = argv[Index] + 9;
+        if (EqualOneOf(Name, "ast"))
+          Engine = ASTEngine;
+        else if (EqualOneOf(Name, "vm"))
+          Engine = VMEngine;
+        else
+          Error(ProgName, "unknown engine, expect `ast' or `vm'");
+        continue;
+      }
+
+      if (!std::strncmp(argv[Index], "--max-stack=", 12)) {
+        char *End;
+        long long N = std::strtoll(argv[Index] + 12, &End, 10);
+        if (End == argv[Index] + 12 || *End || N <= 0)
+          Error(ProgName, "invalid stack depth, expect a positive integer");
+        MaxStack = static_cast<size_t>(N);
+        continue;
+      }
+
+      if (EqualOneOf(argv[Index], "--jit")) {
+        Jit = true;
+        continue;
+      }
+
+      if (EqualOneOf(argv[Index], "--gc-stats")) {
+        std::atexit(DumpGCStatistics);
+        continue;
+      }
+
+      if (EqualOneOf(argv[Index], "--no-cache")) {
+        UseCache = false;
+        continue;
+      }
+
+      if (EqualOneOf(argv[Index], "-o")) {
+        if (++Index == argc)
+          Error(ProgName, "no output file after `-o'");
+        Output = argv[Index];
+        continue;
+      }
+
       if (Action != DefaultAct)
         Error(ProgName, "too many options");
 
@@ -68,6 +142,16 @@ int main(int argc, char *argv[])
         continue;
       }
 
+      if (EqualOneOf(argv[Index], "--emit-cpp")) {
+        Action = EmitCppAct;
+        continue;
+      }
+
+      if (EqualOneOf(argv[Index], "-c", "--compile")) {
+        Action = CompileAct;
+        continue;
+      }
+
       if (EqualOneOf(argv[Index], "-h", "-H", "-help", "--help")) {
         Usage(ProgName);
         std::exit(EXIT_SUCCESS);
@@ -84,17 +168,56 @@ int main(int argc, char *argv[])
 
   if (!Input)
     Error(ProgName, "no input file");
+  if (Jit && Engine != ASTEngine)
+    Error(ProgName, "`--jit' works with the `ast' engine only");
+
+  // The output file may also follow the input file, as in
+  // `cmm --compile foo.cmm -o foo.cmmc'.
+  if (Action == CompileAct && argc - Index == 2 &&
+      EqualOneOf(argv[Index], "-o")) {
+    Output = argv[Index + 1];
+    Index = argc;
+  }
+  if (Action == CompileAct && Index != argc)
+    Error(ProgName, "too many arguments");
+  if (Output && Action != CompileAct)
+    Error(ProgName, "`-o' works with `--compile' only");
 
   cmm::SourceMgr SrcMgr(Input);
 
+  // A compiled program runs on the virtual machine, and nothing else can be
+  // done with it.
+  if (cvm::ProgramFile::isProgramFile(SrcMgr.getBuffer(),
+                                      SrcMgr.getBufferSize())) {
+    if (Action != DefaultAct && Action != DebugAct)
+      Error(ProgName, "the input file is a compiled program");
+    if (Jit)
+      Error(ProgName, "`--jit' works with the `ast' engine only");
+
+    uint64_t SourceHash, SourceSize;
+    std::unique_ptr<cvm::Program> Prog =
+        cvm::ProgramFile::read(SrcMgr.getBuffer(), SrcMgr.getBufferSize(),
+                               SourceHash, SourceSize);
+    if (!Prog) {
+      std::cerr << "Fatal Error: '" << Input
+                << "' is not compiled by this version of cmm, exited."
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    return RunProgram(*Prog, argc - Index, argv + Index, MaxStack,
+                      Action == DebugAct);
+  }
+
   switch (Action) {
   default:
     Res = EXIT_FAILURE;
+    break;
   case DumpFileAct:
     Res = DumpFile(SrcMgr);
     break;
   case DefaultAct:
-    Res = Interpret(SrcMgr, argc - Index, argv + Index);
+    Res = Interpret(SrcMgr, argc - Index, argv + Index, Engine, MaxStack,
+                    Jit, UseCache);
     break;
   case LexAct:
     Res = AsLexInput(SrcMgr);
@@ -103,7 +226,14 @@ int main(int argc, char *argv[])
     Res = DumpAST(SrcMgr);
     break;
   case DebugAct:
-    Res = Interpret(SrcMgr, argc - Index, argv + Index, true);
+    Res = Interpret(SrcMgr, argc - Index, argv + Index, Engine, MaxStack,
+                    Jit, UseCache, true);
+    break;
+  case EmitCppAct:
+    Res = EmitCpp(SrcMgr, Input, MaxStack);
+    break;
+  case CompileAct:
+    Res = CompileFile(SrcMgr, Input, Output);
     break;
   }
 
@@ -125,10 +255,28 @@ void Usage(const char *Name) {
          "  -f  --file       dump a file and exit (for debugging)\n"
          "  -l  --lex        lex tokens from a CMM source code file\n"
          "  -p  --parse      parse a CMM source code file and dump AST\n"
-         "  -d  --debug      interpret a file with extra information dumped\n\n"
+         "  -d  --debug      interpret a file with extra information dumped\n"
+         "  -c  --compile    compile a file to bytecode and save it, foo.cmm\n"
+         "                   as foo.cmmc unless `-o FILE' is given\n"
+         "      --engine=E   execute with engine E: `ast' walks the syntax tree\n"
+         "                   (default), `vm' runs compiled bytecode, cached\n"
+         "                   by the hash of the source\n"
+         "      --no-cache   neither use nor save the bytecode cached\n"
+         "      --max-stack=N\n"
+         "                   allow calls to nest N deep (default 100000)\n"
+         "      --jit        compile functions called often to native code\n"
+         "                   (x86-64 only, with the `ast' engine)\n"
+         "      --gc-stats   report garbage collector statistics on exit\n"
+         "      --emit-cpp   translate a file to C++ and write it to stdout,\n"
+         "                   to be linked against libcmmrt\n\n"
          "Report bugs to <hsu [at] whu [dot] edu [dot] cn>.\n";
 }
 
+void DumpGCStatistics() {
+  cvm::flushOutput();
+  cvm::GarbageCollector::get().dumpStatistics(std::cerr);
+}
+
 int DumpFile(cmm::SourceMgr &SrcMgr) {
   SrcMgr.dumpFile();
   return EXIT_SUCCESS;
@@ -211,25 +359,71 @@ int AsLexInput(cmm::SourceMgr &SrcMgr) {
   return Err;
 }
 
-int Interpret(cmm::SourceMgr &SrcMgr, int Argc, char **Argv, bool Verbose) {
+int Interpret(cmm::SourceMgr &SrcMgr, int Argc, char **Argv,
+              EngineKind Engine, size_t MaxStack, bool Jit, bool UseCache,
+              bool Verbose) {
   using namespace cmm;
-  CMMParser Parser(SrcMgr);
+  int Err;
 
-  int Err = Parser.parse();
-  if (!Err) {
-    if (Verbose) {
-      Parser.dumpAST();
-      std::cout << "\n\n****** Interpreter started ******\n\n";
+  if (Engine == VMEngine) {
+    // The bytecode is cached by the hash of the source, unless everything
+    // is to be dumped.
+    uint64_t SourceHash = 0;
+    uint64_t SourceSize = SrcMgr.getBufferSize();
+    std::string CachePath;
+    std::unique_ptr<cvm::Program> Prog;
+    if (UseCache && !Verbose) {
+      SourceHash = cvm::ProgramFile::hashSource(SrcMgr.getBuffer(),
+                                                SrcMgr.getBufferSize());
+      CachePath = cvm::ProgramFile::getCachePath(SourceHash);
+      if (!CachePath.empty())
+        Prog = cvm::ProgramFile::load(CachePath, SourceHash, SourceSize);
     }
 
-    CMMInterpreter Interpreter(Parser.getTopLevelBlock(),
-                               Parser.getFunctionDefinition(),
-                               Parser.getInfixOpDefinition());
-    Err = Interpreter.interpret(Argc, Argv);
+    if (!Prog) {
+      Prog = Compile(SrcMgr, Verbose, Err);
+      if (!Prog)
+        return Err;
+      // A source with warnings isn't cached, so that they're always shown.
+      // Failing to cache it is no error either.
+      if (!CachePath.empty() && SrcMgr.getDiagnosticCount() == 0)
+        cvm::ProgramFile::write(*Prog, SourceHash, SourceSize, CachePath);
+    }
+    return RunProgram(*Prog, Argc, Argv, MaxStack, Verbose);
   }
-  return Err;
+
+  CMMParser Parser(SrcMgr);
+  Err = Parser.parse();
+  if (Err)
+    return Err;
+
+  if (Verbose)
+    Parser.dumpAST();
+
+  Err = Analyze(SrcMgr, Parser);
+  if (Err)
+    return Err;
+
+  if (Verbose)
+    std::cout << "\n\n****** Interpreter started ******\n\n";
+
+  CMMInterpreter Interpreter(SrcMgr, Parser.getTopLevelBlock(),
+                             Parser.getFunctionDefinition(),
+                             Parser.getInfixOpDefinition(), MaxStack, Jit);
+  return Interpreter.interpret(Argc, Argv);
 }
 
+int RunProgram(const cvm::Program &Prog, int Argc, char **Argv,
+               size_t MaxStack, bool Verbose) {
+  if (Verbose) {
+    std::cout << "\n{-----      Bytecode      -----}\n";
+    Prog.dump();
+    std::cout << "\n\n****** Virtual machine started ******\n\n";
+  }
+
+  cvm::VirtualMachine VM(Prog, MaxStack);
+  return VM.run(Argc, Argv);
+}
 
 int DumpAST(cmm::SourceMgr &SrcMgr) {
   using namespace cmm;
@@ -241,3 +435,102 @@ int DumpAST(cmm::SourceMgr &SrcMgr) {
   }
   return Err;
 }
+
+/// \brief Resolve, fold, check and inline the program parsed, as every
+/// engine runs it.
+int Analyze(cmm::SourceMgr &SrcMgr, cmm::CMMParser &Parser) {
+  using namespace cmm;
+  CMMResolver Resolver(SrcMgr, Parser.getTopLevelBlock(),
+                       Parser.getFunctionDefinition(),
+                       Parser.getInfixOpDefinition());
+  int Err = Resolver.resolve();
+  if (Err)
+    return Err;
+
+  CMMConstantPropagator Propagator(Parser.getTopLevelBlock(),
+                                   Parser.getFunctionDefinition(),
+                                   Parser.getInfixOpDefinition());
+  Propagator.propagate();
+
+  CMMTypeChecker Checker(SrcMgr, Parser.getTopLevelBlock(),
+                         Parser.getFunctionDefinition(),
+                         Parser.getInfixOpDefinition());
+  Err = Checker.check();
+  if (Err)
+    return Err;
+
+  CMMInliner Inliner(Parser.getTopLevelBlock(),
+                     Parser.getFunctionDefinition(),
+                     Parser.getInfixOpDefinition());
+  Inliner.inlineCalls();
+  return 0;
+}
+
+int EmitCpp(cmm::SourceMgr &SrcMgr, const char *Input, size_t MaxStack) {
+  using namespace cmm;
+  CMMParser Parser(SrcMgr);
+
+  int Err = Parser.parse();
+  if (!Err)
+    Err = Analyze(SrcMgr, Parser);
+  if (Err)
+    return Err;
+
+  CMMTranspiler Transpiler(SrcMgr, Parser.getTopLevelBlock(),
+                           Parser.getFunctionDefinition(),
+                           Parser.getInfixOpDefinition(), MaxStack);
+  Transpiler.transpile(std::cout, Input);
+  return 0;
+}
+
+/// \brief Parse, analyze and compile the program to bytecode. Return null
+/// and set \p Err if it has errors.
+std::unique_ptr<cvm::Program> Compile(cmm::SourceMgr &SrcMgr, bool Verbose,
+                                      int &Err) {
+  using namespace cmm;
+  CMMParser Parser(SrcMgr);
+
+  Err = Parser.parse();
+  if (Err)
+    return nullptr;
+
+  if (Verbose)
+    Parser.dumpAST();
+
+  Err = Analyze(SrcMgr, Parser);
+  if (Err)
+    return nullptr;
+
+  CMMCompiler Compiler(SrcMgr, Parser.getTopLevelBlock(),
+                       Parser.getFunctionDefinition(),
+                       Parser.getInfixOpDefinition());
+  return Compiler.compile();
+}
+
+int CompileFile(cmm::SourceMgr &SrcMgr, const char *Input,
+                const char *Output) {
+  int Err;
+  std::unique_ptr<cvm::Program> Prog = Compile(SrcMgr, false, Err);
+  if (!Prog)
+    return Err;
+
+  // foo.cmm is compiled to foo.cmmc by default.
+  std::string Path;
+  if (Output) {
+    Path = Output;
+  } else {
+    Path = Input;
+    size_t Len = Path.size();
+    Path += Len > 4 && !Path.compare(Len - 4, 4, ".cmm") ? "c" : ".cmmc";
+  }
+
+  uint64_t SourceHash = cvm::ProgramFile::hashSource(SrcMgr.getBuffer(),
+                                                     SrcMgr.getBufferSize());
+  if (!cvm::ProgramFile::write(*Prog, SourceHash, SrcMgr.getBufferSize(),
+                               Path)) {
+    std::cerr << "Fatal Error: Cannot write file '" << Path << "', exited."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}